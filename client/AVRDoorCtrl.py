@@ -193,11 +193,67 @@ class AVRDoorCtrlSerialHandler(object):
     CMD_SET_ACCESS_V2 = 32
     CMD_GET_ACCESS_V2 = 33
     CMD_GET_USED_ACCESS_V2 = 34
+    CMD_GET_ACCESS_RECORDS_V2 = 35
+    CMD_GET_ACL_DIGEST = 36
+    CMD_GET_ACCESS_GROUP = 37
+    CMD_SET_ACCESS_GROUP = 38
+    CMD_GET_AUDIT_LOG = 40
+    CMD_GET_ACCESS_SCHEDULE = 41
+    CMD_SET_ACCESS_SCHEDULE = 42
+    CMD_GET_STATS = 50
+    CMD_RESET_STATS = 51
+    CMD_GET_LATENCY_HIST = 52
+    CMD_GET_TRACE = 53
+    CMD_GET_MEMORY_INFO = 54
+    CMD_GET_EEPROM_RAW_INFO = 60
+    CMD_READ_EEPROM_RAW = 61
+    CMD_WRITE_EEPROM_RAW = 62
 
     EVENT_BASE = 127
     EVENT_STARTED = EVENT_BASE + 0
-    EVENT_ACCESS = EVENT_BASE + 1
-    EVENT_DOOR_STATUS = EVENT_BASE + 2
+    EVENT_ACCESS_GRANTED = EVENT_BASE + 1
+    EVENT_ACCESS_DENIED = EVENT_BASE + 2
+    EVENT_DOOR_FORCED = EVENT_BASE + 3
+    EVENT_DOOR_HELD = EVENT_BASE + 4
+    EVENT_READER_ERROR = EVENT_BASE + 5
+    EVENT_DOOR_BACKOFF = EVENT_BASE + 6
+    # Only in the audit log
+    EVENT_RECORDS_MOVED = EVENT_BASE + 7
+    # Only sent at start
+    EVENT_LAYOUT_ERROR = EVENT_BASE + 8
+
+    door_event_names = {
+        EVENT_ACCESS_GRANTED: 'access_granted',
+        EVENT_ACCESS_DENIED: 'access_denied',
+        EVENT_DOOR_FORCED: 'door_forced',
+        EVENT_DOOR_HELD: 'door_held',
+        EVENT_READER_ERROR: 'reader_error',
+        EVENT_DOOR_BACKOFF: 'door_backoff',
+        EVENT_RECORDS_MOVED: 'records_moved',
+        EVENT_LAYOUT_ERROR: 'layout_error',
+    }
+
+    EVENT_NO_RECORD = 0xFFFF
+    EVENT_BACKOFF_RECORD = 0xFFFE
+
+    # Trace points, see firmware/trace.h
+    trace_names = {
+        0x10: 'wiegand_bit',
+        0x11: 'wiegand_word',
+        0x20: 'work_schedule',
+        0x21: 'work_overflow',
+        0x22: 'work_start',
+        0x23: 'work_end',
+        0x30: 'door_state',
+        0x31: 'door_check',
+        0x32: 'door_open',
+        0x33: 'door_reject',
+        0x40: 'ctrl_cmd',
+        0x41: 'ctrl_reply',
+    }
+
+    door_state_names = ('idle', 'read_pin', 'opening', 'reject',
+                        'timeout', 'error')
 
     REPLY_OK = 0
     REPLY_ERROR = 255
@@ -212,13 +268,30 @@ class AVRDoorCtrlSerialHandler(object):
     ACCESS_RECORD_TYPE_CARD_NONE = 0
     ACCESS_RECORD_TYPE_CARD_ID = 1
 
+    # The upper byte of a card ID give the number of low bits ignored
+    # when matching the card, to cover a range of cards in one record.
+    ACCESS_RECORD_CARD_ID_BITS = 24
+
     ACCESS_RECORD_TYPE_PIN_NONE = 0
     ACCESS_RECORD_TYPE_PIN_FIXED = 1 << 1
     ACCESS_RECORD_TYPE_PIN_HOTP = 2 << 1
     ACCESS_RECORD_TYPE_PIN_TOTP = 3 << 1
 
+    # A record with this bit in its doors mask take the doors from
+    # the group given by the other bits
+    ACCESS_RECORD_DOORS_GROUP = 1 << 3
+    NUM_ACCESS_GROUPS = 8
+
     CONTROLLER_KEY_SIZE = 20
 
+    LATENCY_HIST_BUCKETS = 16
+    LATENCY_HIST_SHIFT = 8
+
+    # Raw EEPROM access, the root key is only written with the flag
+    EEPROM_RAW_READ_SIZE = 32
+    EEPROM_RAW_CHUNK_SIZE = 28
+    EEPROM_RAW_ROOT_KEY = 1
+
     @staticmethod
     def parse_version(version):
         major, minor = version.split('.')
@@ -420,11 +493,19 @@ class AVRDoorCtrlSerialHandler(object):
             "doors": (hdr >> 4) & 0xF,
             "used": bool(hdr & (1 << 3)),
         }
+        if ret['doors'] & self.ACCESS_RECORD_DOORS_GROUP:
+            ret['group'] = ret['doors'] & ~self.ACCESS_RECORD_DOORS_GROUP
 
         card_type = hdr & 1
         if card_type == self.ACCESS_RECORD_TYPE_CARD_ID:
-            ret['card_type'] = 'id'
-            ret['card'] = card
+            range_bits = card >> self.ACCESS_RECORD_CARD_ID_BITS
+            if range_bits:
+                ret['card_type'] = 'range'
+                ret['card'] = card & ((1 << self.ACCESS_RECORD_CARD_ID_BITS) - 1)
+                ret['card_range_bits'] = range_bits
+            else:
+                ret['card_type'] = 'id'
+                ret['card'] = card
 
         pin_type = hdr & (3 << 1)
         if pin_type == self.ACCESS_RECORD_TYPE_PIN_FIXED:
@@ -466,18 +547,31 @@ class AVRDoorCtrlSerialHandler(object):
             key = int(card) ^ self.pack_pin(str(pin))
         elif card != None:
             type = self.ACCESS_TYPE_CARD
-            key = int(card)
+            key = self._check_card_id(card)
         elif pin != None:
             type = self.ACCESS_TYPE_PIN
             key = self.pack_pin(str(pin))
         else:
             type = self.ACCESS_TYPE_NONE
             key = 0
-        access = type | ((bool(int(used)) & 1) << 3) | ((int(doors) & 0xF) << 4)
+        if int(doors) < 0 or int(doors) > 0xF:
+            raise ValueError('Doors must be a 4 bits mask')
+        access = type | ((bool(int(used)) & 1) << 3) | (int(doors) << 4)
         return struct.pack("<LB", key, access)
 
+    def _check_doors(self, doors = 0, **kwargs):
+        # On the controllers with groups the bits above the doors
+        # would be read as a group reference
+        if self._descriptor is None:
+            return
+        num_doors = self._descriptor['num_doors']
+        if int(doors) & ~((1 << num_doors) - 1):
+            raise ValueError('Doors must be a mask of the %d doors' %
+                             num_doors)
+
     def set_access_record(self, index, pin = None, card = None,
                           used = False, doors = 0, **kwargs):
+        self._check_doors(doors)
         req = struct.pack("<H", index)
         req += self._pack_access_record(pin, card, doors, used,
                                         kwargs.get('card+pin'))
@@ -487,6 +581,7 @@ class AVRDoorCtrlSerialHandler(object):
     def set_access(self, pin = None, card = None, doors = 0):
         if pin == None and card == None:
             raise ValueError('No card number or pin given')
+        self._check_doors(doors)
         req = self._pack_access_record(pin, card, doors)
         self.send_cmd(self.CMD_SET_ACCESS, req, 0)
         return {}
@@ -497,7 +592,7 @@ class AVRDoorCtrlSerialHandler(object):
 
         if card_type is None:
             pass
-        elif card_type == 'id':
+        elif card_type in ('id', 'range'):
             rec_type |= self.ACCESS_RECORD_TYPE_CARD_ID
         else:
             raise ValueError('Invalid card type')
@@ -518,9 +613,50 @@ class AVRDoorCtrlSerialHandler(object):
 
         return rec_type
 
+    @classmethod
+    def _check_card_id(self, card):
+        # The upper byte would be read as a card range
+        card = int(card)
+        if card < 0 or card >> self.ACCESS_RECORD_CARD_ID_BITS:
+            raise ValueError('Card IDs are limited to %d bits' %
+                             self.ACCESS_RECORD_CARD_ID_BITS)
+        return card
+
+    @classmethod
+    def _pack_card(self, card_type, card, card_range_bits):
+        if card_type is None:
+            return 0
+        if card_type == 'id':
+            return self._check_card_id(card)
+        if card_type == 'range':
+            bits = int(card_range_bits or 0)
+            if bits < 1 or bits > self.ACCESS_RECORD_CARD_ID_BITS:
+                raise ValueError('Card range bits must be between 1 and %d' %
+                                 self.ACCESS_RECORD_CARD_ID_BITS)
+            card = int(card)
+            if card >> self.ACCESS_RECORD_CARD_ID_BITS:
+                raise ValueError('Card ranges are limited to %d bits cards' %
+                                 self.ACCESS_RECORD_CARD_ID_BITS)
+            # Only keep the first card to have a single key for the range
+            card &= ~((1 << bits) - 1)
+            return card | (bits << self.ACCESS_RECORD_CARD_ID_BITS)
+        raise ValueError('Invalid card type')
+
+    @staticmethod
+    def card_range(first, last):
+        """Return the card and card_range_bits of a range record covering
+        exactly the cards from first to last."""
+        count = last - first + 1
+        bits = count.bit_length() - 1
+        if count < 2 or count != 1 << bits or first & (count - 1):
+            raise ValueError('A card range must be a power of 2 aligned '
+                             'block of cards')
+        return first, bits
+
     @classmethod
     def _pack_access_record_v2(self, card_type = None, pin_type = None,
-                               doors = 0, used = False, card = None,
+                               doors = 0, group = None, used = False,
+                               card = None, card_range_bits = None,
                                pin = None, otp_key = None,
                                otp_digits = 6, hotp_resync_limit = 1,
                                hotp_counter = 0, totp_interval = 60,
@@ -542,16 +678,20 @@ class AVRDoorCtrlSerialHandler(object):
             if hotp_counter < 0:
                 raise ValueError('HOTP counter must be >= 0')
 
+        if group is not None:
+            if group < 0 or group >= self.NUM_ACCESS_GROUPS:
+                raise ValueError('Group must be between 0 and %d' %
+                                 (self.NUM_ACCESS_GROUPS - 1))
+            doors = self.ACCESS_RECORD_DOORS_GROUP | group
+
         hdr = self._pack_access_record_v2_type(card_type, pin_type)
-        hdr |= (bool(used) << 3) | ((int(doors) & 0xF) << 4)
+        if int(doors) < 0 or int(doors) > 0xF:
+            raise ValueError('Doors must be a 4 bits mask')
+        hdr |= (bool(used) << 3) | (int(doors) << 4)
         rec_hdr = struct.pack("B", hdr)
 
-        if card_type is None:
-            rec_card = struct.pack("<L", 0)
-        elif card_type == 'id':
-            rec_card = struct.pack("<L", int(card))
-        else:
-            raise ValueError('Invalid card type')
+        rec_card = struct.pack(
+            "<L", self._pack_card(card_type, card, card_range_bits))
 
         if pin_type is None:
             rec_pin = struct.pack("<L", 0)
@@ -573,8 +713,15 @@ class AVRDoorCtrlSerialHandler(object):
 
         return rec_hdr + rec_card + rec_pin
 
+    def _check_card_type(self, card_type = None, **kwargs):
+        # Older controllers would store the range but never match it
+        if card_type == 'range' and self._version < 12:
+            raise ValueError('Card ranges need a controller version 0.12')
+
     @since_version(3)
     def set_access_record_v2(self, index, **kwargs):
+        self._check_card_type(**kwargs)
+        self._check_doors(**kwargs)
         req = struct.pack("<H", index)
         req += self._pack_access_record_v2(**kwargs)
         self.send_cmd(self.CMD_SET_ACCESS_RECORD_V2, req, 0)
@@ -582,6 +729,8 @@ class AVRDoorCtrlSerialHandler(object):
 
     @since_version(3)
     def set_access_v2(self, **kwargs):
+        self._check_card_type(**kwargs)
+        self._check_doors(**kwargs)
         req = self._pack_access_record_v2(**kwargs)
         self.send_cmd(self.CMD_SET_ACCESS_V2, req, 0)
         return {}
@@ -597,17 +746,11 @@ class AVRDoorCtrlSerialHandler(object):
 
     @classmethod
     def _pack_get_access_req_v2(self, card_type = None, pin_type = None,
-                                card = None, pin = None, otp_key = None,
-                                **kwargs):
+                                card = None, card_range_bits = None,
+                                pin = None, otp_key = None, **kwargs):
 
         req_type = self._pack_access_record_v2_type(card_type, pin_type)
-
-        if card_type is None:
-            req_card = 0
-        elif card_type == 'id':
-            req_card = int(card)
-        else:
-            raise ValueError('Invalid card type')
+        req_card = self._pack_card(card_type, card, card_range_bits)
 
         if pin_type is None:
             req_pin = 0
@@ -626,6 +769,43 @@ class AVRDoorCtrlSerialHandler(object):
         response = self.send_cmd(self.CMD_GET_ACCESS_V2, req, 1)
         return self._unpack_access_record_v2(response)
 
+    @since_version(11)
+    def get_group(self, group):
+        response = self.send_cmd(self.CMD_GET_ACCESS_GROUP,
+                                 struct.pack("<B", int(group)), 1)
+        return { "doors": response[0] }
+
+    @since_version(11)
+    def set_group(self, group, doors):
+        req = struct.pack("<BB", int(group), int(doors))
+        self.send_cmd(self.CMD_SET_ACCESS_GROUP, req)
+        return {}
+
+    @since_version(13)
+    def get_schedule(self, group):
+        response = self.send_cmd(self.CMD_GET_ACCESS_SCHEDULE,
+                                 struct.pack("<B", int(group)), 9)
+        since, until, utc_offset, weekdays, h0, h1, h2 = \
+            struct.unpack("<HHbBBBB", response[0:9])
+        return {
+            "since": since,
+            "until": until,
+            "utc_offset": utc_offset * 15,
+            "weekdays": weekdays,
+            "hours": h0 | (h1 << 8) | (h2 << 16),
+        }
+
+    @since_version(13)
+    def set_schedule(self, group, since = 0, until = 0xFFFF,
+                     utc_offset = 0, weekdays = 0x7F, hours = 0xFFFFFF):
+        if utc_offset % 15:
+            raise ValueError('The UTC offset must be a multiple of 15 minutes')
+        req = struct.pack("<BHHbB", int(group), int(since), int(until),
+                          int(utc_offset) // 15, int(weekdays))
+        req += struct.pack("<L", int(hours))[0:3]
+        self.send_cmd(self.CMD_SET_ACCESS_SCHEDULE, req)
+        return {}
+
     def remove_all_access(self):
         self.send_cmd(self.CMD_REMOVE_ALL_ACCESS)
         return {}
@@ -669,6 +849,179 @@ class AVRDoorCtrlSerialHandler(object):
             'used': list(self._generate_used_access_v2(clear)),
         }
 
+    def _generate_access_records_v2(self):
+        start = 0
+        while True:
+            req = struct.pack("<H", start)
+            response = self.send_cmd(self.CMD_GET_ACCESS_RECORDS_V2, req, 1)
+            count, = struct.unpack("B", response[0:1])
+            if count == 0:
+                return
+            for i in range(count):
+                rec = response[1 + i * 11:12 + i * 11]
+                start, = struct.unpack("<H", rec[0:2])
+                ret = self._unpack_access_record_v2(rec[2:])
+                ret['index'] = start - 1
+                yield ret
+
+    @since_version(6)
+    def dump_access_records(self):
+        return {
+            'records': list(self._generate_access_records_v2()),
+        }
+
+    @since_version(6)
+    def get_acl_digest(self):
+        response = self.send_cmd(self.CMD_GET_ACL_DIGEST, None, 4)
+        digest, count = struct.unpack("<HH", response[0:4])
+        return {
+            'digest': digest,
+            'count': count,
+        }
+
+    def _generate_audit_log(self, seq):
+        while True:
+            req = struct.pack("<H", seq & 0xFFFF)
+            response = self.send_cmd(self.CMD_GET_AUDIT_LOG, req, 3)
+            first, count = struct.unpack("<HB", response[0:3])
+            for i in range(count):
+                tm, index, event = struct.unpack(
+                    "<LHB", response[3 + i * 7:10 + i * 7])
+                entry = {
+                    'seq': (first + i) & 0xFFFF,
+                    'event': self.door_event_names.get(
+                        self.EVENT_BASE + (event >> 4), 'unknown'),
+                    'time': time.asctime(time.gmtime(tm)),
+                    'door': event & 0xF,
+                }
+                if index == self.EVENT_BACKOFF_RECORD:
+                    entry['error'] = AVRDoorCtrlError.strerror(
+                        AVRDoorCtrlError.EBUSY)
+                elif index != self.EVENT_NO_RECORD:
+                    entry['index'] = index
+                yield entry
+            if count == 0:
+                return
+            seq = first + count - 1
+
+    @since_version(5)
+    def get_audit_log(self, seq = None):
+        # Without a sequence number start from the oldest entry
+        if seq is None:
+            seq = self.get_audit_log_start()
+        return {
+            'entries': list(self._generate_audit_log(int(seq))),
+        }
+
+    def get_audit_log_start(self):
+        # Ask for the entries after a sequence number that is not in the
+        # log, the controller then start with the oldest entry. As the log
+        # is small at most one of these probes can be in the log.
+        for probe in (0x8000, 0):
+            req = struct.pack("<H", probe)
+            response = self.send_cmd(self.CMD_GET_AUDIT_LOG, req, 3)
+            first, = struct.unpack("<H", response[0:2])
+            if first != probe + 1:
+                break
+        return (first - 1) & 0xFFFF
+
+    @since_version(7)
+    def get_stats(self):
+        response = self.send_cmd(self.CMD_GET_STATS, None, 20)
+        names = ('work_queue_overflows', 'reader_errors',
+                 'crc_errors', 'eeprom_writes', 'access_checks',
+                 'otp_computations', 'max_work_time')
+        stats = struct.unpack("<HHHLLLH", response[0:20])
+        # The back-off counters have been added in version 14
+        if len(response) >= 26:
+            names += ('reject_cache_hits', 'door_backoffs', 'backoff_rejects')
+            stats += struct.unpack("<HHH", response[20:26])
+        return dict(zip(names, stats))
+
+    @since_version(7)
+    def reset_stats(self):
+        self.send_cmd(self.CMD_RESET_STATS, None, 0)
+        return {}
+
+    @since_version(8)
+    def get_latency(self, door, reset = False):
+        req = struct.pack("<BB", int(door), 1 if reset else 0)
+        size = self.LATENCY_HIST_BUCKETS * 2
+        response = self.send_cmd(self.CMD_GET_LATENCY_HIST, req, size)
+        return {
+            'door': int(door),
+            'shift': self.LATENCY_HIST_SHIFT,
+            'count': list(struct.unpack(
+                "<%dH" % self.LATENCY_HIST_BUCKETS, response[0:size])),
+        }
+
+    @since_version(10)
+    def get_memory_info(self):
+        response = self.send_cmd(self.CMD_GET_MEMORY_INFO, None, 8)
+        info = struct.unpack("<HHHH", response[0:8])
+        return dict(zip(('ram_size', 'static_size', 'stack_max',
+                         'stack_free'), info))
+
+    def _generate_trace(self, seq):
+        while True:
+            req = struct.pack("<H", seq & 0xFFFF)
+            response = self.send_cmd(self.CMD_GET_TRACE, req, 3)
+            first, count = struct.unpack("<HB", response[0:3])
+            for i in range(count):
+                yield ((first + i) & 0xFFFF,) + struct.unpack(
+                    "<BBH", response[3 + i * 4:7 + i * 4])
+            if count == 0:
+                return
+            seq = first + count - 1
+
+    def _decode_trace_entry(self, id, arg):
+        entry = { 'event': self.trace_names.get(id, 'unknown_%02x' % id) }
+        if id == 0x30:
+            entry['door'] = arg >> 4
+            state = arg & 0xF
+            entry['state'] = self.door_state_names[state] \
+                if state < len(self.door_state_names) else state
+        elif id in (0x31, 0x32, 0x33):
+            entry['door'] = arg
+        elif id in (0x10, 0x11):
+            entry['bits'] = arg
+        elif id in (0x40, 0x41):
+            entry['type'] = arg
+        else:
+            entry['cmd'] = arg
+        return entry
+
+    def _get_trace_start(self):
+        # Same as for the audit log, ask for the entries after a sequence
+        # number that is not in the ring to get the oldest entry.
+        for probe in (0x8000, 0):
+            req = struct.pack("<H", probe)
+            response = self.send_cmd(self.CMD_GET_TRACE, req, 3)
+            first, = struct.unpack("<H", response[0:2])
+            if first != probe + 1:
+                break
+        return (first - 1) & 0xFFFF
+
+    @since_version(9)
+    def get_trace(self):
+        # The whole ring is read, the recording is stopped until the
+        # last entry has been returned. The time stamps wrap after 65ms,
+        # the gaps between the entries are assumed to be shorter.
+        entries = []
+        time = 0
+        last = None
+        for seq, id, arg, stamp in self._generate_trace(
+                self._get_trace_start()):
+            if last is not None:
+                time += (stamp - last) & 0xFFFF
+            last = stamp
+            entry = { 'seq': seq, 'time': time }
+            entry.update(self._decode_trace_entry(id, arg))
+            entries.append(entry)
+        return {
+            'entries': entries,
+        }
+
     def get_time(self):
         response = self.send_cmd(self.CMD_GET_TIME, None, 4)
         tm, = struct.unpack("<L", response[0:4])
@@ -692,25 +1045,31 @@ class AVRDoorCtrlSerialHandler(object):
             return {
                 'event': 'started',
             }
-        elif type == self.EVENT_ACCESS:
-            access, card, pin = struct.unpack("<BLL", payload)
+        elif type in self.door_event_names:
+            tm, index, door, access, card = \
+                struct.unpack("<LHBBL", payload[0:12])
             ev = {
-                'event': 'access',
-                'door': access & 0xF,
-                'type': self.access_record_types[(access >> 4) & 0x3],
-                'granted': (access >> 6) & 0x1,
+                'event': self.door_event_names[type],
+                'time': time.asctime(time.gmtime(tm)),
+                'door': door,
             }
-            if ev['type'] in ('pin', 'card+pin'):
-                ev['pin'] = self.unpack_pin(pin)
-            if ev['type'] in ('card', 'card+pin'):
+            if type in (self.EVENT_READER_ERROR, self.EVENT_LAYOUT_ERROR):
+                error, = struct.unpack("<l", payload[8:12])
+                ev['error'] = AVRDoorCtrlError.strerror(-error)
+                return ev
+            if type == self.EVENT_DOOR_BACKOFF:
+                ev['delay'] = card
+                return ev
+            if access != self.ACCESS_TYPE_NONE:
+                ev['type'] = self.access_record_types[access & 0x3]
+            if index == self.EVENT_BACKOFF_RECORD:
+                ev['error'] = AVRDoorCtrlError.strerror(
+                    AVRDoorCtrlError.EBUSY)
+            elif index != self.EVENT_NO_RECORD:
+                ev['index'] = index
+            if access & self.ACCESS_TYPE_CARD:
                 ev['card'] = card
             return ev
-        elif type == self.EVENT_DOOR_STATUS:
-            state = struct.unpack("<B", payload)
-            return {
-                'door': state & 0xF,
-                'open': (state >> 4) & 1,
-            }
         else:
             return {
                 'event': 'unknown',
@@ -765,10 +1124,93 @@ class AVRDoorCtrlUbusHandler(ubus.UObject):
     def get_access(self, pin: str = None, card: int = None):
         pass
 
+    @ubus.method
+    def get_group(self, group: int):
+        pass
+
+    @ubus.method
+    def set_group(self, group: int, doors: int):
+        pass
+
+    @ubus.method
+    def get_schedule(self, group: int):
+        pass
+
+    @ubus.method
+    def set_schedule(self, group: int, since: int = 0, until: int = 0xFFFF,
+                     utc_offset: int = 0, weekdays: int = 0x7F,
+                     hours: int = 0xFFFFFF):
+        pass
+
     @ubus.method
     def remove_all_access(self):
         pass
 
+    @ubus.method
+    def apply_acl(self, records: list):
+        pass
+
+    @ubus.method
+    def set_access_batch(self, records: list):
+        pass
+
+    @ubus.method
+    def raw(self, frames: list):
+        pass
+
+    @ubus.method
+    def get_stats(self):
+        return self.call('stats')
+
+    @ubus.method
+    def reset_stats(self):
+        pass
+
+    @ubus.method
+    def get_latency(self, door: int, reset: bool = False):
+        # Clearing the histogram is a write, done by its own method
+        return self.call('reset_latency' if reset else 'latency', door = door)
+
+    @ubus.method
+    def get_memory_info(self):
+        return self.call('memory_info')
+
+    def send_cmds(self, cmds):
+        """Send a list of (type, payload) commands to the controller in
+        a single call. Return a list with the response payload of each
+        command, or an AVRDoorCtrlError if the command failed."""
+        frames = []
+        for type, payload in cmds:
+            frame = { 'type': type }
+            if payload:
+                frame['payload'] = base64.b64encode(payload).decode('ascii')
+            frames.append(frame)
+        resp = self.raw(frames = frames)
+        responses = []
+        for r in resp['responses']:
+            if r['errno'] != 0:
+                responses.append(AVRDoorCtrlError(r['errno']))
+            else:
+                responses.append(base64.b64decode(r.get('payload', '')))
+        return responses
+
+    def send_cmd(self, type, payload = None, response_size=0):
+        response, = self.send_cmds([(type, payload)])
+        if isinstance(response, AVRDoorCtrlError):
+            raise response
+        if len(response) < response_size:
+            raise Exception("Bad response length: %d" % len(response))
+        return response
+
+    @ubus.method
+    def dump_access_records(self):
+        resp = self.call('dump_access_records')
+        # Card numbers are passed as signed 32 bits integers
+        for rec in resp['records']:
+            if rec.get('card', 0) < 0:
+                rec['card'] &= 0xFFFFFFFF
+        return resp
+
     @ubus.method
     def get_used_access(self, clear: int = 0):
         resp = self.call('get_used_access', clear = clear)
@@ -828,6 +1270,74 @@ class AVRDoorCtrl(object):
             return wrapper
         return functools.partial(decorator, default_version, name)
 
+    def _send_cmds(self, cmds, batch_size = 16):
+        # Use as few calls as possible when the handler supports batches
+        if hasattr(self._handler, 'send_cmds'):
+            responses = []
+            for i in range(0, len(cmds), batch_size):
+                responses += self._handler.send_cmds(cmds[i:i + batch_size])
+            return responses
+        responses = []
+        for type, payload in cmds:
+            try:
+                responses.append(self._handler.send_cmd(type, payload))
+            except AVRDoorCtrlError as err:
+                responses.append(err)
+        return responses
+
+    def _send_cmds_checked(self, cmds):
+        responses = self._send_cmds(cmds)
+        for r in responses:
+            if isinstance(r, AVRDoorCtrlError):
+                raise r
+        return responses
+
+    def get_eeprom_raw_info(self):
+        response, = self._send_cmds_checked([
+            (AVRDoorCtrlSerialHandler.CMD_GET_EEPROM_RAW_INFO, None)])
+        size, crc = struct.unpack("<HH", response[0:4])
+        return { 'size': size, 'crc': crc }
+
+    def read_eeprom_image(self):
+        """Read the whole EEPROM of the controller, the root key is
+        returned as zeros."""
+        h = AVRDoorCtrlSerialHandler
+        info = self.get_eeprom_raw_info()
+        cmds = []
+        for offset in range(0, info['size'], h.EEPROM_RAW_READ_SIZE):
+            length = min(h.EEPROM_RAW_READ_SIZE, info['size'] - offset)
+            cmds.append((h.CMD_READ_EEPROM_RAW,
+                         struct.pack("<HB", offset, length)))
+        image = b''.join(self._send_cmds_checked(cmds))
+        if len(image) != info['size'] or \
+           AVRDoorCtrlUartTransport.compute_crc(image) != info['crc']:
+            raise Exception("EEPROM image checksum mismatch")
+        return image
+
+    def write_eeprom_image(self, image, with_root_key = False):
+        """Write a whole EEPROM image to the controller, the root key
+        is left untouched unless with_root_key is set."""
+        h = AVRDoorCtrlSerialHandler
+        info = self.get_eeprom_raw_info()
+        if len(image) != info['size']:
+            raise ValueError("EEPROM image has %d bytes, the controller %d" %
+                             (len(image), info['size']))
+        flags = h.EEPROM_RAW_ROOT_KEY if with_root_key else 0
+        cmds = []
+        for offset in range(0, len(image), h.EEPROM_RAW_CHUNK_SIZE):
+            data = image[offset:offset + h.EEPROM_RAW_CHUNK_SIZE]
+            cmds.append((h.CMD_WRITE_EEPROM_RAW,
+                         struct.pack("<HBB%ds" % h.EEPROM_RAW_CHUNK_SIZE,
+                                     offset, len(data), flags, data)))
+        self._send_cmds_checked(cmds)
+        # The root key always reads as zeros
+        key_size = h.CONTROLLER_KEY_SIZE
+        expected = bytes(key_size) + image[key_size:]
+        if self.get_eeprom_raw_info()['crc'] != \
+           AVRDoorCtrlUartTransport.compute_crc(expected):
+            raise Exception("EEPROM image checksum mismatch after writing")
+        return {}
+
     @staticmethod
     def _access_record_to_v2(rec, from_version):
         if from_version == 1:
@@ -929,6 +1439,21 @@ class AVRDoorCtrl(object):
         raise ValueError(f'Record version {version} not supported')
 
     def get_all_access_records(self, record_version=2):
+        # Get all the records at once if possible
+        try:
+            resp = self._handler.dump_access_records()
+        except (AttributeError, NotImplementedError, ubus.UError):
+            pass
+        else:
+            acl = {}
+            for rec in resp['records']:
+                idx = rec['index']
+                if record_version != 2:
+                    rec = self._access_record_to_v1(rec, from_version=2)
+                    rec['index'] = idx
+                acl[idx] = rec
+            return acl
+
         desc = self.get_device_descriptor()
         acl = {}
         for i in range(desc["num_access_records"]):
@@ -952,6 +1477,34 @@ class AVRDoorCtrl(object):
                 record['index'] = idx
             self.set_access_record(**record, record_version=record_version)
 
+    @optionalmethod
+    def set_access_batch(self, records):
+        # Fallback implementation when the handler doesn't support
+        # batches, apply the records one by one.
+        results = []
+        for rec in records:
+            try:
+                self._handler.set_access(**rec)
+            except AVRDoorCtrlError as err:
+                results.append(err.errno)
+            else:
+                results.append(0)
+        return {
+            'results': results,
+            'failed': len([r for r in results if r != 0]),
+        }
+
+    @optionalmethod
+    def apply_acl(self, records):
+        # Fallback implementation when the handler can't compute the
+        # changes itself, simply rewrite everything.
+        self.remove_all_access()
+        for rec in records:
+            rec = {k: v for k, v in rec.items() if k not in ('index', 'used')}
+            if rec.get('doors', 0):
+                self.set_access(**rec)
+        return {}
+
     @optionalmethod
     def get_used_access_v2(self, *args, **kwargs):
         # Fallback implementation when the handler doesn't support v2 records
@@ -996,6 +1549,26 @@ class AVRDoorCtrlTool(AVRDoorCtrl):
         self.set_all_access_records(acl)
         return {}
 
+    def backup_eeprom_image(self, path):
+        image = self.read_eeprom_image()
+        with open(path, 'wb') as fd:
+            fd.write(image)
+        return { 'size': len(image) }
+
+    def restore_eeprom_image(self, path, with_root_key = False):
+        with open(path, 'rb') as fd:
+            image = fd.read()
+        return self.write_eeprom_image(image, with_root_key)
+
+    def apply_acl_file(self, path):
+        fd = open(path, 'r')
+        acl = json.loads(fd.read())
+        fd.close()
+        # Also accept the backup format
+        if isinstance(acl, dict):
+            acl = list(acl.values())
+        return self.apply_acl(records=acl)
+
     @classmethod
     def get_otp_key(cls, root_key, key_id, card=None):
         if HMAC is None:
@@ -1015,9 +1588,13 @@ class AVRDoorCtrlTool(AVRDoorCtrl):
             return rec
         if rec.get('pin_type') not in ('hotp', 'totp'):
             return rec
+        card = rec.get('card')
+        # The key is derived from the card ID as stored in the record
+        if rec.get('card_type') == 'range':
+            card = AVRDoorCtrlSerialHandler._pack_card(
+                'range', card, rec.get('card_range_bits'))
         try:
-            key = self.get_otp_key(root_key, rec.get('otp_key'),
-                                   rec.get('card'))
+            key = self.get_otp_key(root_key, rec.get('otp_key'), card)
         except NotImplementedError:
             pass
         else:
@@ -1032,6 +1609,34 @@ class AVRDoorCtrlTool(AVRDoorCtrl):
         rec = super().get_access(*args, **kwargs)
         return self.access_record_add_otp_secret(rec, root_key)
 
+WEEKDAYS = ('mon', 'tue', 'wed', 'thu', 'fri', 'sat', 'sun')
+
+def parse_schedule_day(date):
+    """Convert a YYYY-MM-DD date to days since the Unix epoch"""
+    return calendar.timegm(time.strptime(date, '%Y-%m-%d')) // 86400
+
+def parse_ranges(arg, parse_val, end_offset):
+    """Convert a list of values and ranges to a bit mask"""
+    mask = 0
+    for item in arg.split(','):
+        first, _, last = item.partition('-')
+        first = parse_val(first)
+        last = parse_val(last) - end_offset if last else first
+        for i in range(first, last + 1):
+            mask |= 1 << i
+    return mask
+
+def parse_weekdays(arg):
+    """Convert days like 'mon-fri,sun' to a bit mask, 'none' gives an
+    empty mask that never gives access"""
+    if arg.lower() == 'none':
+        return 0
+    return parse_ranges(arg, lambda d: WEEKDAYS.index(d.lower()[0:3]), 0)
+
+def parse_hours(arg):
+    """Convert hours like '8-12,14-18' to a bit mask, the end is excluded"""
+    return parse_ranges(arg, int, 1)
+
 def add_parser_arguments_access_record(method_parser):
     method_parser.add_argument(
         '--record-version', type = int, default = 2,
@@ -1040,6 +1645,12 @@ def add_parser_arguments_access_record(method_parser):
         '--card-type', help = 'Card type')
     method_parser.add_argument(
         '--card', type = int, help = 'Card number')
+    method_parser.add_argument(
+        '--card-range-bits', type = int,
+        help = 'Number of low bits of the card number ignored by a range')
+    method_parser.add_argument(
+        '--card-range', metavar = 'FIRST-LAST',
+        help = 'Power of 2 aligned block of cards')
     method_parser.add_argument(
         '--pin-type', help = 'PIN type')
     method_parser.add_argument(
@@ -1069,9 +1680,13 @@ def add_parser_arguments_access_record_properties(method_parser):
         help = 'Number of previous PIN to allow for H/TOTP')
     method_parser.add_argument(
         '--used', action='store_true', help = 'Mark the record as used')
-    method_parser.add_argument(
-        '--doors', type = int, required = True,
+    doors_group = method_parser.add_mutually_exclusive_group(required = True)
+    doors_group.add_argument(
+        '--doors', type = int,
         help = 'Bitmask of the doors that can be opened')
+    doors_group.add_argument(
+        '--group', type = int,
+        help = 'Group giving the doors that can be opened')
 
 if __name__ == '__main__':
     import binascii, argparse, sys
@@ -1162,6 +1777,52 @@ if __name__ == '__main__':
         '--record-version', type = int, default = 2,
         help = 'Access record version to return')
 
+    method_parser = method_subparsers.add_parser(
+        'get_audit_log',
+        help = 'Get the audit log entries')
+    method_parser.add_argument(
+        '--seq', type = int,
+        help = 'Only get the entries after this sequence number')
+
+    method_parser = method_subparsers.add_parser(
+        'get_group', help = 'Get the doors of an access group')
+    method_parser.add_argument(
+        'group', type = int, help = 'Group id')
+
+    method_parser = method_subparsers.add_parser(
+        'set_group', help = 'Set the doors of an access group')
+    method_parser.add_argument(
+        'group', type = int, help = 'Group id')
+    method_parser.add_argument(
+        'doors', type = int,
+        help = 'Bitmask of the doors the members of the group can open')
+
+    method_parser = method_subparsers.add_parser(
+        'get_schedule', help = 'Get the schedule of an access group')
+    method_parser.add_argument(
+        'group', type = int, help = 'Group id')
+
+    method_parser = method_subparsers.add_parser(
+        'set_schedule', help = 'Set the schedule of an access group, '
+        'without options the group has access at any time')
+    method_parser.add_argument(
+        'group', type = int, help = 'Group id')
+    method_parser.add_argument(
+        '--since', type = parse_schedule_day, default = 0,
+        help = 'First valid day, as YYYY-MM-DD')
+    method_parser.add_argument(
+        '--until', type = parse_schedule_day, default = 0xFFFF,
+        help = 'Last valid day, as YYYY-MM-DD')
+    method_parser.add_argument(
+        '--weekdays', type = parse_weekdays, default = 0x7F,
+        help = 'Valid week days, for example mon-fri,sun, or none')
+    method_parser.add_argument(
+        '--hours', type = parse_hours, default = 0xFFFFFF,
+        help = 'Valid hours in local time, for example 8-12,14-18')
+    method_parser.add_argument(
+        '--utc-offset', type = int, default = 0,
+        help = 'Offset of the local time from UTC in minutes')
+
     method_parser = method_subparsers.add_parser(
         'remove_all_access', help = 'Erase all access records')
 
@@ -1186,6 +1847,57 @@ if __name__ == '__main__':
     method_parser.add_argument(
         'path', help = 'File to read the access records from')
 
+    method_parser = method_subparsers.add_parser(
+        'backup_eeprom_image',
+        help = 'Backup the whole EEPROM, without the root key, to file')
+    method_parser.add_argument(
+        'path', help = 'File to save the EEPROM image to')
+
+    method_parser = method_subparsers.add_parser(
+        'restore_eeprom_image',
+        help = 'Write an EEPROM image from a file to the controller')
+    method_parser.add_argument(
+        '--with-root-key', action='store_true',
+        help = 'Also write the root key from the image')
+    method_parser.add_argument(
+        'path', help = 'File to read the EEPROM image from')
+
+    method_parser = method_subparsers.add_parser(
+        'apply_acl_file',
+        help = 'Make the access records match the list in a file')
+    method_parser.add_argument(
+        'path', help = 'File to read the access records from')
+
+    method_parser = method_subparsers.add_parser(
+        'get_acl_digest',
+        help = 'Get the digest of the access records')
+
+    method_parser = method_subparsers.add_parser(
+        'get_stats',
+        help = 'Get the statistics counters of the controller')
+
+    method_parser = method_subparsers.add_parser(
+        'reset_stats',
+        help = 'Reset the statistics counters of the controller')
+
+    method_parser = method_subparsers.add_parser(
+        'get_latency',
+        help = 'Get the histogram of the time from the last reader bit '
+        'to the open or reject decision, in log2 buckets of microseconds')
+    method_parser.add_argument(
+        '--reset', action='store_true',
+        help = 'Clear the histogram after reading it')
+    method_parser.add_argument(
+        'door', type = int, help = 'Index of the door')
+
+    method_parser = method_subparsers.add_parser(
+        'get_memory_info',
+        help = 'Get the RAM usage and the stack high-water mark')
+
+    method_parser = method_subparsers.add_parser(
+        'get_trace',
+        help = 'Read the trace ring of a firmware built with TRACE')
+
     method_parser = method_subparsers.add_parser(
         'get_time',
         help = 'Get the time from the controller')
@@ -1214,6 +1926,14 @@ if __name__ == '__main__':
             url_kwargs[f] = v
         delattr(args, f)
 
+    if method in [ 'set_access_record', 'set_access', 'get_access' ]:
+        if args.card_range is not None:
+            first, last = (int(c) for c in args.card_range.split('-'))
+            args.card, args.card_range_bits = \
+                AVRDoorCtrlSerialHandler.card_range(first, last)
+            args.card_type = 'range'
+        del args.card_range
+
     if method in [ 'set_access_record', 'set_access', 'get_access' ] and \
        args.record_version == 2:
         if args.card_type is None and args.card is not None:
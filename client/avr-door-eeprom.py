@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+# Compile an ACL into the initial content of the controller EEPROM.
+#
+# The output is a C file defining a struct eeprom_config with the EEMEM
+# attribute, the firmware Makefile builds it for the board and extracts
+# the .eeprom section as Intel HEX, see `make eeprom-image`. Letting the
+# compiler lay out the structure keeps the image byte exact for every
+# board without duplicating the EEPROM layout here.
+#
+# The input is a JSON file with either a list of access records, in the
+# format used by apply_acl_file, or an object with the following keys:
+#
+#   records:  list of access records
+#   groups:   { group id: doors mask }
+#   doors:    { door index: open time in ms }
+#   root_key: root key as hex string
+#
+# The records are written one after the other from the first entry, the
+# index given in the backups is ignored.
+
+import argparse
+import base64
+import io
+import json
+import struct
+import sys
+import AVRDoorCtrl
+
+Handler = AVRDoorCtrl.AVRDoorCtrlSerialHandler
+
+# Fields of the JSON records that are not stored in the EEPROM
+IGNORED_FIELDS = ('index', 'used', 'otp_secret')
+
+def record_entries(rec):
+    """Return the list of (type, doors, data) of the EEPROM entries
+    needed for a record"""
+    rec = { k: v for k, v in rec.items() if k not in IGNORED_FIELDS }
+    if 'card_type' not in rec and 'pin_type' not in rec:
+        rec = AVRDoorCtrl.AVRDoorCtrl._access_record_to_v2(
+            rec, from_version = 1)
+    packed = Handler._pack_access_record_v2(**rec)
+    hdr, card, pin = struct.unpack("<BLL", packed)
+    rec_type, doors = hdr & 0x7, hdr >> 4
+    if doors == 0:
+        raise ValueError('Record without any door: %s' % rec)
+
+    entries = []
+    if rec_type & Handler.ACCESS_RECORD_TYPE_CARD_ID:
+        entries.append((rec_type, doors, '.card = 0x%08x' % card))
+        # The continuation entry only has the PIN type and no doors
+        rec_type &= ~Handler.ACCESS_RECORD_TYPE_CARD_ID
+        doors = 0
+    if rec_type:
+        entries.append((rec_type, doors, '.pin.fixed = 0x%08x' % pin))
+    return entries
+
+def load_acl(path):
+    fd = sys.stdin if path == '-' else open(path, 'r')
+    acl = json.loads(fd.read())
+    # Also accept the backup format and a plain list of records
+    if isinstance(acl, list) or 'records' not in acl:
+        acl = { 'records': acl }
+    if isinstance(acl['records'], dict):
+        acl['records'] = list(acl['records'].values())
+    return acl
+
+def write_image(out, acl):
+    entries = []
+    for rec in acl['records']:
+        entries += record_entries(rec)
+
+    out.write('/* Generated by avr-door-eeprom.py, do not edit */\n')
+    out.write('#include <avr/eeprom.h>\n')
+    out.write('#include "eeprom.h"\n\n')
+    out.write('_Static_assert(%d <= NUM_ACCESS_RECORDS,\n'
+              '\t       "Too many access records for this controller");\n\n'
+              % len(entries))
+    out.write('struct eeprom_config eeprom_image EEMEM = {\n')
+
+    if acl.get('root_key'):
+        key = base64.b16decode(acl['root_key'].upper())
+        if len(key) != Handler.CONTROLLER_KEY_SIZE:
+            raise ValueError('The root key must have %d bytes' %
+                             Handler.CONTROLLER_KEY_SIZE)
+        out.write('\t.ctrl.root_key = {\n')
+        for i in range(0, len(key), 8):
+            out.write('\t\t%s\n' % ' '.join(
+                '0x%02x,' % b for b in key[i:i + 8]))
+        out.write('\t},\n')
+
+    if acl.get('doors'):
+        out.write('\t.door = {\n')
+        for idx, open_time in sorted(acl['doors'].items()):
+            out.write('\t\t[%d] = { .open_time = %d },\n' %
+                      (int(idx), int(open_time)))
+        out.write('\t},\n')
+
+    if entries:
+        out.write('\t.access = {\n')
+        for idx, (rec_type, doors, data) in enumerate(entries):
+            out.write('\t\t[%d] = { .hdr = { .type = %d, .doors = %d }, '
+                      '%s },\n' % (idx, rec_type, doors, data))
+        out.write('\t},\n')
+
+    if acl.get('groups'):
+        out.write('\t.group = {\n')
+        for gid, doors in sorted(acl['groups'].items()):
+            gid = int(gid)
+            if gid < 0 or gid >= Handler.NUM_ACCESS_GROUPS:
+                raise ValueError('Group must be between 0 and %d' %
+                                 (Handler.NUM_ACCESS_GROUPS - 1))
+            out.write('\t\t[%d] = { .doors = 0x%x },\n' % (gid, int(doors)))
+        out.write('\t},\n')
+
+    # A zeroed schedule never gives access, leave them erased
+    out.write('#if NUM_ACCESS_SCHEDULES > 0\n')
+    out.write('\t.schedule = {\n')
+    out.write('\t\t[0 ... NUM_ACCESS_SCHEDULES - 1] = '
+              '{ .weekdays = ACCESS_SCHEDULE_ERASED },\n')
+    out.write('\t},\n')
+    out.write('#endif\n')
+    out.write('\t.layout_version = EEPROM_LAYOUT_VERSION,\n')
+
+    out.write('};\n')
+    return len(entries)
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='Compile an ACL into an EEPROM image source')
+    parser.add_argument(
+        '-o', '--output', default = '-',
+        help = 'C file to write, default to stdout')
+    parser.add_argument(
+        'acl', help = 'JSON file with the ACL, - for stdin')
+    args = parser.parse_args()
+
+    acl = load_acl(args.acl)
+    # Only write the output once everything has been converted
+    image = io.StringIO()
+    count = write_image(image, acl)
+    if args.output == '-':
+        sys.stdout.write(image.getvalue())
+    else:
+        with open(args.output, 'w') as fd:
+            fd.write(image.getvalue())
+    print('%d records in %d entries' % (len(acl['records']), count),
+          file = sys.stderr)
@@ -0,0 +1,45 @@
+#!/usr/bin/env python3
+#
+# Read the trace ring of a controller and print it as a timeline.
+# The firmware must be built with TRACE set, see firmware/trace.h.
+
+import argparse
+import logging
+import AVRDoorCtrl
+
+def format_entry(entry):
+    args = ' '.join('%s=%s' % (k, v) for k, v in entry.items()
+                    if k not in ('seq', 'time', 'event'))
+    return '%-14s %s' % (entry['event'], args)
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='Show the trace of an AVR door controller')
+    parser.add_argument(
+        '--timeout', type = int, help = 'Timeout for serial access')
+    parser.add_argument(
+        '--log-level', choices=('DEBUG', 'INFO', 'WARNING', 'ERROR', 'CRITICAL'),
+        help = 'Log level', default='WARNING')
+    parser.add_argument(
+        '--controller-version', help = 'Force the UART protocol version')
+    parser.add_argument(
+        'device', help = 'Serial port of the controller')
+    args = parser.parse_args()
+
+    logging.basicConfig(level=getattr(logging, args.log_level.upper()),
+                        format='%(levelname)s: %(message)s')
+
+    kwargs = {}
+    for f in [ 'timeout', 'controller_version' ]:
+        v = getattr(args, f)
+        if v is not None:
+            kwargs[f] = v
+    door = AVRDoorCtrl.AVRDoorCtrl(args.device, **kwargs)
+
+    last = None
+    for entry in door.get_trace()['entries']:
+        delta = entry['time'] - last if last is not None else 0
+        last = entry['time']
+        print('%5d %10.3f ms %+10.3f ms  %s' % (
+            entry['seq'], entry['time'] / 1000, delta / 1000,
+            format_entry(entry)))
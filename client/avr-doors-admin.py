@@ -1,8 +1,10 @@
 #!/usr/bin/env python3
 
 import MySQLdb as dbapi2
+import json
 import AVRDoorsDB
 import AVRDoorCtrl
+import ubus
 
 class Controller(AVRDoorsDB.Controller):
     def __init__(self, *args, **kwargs):
@@ -28,15 +30,9 @@ class Controller(AVRDoorsDB.Controller):
         self.max_acl = desc["num_access_records"]
         self.save()
 
-    def set_access(self, card = None, pin = None, doors = 0):
-        args = { 'doors': doors }
-        if card != None:
-            args['card'] = card
-        if pin != None:
-            args['pin'] = pin
+    def _save_access(self, cursor, card, pin, doors):
         # Delete any old record, this is always needed as we have
         # no proper primary key because card or pin could be null
-        cursor = self._db.cursor()
         cursor.execute(
             "delete from ControllerSetACL where " +
             "ControllerID = %s and Card <=> %s and PIN <=> %s",
@@ -47,15 +43,47 @@ class Controller(AVRDoorsDB.Controller):
                 "insert into ControllerSetACL set " +
                 "ControllerID = %s, Card = %s, PIN = %s, Doors = %s",
                 (self.id, card, pin, doors));
+
+    @staticmethod
+    def _access_args(card, pin, doors):
+        args = { 'doors': doors }
+        if card != None:
+            args['card'] = card
+        if pin != None:
+            args['pin'] = pin
+        return args
+
+    def set_access(self, card = None, pin = None, doors = 0):
+        cursor = self._db.cursor()
+        self._save_access(cursor, card, pin, doors)
         # Apply the changes on the device and commit to the DB
         try:
-            self.device.set_access(**args)
+            self.device.set_access(**self._access_args(card, pin, doors))
         except:
             self._db.rollback()
             raise
         else:
             self._db.commit()
 
+    def set_access_batch(self, changes):
+        """Apply a list of (card, pin, doors) on the device in a single
+        call and record the successful ones in a single transaction.
+        Return the errno of each change, 0 on success."""
+        if len(changes) == 0:
+            return []
+        records = [self._access_args(*c) for c in changes]
+        try:
+            resp = self.device.set_access_batch(records=records)
+        except:
+            self._db.rollback()
+            raise
+        cursor = self._db.cursor()
+        for change, err in zip(changes, resp['results']):
+            if err == 0:
+                self._save_access(cursor, *change)
+        self._db.commit()
+        return resp['results']
+
     def describe_acl(self, card, pin, doors_mask):
         if card is not None:
             try:
@@ -86,10 +114,17 @@ class Controller(AVRDoorsDB.Controller):
             if dry_run is False:
                 self.device.get_device_descriptor()
         except Exception as err:
-            msg = str(err) or type(err).__name__
-            print("Skipping %s, controller is not accessible: %s" %
-                  (self.location, msg))
-            return
+            # The daemon keeps the writes to offline controllers in
+            # its journal and apply them once they are back.
+            if isinstance(err, ubus.UError) and \
+               err.status == ubus.UError.STATUS_TIMEOUT:
+                print("%s is offline, the changes will be applied when "
+                      "it is back" % self.location)
+            else:
+                msg = str(err) or type(err).__name__
+                print("Skipping %s, controller is not accessible: %s" %
+                      (self.location, msg))
+                return
         # Get the list of changes to apply, sort by doors for the presentation
         cursor = self._db.cursor()
         if reset is True:
@@ -111,26 +146,55 @@ class Controller(AVRDoorsDB.Controller):
             "select Op, Card, PIN, Doors from ControllerChanges " +
             "where ControllerID = %s order by Op, Doors, Card, PIN",
             (self.id,));
-        # Apply each access update
+        changes = [(int(add), card, pin, int(doors))
+                   for add, card, pin, doors in cursor]
+        # Apply all the access updates at once
+        if dry_run is False and len(changes) > 0:
+            try:
+                results = self.set_access_batch(
+                    [(card, pin, add * doors)
+                     for add, card, pin, doors in changes])
+            except Exception as e:
+                print("Failed to update %s: %s" % (self.location, e))
+                return
+        else:
+            results = [0] * len(changes)
         last_access = None
-        for add, card, pin, doors in cursor:
-            # Convert to int to allow bit operations
-            doors = int(doors)
-            add = int(add)
+        for (add, card, pin, doors), err in zip(changes, results):
             access, who = self.describe_acl(card, pin, doors)
             if access != last_access:
                 print("%s:" % access)
             last_access = access
-            try:
-                if dry_run is False:
-                    self.set_access(card, pin, add * doors)
-            except Exception as e:
+            if err != 0:
                 op = "add" if add else "remove"
-                print("\t* Failed to %s %s: %s" % (op, who, e))
+                print("\t* Failed to %s %s: %s" %
+                      (op, who, AVRDoorCtrl.AVRDoorCtrlError.strerror(err)))
             else:
                 op = "Added" if add else "Removed"
                 print("\t* %s %s" % (op, who))
 
+    def export_acl(self, path, mark_applied = False):
+        """Write the ACL wanted for this controller as a JSON list of
+        records, for avr-door-eeprom.py. With mark_applied the ACL is
+        recorded as being on the controller, as it will once the image
+        is flashed."""
+        cursor = self._db.cursor()
+        cursor.execute(
+            "select Card, PIN, Doors from ControllerACL " +
+            "where ControllerID = %s order by Card, PIN",
+            (self.id,));
+        acl = [(card, pin, int(doors)) for card, pin, doors in cursor]
+        with open(path, 'w') as fd:
+            json.dump([self._access_args(*a) for a in acl], fd, indent = 1)
+        if mark_applied:
+            cursor.execute("delete from ControllerSetACL where " +
+                           "ControllerID = %s",
+                           (self.id,))
+            for a in acl:
+                self._save_access(cursor, *a)
+            self._db.commit()
+        return len(acl)
+
 class Actions(object):
     def __init__(self, db):
         self.db = db
@@ -365,6 +429,12 @@ class ControllerActions(Actions):
                     setattr(ctrl, prop, patches[ctrl.id][prop])
             ctrl.update_acl(reset, dry_run)
 
+    def export_acl(self, identifier, output, mark_applied):
+        ctrl = self.cls(self.db, identifier)
+        count = ctrl.export_acl(output, mark_applied)
+        print("Exported %d records of %s to %s" %
+              (count, ctrl.location, output))
+
 class DoorActions(Actions):
     cls = AVRDoorsDB.Door
 
@@ -749,6 +819,19 @@ if __name__ == '__main__':
         'devices', metavar = 'CONTROLLER', type = str, nargs = '*',
         help = 'The devices to update, all if none given')
 
+    # Export the ACL to build an EEPROM image
+    subparser = action_subparsers.add_parser(
+        'export-acl', help = 'Export the controller ACL for avr-door-eeprom.py')
+    subparser.add_argument(
+        '--mark-applied', action = 'store_true',
+        help = 'Record the ACL as applied, to use when the image is flashed')
+    subparser.add_argument(
+        'identifier', metavar = 'CONTROLLER',
+        help = 'Location or ID of the controller')
+    subparser.add_argument(
+        'output', metavar = 'FILE',
+        help = 'JSON file to write')
+
     #
     # Doors
     #
@@ -20,9 +20,15 @@ class UError(Exception):
         'Connection failed',
     ]
 
+    STATUS_TIMEOUT = 7
+
     def __init__(self, val=None):
         self._val = val
 
+    @property
+    def status(self):
+        return self._val
+
     def __str__(self):
         if self._val != None and self._val < len(self.messages):
             return self.messages[self._val]
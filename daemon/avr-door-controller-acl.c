@@ -0,0 +1,1173 @@
+/*
+ * Copyright (C) 2017 Alban Bedel <albeu@free.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "avr-door-controller-daemon.h"
+#include "../firmware/ctrl-cmd-types.h"
+#include <libubox/ulog.h>
+#include <string.h>
+#include <endian.h>
+
+/*
+ * The daemon keep a copy of the access records of each controller. The
+ * copy is loaded with bulk reads and checked against a digest computed
+ * by the controller. Once loaded it is kept up to date by replaying the
+ * writes done on the controller, this requires following exactly the
+ * same allocation logic as the firmware.
+ *
+ * The records are kept in the controller format, the bit fields are
+ * broken with Chaos Calmer MIPS compiler so the header is always
+ * accessed as a plain byte.
+ */
+
+#define ACL_HDR_TYPE(hdr)		((hdr) & 0x7)
+#define ACL_HDR_USED			BIT(3)
+#define ACL_HDR_DOORS(hdr)		(((hdr) >> 4) & 0xF)
+#define ACL_HDR(type, doors)		((type) | ((doors) << 4))
+
+#define ACL_LOAD_MAX_RETRIES		3
+
+struct avr_door_ctrl_acl_load {
+	struct avr_door_ctrl_request req;
+	unsigned int retries;
+};
+
+#define ACL_APPLY_ADD			0
+#define ACL_APPLY_CHANGE		1
+#define ACL_APPLY_REMOVE		2
+
+struct avr_door_ctrl_acl_op {
+	unsigned int what;
+	struct access_record_v2 rec;
+};
+
+struct avr_door_ctrl_acl_apply {
+	struct avr_door_ctrl_request req;
+	struct ubus_context *uctx;
+	struct ubus_request_data uresp;
+
+	unsigned int done[3];
+	unsigned int pos;
+	unsigned int num_ops;
+	struct avr_door_ctrl_acl_op ops[];
+};
+
+static uint8_t acl_rec_hdr(const struct access_record_v2 *rec)
+{
+	return ((const uint8_t *)rec)[0];
+}
+
+static void acl_rec_set_hdr(struct access_record_v2 *rec, uint8_t hdr)
+{
+	((uint8_t *)rec)[0] = hdr;
+}
+
+static unsigned int acl_rec_entries(const struct access_record_v2 *rec)
+{
+	return ACCESS_RECORD_TYPE_ENTRIES(ACL_HDR_TYPE(acl_rec_hdr(rec)));
+}
+
+static bool acl_rec_is_empty(const struct access_record_v2 *rec)
+{
+	return ACL_HDR_TYPE(acl_rec_hdr(rec)) ==
+		ACCESS_RECORD_TYPE(NONE, NONE);
+}
+
+static bool acl_rec_is_continuation(const struct access_record_v2 *rec)
+{
+	return !acl_rec_is_empty(rec) && ACL_HDR_DOORS(acl_rec_hdr(rec)) == 0;
+}
+
+/* The value used to identify the PIN of a record, like in the firmware */
+static uint32_t acl_rec_pin_key(const struct access_record_v2 *rec)
+{
+	uint32_t pin = le32toh(rec->pin.fixed);
+
+	switch (ACCESS_RECORD_TYPE_PIN(acl_rec_hdr(rec))) {
+	case ACCESS_RECORD_TYPE_PIN_FIXED:
+		return pin;
+	case ACCESS_RECORD_TYPE_PIN_HOTP:
+	case ACCESS_RECORD_TYPE_PIN_TOTP:
+		return pin & 0x3FF;
+	default:
+		return (uint32_t)-1;
+	}
+}
+
+/* Clear the fields that are not stored for this record type */
+static void acl_rec_normalize(struct access_record_v2 *rec)
+{
+	uint8_t type = ACL_HDR_TYPE(acl_rec_hdr(rec));
+
+	if (!ACCESS_RECORD_TYPE_HAS_CARD(type))
+		rec->card = 0;
+	if (!ACCESS_RECORD_TYPE_HAS_PIN(type))
+		rec->pin.fixed = 0;
+}
+
+static bool acl_rec_same_key(const struct access_record_v2 *a,
+			     const struct access_record_v2 *b)
+{
+	uint8_t type = ACL_HDR_TYPE(acl_rec_hdr(a));
+
+	if (type != ACL_HDR_TYPE(acl_rec_hdr(b)))
+		return false;
+	if (ACCESS_RECORD_TYPE_HAS_CARD(type) && a->card != b->card)
+		return false;
+	if (ACCESS_RECORD_TYPE_HAS_PIN(type) &&
+	    acl_rec_pin_key(a) != acl_rec_pin_key(b))
+		return false;
+	return true;
+}
+
+/* Get a copy of the record without the fields that the controller
+ * update when the record is used. */
+static void acl_rec_get_static(struct access_record_v2 *dst,
+			       const struct access_record_v2 *src)
+{
+	*dst = *src;
+	acl_rec_set_hdr(dst, acl_rec_hdr(src) & ~ACL_HDR_USED);
+	if (ACCESS_RECORD_TYPE_PIN(acl_rec_hdr(src)) ==
+	    ACCESS_RECORD_TYPE_PIN_HOTP)
+		dst->pin.fixed = htole32(le32toh(src->pin.fixed) & 0xFFFF);
+}
+
+static bool acl_rec_same_content(const struct access_record_v2 *a,
+				 const struct access_record_v2 *b)
+{
+	struct access_record_v2 sa, sb;
+
+	acl_rec_get_static(&sa, a);
+	acl_rec_get_static(&sb, b);
+	return !memcmp(&sa, &sb, sizeof(sa));
+}
+
+#define acl_for_each_record(acl, idx)				\
+	for (idx = 0; idx < (acl)->num_records;			\
+	     idx += acl_rec_entries(&(acl)->records[idx]))
+
+static int acl_find_record(const struct avr_door_ctrl_acl *acl,
+			   const struct access_record_v2 *rec,
+			   unsigned int *pos)
+{
+	unsigned int idx;
+
+	acl_for_each_record(acl, idx) {
+		if (acl_rec_is_empty(&acl->records[idx]))
+			continue;
+		if (acl_rec_same_key(&acl->records[idx], rec)) {
+			*pos = idx;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static int acl_find_free_entry(const struct avr_door_ctrl_acl *acl,
+			       const struct access_record_v2 *rec,
+			       unsigned int *pos)
+{
+	unsigned int idx, start = -1;
+
+	acl_for_each_record(acl, idx) {
+		/* Restart the search if the entry is not empty */
+		if (!acl_rec_is_empty(&acl->records[idx])) {
+			start = -1;
+			continue;
+		}
+		/* Save the start of the range */
+		if (start == -1)
+			start = idx;
+		/* Done if we have enough entries */
+		if (idx + 1 - start == acl_rec_entries(rec)) {
+			*pos = start;
+			return 0;
+		}
+	}
+
+	return -ENOSPC;
+}
+
+static void acl_write_record(struct avr_door_ctrl_acl *acl, unsigned int idx,
+			     const struct access_record_v2 *rec)
+{
+	unsigned int n = 0, old_len = acl_rec_entries(&acl->records[idx]);
+	uint8_t hdr = acl_rec_hdr(rec);
+
+	if (idx + acl_rec_entries(rec) > acl->num_records)
+		return;
+
+	if (!acl_rec_is_empty(rec) && ACL_HDR_DOORS(hdr)) {
+		acl->records[idx] = *rec;
+		acl_rec_normalize(&acl->records[idx]);
+		n++;
+
+		/* Like the firmware mark the continuation entry */
+		if (acl_rec_entries(rec) > 1) {
+			memset(&acl->records[idx + 1], 0, sizeof(*rec));
+			acl_rec_set_hdr(&acl->records[idx + 1],
+					ACL_HDR_TYPE(hdr) &
+					~ACCESS_RECORD_TYPE_CARD(-1));
+			n++;
+		}
+	}
+
+	/* Clear the left over entries */
+	for ( ; n < old_len && idx + n < acl->num_records; n++) {
+		if (n > 0 && !acl_rec_is_continuation(&acl->records[idx + n]))
+			break;
+		memset(&acl->records[idx + n], 0, sizeof(*rec));
+	}
+}
+
+/* Replay CTRL_CMD_SET_ACCESS_V2, or CTRL_CMD_UPDATE_ACCESS_V2
+ * if keep_state is set */
+static void acl_save_record(struct avr_door_ctrl_acl *acl,
+			    const struct access_record_v2 *rec,
+			    bool keep_state)
+{
+	struct access_record_v2 tmp;
+	unsigned int idx;
+	int err;
+
+	if (acl_rec_is_empty(rec))
+		return;
+
+	err = acl_find_record(acl, rec, &idx);
+	if (err == -ENOENT) {
+		if (ACL_HDR_DOORS(acl_rec_hdr(rec)) == 0)
+			return;
+		err = acl_find_free_entry(acl, rec, &idx);
+	} else if (!err && keep_state && ACL_HDR_DOORS(acl_rec_hdr(rec)) &&
+		   ACCESS_RECORD_TYPE_PIN(acl_rec_hdr(rec)) ==
+		   ACCESS_RECORD_TYPE_PIN_HOTP) {
+		uint32_t pin = le32toh(rec->pin.fixed);
+		uint32_t old_pin = le32toh(acl->records[idx].pin.fixed);
+
+		tmp = *rec;
+		acl_rec_set_hdr(&tmp, acl_rec_hdr(&tmp) |
+				(acl_rec_hdr(&acl->records[idx]) &
+				 ACL_HDR_USED));
+		if ((pin >> 16) < (old_pin >> 16))
+			tmp.pin.fixed = htole32((pin & 0xFFFF) |
+						(old_pin & 0xFFFF0000));
+		rec = &tmp;
+	}
+	if (err)
+		return;
+
+	acl_write_record(acl, idx, rec);
+}
+
+/* Same CRC as the one used by the UART transport */
+static uint16_t acl_crc_update(uint16_t crc, const void *data, size_t size)
+{
+	const uint8_t *d = data;
+	int i;
+
+	while (size--) {
+		crc = crc ^ ((uint16_t)*d++ << 8);
+		for (i = 0; i < 8; i++) {
+			if (crc & 0x8000)
+				crc = (crc << 1) ^ 0x1021;
+			else
+				crc <<= 1;
+		}
+	}
+
+	return crc;
+}
+
+/* Compute the same digest as CTRL_CMD_GET_ACL_DIGEST */
+static uint16_t acl_get_digest(const struct avr_door_ctrl_acl *acl,
+			       uint16_t *count)
+{
+	struct access_record_v2 rec;
+	uint16_t crc = 0, n = 0, le_idx;
+	unsigned int idx;
+
+	acl_for_each_record(acl, idx) {
+		if (acl_rec_is_empty(&acl->records[idx]))
+			continue;
+
+		acl_rec_get_static(&rec, &acl->records[idx]);
+		le_idx = htole16(idx);
+		crc = acl_crc_update(crc, &le_idx, sizeof(le_idx));
+		crc = acl_crc_update(crc, &rec, sizeof(rec));
+		n++;
+	}
+
+	*count = n;
+	return crc;
+}
+
+static int acl_check_digest(const struct avr_door_ctrl_acl *acl,
+			    const struct avr_door_ctrl_msg *msg)
+{
+	const struct ctrl_cmd_resp_acl_digest *resp =
+		(const void *)msg->payload;
+	uint16_t digest, count;
+
+	if (msg->length < sizeof(*resp))
+		return -EINVAL;
+
+	digest = acl_get_digest(acl, &count);
+	if (digest != le16toh(resp->digest) || count != le16toh(resp->count))
+		return -ESTALE;
+
+	return 0;
+}
+
+static void acl_request_digest(struct avr_door_ctrl_request *req)
+{
+	req->msg.type = CTRL_CMD_GET_ACL_DIGEST;
+	req->msg.length = 0;
+	avr_door_ctrl_request_continue(req);
+}
+
+static void acl_load_start_records(struct avr_door_ctrl_acl_load *load)
+{
+	struct avr_door_ctrl_acl *acl = &load->req.ctrl->acl;
+	struct ctrl_cmd_get_access_records *get =
+		(void *)load->req.msg.payload;
+
+	memset(acl->records, 0, acl->num_records * sizeof(*acl->records));
+
+	load->req.msg.type = CTRL_CMD_GET_ACCESS_RECORDS_V2;
+	load->req.msg.length = sizeof(*get);
+	get->start = 0;
+	avr_door_ctrl_request_continue(&load->req);
+}
+
+static int acl_load_on_descriptor(struct avr_door_ctrl_acl_load *load,
+				  const struct avr_door_ctrl_msg *msg)
+{
+	struct avr_door_ctrl_acl *acl = &load->req.ctrl->acl;
+	const struct device_descriptor *desc = (const void *)msg->payload;
+	struct access_record_v2 *records;
+	unsigned int num;
+
+	if (msg->length < sizeof(*desc))
+		return -EINVAL;
+
+	acl->num_doors = desc->num_doors;
+
+	/* The updates appeared with version 0.16 */
+	acl->can_update = desc->major_version > 0 ||
+		desc->minor_version >= 16;
+
+	/* The bulk read and digest appeared with version 0.6 */
+	if (desc->major_version == 0 && desc->minor_version < 6) {
+		acl->unsupported = true;
+		return 0;
+	}
+
+	num = le16toh(desc->num_access_records);
+	if (num != acl->num_records) {
+		records = realloc(acl->records, num * sizeof(*records));
+		if (num && !records)
+			return -ENOMEM;
+		acl->records = records;
+		acl->num_records = num;
+	}
+
+	acl_load_start_records(load);
+	return -EINPROGRESS;
+}
+
+static int acl_load_on_records(struct avr_door_ctrl_acl_load *load,
+			       const struct avr_door_ctrl_msg *msg)
+{
+	struct avr_door_ctrl_acl *acl = &load->req.ctrl->acl;
+	const struct ctrl_cmd_resp_access_records *resp =
+		(const void *)msg->payload;
+	struct ctrl_cmd_get_access_records *get =
+		(void *)load->req.msg.payload;
+	unsigned int i, idx;
+
+	if (msg->length < offsetof(typeof(*resp), record) ||
+	    resp->count > ARRAY_SIZE(resp->record) ||
+	    msg->length < offsetof(typeof(*resp), record) +
+	    resp->count * sizeof(resp->record[0]))
+		return -EINVAL;
+
+	/* All records have been read, check the digest */
+	if (resp->count == 0) {
+		acl_request_digest(&load->req);
+		return -EINPROGRESS;
+	}
+
+	for (i = 0; i < resp->count; i++) {
+		idx = le16toh(resp->record[i].index) - 1;
+		if (idx >= acl->num_records ||
+		    acl_rec_is_empty(&resp->record[i].record) ||
+		    acl_rec_is_continuation(&resp->record[i].record))
+			return -EINVAL;
+		acl_write_record(acl, idx, &resp->record[i].record);
+	}
+
+	/* Continue after the last record */
+	get->start = resp->record[resp->count - 1].index;
+	avr_door_ctrl_request_continue(&load->req);
+	return -EINPROGRESS;
+}
+
+static int acl_load_on_response(struct avr_door_ctrl_request *req,
+				const struct avr_door_ctrl_msg *msg)
+{
+	struct avr_door_ctrl_acl_load *load =
+		container_of(req, struct avr_door_ctrl_acl_load, req);
+	struct avr_door_ctrl_acl *acl = &req->ctrl->acl;
+	int err;
+
+	switch (req->msg.type) {
+	case CTRL_CMD_GET_DEVICE_DESCRIPTOR:
+		return acl_load_on_descriptor(load, msg);
+	case CTRL_CMD_GET_ACCESS_RECORDS_V2:
+		return acl_load_on_records(load, msg);
+	case CTRL_CMD_GET_ACL_DIGEST:
+		err = acl_check_digest(acl, msg);
+		/* The records might have changed while we were reading
+		 * them, try again. */
+		if (err == -ESTALE && ++load->retries < ACL_LOAD_MAX_RETRIES) {
+			acl_load_start_records(load);
+			return -EINPROGRESS;
+		}
+		if (!err)
+			acl->valid = true;
+		return err;
+	default:
+		return -EINVAL;
+	}
+}
+
+static void acl_load_complete(struct avr_door_ctrl_request *req, int err)
+{
+	struct avr_door_ctrl *ctrl = req->ctrl;
+
+	/* Old firmwares don't know the bulk read */
+	if (err == -ENOENT)
+		ctrl->acl.unsupported = true;
+
+	if (err)
+		ULOG_WARN("%s: Failed to load the access records: %s\n",
+			  ctrl->name, strerror(-err));
+	else if (ctrl->acl.unsupported)
+		ULOG_INFO("%s: Controller doesn't support the ACL cache\n",
+			  ctrl->name);
+}
+
+static void acl_load_destroy(struct avr_door_ctrl_request *req)
+{
+	struct avr_door_ctrl_acl_load *load =
+		container_of(req, struct avr_door_ctrl_acl_load, req);
+
+	struct avr_door_ctrl *ctrl = req->ctrl;
+
+	ctrl->acl.load = NULL;
+	free(load);
+
+	/* The journal replay waits to know if updates are supported */
+	avr_door_ctrl_journal_replay(ctrl);
+}
+
+static const
+struct avr_door_ctrl_request_handlers avr_door_ctrl_acl_load_handlers = {
+	.on_response = acl_load_on_response,
+	.complete = acl_load_complete,
+	.destroy = acl_load_destroy,
+};
+
+void avr_door_ctrl_acl_reload(struct avr_door_ctrl *ctrl)
+{
+	struct avr_door_ctrl_acl *acl = &ctrl->acl;
+	struct avr_door_ctrl_acl_load *load;
+
+	if (acl->unsupported || acl->load)
+		return;
+
+	load = calloc(1, sizeof(*load));
+	if (!load)
+		return;
+
+	avr_door_ctrl_request_init(
+		&load->req, ctrl, &avr_door_ctrl_acl_load_handlers,
+		CTRL_CMD_GET_DEVICE_DESCRIPTOR, 0);
+	load->req.priority = AVR_DOOR_CTRL_PRIO_BULK;
+
+	acl->load = &load->req;
+	avr_door_ctrl_request_send(&load->req);
+}
+
+void avr_door_ctrl_acl_invalidate(struct avr_door_ctrl *ctrl)
+{
+	ctrl->acl.valid = false;
+	avr_door_ctrl_acl_reload(ctrl);
+}
+
+void avr_door_ctrl_acl_on_event(struct avr_door_ctrl *ctrl,
+				const struct avr_door_ctrl_msg *msg)
+{
+	const struct ctrl_event_door *ev = (const void *)msg->payload;
+	struct avr_door_ctrl_acl *acl = &ctrl->acl;
+	unsigned int idx;
+
+	switch (msg->type) {
+	case CTRL_EVENT_STARTED:
+		/* The EEPROM might have been flashed */
+		avr_door_ctrl_acl_invalidate(ctrl);
+		break;
+	case CTRL_EVENT_ACCESS_GRANTED:
+		if (!acl->valid || msg->length < sizeof(*ev))
+			break;
+		idx = le16toh(ev->index);
+		if (idx < acl->num_records &&
+		    !acl_rec_is_empty(&acl->records[idx]) &&
+		    !acl_rec_is_continuation(&acl->records[idx]))
+			acl_rec_set_hdr(&acl->records[idx],
+					acl_rec_hdr(&acl->records[idx]) |
+					ACL_HDR_USED);
+		break;
+	}
+}
+
+static int acl_rec_from_v1(struct access_record_v2 *rec,
+			   const struct access_record *rec_v1)
+{
+	uint8_t perms = ((const uint8_t *)rec_v1)[4];
+	uint8_t used = perms & ACL_HDR_USED;
+	uint8_t doors = perms >> 4;
+
+	memset(rec, 0, sizeof(*rec));
+
+	switch (perms & 0x3) {
+	case ACCESS_TYPE_NONE:
+		break;
+	case ACCESS_TYPE_PIN:
+		acl_rec_set_hdr(rec, ACL_HDR(ACCESS_RECORD_TYPE(NONE, FIXED),
+					     doors) | used);
+		rec->pin.fixed = rec_v1->key;
+		break;
+	case ACCESS_TYPE_CARD:
+		acl_rec_set_hdr(rec, ACL_HDR(ACCESS_RECORD_TYPE(ID, NONE),
+					     doors) | used);
+		rec->card = rec_v1->key;
+		break;
+	default:
+		/* Old style card + pin can't be converted */
+		return -EBADF;
+	}
+
+	return 0;
+}
+
+static int acl_rec_to_v1(struct access_record *rec_v1,
+			 const struct access_record_v2 *rec)
+{
+	uint8_t hdr = acl_rec_hdr(rec), type = ACL_HDR_TYPE(hdr);
+	uint8_t perms = 0;
+	uint32_t key = 0;
+
+	memset(rec_v1, 0, sizeof(*rec_v1));
+
+	if (acl_rec_is_empty(rec))
+		return 0;
+	if (acl_rec_is_continuation(rec))
+		return -EBUSY;
+
+	if (ACCESS_RECORD_TYPE_HAS_PIN(type)) {
+		if (ACCESS_RECORD_TYPE_PIN(type) != ACCESS_RECORD_TYPE_PIN_FIXED)
+			return -EEXIST;
+		perms |= ACCESS_TYPE_PIN;
+		key ^= le32toh(rec->pin.fixed);
+	}
+
+	if (ACCESS_RECORD_TYPE_HAS_CARD(type)) {
+		if (ACCESS_RECORD_CARD_IS_RANGE(le32toh(rec->card)))
+			return -EEXIST;
+		perms |= ACCESS_TYPE_CARD;
+		key ^= le32toh(rec->card);
+	}
+
+	perms |= (hdr & ACL_HDR_USED) | (ACL_HDR_DOORS(hdr) << 4);
+	rec_v1->key = htole32(key);
+	((uint8_t *)rec_v1)[4] = perms;
+
+	return 0;
+}
+
+int avr_door_ctrl_acl_get_record_v1(struct avr_door_ctrl *ctrl,
+				    unsigned int idx,
+				    struct access_record *rec)
+{
+	struct avr_door_ctrl_acl *acl = &ctrl->acl;
+
+	/* Let the controller handle the errors */
+	if (!acl->valid || idx >= acl->num_records)
+		return -ENODATA;
+
+	return acl_rec_to_v1(rec, &acl->records[idx]) ? -ENODATA : 0;
+}
+
+int avr_door_ctrl_acl_get_access_v1(struct avr_door_ctrl *ctrl,
+				    const struct access_record *rec_v1,
+				    uint8_t *doors)
+{
+	struct avr_door_ctrl_acl *acl = &ctrl->acl;
+	struct access_record_v2 rec;
+	unsigned int idx;
+
+	if (!acl->valid)
+		return -ENODATA;
+
+	*doors = 0;
+	if (acl_rec_from_v1(&rec, rec_v1) || acl_rec_is_empty(&rec))
+		return 0;
+
+	if (!acl_find_record(acl, &rec, &idx))
+		*doors = ACL_HDR_DOORS(acl_rec_hdr(&acl->records[idx]));
+
+	/* The groups are not cached, let the controller resolve them */
+	if (ACCESS_RECORD_DOORS_IS_GROUP(*doors))
+		return -ENODATA;
+
+	return 0;
+}
+
+void avr_door_ctrl_acl_set_record_v1(struct avr_door_ctrl *ctrl,
+				     unsigned int idx,
+				     const struct access_record *rec_v1)
+{
+	struct avr_door_ctrl_acl *acl = &ctrl->acl;
+	struct access_record_v2 rec;
+
+	if (!acl->valid || idx >= acl->num_records ||
+	    acl_rec_from_v1(&rec, rec_v1))
+		return;
+
+	acl_write_record(acl, idx, &rec);
+}
+
+void avr_door_ctrl_acl_set_access_v1(struct avr_door_ctrl *ctrl,
+				     const struct access_record *rec_v1)
+{
+	struct avr_door_ctrl_acl *acl = &ctrl->acl;
+	struct access_record_v2 rec;
+
+	if (!acl->valid || acl_rec_from_v1(&rec, rec_v1))
+		return;
+
+	acl_save_record(acl, &rec, false);
+}
+
+void avr_door_ctrl_acl_remove_all(struct avr_door_ctrl *ctrl)
+{
+	struct avr_door_ctrl_acl *acl = &ctrl->acl;
+
+	memset(acl->records, 0, acl->num_records * sizeof(*acl->records));
+}
+
+void avr_door_ctrl_acl_clear_used(struct avr_door_ctrl *ctrl)
+{
+	struct avr_door_ctrl_acl *acl = &ctrl->acl;
+	unsigned int idx;
+
+	acl_for_each_record(acl, idx)
+		acl_rec_set_hdr(&acl->records[idx],
+				acl_rec_hdr(&acl->records[idx]) &
+				~ACL_HDR_USED);
+}
+
+int avr_door_ctrl_acl_msg_to_record(const struct avr_door_ctrl_msg *msg,
+				    struct access_record_v2 *rec)
+{
+	switch (msg->type) {
+	case CTRL_CMD_SET_ACCESS:
+		if (msg->length < sizeof(struct access_record))
+			return -EINVAL;
+		return acl_rec_from_v1(rec, (const void *)msg->payload);
+	case CTRL_CMD_SET_ACCESS_V2:
+	case CTRL_CMD_UPDATE_ACCESS_V2:
+		if (msg->length < sizeof(*rec))
+			return -EINVAL;
+		memcpy(rec, msg->payload, sizeof(*rec));
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+bool avr_door_ctrl_acl_same_key(const struct access_record_v2 *a,
+				const struct access_record_v2 *b)
+{
+	return acl_rec_same_key(a, b);
+}
+
+unsigned int avr_door_ctrl_acl_record_doors(const struct access_record_v2 *rec)
+{
+	return ACL_HDR_DOORS(acl_rec_hdr(rec));
+}
+
+void avr_door_ctrl_acl_on_write(struct avr_door_ctrl *ctrl,
+				const struct avr_door_ctrl_msg *msg)
+{
+	struct access_record_v2 rec;
+
+	if (msg->type == CTRL_CMD_REMOVE_ALL_ACCESS) {
+		avr_door_ctrl_acl_remove_all(ctrl);
+		return;
+	}
+
+	if (!ctrl->acl.valid || avr_door_ctrl_acl_msg_to_record(msg, &rec))
+		return;
+
+	acl_save_record(&ctrl->acl, &rec,
+			msg->type == CTRL_CMD_UPDATE_ACCESS_V2);
+}
+
+#define ACCESS_RECORD_V2_CARD_TYPE		0
+#define ACCESS_RECORD_V2_CARD			1
+#define ACCESS_RECORD_V2_PIN_TYPE		2
+#define ACCESS_RECORD_V2_PIN			3
+#define ACCESS_RECORD_V2_OTP_KEY		4
+#define ACCESS_RECORD_V2_OTP_DIGITS		5
+#define ACCESS_RECORD_V2_HOTP_RESYNC_LIMIT	6
+#define ACCESS_RECORD_V2_HOTP_COUNTER		7
+#define ACCESS_RECORD_V2_TOTP_INTERVAL		8
+#define ACCESS_RECORD_V2_TOTP_ALLOW_FOLLOWINGS	9
+#define ACCESS_RECORD_V2_TOTP_ALLOW_PREVIOUS	10
+#define ACCESS_RECORD_V2_DOORS			11
+#define ACCESS_RECORD_V2_USED			12
+#define ACCESS_RECORD_V2_GROUP			13
+#define ACCESS_RECORD_V2_CARD_RANGE_BITS	14
+
+static const struct blobmsg_policy access_record_v2_policy[] = {
+	[ACCESS_RECORD_V2_CARD_TYPE] = {
+		.name = "card_type",
+		.type = BLOBMSG_TYPE_STRING,
+	},
+	[ACCESS_RECORD_V2_CARD] = {
+		.name = "card",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_PIN_TYPE] = {
+		.name = "pin_type",
+		.type = BLOBMSG_TYPE_STRING,
+	},
+	[ACCESS_RECORD_V2_PIN] = {
+		.name = "pin",
+		.type = BLOBMSG_TYPE_STRING,
+	},
+	[ACCESS_RECORD_V2_OTP_KEY] = {
+		.name = "otp_key",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_OTP_DIGITS] = {
+		.name = "otp_digits",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_HOTP_RESYNC_LIMIT] = {
+		.name = "hotp_resync_limit",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_HOTP_COUNTER] = {
+		.name = "hotp_counter",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_TOTP_INTERVAL] = {
+		.name = "totp_interval",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_TOTP_ALLOW_FOLLOWINGS] = {
+		.name = "totp_allow_followings",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_TOTP_ALLOW_PREVIOUS] = {
+		.name = "totp_allow_previous",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_DOORS] = {
+		.name = "doors",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_USED] = {
+		.name = "used",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_GROUP] = {
+		.name = "group",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[ACCESS_RECORD_V2_CARD_RANGE_BITS] = {
+		.name = "card_range_bits",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+};
+
+static uint32_t blobmsg_get_u32_default(struct blob_attr *attr,
+					uint32_t def)
+{
+	return attr ? blobmsg_get_u32(attr) : def;
+}
+
+static int blobmsg_parse_access_record_v2(struct blob_attr *attr,
+					  unsigned int num_doors,
+					  struct access_record_v2 *rec)
+{
+	struct blob_attr *tb[ARRAY_SIZE(access_record_v2_policy)];
+	uint32_t card = 0, pin = 0, digits, doors, val;
+	const char *card_type, *pin_type;
+	uint8_t type = 0, hdr;
+
+	if (blobmsg_type(attr) != BLOBMSG_TYPE_TABLE)
+		return -EINVAL;
+
+	blobmsg_parse(access_record_v2_policy,
+		      ARRAY_SIZE(access_record_v2_policy), tb,
+		      blobmsg_data(attr), blobmsg_data_len(attr));
+
+	/* Like the client default to card ID and fixed PIN */
+	if (tb[ACCESS_RECORD_V2_CARD_TYPE])
+		card_type = blobmsg_get_string(tb[ACCESS_RECORD_V2_CARD_TYPE]);
+	else
+		card_type = tb[ACCESS_RECORD_V2_CARD] ? "id" : NULL;
+
+	if (tb[ACCESS_RECORD_V2_PIN_TYPE])
+		pin_type = blobmsg_get_string(tb[ACCESS_RECORD_V2_PIN_TYPE]);
+	else
+		pin_type = tb[ACCESS_RECORD_V2_PIN] ? "fixed" : NULL;
+
+	if (!card_type) {
+		/* No card */
+	} else if (!strcmp(card_type, "id") && tb[ACCESS_RECORD_V2_CARD]) {
+		type |= ACCESS_RECORD_TYPE_CARD_ID;
+		card = blobmsg_get_u32(tb[ACCESS_RECORD_V2_CARD]);
+		/* The upper byte would be read as a card range */
+		if (card & ~ACCESS_RECORD_CARD_ID_MASK)
+			return -EINVAL;
+	} else if (!strcmp(card_type, "range") && tb[ACCESS_RECORD_V2_CARD] &&
+		   tb[ACCESS_RECORD_V2_CARD_RANGE_BITS]) {
+		type |= ACCESS_RECORD_TYPE_CARD_ID;
+		card = blobmsg_get_u32(tb[ACCESS_RECORD_V2_CARD]);
+		val = blobmsg_get_u32(tb[ACCESS_RECORD_V2_CARD_RANGE_BITS]);
+		if (card > ACCESS_RECORD_CARD_ID_MASK || val < 1 ||
+		    val > ACCESS_RECORD_CARD_ID_BITS)
+			return -EINVAL;
+		/* Give a single key to each range */
+		card = ACCESS_RECORD_CARD_RANGE(card & ~((1UL << val) - 1), val);
+	} else {
+		return -EINVAL;
+	}
+
+	if (!pin_type) {
+		/* No PIN */
+	} else if (!strcmp(pin_type, "fixed")) {
+		if (!tb[ACCESS_RECORD_V2_PIN] ||
+		    pin_from_str(&pin, blobmsg_get_string(
+					 tb[ACCESS_RECORD_V2_PIN])))
+			return -EINVAL;
+		type |= ACCESS_RECORD_TYPE_PIN_FIXED;
+	} else if (!strcmp(pin_type, "hotp") || !strcmp(pin_type, "totp")) {
+		digits = blobmsg_get_u32_default(
+			tb[ACCESS_RECORD_V2_OTP_DIGITS], 6);
+		if (!tb[ACCESS_RECORD_V2_OTP_KEY] || digits < 6 || digits > 9)
+			return -EINVAL;
+		val = blobmsg_get_u32(tb[ACCESS_RECORD_V2_OTP_KEY]);
+		if (val > 0x3FF)
+			return -EINVAL;
+		pin = val | ((digits - 6) << 10);
+
+		if (pin_type[0] == 'h') {
+			type |= ACCESS_RECORD_TYPE_PIN_HOTP;
+			val = blobmsg_get_u32_default(
+				tb[ACCESS_RECORD_V2_HOTP_RESYNC_LIMIT], 1);
+			if (val > 0xF)
+				return -EINVAL;
+			pin |= val << 12;
+			val = blobmsg_get_u32_default(
+				tb[ACCESS_RECORD_V2_HOTP_COUNTER], 0);
+			if (val > 0xFFFF)
+				return -EINVAL;
+			pin |= val << 16;
+		} else {
+			type |= ACCESS_RECORD_TYPE_PIN_TOTP;
+			val = blobmsg_get_u32_default(
+				tb[ACCESS_RECORD_V2_TOTP_ALLOW_FOLLOWINGS], 0);
+			if (val > 1)
+				return -EINVAL;
+			pin |= val << 12;
+			val = blobmsg_get_u32_default(
+				tb[ACCESS_RECORD_V2_TOTP_ALLOW_PREVIOUS], 0);
+			if (val > 7)
+				return -EINVAL;
+			pin |= val << 13;
+			val = blobmsg_get_u32_default(
+				tb[ACCESS_RECORD_V2_TOTP_INTERVAL], 60);
+			if (val > 0xFFFF)
+				return -EINVAL;
+			pin |= val << 16;
+		}
+	} else {
+		return -EINVAL;
+	}
+
+	if (type == ACCESS_RECORD_TYPE(NONE, NONE))
+		return -EINVAL;
+
+	/* A group replace the doors mask */
+	if (tb[ACCESS_RECORD_V2_GROUP]) {
+		val = blobmsg_get_u32(tb[ACCESS_RECORD_V2_GROUP]);
+		if (val > ACCESS_RECORD_DOORS_GROUP_ID(0xF))
+			return -EINVAL;
+		doors = ACCESS_RECORD_DOORS_FROM_GROUP(val);
+	} else {
+		doors = blobmsg_get_u32_default(
+			tb[ACCESS_RECORD_V2_DOORS], 0);
+		/* Otherwise these bits would be read as a group */
+		if (doors & ~((1U << num_doors) - 1))
+			return -EINVAL;
+	}
+
+	hdr = ACL_HDR(type, doors);
+	if (blobmsg_get_u32_default(tb[ACCESS_RECORD_V2_USED], 0))
+		hdr |= ACL_HDR_USED;
+
+	memset(rec, 0, sizeof(*rec));
+	acl_rec_set_hdr(rec, hdr);
+	rec->card = htole32(card);
+	rec->pin.fixed = htole32(pin);
+
+	return 0;
+}
+
+static int acl_apply_send_next(struct avr_door_ctrl_acl_apply *apply)
+{
+	if (apply->pos >= apply->num_ops) {
+		/* Check that we are still in sync with the controller */
+		acl_request_digest(&apply->req);
+		return -EINPROGRESS;
+	}
+
+	memcpy(apply->req.msg.payload, &apply->ops[apply->pos].rec,
+	       sizeof(struct access_record_v2));
+	avr_door_ctrl_request_continue(&apply->req);
+	return -EINPROGRESS;
+}
+
+static int acl_apply_on_response(struct avr_door_ctrl_request *req,
+				 const struct avr_door_ctrl_msg *msg)
+{
+	struct avr_door_ctrl_acl_apply *apply =
+		container_of(req, struct avr_door_ctrl_acl_apply, req);
+	struct avr_door_ctrl *ctrl = req->ctrl;
+	struct avr_door_ctrl_acl_op *op;
+	int err;
+
+	if (req->msg.type == CTRL_CMD_GET_ACL_DIGEST) {
+		err = acl_check_digest(&ctrl->acl, msg);
+		if (err) {
+			ULOG_WARN("%s: ACL cache out of sync, reloading\n",
+				  ctrl->name);
+			avr_door_ctrl_acl_invalidate(ctrl);
+		}
+		return err;
+	}
+
+	/* The last write went through, update the cache */
+	op = &apply->ops[apply->pos++];
+	acl_save_record(&ctrl->acl, &op->rec,
+			req->msg.type == CTRL_CMD_UPDATE_ACCESS_V2);
+	apply->done[op->what]++;
+
+	return acl_apply_send_next(apply);
+}
+
+static void acl_apply_complete(struct avr_door_ctrl_request *req, int err)
+{
+	struct avr_door_ctrl_acl_apply *apply =
+		container_of(req, struct avr_door_ctrl_acl_apply, req);
+	struct blob_buf bbuf = {};
+	int status;
+
+	/* We don't know if the last write went through */
+	if (err == -ETIMEDOUT)
+		avr_door_ctrl_acl_invalidate(req->ctrl);
+
+	blob_buf_init(&bbuf, 0);
+	blobmsg_add_u32(&bbuf, "added", apply->done[ACL_APPLY_ADD]);
+	blobmsg_add_u32(&bbuf, "changed", apply->done[ACL_APPLY_CHANGE]);
+	blobmsg_add_u32(&bbuf, "removed", apply->done[ACL_APPLY_REMOVE]);
+	if (err) {
+		blobmsg_add_u32(&bbuf, "errno", -err);
+		blobmsg_add_string(&bbuf, "error", strerror(-err));
+	}
+	ubus_send_reply(apply->uctx, &apply->uresp, bbuf.head);
+	blob_buf_free(&bbuf);
+
+	if (err == 0)
+		status = UBUS_STATUS_OK;
+	else if (err == -ETIMEDOUT)
+		status = UBUS_STATUS_TIMEOUT;
+	else
+		status = UBUS_STATUS_UNKNOWN_ERROR;
+
+	ubus_complete_deferred_request(apply->uctx, &apply->uresp, status);
+}
+
+static void acl_apply_destroy(struct avr_door_ctrl_request *req)
+{
+	free(container_of(req, struct avr_door_ctrl_acl_apply, req));
+}
+
+static const
+struct avr_door_ctrl_request_handlers avr_door_ctrl_acl_apply_handlers = {
+	.on_response = acl_apply_on_response,
+	.complete = acl_apply_complete,
+	.destroy = acl_apply_destroy,
+};
+
+static void acl_apply_add_op(struct avr_door_ctrl_acl_apply *apply,
+			     unsigned int what,
+			     const struct access_record_v2 *rec)
+{
+	struct avr_door_ctrl_acl_op *op = &apply->ops[apply->num_ops++];
+
+	op->what = what;
+	op->rec = *rec;
+}
+
+int avr_door_ctrl_acl_apply(struct ubus_context *uctx,
+			    struct avr_door_ctrl *ctrl,
+			    struct ubus_request_data *ureq,
+			    struct blob_attr *records)
+{
+	struct avr_door_ctrl_acl *acl = &ctrl->acl;
+	struct avr_door_ctrl_acl_apply *apply;
+	struct access_record_v2 *wanted, rec;
+	unsigned int i, idx, num_wanted = 0;
+	struct blob_buf bbuf = {};
+	struct blob_attr *cur;
+	int rem, count;
+
+	if (acl->unsupported)
+		return UBUS_STATUS_NOT_SUPPORTED;
+	if (!acl->valid)
+		return UBUS_STATUS_NO_DATA;
+	/* The cache doesn't have the writes still in the journal and the
+	 * changes can't be sent to an offline controller, the caller
+	 * should try again once it is back and the journal replayed. */
+	if (!ctrl->online || avr_door_ctrl_journal_active(ctrl))
+		return UBUS_STATUS_NO_DATA;
+
+	count = blobmsg_check_array(records, BLOBMSG_TYPE_TABLE);
+	if (count < 0 || count > AVR_DOOR_CTRL_MAX_BATCH_SIZE)
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	wanted = calloc(count ? count : 1, sizeof(*wanted));
+	if (!wanted)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	/* Parse the wanted records, records without doors are dropped */
+	blobmsg_for_each_attr(cur, records, rem) {
+		if (blobmsg_parse_access_record_v2(cur, acl->num_doors, &rec))
+			goto invalid;
+		if (ACL_HDR_DOORS(acl_rec_hdr(&rec)) == 0)
+			continue;
+		for (i = 0; i < num_wanted; i++)
+			if (acl_rec_same_key(&wanted[i], &rec))
+				goto invalid;
+		wanted[num_wanted++] = rec;
+	}
+
+	/* We need at most one operation per record */
+	apply = calloc(1, sizeof(*apply) +
+		       (acl->num_records + num_wanted) * sizeof(apply->ops[0]));
+	if (!apply) {
+		free(wanted);
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+
+	/* First remove the records not wanted anymore to free some space */
+	acl_for_each_record(acl, idx) {
+		if (acl_rec_is_empty(&acl->records[idx]))
+			continue;
+		for (i = 0; i < num_wanted; i++)
+			if (acl_rec_same_key(&acl->records[idx], &wanted[i]))
+				break;
+		if (i < num_wanted)
+			continue;
+		rec = acl->records[idx];
+		acl_rec_set_hdr(&rec, ACL_HDR_TYPE(acl_rec_hdr(&rec)));
+		acl_apply_add_op(apply, ACL_APPLY_REMOVE, &rec);
+	}
+
+	/* Then update the existing records. The used flag and HOTP counter
+	 * are maintained by the controller, keep their current values. The
+	 * cached HOTP counter might be stale, so it is only copied when the
+	 * controller can't keep it itself. */
+	for (i = 0; i < num_wanted; i++) {
+		if (acl_find_record(acl, &wanted[i], &idx) ||
+		    acl_rec_same_content(&acl->records[idx], &wanted[i]))
+			continue;
+
+		rec = wanted[i];
+		acl_rec_set_hdr(&rec, (acl_rec_hdr(&rec) & ~ACL_HDR_USED) |
+				(acl_rec_hdr(&acl->records[idx]) &
+				 ACL_HDR_USED));
+		if (!acl->can_update &&
+		    ACCESS_RECORD_TYPE_PIN(acl_rec_hdr(&rec)) ==
+		    ACCESS_RECORD_TYPE_PIN_HOTP)
+			rec.pin.fixed = htole32(
+				(le32toh(rec.pin.fixed) & 0xFFFF) |
+				(le32toh(acl->records[idx].pin.fixed) &
+				 0xFFFF0000));
+		acl_apply_add_op(apply, ACL_APPLY_CHANGE, &rec);
+	}
+
+	/* And finally add the new ones */
+	for (i = 0; i < num_wanted; i++)
+		if (acl_find_record(acl, &wanted[i], &idx))
+			acl_apply_add_op(apply, ACL_APPLY_ADD, &wanted[i]);
+
+	free(wanted);
+
+	/* Nothing to do, reply directly */
+	if (apply->num_ops == 0) {
+		blob_buf_init(&bbuf, 0);
+		blobmsg_add_u32(&bbuf, "added", 0);
+		blobmsg_add_u32(&bbuf, "changed", 0);
+		blobmsg_add_u32(&bbuf, "removed", 0);
+		ubus_send_reply(uctx, ureq, bbuf.head);
+		blob_buf_free(&bbuf);
+		free(apply);
+		return 0;
+	}
+
+	avr_door_ctrl_request_init(
+		&apply->req, ctrl, &avr_door_ctrl_acl_apply_handlers,
+		acl->can_update ? CTRL_CMD_UPDATE_ACCESS_V2 :
+		CTRL_CMD_SET_ACCESS_V2, sizeof(struct access_record_v2));
+	apply->req.priority = AVR_DOOR_CTRL_PRIO_BULK;
+	memcpy(apply->req.msg.payload, &apply->ops[0].rec,
+	       sizeof(struct access_record_v2));
+	apply->uctx = uctx;
+
+	ubus_defer_request(uctx, ureq, &apply->uresp);
+	avr_door_ctrl_request_send(&apply->req);
+
+	return 0;
+
+invalid:
+	free(wanted);
+	return UBUS_STATUS_INVALID_ARGUMENT;
+}
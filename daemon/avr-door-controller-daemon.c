@@ -12,11 +12,13 @@
  */
 
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <time.h>
 
 #include <libubox/ulog.h>
 #include <libubus.h>
@@ -24,12 +26,29 @@
 #include "avr-door-controller-daemon.h"
 #include "../firmware/ctrl-cmd-types.h"
 
-#define AVR_DOOR_CTRL_REQUEST_TIMEOUT 500
 #define AVR_DOOR_CTRL_PING_TIMEOUT 5000
+#define AVR_DOOR_CTRL_MAX_RETRIES 2
+
+/* Timeout bounds of each class in ms, the initial value is used until
+ * a round trip time has been measured. Writing a byte in the EEPROM
+ * takes 3.3ms and a full scan of the records on a nano v3 takes over
+ * a second. */
+static const struct avr_door_ctrl_timeout_bounds {
+	int initial;
+	int min;
+	int max;
+} avr_door_ctrl_timeout_bounds[AVR_DOOR_CTRL_NUM_TIMEOUT_CLASSES] = {
+	[AVR_DOOR_CTRL_TIMEOUT_FAST] = { 500, 50, 1000 },
+	[AVR_DOOR_CTRL_TIMEOUT_WRITE] = { 1000, 100, 2000 },
+	[AVR_DOOR_CTRL_TIMEOUT_SCAN] = { 3000, 500, 10000 },
+};
 
 struct avr_door_ctrld {
 	struct ubus_context *uctx;
 	struct list_head ctrls;
+	unsigned int max_pending;
+	/* Directory to store the journals, NULL to disable them */
+	const char *journal_dir;
 };
 
 void avr_door_ctrl_start_sending(struct avr_door_ctrl *ctrl)
@@ -38,6 +57,188 @@ void avr_door_ctrl_start_sending(struct avr_door_ctrl *ctrl)
 	uloop_fd_add(&ctrl->fd, ctrl->fd.flags | ULOOP_WRITE);
 }
 
+static int64_t avr_door_ctrl_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static enum avr_door_ctrl_timeout_class
+avr_door_ctrl_cmd_timeout_class(unsigned int type)
+{
+	switch (type) {
+	case CTRL_CMD_GET_DEVICE_DESCRIPTOR:
+	case CTRL_CMD_PING:
+	case CTRL_CMD_GET_TIME:
+	case CTRL_CMD_GET_CONTROLLER_CONFIG:
+	case CTRL_CMD_GET_DOOR_CONFIG:
+	case CTRL_CMD_GET_ACCESS_RECORD:
+	case CTRL_CMD_GET_ACCESS_RECORD_V2:
+	case CTRL_CMD_GET_AUDIT_LOG:
+	case CTRL_CMD_GET_STATS:
+	case CTRL_CMD_RESET_STATS:
+	case CTRL_CMD_GET_LATENCY_HIST:
+	case CTRL_CMD_GET_MEMORY_INFO:
+	case CTRL_CMD_GET_ACCESS_GROUP:
+	case CTRL_CMD_GET_ACCESS_SCHEDULE:
+	case CTRL_CMD_GET_EEPROM_RAW_INFO:
+	case CTRL_CMD_READ_EEPROM_RAW:
+		return AVR_DOOR_CTRL_TIMEOUT_FAST;
+	case CTRL_CMD_SET_TIME:
+	case CTRL_CMD_SET_CONTROLLER_CONFIG:
+	case CTRL_CMD_SET_DOOR_CONFIG:
+	case CTRL_CMD_SET_ACCESS_GROUP:
+	case CTRL_CMD_SET_ACCESS_SCHEDULE:
+	case CTRL_CMD_SET_ACCESS_RECORD:
+	case CTRL_CMD_SET_ACCESS_RECORD_V2:
+	case CTRL_CMD_WRITE_EEPROM_RAW:
+		return AVR_DOOR_CTRL_TIMEOUT_WRITE;
+	default:
+		/* Searches, bulk reads and unknown commands */
+		return AVR_DOOR_CTRL_TIMEOUT_SCAN;
+	}
+}
+
+static void avr_door_ctrl_init_rtt(struct avr_door_ctrl *ctrl)
+{
+	int i;
+
+	for (i = 0; i < AVR_DOOR_CTRL_NUM_TIMEOUT_CLASSES; i++) {
+		ctrl->rtt[i].srtt = 0;
+		ctrl->rtt[i].rttvar = 0;
+		ctrl->rtt[i].rto = avr_door_ctrl_timeout_bounds[i].initial;
+	}
+}
+
+/* Update the round trip time estimation like TCP does (RFC 6298) */
+static void avr_door_ctrl_update_rtt(struct avr_door_ctrl *ctrl,
+				     unsigned int type, int rtt)
+{
+	enum avr_door_ctrl_timeout_class class =
+		avr_door_ctrl_cmd_timeout_class(type);
+	const struct avr_door_ctrl_timeout_bounds *bounds =
+		&avr_door_ctrl_timeout_bounds[class];
+	struct avr_door_ctrl_rtt *est = &ctrl->rtt[class];
+
+	if (est->srtt == 0) {
+		est->srtt = rtt;
+		est->rttvar = rtt / 2;
+	} else {
+		est->rttvar = (3 * est->rttvar + abs(est->srtt - rtt)) / 4;
+		est->srtt = (7 * est->srtt + rtt) / 8;
+	}
+
+	est->rto = est->srtt + 4 * est->rttvar;
+	if (est->rto < bounds->min)
+		est->rto = bounds->min;
+	if (est->rto > bounds->max)
+		est->rto = bounds->max;
+}
+
+/* Double the timeout after a timeout until a new measurement is done */
+static void avr_door_ctrl_backoff_rtt(struct avr_door_ctrl *ctrl,
+				      unsigned int type)
+{
+	enum avr_door_ctrl_timeout_class class =
+		avr_door_ctrl_cmd_timeout_class(type);
+	struct avr_door_ctrl_rtt *est = &ctrl->rtt[class];
+
+	est->rto *= 2;
+	if (est->rto > avr_door_ctrl_timeout_bounds[class].max)
+		est->rto = avr_door_ctrl_timeout_bounds[class].max;
+}
+
+static int avr_door_ctrl_request_timeout(struct avr_door_ctrl_request *req)
+{
+	return req->ctrl->rtt[avr_door_ctrl_cmd_timeout_class(
+			req->msg.type)].rto;
+}
+
+bool avr_door_ctrl_cmd_is_idempotent(const struct avr_door_ctrl_msg *msg)
+{
+	const struct ctrl_cmd_get_used_access *get_used =
+		(const void *)msg->payload;
+	const struct ctrl_cmd_get_latency_hist *get_latency =
+		(const void *)msg->payload;
+
+	switch (msg->type) {
+	case CTRL_CMD_GET_DEVICE_DESCRIPTOR:
+	case CTRL_CMD_PING:
+	case CTRL_CMD_GET_TIME:
+	case CTRL_CMD_GET_CONTROLLER_CONFIG:
+	case CTRL_CMD_GET_DOOR_CONFIG:
+	case CTRL_CMD_GET_ACCESS_RECORD:
+	case CTRL_CMD_GET_ACCESS:
+	case CTRL_CMD_GET_ACCESS_RECORD_V2:
+	case CTRL_CMD_GET_ACCESS_V2:
+	case CTRL_CMD_GET_ACCESS_RECORDS_V2:
+	case CTRL_CMD_GET_ACL_DIGEST:
+	case CTRL_CMD_GET_AUDIT_LOG:
+	case CTRL_CMD_GET_STATS:
+	case CTRL_CMD_RESET_STATS:
+	case CTRL_CMD_GET_MEMORY_INFO:
+	case CTRL_CMD_GET_ACCESS_GROUP:
+	case CTRL_CMD_GET_ACCESS_SCHEDULE:
+	case CTRL_CMD_GET_EEPROM_RAW_INFO:
+	case CTRL_CMD_READ_EEPROM_RAW:
+	/* The groups and schedules are not part of the access records */
+	case CTRL_CMD_SET_ACCESS_GROUP:
+	case CTRL_CMD_SET_ACCESS_SCHEDULE:
+		return true;
+	case CTRL_CMD_GET_LATENCY_HIST:
+		return msg->length >= sizeof(*get_latency) &&
+			!get_latency->reset;
+	case CTRL_CMD_GET_USED_ACCESS:
+	case CTRL_CMD_GET_USED_ACCESS_V2:
+		return msg->length >= sizeof(*get_used) && !get_used->clear;
+	default:
+		return false;
+	}
+}
+
+/* Send a read again after a transmission error. As the messages have
+ * no sequence number this must only be done once the line has been
+ * quiet for a full timeout, otherwise a late response would be taken
+ * as the response to the next command. */
+static bool avr_door_ctrl_retry_request(
+	struct avr_door_ctrl_request *req, int err)
+{
+	if (err != -ETIMEDOUT && err != -EBADMSG)
+		return false;
+	if (req->retries >= AVR_DOOR_CTRL_MAX_RETRIES ||
+	    !avr_door_ctrl_cmd_is_idempotent(&req->msg))
+		return false;
+
+	ULOG_INFO("%s: Resending command %u: %s\n", req->ctrl->name,
+		  req->msg.type, strerror(-err));
+	uloop_timeout_cancel(&req->timeout);
+	req->retries++;
+	req->error = 0;
+	avr_door_ctrl_start_sending(req->ctrl);
+	return true;
+}
+
+static struct avr_door_ctrl_request *
+avr_door_ctrl_dequeue_request(struct avr_door_ctrl *ctrl)
+{
+	struct avr_door_ctrl_request *req;
+	int prio;
+
+	for (prio = 0; prio < AVR_DOOR_CTRL_NUM_PRIOS; prio++) {
+		if (list_empty(&ctrl->pending_reqs[prio]))
+			continue;
+		req = list_first_entry(&ctrl->pending_reqs[prio],
+				       struct avr_door_ctrl_request, list);
+		list_del_init(&req->list);
+		ctrl->num_pending[prio]--;
+		return req;
+	}
+
+	return NULL;
+}
+
 static void avr_door_ctrl_send_next_request(struct avr_door_ctrl *ctrl)
 {
 	/* Destroy the last request */
@@ -47,8 +248,11 @@ static void avr_door_ctrl_send_next_request(struct avr_door_ctrl *ctrl)
 		ctrl->req = NULL;
 	}
 
-	/* If the pending list is empty schedule a ping command */
-	if (list_empty(&ctrl->pending_reqs)) {
+	/* Get the next request out of the pending lists */
+	ctrl->req = avr_door_ctrl_dequeue_request(ctrl);
+
+	/* If the pending lists are empty schedule a ping command */
+	if (!ctrl->req) {
 		uloop_timeout_set(&ctrl->ping_timeout,
 				  AVR_DOOR_CTRL_PING_TIMEOUT);
 		return;
@@ -57,20 +261,32 @@ static void avr_door_ctrl_send_next_request(struct avr_door_ctrl *ctrl)
 		uloop_timeout_cancel(&ctrl->ping_timeout);
 	}
 
-	/* Get the next request out of the pending list */
-	ctrl->req = list_first_entry(&ctrl->pending_reqs,
-			       struct avr_door_ctrl_request, list);
-	list_del_init(&ctrl->req->list);
-
 	avr_door_ctrl_start_sending(ctrl);
 }
 
+static void avr_door_ctrl_set_online(struct avr_door_ctrl *ctrl, bool online)
+{
+	if (ctrl->online == online)
+		return;
+
+	ctrl->online = online;
+	if (online) {
+		ULOG_INFO("%s: Controller is online\n", ctrl->name);
+		/* Apply the writes done while it was offline */
+		avr_door_ctrl_journal_replay(ctrl);
+	} else {
+		ULOG_WARN("%s: Controller is offline\n", ctrl->name);
+	}
+}
+
 static void avr_door_ctrl_complete_request(
 	struct avr_door_ctrl_request *req, int status)
 {
 	struct avr_door_ctrl *ctrl = req->ctrl;
 
 	uloop_timeout_cancel(&req->timeout);
+	if (status == -ETIMEDOUT || status == -ENOLINK)
+		avr_door_ctrl_set_online(ctrl, false);
 	if (req->handlers->complete)
 		req->handlers->complete(req, status);
 
@@ -81,8 +297,21 @@ static void avr_door_ctrl_on_request_timeout(struct uloop_timeout *timeout)
 {
 	struct avr_door_ctrl_request *req = container_of(
 		timeout, struct avr_door_ctrl_request, timeout);
+	int rto = avr_door_ctrl_request_timeout(req);
+	int64_t quiet = avr_door_ctrl_now() - req->ctrl->last_frame_time;
+	int err = req->error ? req->error : -ETIMEDOUT;
+
+	/* Wait until nothing has been received for a full timeout */
+	if (quiet < rto) {
+		uloop_timeout_set(&req->timeout, rto - quiet);
+		return;
+	}
 
-	avr_door_ctrl_complete_request(req, -ETIMEDOUT);
+	if (err == -ETIMEDOUT)
+		avr_door_ctrl_backoff_rtt(req->ctrl, req->msg.type);
+	if (!avr_door_ctrl_retry_request(req, err))
+		avr_door_ctrl_complete_request(
+			req, err == -EBADMSG ? -EINVAL : err);
 }
 
 void avr_door_ctrl_request_init(
@@ -91,8 +320,11 @@ void avr_door_ctrl_request_init(
 	unsigned msg_type, unsigned msg_length)
 {
 	req->ctrl = ctrl;
+	req->priority = AVR_DOOR_CTRL_PRIO_INTERACTIVE;
 	req->handlers = handlers;
 	req->timeout.cb = avr_door_ctrl_on_request_timeout;
+	req->retries = 0;
+	req->error = 0;
 	req->msg.type = msg_type;
 	req->msg.length = msg_length;
 }
@@ -102,19 +334,43 @@ void avr_door_ctrl_request_send(struct avr_door_ctrl_request *req)
 	struct avr_door_ctrl *ctrl = req->ctrl;
 
 	/* Add the request to the pending list */
-	list_add_tail(&req->list, &ctrl->pending_reqs);
+	list_add_tail(&req->list, &ctrl->pending_reqs[req->priority]);
+	ctrl->num_pending[req->priority]++;
 
 	/* Send it out if no request is beeing sent */
 	if (!ctrl->req)
 		avr_door_ctrl_send_next_request(ctrl);
 }
 
+void avr_door_ctrl_request_continue(struct avr_door_ctrl_request *req)
+{
+	struct avr_door_ctrl *ctrl = req->ctrl;
+
+	/* Put the request back in the queue without destroying it,
+	 * so a long request doesn't block the others. */
+	ctrl->req = NULL;
+	avr_door_ctrl_request_send(req);
+}
+
+bool avr_door_ctrl_can_queue(struct avr_door_ctrl *ctrl,
+			     enum avr_door_ctrl_request_priority prio)
+{
+	return ctrl->num_pending[prio] < ctrl->max_pending;
+}
+
 static void avr_door_ctrl_recv_msg(
 	struct avr_door_ctrl *ctrl, struct avr_door_ctrl_msg *msg)
 {
 	struct avr_door_ctrl_request *req = ctrl->req;
 	int err = 0;
 
+	/* Events can arrive at any time, forward them to ubus */
+	if (msg->type >= CTRL_EVENT_BASE && msg->type != CTRL_CMD_ERROR) {
+		avr_door_ctrl_acl_on_event(ctrl, msg);
+		avr_door_ctrl_notify_event(ctrl->daemon->uctx, ctrl, msg);
+		return;
+	}
+
 	if (!req) {
 		fprintf(stderr, "Got message, but no request is pending\n");
 		return;
@@ -122,6 +378,18 @@ static void avr_door_ctrl_recv_msg(
 
 	uloop_timeout_cancel(&req->timeout);
 
+	/* Only use the first transmission to measure the round trip
+	 * time as we don't know which one is answered (Karn's algorithm).
+	 * The retry count restart for the follow up of multi-part
+	 * requests. */
+	if (req->retries == 0)
+		avr_door_ctrl_update_rtt(ctrl, req->msg.type,
+					 avr_door_ctrl_now() - req->sent_time);
+	req->retries = 0;
+	req->error = 0;
+
+	avr_door_ctrl_set_online(ctrl, true);
+
 	switch (msg->type) {
 	case CTRL_CMD_OK:
 		if (req->handlers->on_response) {
@@ -156,6 +424,8 @@ static void avr_door_ctrl_on_transport_event(
 
 	if (events & ULOOP_READ) {
 		err = ctrl->transport->recv(ctrl->transport, &ctrl->msg);
+		if (err > 0 || err == -EBADMSG)
+			ctrl->last_frame_time = avr_door_ctrl_now();
 		if (err > 0) {
 			avr_door_ctrl_recv_msg(ctrl, &ctrl->msg);
 		} else if (err == 0) {
@@ -165,10 +435,17 @@ static void avr_door_ctrl_on_transport_event(
 		} else if (err == -EAGAIN || err == -EWOULDBLOCK) {
 			/* No data available anymore */
 		} else if (err == -EBADMSG) {
-			/* Terminate the request */
-			if (ctrl->req)
-				avr_door_ctrl_complete_request(
-					ctrl->req, -EINVAL);
+			/* The bad frame might not be the response, like a
+			 * corrupted event, keep waiting for the response
+			 * and only resend once the line is quiet. When no
+			 * response is pending there is nothing to do. */
+			if (ctrl->req && ctrl->req->timeout.pending) {
+				ctrl->req->error = err;
+				uloop_timeout_set(
+					&ctrl->req->timeout,
+					avr_door_ctrl_request_timeout(
+						ctrl->req));
+			}
 		} else {
 			// TODO: log error
 		}
@@ -182,9 +459,12 @@ static void avr_door_ctrl_on_transport_event(
 
 		err = ctrl->transport->send(ctrl->transport, &ctrl->req->msg);
 		/* If we finished writing the message, wait for the anwser */
-		if (err > 0)
-			uloop_timeout_set(&ctrl->req->timeout,
-					  AVR_DOOR_CTRL_REQUEST_TIMEOUT);
+		if (err > 0) {
+			ctrl->req->sent_time = avr_door_ctrl_now();
+			uloop_timeout_set(
+				&ctrl->req->timeout,
+				avr_door_ctrl_request_timeout(ctrl->req));
+		}
 		else if (err == 0) /* Handle EOF as an error */
 			err = -ENOLINK;
 
@@ -205,8 +485,12 @@ static void avr_door_ctrl_ping_complete(
 
 	/* ENOENT is returned if the controller doesn't support the ping
 	 * command. That's also fine as the controller is reacting. */
-	if (err == 0 || err == -ENOENT)
+	if (err == 0 || err == -ENOENT) {
+		/* Retry loading the access records if needed */
+		if (!req->ctrl->acl.valid)
+			avr_door_ctrl_acl_reload(req->ctrl);
 		return;
+	}
 
 	/* Ping failed, we should reopen the tty to reset
 	 * the controller.
@@ -215,44 +499,31 @@ static void avr_door_ctrl_ping_complete(
 		transport->reset(transport);
 }
 
-static void avr_door_ctrl_ping_destroy(struct avr_door_ctrl_request *req)
-{
-	free(req);
-}
-
 static const
 struct avr_door_ctrl_request_handlers avr_door_ctrl_ping_handlers = {
 	.complete = avr_door_ctrl_ping_complete,
-	.destroy = avr_door_ctrl_ping_destroy,
 };
 
 static void avr_door_ctrl_on_ping_timeout(struct uloop_timeout *timeout)
 {
 	struct avr_door_ctrl *ctrl = container_of(
 		timeout, struct avr_door_ctrl, ping_timeout);
-	struct avr_door_ctrl_request *req;
-
-	req = calloc(1, sizeof(*req));
-	if (!req) {
-		/* What now, die? */
-		return;
-	}
 
 	/* Setup the request */
 	avr_door_ctrl_request_init(
-		req, ctrl, &avr_door_ctrl_ping_handlers, CTRL_CMD_PING, 0);
+		&ctrl->ping_req, ctrl, &avr_door_ctrl_ping_handlers,
+		CTRL_CMD_PING, 0);
+	ctrl->ping_req.priority = AVR_DOOR_CTRL_PRIO_KEEPALIVE;
 
 	/* And send it */
-	avr_door_ctrl_request_send(req);
-
-	return;
+	avr_door_ctrl_request_send(&ctrl->ping_req);
 }
 
 int avr_door_ctrld_add_device(struct avr_door_ctrld *ctrld,
 			     const char *name, const char *path)
 {
 	struct avr_door_ctrl *ctrl;
-	int err;
+	int i, err;
 
 	ctrl = calloc(1, sizeof(*ctrl));
 	if (!ctrl)
@@ -261,14 +532,29 @@ int avr_door_ctrld_add_device(struct avr_door_ctrld *ctrld,
 	snprintf(ctrl->name, sizeof(ctrl->name), "doors.%s", name);
 	ctrl->daemon = ctrld;
 	INIT_LIST_HEAD(&ctrl->list);
-	INIT_LIST_HEAD(&ctrl->pending_reqs);
+	for (i = 0; i < AVR_DOOR_CTRL_NUM_PRIOS; i++)
+		INIT_LIST_HEAD(&ctrl->pending_reqs[i]);
+	ctrl->max_pending = ctrld->max_pending;
+	avr_door_ctrl_init_rtt(ctrl);
 	ctrl->ping_timeout.cb = avr_door_ctrl_on_ping_timeout;
 
+	err = avr_door_ctrl_alloc_request_pool(ctrl);
+	if (err) {
+		free(ctrl);
+		return err;
+	}
+
+	if (ctrld->journal_dir) {
+		err = avr_door_ctrl_journal_open(ctrl, ctrld->journal_dir);
+		if (err)
+			goto free_pool;
+	}
+
 	err = avr_door_ctrl_uart_transport_open(path, &ctrl->transport);
 	if (err) {
 		ULOG_ERR("Failed to open UART transport %s: %s\n",
 			 path, strerror(-err));
-		return err;
+		goto close_journal;
 	}
 
 	ctrl->fd.fd = ctrl->transport->fd;
@@ -293,6 +579,9 @@ int avr_door_ctrld_add_device(struct avr_door_ctrld *ctrld,
 	/* Start sending pings */
 	uloop_timeout_set(&ctrl->ping_timeout, AVR_DOOR_CTRL_PING_TIMEOUT);
 
+	/* And load the access records */
+	avr_door_ctrl_acl_reload(ctrl);
+
 	list_add_tail(&ctrl->list, &ctrld->ctrls);
 
 	return 0;
@@ -301,6 +590,10 @@ uloop_delete:
 	uloop_fd_delete(&ctrl->fd);
 close_transport:
 	ctrl->transport->close(ctrl->transport);
+close_journal:
+	avr_door_ctrl_journal_close(ctrl);
+free_pool:
+	avr_door_ctrl_free_request_pool(ctrl);
 	free(ctrl);
 	return err;
 }
@@ -328,21 +621,32 @@ void avr_door_ctrld_uninit(struct avr_door_ctrld *ctrld)
 
 void usage(const char *progname, int ret)
 {
-	fprintf(stderr, "Usage: %s [-h | -s PATH] NAME PATH...\n", progname);
+	fprintf(stderr, "Usage: %s [-h | -s PATH] [-q DEPTH] [-j DIR] "
+		"NAME PATH...\n", progname);
 	exit(ret);
 }
 
 int main(int argc, char **argv)
 {
-	struct avr_door_ctrld ctrld = {};
+	struct avr_door_ctrld ctrld = {
+		.max_pending = AVR_DOOR_CTRL_DEFAULT_MAX_PENDING,
+	};
 	const char *ubus_socket = NULL;
 	int i, opt, err = 0;
 
-	while ((opt = getopt(argc, argv, "hs:")) != -1) {
+	while ((opt = getopt(argc, argv, "hs:q:j:")) != -1) {
 		switch (opt) {
 		case 's':
 			ubus_socket = optarg;
 			break;
+		case 'q':
+			ctrld.max_pending = atoi(optarg);
+			if (ctrld.max_pending < 1)
+				usage(argv[0], 1);
+			break;
+		case 'j':
+			ctrld.journal_dir = optarg;
+			break;
 		case 'h':
 			usage(argv[0], 0);
 			break;
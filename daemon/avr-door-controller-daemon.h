@@ -15,9 +15,13 @@
 
 #include <stdint.h>
 #include <libubus.h>
+#include "../firmware/ctrl-cmd-types.h"
 
-#define AVR_DOOR_CTRL_MSG_MAX_PAYLOAD_SIZE	16
+#define AVR_DOOR_CTRL_MSG_MAX_PAYLOAD_SIZE	CTRL_MSG_MAX_PAYLOAD_SIZE
 #define AVR_DOOR_CTRL_METHOD_MAX_ARGS		8
+#define AVR_DOOR_CTRL_DEFAULT_MAX_PENDING	32
+/* Largest number of records or frames accepted in a single call */
+#define AVR_DOOR_CTRL_MAX_BATCH_SIZE		256
 
 struct avr_door_ctrld;
 struct avr_door_ctrl_request;
@@ -36,11 +40,50 @@ struct avr_door_ctrl_request_handlers {
 	void (*destroy)(struct avr_door_ctrl_request *req);
 };
 
+/* The requests are sent by priority, then in order */
+enum avr_door_ctrl_request_priority {
+	/* Single requests from ubus clients */
+	AVR_DOOR_CTRL_PRIO_INTERACTIVE,
+	/* Multi-part and batched requests */
+	AVR_DOOR_CTRL_PRIO_BULK,
+	/* Keep-alive pings */
+	AVR_DOOR_CTRL_PRIO_KEEPALIVE,
+
+	AVR_DOOR_CTRL_NUM_PRIOS
+};
+
+/* The commands are grouped by expected duration for the timeouts */
+enum avr_door_ctrl_timeout_class {
+	/* Commands that don't access the EEPROM or just read a record */
+	AVR_DOOR_CTRL_TIMEOUT_FAST,
+	/* Commands that write a single EEPROM location */
+	AVR_DOOR_CTRL_TIMEOUT_WRITE,
+	/* Commands that might go over all the access records */
+	AVR_DOOR_CTRL_TIMEOUT_SCAN,
+
+	AVR_DOOR_CTRL_NUM_TIMEOUT_CLASSES
+};
+
+/* Round trip time estimation, all times are in ms */
+struct avr_door_ctrl_rtt {
+	int srtt;
+	int rttvar;
+	/* Current retransmission timeout */
+	int rto;
+};
+
 struct avr_door_ctrl_request {
 	struct list_head list;
 	struct avr_door_ctrl *ctrl;
+	enum avr_door_ctrl_request_priority priority;
 	struct avr_door_ctrl_msg msg;
 	struct uloop_timeout timeout;
+	/* Time the message was sent, to measure the round trip time */
+	int64_t sent_time;
+	/* Number of times the message has been resent */
+	unsigned int retries;
+	/* Transmission error seen while waiting for the response */
+	int error;
 	const struct avr_door_ctrl_request_handlers *handlers;
 };
 
@@ -51,6 +94,45 @@ void avr_door_ctrl_request_init(
 
 void avr_door_ctrl_request_send(struct avr_door_ctrl_request *req);
 
+/* Send the follow up of a multi-part request after the pending requests
+ * of the same or higher priority, must be called from on_response()
+ * which should then return -EINPROGRESS. */
+void avr_door_ctrl_request_continue(struct avr_door_ctrl_request *req);
+
+/* Return true if sending the command again has no side effect */
+bool avr_door_ctrl_cmd_is_idempotent(const struct avr_door_ctrl_msg *msg);
+
+/* Return false if no new ubus call with this priority should be
+ * accepted, each priority has its own limit. */
+bool avr_door_ctrl_can_queue(struct avr_door_ctrl *ctrl,
+			     enum avr_door_ctrl_request_priority prio);
+
+struct avr_door_ctrl_acl {
+	/* Copy of the access records, indexed like the EEPROM entries */
+	struct access_record_v2 *records;
+	unsigned int num_records;
+	/* Set once the copy has been checked against the controller */
+	bool valid;
+	/* Set if the controller doesn't support the needed commands */
+	bool unsupported;
+	/* Set if the controller supports CTRL_CMD_UPDATE_ACCESS_V2 */
+	bool can_update;
+	/* Number of doors of the controller */
+	unsigned int num_doors;
+	/* Request loading the records, if any */
+	struct avr_door_ctrl_request *load;
+};
+
+struct avr_door_ctrl_journal {
+	/* Path of the journal file, NULL if the journal is disabled */
+	char *path;
+	/* Pending writes, at most one per access key */
+	struct avr_door_ctrl_msg *entries;
+	unsigned int num_entries;
+	/* Request replaying the journal, if any */
+	struct avr_door_ctrl_request *replay;
+};
+
 struct avr_door_ctrl {
 	/* Name of this controller object */
 	char name[64];
@@ -70,13 +152,35 @@ struct avr_door_ctrl {
 	struct avr_door_ctrl_msg msg;
 	unsigned int msg_pos;
 
-	/* List of pending requests */
-	struct list_head pending_reqs;
+	/* Lists of pending requests, one per priority */
+	struct list_head pending_reqs[AVR_DOOR_CTRL_NUM_PRIOS];
+	unsigned int num_pending[AVR_DOOR_CTRL_NUM_PRIOS];
+	/* Maximum number of pending requests to accept new ubus calls */
+	unsigned int max_pending;
 	/* Request currently processed */
 	struct avr_door_ctrl_request *req;
 
+	/* Preallocated method requests */
+	void *req_pool;
+	struct list_head free_reqs;
+
 	/* Timeout to trigger sending ping commands */
 	struct uloop_timeout ping_timeout;
+	/* Ping request, there is never more than one */
+	struct avr_door_ctrl_request ping_req;
+
+	/* Round trip time estimation for each timeout class */
+	struct avr_door_ctrl_rtt rtt[AVR_DOOR_CTRL_NUM_TIMEOUT_CLASSES];
+	/* Time the last frame, valid or not, has been received */
+	int64_t last_frame_time;
+
+	/* Cache of the access records */
+	struct avr_door_ctrl_acl acl;
+
+	/* Set while the controller answers */
+	bool online;
+	/* Writes waiting for the controller to come back */
+	struct avr_door_ctrl_journal journal;
 };
 
 void avr_door_ctrl_start_sending(struct avr_door_ctrl *ctrl);
@@ -84,6 +188,82 @@ void avr_door_ctrl_start_sending(struct avr_door_ctrl *ctrl);
 void avr_door_ctrld_init_door_uobject(
 	const char *name, struct ubus_object *uobj);
 
+int avr_door_ctrl_alloc_request_pool(struct avr_door_ctrl *ctrl);
+
+void avr_door_ctrl_free_request_pool(struct avr_door_ctrl *ctrl);
+
+void avr_door_ctrl_notify_event(struct ubus_context *uctx,
+				struct avr_door_ctrl *ctrl,
+				const struct avr_door_ctrl_msg *msg);
+
+int pin_from_str(uint32_t *pin, const char *str);
+
+void avr_door_ctrl_acl_reload(struct avr_door_ctrl *ctrl);
+
+void avr_door_ctrl_acl_invalidate(struct avr_door_ctrl *ctrl);
+
+void avr_door_ctrl_acl_on_event(struct avr_door_ctrl *ctrl,
+				const struct avr_door_ctrl_msg *msg);
+
+/* The getters return -ENODATA if the query can't be answered
+ * from the cache, the setters just replay successful writes. */
+int avr_door_ctrl_acl_get_record_v1(struct avr_door_ctrl *ctrl,
+				    unsigned int idx,
+				    struct access_record *rec);
+
+int avr_door_ctrl_acl_get_access_v1(struct avr_door_ctrl *ctrl,
+				    const struct access_record *rec,
+				    uint8_t *doors);
+
+void avr_door_ctrl_acl_set_record_v1(struct avr_door_ctrl *ctrl,
+				     unsigned int idx,
+				     const struct access_record *rec);
+
+void avr_door_ctrl_acl_set_access_v1(struct avr_door_ctrl *ctrl,
+				     const struct access_record *rec);
+
+void avr_door_ctrl_acl_remove_all(struct avr_door_ctrl *ctrl);
+
+void avr_door_ctrl_acl_clear_used(struct avr_door_ctrl *ctrl);
+
+/* Helpers for the journal */
+int avr_door_ctrl_acl_msg_to_record(const struct avr_door_ctrl_msg *msg,
+				    struct access_record_v2 *rec);
+
+bool avr_door_ctrl_acl_same_key(const struct access_record_v2 *a,
+				const struct access_record_v2 *b);
+
+unsigned int avr_door_ctrl_acl_record_doors(const struct access_record_v2 *rec);
+
+/* Replay a successful write command in the cache */
+void avr_door_ctrl_acl_on_write(struct avr_door_ctrl *ctrl,
+				const struct avr_door_ctrl_msg *msg);
+
+int avr_door_ctrl_acl_apply(struct ubus_context *uctx,
+			    struct avr_door_ctrl *ctrl,
+			    struct ubus_request_data *ureq,
+			    struct blob_attr *records);
+
+int avr_door_ctrl_journal_open(struct avr_door_ctrl *ctrl, const char *dir);
+
+void avr_door_ctrl_journal_close(struct avr_door_ctrl *ctrl);
+
+/* Return true if the writes must go through the journal */
+bool avr_door_ctrl_journal_active(struct avr_door_ctrl *ctrl);
+
+/* Add a write command to the journal, return -EOPNOTSUPP if
+ * the command can't be journaled. */
+int avr_door_ctrl_journal_write(struct avr_door_ctrl *ctrl,
+				const struct avr_door_ctrl_msg *msg);
+
+/* Add several write commands to the journal with a single update of
+ * the journal file, the status of each command is returned in errs. */
+int avr_door_ctrl_journal_write_batch(struct avr_door_ctrl *ctrl,
+				      const struct avr_door_ctrl_msg **msgs,
+				      int *errs, unsigned int count);
+
+void avr_door_ctrl_journal_replay(struct avr_door_ctrl *ctrl);
+
 struct avr_door_ctrl_transport {
 	int fd;
 
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2017 Alban Bedel <albeu@free.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "avr-door-controller-daemon.h"
+#include "../firmware/ctrl-cmd-types.h"
+#include <libubox/ulog.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+
+struct avr_door_ctrl_event {
+	unsigned int type;
+	const char *name;
+
+	/* Convert the event payload to a ubus message */
+	int (*read_event)(const void *payload, struct blob_buf *bbuf);
+	unsigned int payload_size;
+};
+
+static const char *const access_type_names[] = {
+	[ACCESS_TYPE_NONE] = "none",
+	[ACCESS_TYPE_PIN] = "pin",
+	[ACCESS_TYPE_CARD] = "card",
+	[ACCESS_TYPE_CARD_AND_PIN] = "card+pin",
+};
+
+static int read_started_event(const void *payload, struct blob_buf *bbuf)
+{
+	const struct device_descriptor *desc = payload;
+
+	blobmsg_add_u32(bbuf, "major_version", desc->major_version);
+	blobmsg_add_u32(bbuf, "minor_version", desc->minor_version);
+	blobmsg_add_u32(bbuf, "num_doors", desc->num_doors);
+	blobmsg_add_u32(bbuf, "num_access_records",
+			le16toh(desc->num_access_records));
+	blobmsg_add_u32(bbuf, "free_access_records",
+			le16toh(desc->free_access_records));
+	return 0;
+}
+
+static int read_door_event(const void *payload, struct blob_buf *bbuf)
+{
+	const struct ctrl_event_door *ev = payload;
+	uint16_t index = le16toh(ev->index);
+
+	blobmsg_add_u32(bbuf, "time", le32toh(ev->time));
+	blobmsg_add_u32(bbuf, "door", ev->door);
+
+	if (ev->type != ACCESS_TYPE_NONE &&
+	    ev->type < ARRAY_SIZE(access_type_names))
+		blobmsg_add_string(bbuf, "type",
+				   access_type_names[ev->type]);
+	if (index == CTRL_EVENT_BACKOFF_RECORD) {
+		blobmsg_add_u32(bbuf, "errno", EBUSY);
+		blobmsg_add_string(bbuf, "error", strerror(EBUSY));
+	} else if (index != CTRL_EVENT_NO_RECORD) {
+		blobmsg_add_u32(bbuf, "index", index);
+	}
+	if (ev->type & ACCESS_TYPE_CARD)
+		blobmsg_add_u32(bbuf, "card", le32toh(ev->card));
+
+	return 0;
+}
+
+static int read_backoff_event(const void *payload, struct blob_buf *bbuf)
+{
+	const struct ctrl_event_door *ev = payload;
+
+	blobmsg_add_u32(bbuf, "time", le32toh(ev->time));
+	blobmsg_add_u32(bbuf, "door", ev->door);
+	blobmsg_add_u32(bbuf, "delay", le32toh(ev->delay));
+
+	return 0;
+}
+
+static int read_reader_error_event(const void *payload, struct blob_buf *bbuf)
+{
+	const struct ctrl_event_door *ev = payload;
+	int err = -(int32_t)le32toh(ev->error);
+
+	blobmsg_add_u32(bbuf, "time", le32toh(ev->time));
+	blobmsg_add_u32(bbuf, "door", ev->door);
+	blobmsg_add_u32(bbuf, "errno", err);
+	blobmsg_add_string(bbuf, "error", strerror(err));
+
+	return 0;
+}
+
+#define AVR_DOOR_CTRL_EVENT(ev_type, ev_name, rd_event, size)	\
+	{							\
+		.type = ev_type,				\
+		.name = ev_name,				\
+		.read_event = rd_event,				\
+		.payload_size = size,				\
+	}
+
+static const struct avr_door_ctrl_event avr_door_ctrl_events[] = {
+	/* Old firmwares send the started event without payload */
+	AVR_DOOR_CTRL_EVENT(
+		CTRL_EVENT_STARTED, "started",
+		NULL, 0),
+
+	AVR_DOOR_CTRL_EVENT(
+		CTRL_EVENT_ACCESS_GRANTED, "access_granted",
+		read_door_event, sizeof(struct ctrl_event_door)),
+
+	AVR_DOOR_CTRL_EVENT(
+		CTRL_EVENT_ACCESS_DENIED, "access_denied",
+		read_door_event, sizeof(struct ctrl_event_door)),
+
+	AVR_DOOR_CTRL_EVENT(
+		CTRL_EVENT_DOOR_FORCED, "door_forced",
+		read_door_event, sizeof(struct ctrl_event_door)),
+
+	AVR_DOOR_CTRL_EVENT(
+		CTRL_EVENT_DOOR_HELD, "door_held",
+		read_door_event, sizeof(struct ctrl_event_door)),
+
+	AVR_DOOR_CTRL_EVENT(
+		CTRL_EVENT_READER_ERROR, "reader_error",
+		read_reader_error_event, sizeof(struct ctrl_event_door)),
+
+	AVR_DOOR_CTRL_EVENT(
+		CTRL_EVENT_DOOR_BACKOFF, "door_backoff",
+		read_backoff_event, sizeof(struct ctrl_event_door)),
+
+	AVR_DOOR_CTRL_EVENT(
+		CTRL_EVENT_LAYOUT_ERROR, "layout_error",
+		read_reader_error_event, sizeof(struct ctrl_event_door)),
+};
+
+static const struct avr_door_ctrl_event *
+avr_door_ctrl_get_event(unsigned int type)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(avr_door_ctrl_events); i++)
+		if (avr_door_ctrl_events[i].type == type)
+			return &avr_door_ctrl_events[i];
+
+	return NULL;
+}
+
+void avr_door_ctrl_notify_event(struct ubus_context *uctx,
+				struct avr_door_ctrl *ctrl,
+				const struct avr_door_ctrl_msg *msg)
+{
+	const struct avr_door_ctrl_event *event;
+	static struct blob_buf bbuf;
+	int err;
+
+	event = avr_door_ctrl_get_event(msg->type);
+	if (!event) {
+		ULOG_WARN("%s: Got unknown event %u\n", ctrl->name, msg->type);
+		return;
+	}
+
+	if (msg->length < event->payload_size) {
+		ULOG_WARN("%s: Got too short %s event\n",
+			  ctrl->name, event->name);
+		return;
+	}
+
+	/* Nothing to do if nobody is listening */
+	if (!ctrl->uobject.has_subscribers)
+		return;
+
+	blob_buf_init(&bbuf, 0);
+
+	/* The started event got its payload later on */
+	if (event->type == CTRL_EVENT_STARTED &&
+	    msg->length >= sizeof(struct device_descriptor))
+		err = read_started_event(msg->payload, &bbuf);
+	else if (event->read_event)
+		err = event->read_event(msg->payload, &bbuf);
+	else
+		err = 0;
+
+	if (err) {
+		ULOG_WARN("%s: Failed to read %s event\n",
+			  ctrl->name, event->name);
+		return;
+	}
+
+	err = ubus_notify(uctx, &ctrl->uobject, event->name, bbuf.head, -1);
+	if (err)
+		ULOG_WARN("%s: Failed to send %s notification: %s\n",
+			  ctrl->name, event->name, ubus_strerror(err));
+}
@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2017 Alban Bedel <albeu@free.fr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "avr-door-controller-daemon.h"
+#include "../firmware/ctrl-cmd-types.h"
+#include <libubox/ulog.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdio.h>
+
+/* The journal keep the writes done while a controller is offline to
+ * apply them once it is back. Only the last write of each access key
+ * is kept and a remove all drop all the previous writes, so replaying
+ * the journal only cost the net change.
+ *
+ * The journal file is a simple list of messages: type, length and
+ * payload. It is rewritten after each call that changed it, a batch
+ * being written at once. While replaying it is only rewritten when the
+ * replay stops: if the daemon dies before, the replayed writes are sent
+ * again, which is harmless as they only carry the net changes. */
+
+#define AVR_DOOR_CTRL_JOURNAL_MAX_ENTRIES 1024
+
+static bool journal_msg_equal(const struct avr_door_ctrl_msg *a,
+			      const struct avr_door_ctrl_msg *b)
+{
+	return a->type == b->type && a->length == b->length &&
+		!memcmp(a->payload, b->payload, a->length);
+}
+
+static int journal_save(struct avr_door_ctrl_journal *journal)
+{
+	char tmp[PATH_MAX];
+	unsigned int i;
+	FILE *f;
+
+	if (journal->num_entries == 0) {
+		if (unlink(journal->path) && errno != ENOENT)
+			return -errno;
+		return 0;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", journal->path);
+	f = fopen(tmp, "w");
+	if (!f)
+		return -errno;
+
+	for (i = 0; i < journal->num_entries; i++) {
+		const struct avr_door_ctrl_msg *msg = &journal->entries[i];
+
+		if (fwrite(msg, 2 + msg->length, 1, f) != 1)
+			goto error;
+	}
+
+	if (fflush(f) || fsync(fileno(f)))
+		goto error;
+	fclose(f);
+
+	/* Atomically replace the old journal */
+	if (rename(tmp, journal->path))
+		return -errno;
+
+	return 0;
+
+error:
+	fclose(f);
+	unlink(tmp);
+	return -EIO;
+}
+
+static int journal_load(struct avr_door_ctrl_journal *journal)
+{
+	struct avr_door_ctrl_msg msg, *entries;
+	FILE *f;
+	int err = 0;
+
+	f = fopen(journal->path, "r");
+	if (!f)
+		return errno == ENOENT ? 0 : -errno;
+
+	while (fread(&msg, 2, 1, f) == 1) {
+		if (msg.length > sizeof(msg.payload) ||
+		    fread(msg.payload, msg.length, 1, f) != 1 ||
+		    journal->num_entries >= AVR_DOOR_CTRL_JOURNAL_MAX_ENTRIES) {
+			err = -EINVAL;
+			break;
+		}
+
+		entries = realloc(journal->entries,
+				  (journal->num_entries + 1) * sizeof(msg));
+		if (!entries) {
+			err = -ENOMEM;
+			break;
+		}
+		journal->entries = entries;
+		journal->entries[journal->num_entries++] = msg;
+	}
+
+	fclose(f);
+	return err;
+}
+
+static void journal_remove_entry(struct avr_door_ctrl_journal *journal,
+				 unsigned int idx)
+{
+	journal->num_entries--;
+	memmove(&journal->entries[idx], &journal->entries[idx + 1],
+		(journal->num_entries - idx) * sizeof(journal->entries[0]));
+}
+
+int avr_door_ctrl_journal_open(struct avr_door_ctrl *ctrl, const char *dir)
+{
+	struct avr_door_ctrl_journal *journal = &ctrl->journal;
+	int err;
+
+	if (mkdir(dir, 0700) && errno != EEXIST)
+		return -errno;
+
+	journal->path = malloc(PATH_MAX);
+	if (!journal->path)
+		return -ENOMEM;
+	snprintf(journal->path, PATH_MAX, "%s/%s.journal", dir, ctrl->name);
+
+	err = journal_load(journal);
+	if (err) {
+		ULOG_ERR("%s: Failed to load the journal %s: %s\n",
+			 ctrl->name, journal->path, strerror(-err));
+		avr_door_ctrl_journal_close(ctrl);
+		return err;
+	}
+
+	if (journal->num_entries)
+		ULOG_INFO("%s: %u writes pending in the journal\n",
+			  ctrl->name, journal->num_entries);
+
+	return 0;
+}
+
+void avr_door_ctrl_journal_close(struct avr_door_ctrl *ctrl)
+{
+	struct avr_door_ctrl_journal *journal = &ctrl->journal;
+
+	free(journal->entries);
+	journal->entries = NULL;
+	journal->num_entries = 0;
+	free(journal->path);
+	journal->path = NULL;
+}
+
+bool avr_door_ctrl_journal_active(struct avr_door_ctrl *ctrl)
+{
+	/* Keep using the journal until it has been fully replayed
+	 * to not reorder the writes. */
+	return ctrl->journal.path &&
+		(!ctrl->online || ctrl->journal.num_entries > 0);
+}
+
+/* Add a write to the journal in memory, the caller must save it */
+static int journal_add(struct avr_door_ctrl_journal *journal,
+		       const struct avr_door_ctrl_msg *msg)
+{
+	struct access_record_v2 rec, entry_rec;
+	struct avr_door_ctrl_msg *entries;
+	unsigned int i;
+	int err;
+
+	if (msg->type == CTRL_CMD_REMOVE_ALL_ACCESS) {
+		/* Drop all the previous writes */
+		journal->num_entries = 0;
+		goto append;
+	}
+
+	err = avr_door_ctrl_acl_msg_to_record(msg, &rec);
+	if (err)
+		return err;
+
+	/* Replace the last write to the same key */
+	for (i = 0; i < journal->num_entries; i++) {
+		if (avr_door_ctrl_acl_msg_to_record(&journal->entries[i],
+						    &entry_rec) ||
+		    !avr_door_ctrl_acl_same_key(&rec, &entry_rec))
+			continue;
+		journal_remove_entry(journal, i);
+		break;
+	}
+
+	/* Removing a record after a remove all is a no-op */
+	if (avr_door_ctrl_acl_record_doors(&rec) == 0 &&
+	    journal->num_entries > 0 &&
+	    journal->entries[0].type == CTRL_CMD_REMOVE_ALL_ACCESS)
+		return 0;
+
+append:
+	if (journal->num_entries >= AVR_DOOR_CTRL_JOURNAL_MAX_ENTRIES)
+		return -ENOSPC;
+
+	entries = realloc(journal->entries,
+			  (journal->num_entries + 1) * sizeof(*msg));
+	if (!entries)
+		return -ENOMEM;
+	journal->entries = entries;
+	journal->entries[journal->num_entries++] = *msg;
+
+	return 0;
+}
+
+int avr_door_ctrl_journal_write(struct avr_door_ctrl *ctrl,
+				const struct avr_door_ctrl_msg *msg)
+{
+	struct avr_door_ctrl_journal *journal = &ctrl->journal;
+	int err;
+
+	if (!journal->path)
+		return -EOPNOTSUPP;
+
+	err = journal_add(journal, msg);
+	if (err)
+		return err;
+
+	return journal_save(journal);
+}
+
+int avr_door_ctrl_journal_write_batch(struct avr_door_ctrl *ctrl,
+				      const struct avr_door_ctrl_msg **msgs,
+				      int *errs, unsigned int count)
+{
+	struct avr_door_ctrl_journal *journal = &ctrl->journal;
+	bool changed = false;
+	unsigned int i;
+	int err;
+
+	if (!journal->path)
+		return -EOPNOTSUPP;
+
+	for (i = 0; i < count; i++) {
+		errs[i] = journal_add(journal, msgs[i]);
+		if (errs[i] == 0)
+			changed = true;
+	}
+
+	if (!changed)
+		return 0;
+
+	/* None of the writes reached the disk if the save failed */
+	err = journal_save(journal);
+	if (err)
+		for (i = 0; i < count; i++)
+			if (errs[i] == 0)
+				errs[i] = err;
+
+	return err;
+}
+
+/* Get the message to send for the first entry. The access records are
+ * replayed as updates when possible to not reset the state the
+ * controller changed in the mean time. */
+static void journal_replay_msg(struct avr_door_ctrl *ctrl,
+			       struct avr_door_ctrl_msg *msg)
+{
+	*msg = ctrl->journal.entries[0];
+	if (msg->type == CTRL_CMD_SET_ACCESS_V2 && ctrl->acl.can_update)
+		msg->type = CTRL_CMD_UPDATE_ACCESS_V2;
+}
+
+/* Return true if the message was sent for the first entry */
+static bool journal_replay_is_first(struct avr_door_ctrl *ctrl,
+				    const struct avr_door_ctrl_msg *msg)
+{
+	struct avr_door_ctrl_msg first;
+
+	if (ctrl->journal.num_entries == 0)
+		return false;
+
+	journal_replay_msg(ctrl, &first);
+	return journal_msg_equal(&first, msg);
+}
+
+/* Write the entries removed by the replay to the journal file */
+static int journal_save_replayed(struct avr_door_ctrl *ctrl)
+{
+	int err;
+
+	err = journal_save(&ctrl->journal);
+	if (err)
+		ULOG_ERR("%s: Failed to save the journal: %s\n",
+			 ctrl->name, strerror(-err));
+	return err;
+}
+
+static int journal_replay_on_response(struct avr_door_ctrl_request *req,
+				      const struct avr_door_ctrl_msg *msg)
+{
+	struct avr_door_ctrl *ctrl = req->ctrl;
+	struct avr_door_ctrl_journal *journal = &ctrl->journal;
+
+	avr_door_ctrl_acl_on_write(ctrl, &req->msg);
+
+	/* The entry might have been replaced while it was sent, the
+	 * journal file is only updated once the replay stops. */
+	if (journal_replay_is_first(ctrl, &req->msg))
+		journal_remove_entry(journal, 0);
+
+	if (journal->num_entries == 0)
+		return 0;
+
+	/* Send the next entry */
+	journal_replay_msg(ctrl, &req->msg);
+	avr_door_ctrl_request_continue(req);
+	return -EINPROGRESS;
+}
+
+static void journal_replay_complete(struct avr_door_ctrl_request *req,
+				    int err)
+{
+	struct avr_door_ctrl *ctrl = req->ctrl;
+	struct avr_door_ctrl_journal *journal = &ctrl->journal;
+
+	journal->replay = NULL;
+
+	if (err == 0) {
+		journal_save_replayed(ctrl);
+		ULOG_INFO("%s: Journal replayed\n", ctrl->name);
+		return;
+	}
+
+	/* The controller is gone again, keep the entry for later */
+	if (err == -ETIMEDOUT || err == -ENOLINK) {
+		journal_save_replayed(ctrl);
+		return;
+	}
+
+	/* The controller refused the write, it would fail again */
+	ULOG_WARN("%s: Dropping journaled command %u: %s\n",
+		  ctrl->name, req->msg.type, strerror(-err));
+	if (journal_replay_is_first(ctrl, &req->msg))
+		journal_remove_entry(journal, 0);
+
+	journal_save_replayed(ctrl);
+	avr_door_ctrl_journal_replay(ctrl);
+}
+
+static void journal_replay_destroy(struct avr_door_ctrl_request *req)
+{
+	free(req);
+}
+
+static const
+struct avr_door_ctrl_request_handlers journal_replay_handlers = {
+	.on_response = journal_replay_on_response,
+	.complete = journal_replay_complete,
+	.destroy = journal_replay_destroy,
+};
+
+void avr_door_ctrl_journal_replay(struct avr_door_ctrl *ctrl)
+{
+	struct avr_door_ctrl_journal *journal = &ctrl->journal;
+	struct avr_door_ctrl_request *req;
+
+	/* Wait for the descriptor to know if updates are supported,
+	 * the replay is restarted once the access records are loaded. */
+	if (journal->replay || journal->num_entries == 0 || !ctrl->online ||
+	    ctrl->acl.load)
+		return;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return;
+
+	avr_door_ctrl_request_init(req, ctrl, &journal_replay_handlers,
+				   journal->entries[0].type,
+				   journal->entries[0].length);
+	journal_replay_msg(ctrl, &req->msg);
+	req->priority = AVR_DOOR_CTRL_PRIO_BULK;
+
+	ULOG_INFO("%s: Replaying %u journaled writes\n",
+		  ctrl->name, journal->num_entries);
+	journal->replay = req;
+	avr_door_ctrl_request_send(req);
+}
@@ -13,6 +13,7 @@
 
 #include "avr-door-controller-daemon.h"
 #include "../firmware/ctrl-cmd-types.h"
+#include <libubox/utils.h>
 #include <endian.h>
 
 struct avr_door_ctrl_method {
@@ -40,6 +41,18 @@ struct avr_door_ctrl_method {
 	/* Write a follow up query based on the response */
 	int (*write_continue_query)(const void *response, void *query,
 				    void *query_ctx);
+
+	/* Build the response from the ACL cache, return 0 on success */
+	int (*read_cache)(struct avr_door_ctrl *ctrl, const void *query,
+			  void *response);
+
+	/* Update the ACL cache after a successful query */
+	void (*update_cache)(struct avr_door_ctrl *ctrl, const void *query);
+
+	/* Methods fully handled in the daemon */
+	int (*handler)(struct ubus_context *uctx, struct avr_door_ctrl *ctrl,
+		       struct ubus_request_data *ureq,
+		       struct blob_attr *const *const args);
 };
 
 struct avr_door_ctrl_method_request {
@@ -65,7 +78,7 @@ static void pin_to_str(uint32_t key, char *pin)
 	pin[j] = 0;
 }
 
-static int pin_from_str(uint32_t *pin, const char *str)
+int pin_from_str(uint32_t *pin, const char *str)
 {
 	int i;
 
@@ -206,6 +219,165 @@ static int write_set_door_config_query(
 	return 0;
 }
 
+static const struct blobmsg_policy get_group_args[] = {
+	{
+		.name = "group",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+};
+
+static int write_get_group_query(
+	struct blob_attr *const *const args,
+	void *query, struct blob_buf *bbuf, void **ctx)
+{
+	struct ctrl_cmd_get_access_group *cmd = query;
+
+	blobmsg_add_u32(bbuf, "group", blobmsg_get_u32(args[0]));
+	cmd->id = blobmsg_get_u32(args[0]);
+	return 0;
+}
+
+static int read_get_group_response(
+	const void *response, struct blob_buf *bbuf, void *ctx)
+{
+	const struct access_group *grp = response;
+
+	blobmsg_add_u32(bbuf, "doors", grp->doors);
+	return 0;
+}
+
+#define SET_GROUP_ID			0
+#define SET_GROUP_DOORS			1
+
+static const struct blobmsg_policy set_group_args[] = {
+	[SET_GROUP_ID] = {
+		.name = "group",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[SET_GROUP_DOORS] = {
+		.name = "doors",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+};
+
+static int write_set_group_query(
+	struct blob_attr *const *const args,
+	void *query, struct blob_buf *bbuf, void **ctx)
+{
+	struct ctrl_cmd_set_access_group *cmd = query;
+
+	blobmsg_add_u32(bbuf, "group", blobmsg_get_u32(args[SET_GROUP_ID]));
+	cmd->id = blobmsg_get_u32(args[SET_GROUP_ID]);
+	cmd->group.doors = blobmsg_get_u32(args[SET_GROUP_DOORS]);
+	return 0;
+}
+
+static const struct blobmsg_policy get_schedule_args[] = {
+	{
+		.name = "group",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+};
+
+static int write_get_schedule_query(
+	struct blob_attr *const *const args,
+	void *query, struct blob_buf *bbuf, void **ctx)
+{
+	struct ctrl_cmd_get_access_schedule *cmd = query;
+
+	blobmsg_add_u32(bbuf, "group", blobmsg_get_u32(args[0]));
+	cmd->id = blobmsg_get_u32(args[0]);
+	return 0;
+}
+
+static int read_get_schedule_response(
+	const void *response, struct blob_buf *bbuf, void *ctx)
+{
+	const struct access_schedule *sch = response;
+
+	blobmsg_add_u32(bbuf, "since", le16toh(sch->since));
+	blobmsg_add_u32(bbuf, "until", le16toh(sch->until));
+	blobmsg_add_u32(bbuf, "utc_offset", sch->utc_offset * 15);
+	blobmsg_add_u32(bbuf, "weekdays", sch->weekdays);
+	blobmsg_add_u32(bbuf, "hours", sch->hours[0] |
+			(sch->hours[1] << 8) | (sch->hours[2] << 16));
+	return 0;
+}
+
+#define SET_SCHEDULE_ID			0
+#define SET_SCHEDULE_SINCE		1
+#define SET_SCHEDULE_UNTIL		2
+#define SET_SCHEDULE_UTC_OFFSET		3
+#define SET_SCHEDULE_WEEKDAYS		4
+#define SET_SCHEDULE_HOURS		5
+
+static const struct blobmsg_policy set_schedule_args[] = {
+	[SET_SCHEDULE_ID] = {
+		.name = "group",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[SET_SCHEDULE_SINCE] = {
+		.name = "since",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[SET_SCHEDULE_UNTIL] = {
+		.name = "until",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[SET_SCHEDULE_UTC_OFFSET] = {
+		.name = "utc_offset",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[SET_SCHEDULE_WEEKDAYS] = {
+		.name = "weekdays",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[SET_SCHEDULE_HOURS] = {
+		.name = "hours",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+};
+
+static int write_set_schedule_query(
+	struct blob_attr *const *const args,
+	void *query, struct blob_buf *bbuf, void **ctx)
+{
+	struct ctrl_cmd_set_access_schedule *cmd = query;
+	uint32_t since = 0, until = 0xFFFF, hours = 0xFFFFFF;
+	uint32_t weekdays = ACCESS_SCHEDULE_ALL_WEEKDAYS;
+	int32_t utc_offset = 0;
+
+	/* Without argument the schedule allow the access at any time,
+	 * an explicit empty weekdays mask suspends the group. */
+	if (args[SET_SCHEDULE_SINCE])
+		since = blobmsg_get_u32(args[SET_SCHEDULE_SINCE]);
+	if (args[SET_SCHEDULE_UNTIL])
+		until = blobmsg_get_u32(args[SET_SCHEDULE_UNTIL]);
+	if (args[SET_SCHEDULE_UTC_OFFSET])
+		utc_offset = (int32_t)blobmsg_get_u32(
+			args[SET_SCHEDULE_UTC_OFFSET]);
+	if (args[SET_SCHEDULE_WEEKDAYS])
+		weekdays = blobmsg_get_u32(args[SET_SCHEDULE_WEEKDAYS]);
+	if (args[SET_SCHEDULE_HOURS])
+		hours = blobmsg_get_u32(args[SET_SCHEDULE_HOURS]);
+
+	if (since > 0xFFFF || until > 0xFFFF ||
+	    weekdays & ~ACCESS_SCHEDULE_ALL_WEEKDAYS || hours > 0xFFFFFF ||
+	    utc_offset % 15 || utc_offset < -128 * 15 || utc_offset > 127 * 15)
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	blobmsg_add_u32(bbuf, "group", blobmsg_get_u32(args[SET_SCHEDULE_ID]));
+	cmd->id = blobmsg_get_u32(args[SET_SCHEDULE_ID]);
+	cmd->schedule.since = htole16(since);
+	cmd->schedule.until = htole16(until);
+	cmd->schedule.utc_offset = utc_offset / 15;
+	cmd->schedule.weekdays = weekdays;
+	cmd->schedule.hours[0] = hours;
+	cmd->schedule.hours[1] = hours >> 8;
+	cmd->schedule.hours[2] = hours >> 16;
+	return 0;
+}
+
 #define GET_ACCESS_RECORD_INDEX		0
 #define GET_ACCESS_RECORD_PIN		1
 #define GET_ACCESS_RECORD_CARD		2
@@ -269,6 +441,15 @@ static int read_get_access_record_response(
 		pin, true);
 }
 
+static int read_get_access_record_cache(
+	struct avr_door_ctrl *ctrl, const void *query, void *response)
+{
+	const struct ctrl_cmd_get_access_record *cmd = query;
+
+	return avr_door_ctrl_acl_get_record_v1(
+		ctrl, le16toh(cmd->index), response);
+}
+
 #define SET_ACCESS_RECORD_INDEX		0
 #define SET_ACCESS_RECORD_PIN		1
 #define SET_ACCESS_RECORD_CARD		2
@@ -308,8 +489,7 @@ static int write_set_access_record_query(
 	void *query, struct blob_buf *bbuf, void **ctx)
 {
 	struct ctrl_cmd_set_access_record *cmd = query;
-	uint32_t card = 0, pin = 0, used = 0;
-	uint8_t doors = 0;
+	uint32_t card = 0, pin = 0, used = 0, doors = 0;
 	char *str_pin;
 	uint8_t type;
 
@@ -318,10 +498,15 @@ static int write_set_access_record_query(
 	str_pin = blobmsg_get_string(args[SET_ACCESS_RECORD_PIN]);
 	if (args[SET_ACCESS_RECORD_CARD])
 		card = blobmsg_get_u32(args[SET_ACCESS_RECORD_CARD]);
+	/* The upper byte would be read as a card range */
+	if (card & ~ACCESS_RECORD_CARD_ID_MASK)
+		return UBUS_STATUS_INVALID_ARGUMENT;
 	if (args[SET_ACCESS_RECORD_CARD_N_PIN])
 		card = blobmsg_get_u32(args[SET_ACCESS_RECORD_CARD_N_PIN]);
 	if (args[SET_ACCESS_RECORD_DOORS])
-		doors = blobmsg_get_u32(args[SET_ACCESS_RECORD_DOORS]) & 0xF;
+		doors = blobmsg_get_u32(args[SET_ACCESS_RECORD_DOORS]);
+	if (doors > 0xF)
+		return UBUS_STATUS_INVALID_ARGUMENT;
 	if (args[SET_ACCESS_RECORD_USED])
 		used = !!blobmsg_get_u32(args[SET_ACCESS_RECORD_USED]);
 
@@ -358,6 +543,15 @@ static int write_set_access_record_query(
 	return 0;
 }
 
+static void update_set_access_record_cache(
+	struct avr_door_ctrl *ctrl, const void *query)
+{
+	const struct ctrl_cmd_set_access_record *cmd = query;
+
+	avr_door_ctrl_acl_set_record_v1(
+		ctrl, le16toh(cmd->index), &cmd->record);
+}
+
 #define SET_ACCESS_PIN		0
 #define SET_ACCESS_CARD		1
 #define SET_ACCESS_DOORS	2
@@ -382,16 +576,20 @@ static int write_set_access_query(
 	void *query, struct blob_buf *bbuf, void **ctx)
 {
 	struct access_record *rec = query;
-	uint32_t card = 0, pin = 0;
-	uint8_t doors = 0;
+	uint32_t card = 0, pin = 0, doors = 0;
 	char *str_pin;
 	uint8_t type;
 
 	str_pin = blobmsg_get_string(args[SET_ACCESS_PIN]);
 	if (args[SET_ACCESS_CARD])
 		card = blobmsg_get_u32(args[SET_ACCESS_CARD]);
+	/* The upper byte would be read as a card range */
+	if (card & ~ACCESS_RECORD_CARD_ID_MASK)
+		return UBUS_STATUS_INVALID_ARGUMENT;
 	if (args[SET_ACCESS_DOORS])
-		doors = blobmsg_get_u32(args[SET_ACCESS_DOORS]) & 0xF;
+		doors = blobmsg_get_u32(args[SET_ACCESS_DOORS]);
+	if (doors > 0xF)
+		return UBUS_STATUS_INVALID_ARGUMENT;
 
 	if (args[SET_ACCESS_CARD] && str_pin)
 		type = ACCESS_TYPE_CARD_AND_PIN;
@@ -416,9 +614,81 @@ static int write_set_access_query(
 	return 0;
 }
 
+static void update_set_access_cache(
+	struct avr_door_ctrl *ctrl, const void *query)
+{
+	avr_door_ctrl_acl_set_access_v1(ctrl, query);
+}
+
+#define GET_ACCESS_PIN		0
+#define GET_ACCESS_CARD		1
+
+static const struct blobmsg_policy get_access_args[] = {
+	[GET_ACCESS_PIN] = {
+		.name = "pin",
+		.type = BLOBMSG_TYPE_STRING,
+	},
+	[GET_ACCESS_CARD] = {
+		.name = "card",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+};
+
+static int write_get_access_query(
+	struct blob_attr *const *const args,
+	void *query, struct blob_buf *bbuf, void **ctx)
+{
+	struct access_record *rec = query;
+	uint32_t card = 0, pin = 0;
+	char *str_pin;
+	uint8_t type;
+
+	str_pin = blobmsg_get_string(args[GET_ACCESS_PIN]);
+	if (args[GET_ACCESS_CARD])
+		card = blobmsg_get_u32(args[GET_ACCESS_CARD]);
+
+	if (args[GET_ACCESS_CARD] && str_pin)
+		type = ACCESS_TYPE_CARD_AND_PIN;
+	else if (args[GET_ACCESS_CARD])
+		type = ACCESS_TYPE_CARD;
+	else if (str_pin)
+		type = ACCESS_TYPE_PIN;
+	else
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	if (str_pin && pin_from_str(&pin, str_pin))
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	rec->key = htole32(card ^ pin);
+	((uint8_t*)rec)[4] = type;
+
+	return 0;
+}
+
+static int read_get_access_response(
+	const void *response, struct blob_buf *bbuf, void *ctx)
+{
+	const uint8_t *doors = response;
+
+	blobmsg_add_u32(bbuf, "doors", *doors);
+	return 0;
+}
+
+static int read_get_access_cache(
+	struct avr_door_ctrl *ctrl, const void *query, void *response)
+{
+	return avr_door_ctrl_acl_get_access_v1(ctrl, query, response);
+}
+
 static const struct blobmsg_policy remove_all_access_args[] = {
 };
 
+static void update_remove_all_access_cache(
+	struct avr_door_ctrl *ctrl, const void *query)
+{
+	avr_door_ctrl_acl_remove_all(ctrl);
+}
+
 #define GET_USED_ACCESS_CLEAR	0
 
 static const struct blobmsg_policy get_used_access_args[] = {
@@ -488,9 +758,637 @@ static int read_get_used_access_response(
 	}
 }
 
-#define AVR_DOOR_CTRL_METHOD_FULL(method, opt_args, cmd_id,		\
-				  wr_query, qr_size, wr_cont_query,     \
-				  rd_resp, resp_size)			\
+static int blobmsg_add_access_record_v2(
+	struct blob_buf *bbuf, const struct access_record_v2 *rec)
+{
+	uint8_t hdr, type, doors;
+	uint32_t card, pin;
+	char str_pin[9];
+
+	/* The bit fields are broken with Chaos Calmer MIPS compiler */
+	hdr = ((uint8_t*)rec)[0];
+	type = hdr & 0x7;
+	doors = (hdr >> 4) & 0xF;
+	card = le32toh(rec->card);
+	pin = le32toh(rec->pin.fixed);
+
+	blobmsg_add_u32(bbuf, "doors", doors);
+	if (ACCESS_RECORD_DOORS_IS_GROUP(doors))
+		blobmsg_add_u32(bbuf, "group",
+				ACCESS_RECORD_DOORS_GROUP_ID(doors));
+	blobmsg_add_u8(bbuf, "used", !!(hdr & BIT(3)));
+
+	if (ACCESS_RECORD_TYPE_CARD(type) == ACCESS_RECORD_TYPE_CARD_ID &&
+	    ACCESS_RECORD_CARD_IS_RANGE(card)) {
+		blobmsg_add_string(bbuf, "card_type", "range");
+		blobmsg_add_u32(bbuf, "card", card & ACCESS_RECORD_CARD_ID_MASK);
+		blobmsg_add_u32(bbuf, "card_range_bits",
+				ACCESS_RECORD_CARD_RANGE_BITS(card));
+	} else if (ACCESS_RECORD_TYPE_CARD(type) ==
+		   ACCESS_RECORD_TYPE_CARD_ID) {
+		blobmsg_add_string(bbuf, "card_type", "id");
+		blobmsg_add_u32(bbuf, "card", card);
+	}
+
+	switch (ACCESS_RECORD_TYPE_PIN(type)) {
+	case ACCESS_RECORD_TYPE_PIN_FIXED:
+		blobmsg_add_string(bbuf, "pin_type", "fixed");
+		pin_to_str(pin, str_pin);
+		blobmsg_add_string(bbuf, "pin", str_pin);
+		break;
+	case ACCESS_RECORD_TYPE_PIN_HOTP:
+		blobmsg_add_string(bbuf, "pin_type", "hotp");
+		blobmsg_add_u32(bbuf, "otp_key", pin & 0x3FF);
+		blobmsg_add_u32(bbuf, "otp_digits", ((pin >> 10) & 0x3) + 6);
+		blobmsg_add_u32(bbuf, "hotp_resync_limit", (pin >> 12) & 0xF);
+		blobmsg_add_u32(bbuf, "hotp_counter", pin >> 16);
+		break;
+	case ACCESS_RECORD_TYPE_PIN_TOTP:
+		blobmsg_add_string(bbuf, "pin_type", "totp");
+		blobmsg_add_u32(bbuf, "otp_key", pin & 0x3FF);
+		blobmsg_add_u32(bbuf, "otp_digits", ((pin >> 10) & 0x3) + 6);
+		blobmsg_add_u32(bbuf, "totp_allow_followings", (pin >> 12) & 0x1);
+		blobmsg_add_u32(bbuf, "totp_allow_previous", (pin >> 13) & 0x7);
+		blobmsg_add_u32(bbuf, "totp_interval", pin >> 16);
+		break;
+	}
+
+	return 0;
+}
+
+static const struct blobmsg_policy dump_access_records_args[] = {
+};
+
+static int write_dump_access_records_query(
+	struct blob_attr *const *const args,
+	void *query, struct blob_buf *bbuf, void **ctx)
+{
+	struct ctrl_cmd_get_access_records *get = query;
+	void *cookie;
+
+	get->start = 0;
+
+	cookie = blobmsg_open_array(bbuf, "records");
+	if (cookie == NULL)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	*ctx = cookie;
+	return 0;
+}
+
+static int write_dump_access_records_continue_query(
+	const void *response, void *query, void *ctx)
+{
+	const struct ctrl_cmd_resp_access_records *resp = response;
+	struct ctrl_cmd_get_access_records *get = query;
+
+	/* Continue after the last record, the index is already offset */
+	get->start = resp->record[resp->count - 1].index;
+
+	return 0;
+}
+
+static int read_dump_access_records_response(
+	const void *response, struct blob_buf *bbuf, void *ctx)
+{
+	const struct ctrl_cmd_resp_access_records *resp = response;
+	void *tbl;
+	int i;
+
+	if (resp->count > ARRAY_SIZE(resp->record)) {
+		blobmsg_close_array(bbuf, ctx);
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+
+	/* No more records */
+	if (resp->count == 0) {
+		blobmsg_close_array(bbuf, ctx);
+		return 0;
+	}
+
+	for (i = 0; i < resp->count; i++) {
+		tbl = blobmsg_open_table(bbuf, NULL);
+		if (tbl == NULL) {
+			blobmsg_close_array(bbuf, ctx);
+			return UBUS_STATUS_UNKNOWN_ERROR;
+		}
+
+		blobmsg_add_u32(bbuf, "index",
+				le16toh(resp->record[i].index) - 1);
+		blobmsg_add_access_record_v2(bbuf, &resp->record[i].record);
+		blobmsg_close_table(bbuf, tbl);
+	}
+
+	return -EAGAIN;
+}
+
+static void update_get_used_access_cache(
+	struct avr_door_ctrl *ctrl, const void *query)
+{
+	const struct ctrl_cmd_get_used_access *get = query;
+
+	/* All the used flags have been cleared */
+	if (get->clear)
+		avr_door_ctrl_acl_clear_used(ctrl);
+}
+
+#define APPLY_ACL_RECORDS	0
+
+static const struct blobmsg_policy apply_acl_args[] = {
+	[APPLY_ACL_RECORDS] = {
+		.name = "records",
+		.type = BLOBMSG_TYPE_ARRAY,
+	},
+};
+
+static int apply_acl_handler(
+	struct ubus_context *uctx, struct avr_door_ctrl *ctrl,
+	struct ubus_request_data *ureq, struct blob_attr *const *const args)
+{
+	return avr_door_ctrl_acl_apply(uctx, ctrl, ureq,
+				       args[APPLY_ACL_RECORDS]);
+}
+
+struct request_batch;
+
+struct request_batch_entry {
+	struct avr_door_ctrl_request req;
+	struct request_batch *batch;
+	int err;
+	/* Response payload */
+	uint8_t length;
+	uint8_t payload[AVR_DOOR_CTRL_MSG_MAX_PAYLOAD_SIZE];
+};
+
+struct request_batch {
+	struct ubus_context *uctx;
+	struct ubus_request_data uresp;
+	/* Called when a request of the batch completed */
+	void (*complete)(struct request_batch_entry *entry, int err);
+	/* Write the reply once all the requests completed */
+	void (*add_results)(struct blob_buf *bbuf,
+			    const struct request_batch *batch);
+	/* Next request to queue */
+	unsigned int next;
+	/* Requests not completed yet */
+	unsigned int pending;
+	/* Requests not destroyed yet */
+	unsigned int alive;
+	unsigned int num_reqs;
+	struct request_batch_entry reqs[];
+};
+
+static int request_batch_on_response(
+	struct avr_door_ctrl_request *request,
+	const struct avr_door_ctrl_msg *resp)
+{
+	struct request_batch_entry *entry =
+		container_of(request, struct request_batch_entry, req);
+
+	entry->length = resp->length;
+	memcpy(entry->payload, resp->payload, resp->length);
+	return 0;
+}
+
+static void request_batch_reply(struct request_batch *batch)
+{
+	struct blob_buf bbuf = {};
+
+	blob_buf_init(&bbuf, 0);
+	batch->add_results(&bbuf, batch);
+	ubus_send_reply(batch->uctx, &batch->uresp, bbuf.head);
+	ubus_complete_deferred_request(batch->uctx, &batch->uresp,
+				       UBUS_STATUS_OK);
+	blob_buf_free(&bbuf);
+}
+
+static void request_batch_complete(
+	struct avr_door_ctrl_request *request, int err)
+{
+	struct request_batch_entry *entry =
+		container_of(request, struct request_batch_entry, req);
+	struct request_batch *batch = entry->batch;
+
+	if (batch->complete)
+		batch->complete(entry, err);
+
+	entry->err = err;
+	if (--batch->pending == 0)
+		request_batch_reply(batch);
+	else if (batch->next < batch->num_reqs)
+		avr_door_ctrl_request_send(&batch->reqs[batch->next++].req);
+}
+
+static void request_batch_destroy(struct avr_door_ctrl_request *request)
+{
+	struct request_batch_entry *entry =
+		container_of(request, struct request_batch_entry, req);
+
+	if (--entry->batch->alive == 0)
+		free(entry->batch);
+}
+
+static const
+struct avr_door_ctrl_request_handlers request_batch_handlers = {
+	.on_response = request_batch_on_response,
+	.complete = request_batch_complete,
+	.destroy = request_batch_destroy,
+};
+
+static struct request_batch *request_batch_alloc(unsigned int count)
+{
+	return calloc(1, sizeof(struct request_batch) +
+		      count * sizeof(struct request_batch_entry));
+}
+
+static void request_batch_init_entry(
+	struct request_batch *batch, struct avr_door_ctrl *ctrl,
+	unsigned int idx, unsigned msg_type, unsigned msg_length)
+{
+	struct request_batch_entry *entry = &batch->reqs[idx];
+
+	avr_door_ctrl_request_init(&entry->req, ctrl, &request_batch_handlers,
+				   msg_type, msg_length);
+	entry->req.priority = AVR_DOOR_CTRL_PRIO_BULK;
+	entry->batch = batch;
+}
+
+/* Send all the requests in order, the next one is only queued once
+ * the previous one completed to let the single calls through and
+ * keep the queue short. The ubus request is answered once they all
+ * completed. */
+static void request_batch_send(
+	struct request_batch *batch, unsigned int count,
+	struct ubus_context *uctx, struct ubus_request_data *ureq)
+{
+	batch->uctx = uctx;
+	batch->num_reqs = count;
+	batch->pending = count;
+	batch->alive = count;
+	batch->next = 1;
+	ubus_defer_request(uctx, ureq, &batch->uresp);
+
+	avr_door_ctrl_request_send(&batch->reqs[0].req);
+}
+
+/* Reply directly to a batch without any request */
+static int request_batch_reply_empty(
+	struct ubus_context *uctx, struct ubus_request_data *ureq,
+	void (*add_results)(struct blob_buf *bbuf,
+			    const struct request_batch *batch))
+{
+	struct request_batch batch = {};
+	struct blob_buf bbuf = {};
+
+	blob_buf_init(&bbuf, 0);
+	add_results(&bbuf, &batch);
+	ubus_send_reply(uctx, ureq, bbuf.head);
+	blob_buf_free(&bbuf);
+	return 0;
+}
+
+static void set_access_batch_add_results(
+	struct blob_buf *bbuf, const struct request_batch *batch)
+{
+	unsigned int i, failed = 0;
+	void *cookie;
+
+	/* The status of each record, 0 or an errno value */
+	cookie = blobmsg_open_array(bbuf, "results");
+	for (i = 0; i < batch->num_reqs; i++) {
+		blobmsg_add_u32(bbuf, NULL, -batch->reqs[i].err);
+		if (batch->reqs[i].err)
+			failed++;
+	}
+	blobmsg_close_array(bbuf, cookie);
+	blobmsg_add_u32(bbuf, "failed", failed);
+}
+
+static void set_access_batch_complete(
+	struct request_batch_entry *entry, int err)
+{
+	/* Keep the ACL cache in sync like for set_access */
+	if (err == 0)
+		update_set_access_cache(entry->req.ctrl,
+					entry->req.msg.payload);
+	else if (err == -ETIMEDOUT)
+		avr_door_ctrl_acl_invalidate(entry->req.ctrl);
+}
+
+#define SET_ACCESS_BATCH_RECORDS	0
+
+static const struct blobmsg_policy set_access_batch_args[] = {
+	[SET_ACCESS_BATCH_RECORDS] = {
+		.name = "records",
+		.type = BLOBMSG_TYPE_ARRAY,
+	},
+};
+
+static int set_access_batch_handler(
+	struct ubus_context *uctx, struct avr_door_ctrl *ctrl,
+	struct ubus_request_data *ureq, struct blob_attr *const *const args)
+{
+	struct blob_attr *tb[ARRAY_SIZE(set_access_args)];
+	struct blob_attr *records = args[SET_ACCESS_BATCH_RECORDS];
+	struct request_batch *batch;
+	struct blob_attr *cur;
+	int rem, count, i = 0, err;
+
+	count = blobmsg_check_array(records, BLOBMSG_TYPE_TABLE);
+	if (count < 0 || count > AVR_DOOR_CTRL_MAX_BATCH_SIZE)
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	if (count == 0)
+		return request_batch_reply_empty(
+			uctx, ureq, set_access_batch_add_results);
+
+	batch = request_batch_alloc(count);
+	if (!batch)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	/* Convert all the records before queuing anything */
+	blobmsg_for_each_attr(cur, records, rem) {
+		blobmsg_parse(set_access_args, ARRAY_SIZE(set_access_args), tb,
+			      blobmsg_data(cur), blobmsg_data_len(cur));
+		err = write_set_access_query(tb, batch->reqs[i].req.msg.payload,
+					     NULL, NULL);
+		if (err) {
+			free(batch);
+			return err;
+		}
+
+		request_batch_init_entry(batch, ctrl, i++, CTRL_CMD_SET_ACCESS,
+					 sizeof(struct access_record));
+	}
+
+	batch->complete = set_access_batch_complete;
+	batch->add_results = set_access_batch_add_results;
+
+	/* Store the records in the journal while the controller is offline */
+	if (avr_door_ctrl_journal_active(ctrl)) {
+		const struct avr_door_ctrl_msg
+			*msgs[AVR_DOOR_CTRL_MAX_BATCH_SIZE];
+		int errs[AVR_DOOR_CTRL_MAX_BATCH_SIZE];
+		struct blob_buf bbuf = {};
+
+		for (i = 0; i < count; i++)
+			msgs[i] = &batch->reqs[i].req.msg;
+		avr_door_ctrl_journal_write_batch(ctrl, msgs, errs, count);
+		for (i = 0; i < count; i++)
+			batch->reqs[i].err = errs[i];
+		batch->num_reqs = count;
+
+		blob_buf_init(&bbuf, 0);
+		set_access_batch_add_results(&bbuf, batch);
+		ubus_send_reply(uctx, ureq, bbuf.head);
+		blob_buf_free(&bbuf);
+		free(batch);
+		return 0;
+	}
+
+	request_batch_send(batch, count, uctx, ureq);
+
+	return 0;
+}
+
+static void raw_add_results(
+	struct blob_buf *bbuf, const struct request_batch *batch)
+{
+	char b64[B64_ENCODE_LEN(AVR_DOOR_CTRL_MSG_MAX_PAYLOAD_SIZE)];
+	const struct request_batch_entry *entry;
+	unsigned int i, failed = 0;
+	void *array, *table;
+
+	array = blobmsg_open_array(bbuf, "responses");
+	for (i = 0; i < batch->num_reqs; i++) {
+		entry = &batch->reqs[i];
+		table = blobmsg_open_table(bbuf, NULL);
+		blobmsg_add_u32(bbuf, "errno", -entry->err);
+		if (entry->err == 0) {
+			b64_encode(entry->payload, entry->length,
+				   b64, sizeof(b64));
+			blobmsg_add_string(bbuf, "payload", b64);
+		} else {
+			failed++;
+		}
+		blobmsg_close_table(bbuf, table);
+	}
+	blobmsg_close_array(bbuf, array);
+	blobmsg_add_u32(bbuf, "failed", failed);
+}
+
+static void raw_complete(struct request_batch_entry *entry, int err)
+{
+	/* We can't follow what the raw commands do, reload the ACL
+	 * cache if one might have changed the access records. */
+	if ((err == 0 || err == -ETIMEDOUT) &&
+	    !avr_door_ctrl_cmd_is_idempotent(&entry->req.msg))
+		avr_door_ctrl_acl_invalidate(entry->req.ctrl);
+}
+
+static const struct blobmsg_policy stats_args[] = {
+};
+
+static int read_stats_response(
+	const void *response, struct blob_buf *bbuf, void *ctx)
+{
+	const struct ctrl_stats *stats = response;
+	const struct avr_door_ctrl_msg *resp =
+		container_of(response, struct avr_door_ctrl_msg, payload);
+
+	blobmsg_add_u32(bbuf, "work_queue_overflows",
+			le16toh(stats->work_queue_overflows));
+	blobmsg_add_u32(bbuf, "reader_errors", le16toh(stats->reader_errors));
+	blobmsg_add_u32(bbuf, "crc_errors", le16toh(stats->crc_errors));
+	blobmsg_add_u32(bbuf, "eeprom_writes", le32toh(stats->eeprom_writes));
+	blobmsg_add_u32(bbuf, "access_checks", le32toh(stats->access_checks));
+	blobmsg_add_u32(bbuf, "otp_computations",
+			le32toh(stats->otp_computations));
+	blobmsg_add_u32(bbuf, "max_work_time", le16toh(stats->max_work_time));
+
+	/* The back-off counters are missing with the older firmwares */
+	if (resp->length < sizeof(*stats))
+		return 0;
+
+	blobmsg_add_u32(bbuf, "reject_cache_hits",
+			le16toh(stats->reject_cache_hits));
+	blobmsg_add_u32(bbuf, "door_backoffs", le16toh(stats->door_backoffs));
+	blobmsg_add_u32(bbuf, "backoff_rejects",
+			le16toh(stats->backoff_rejects));
+	return 0;
+}
+
+static const struct blobmsg_policy reset_stats_args[] = {
+};
+
+static const struct blobmsg_policy memory_info_args[] = {
+};
+
+static int read_memory_info_response(
+	const void *response, struct blob_buf *bbuf, void *ctx)
+{
+	const struct ctrl_memory_info *info = response;
+
+	blobmsg_add_u32(bbuf, "ram_size", le16toh(info->ram_size));
+	blobmsg_add_u32(bbuf, "static_size", le16toh(info->static_size));
+	blobmsg_add_u32(bbuf, "stack_max", le16toh(info->stack_max));
+	blobmsg_add_u32(bbuf, "stack_free", le16toh(info->stack_free));
+	return 0;
+}
+
+#define LATENCY_DOOR		0
+
+static const struct blobmsg_policy latency_args[] = {
+	[LATENCY_DOOR] = {
+		.name = "door",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+};
+
+/* Clearing the histogram needs the write permission, so it is done
+ * by a separate method like reset_stats. */
+static const struct blobmsg_policy reset_latency_args[] = {
+	[LATENCY_DOOR] = {
+		.name = "door",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+};
+
+static int write_latency_query(
+	struct blob_attr *const *const args,
+	void *query, struct blob_buf *bbuf, void **ctx)
+{
+	struct ctrl_cmd_get_latency_hist *get = query;
+
+	get->door = blobmsg_get_u32(args[LATENCY_DOOR]);
+	get->reset = 0;
+
+	blobmsg_add_u32(bbuf, "door", get->door);
+	return 0;
+}
+
+static int write_reset_latency_query(
+	struct blob_attr *const *const args,
+	void *query, struct blob_buf *bbuf, void **ctx)
+{
+	struct ctrl_cmd_get_latency_hist *get = query;
+
+	write_latency_query(args, query, bbuf, ctx);
+	get->reset = 1;
+	return 0;
+}
+
+static int read_latency_response(
+	const void *response, struct blob_buf *bbuf, void *ctx)
+{
+	const struct ctrl_latency_hist *hist = response;
+	void *cookie;
+	int i;
+
+	blobmsg_add_u32(bbuf, "shift", CTRL_LATENCY_HIST_SHIFT);
+	cookie = blobmsg_open_array(bbuf, "count");
+	if (cookie == NULL)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	for (i = 0; i < CTRL_LATENCY_HIST_BUCKETS; i++)
+		blobmsg_add_u32(bbuf, NULL, le16toh(hist->count[i]));
+	blobmsg_close_array(bbuf, cookie);
+
+	return 0;
+}
+
+#define RAW_FRAMES		0
+
+static const struct blobmsg_policy raw_args[] = {
+	[RAW_FRAMES] = {
+		.name = "frames",
+		.type = BLOBMSG_TYPE_ARRAY,
+	},
+};
+
+#define RAW_FRAME_TYPE		0
+#define RAW_FRAME_PAYLOAD	1
+
+static const struct blobmsg_policy raw_frame_args[] = {
+	[RAW_FRAME_TYPE] = {
+		.name = "type",
+		.type = BLOBMSG_TYPE_INT32,
+	},
+	[RAW_FRAME_PAYLOAD] = {
+		.name = "payload",
+		.type = BLOBMSG_TYPE_STRING,
+	},
+};
+
+static int raw_handler(
+	struct ubus_context *uctx, struct avr_door_ctrl *ctrl,
+	struct ubus_request_data *ureq, struct blob_attr *const *const args)
+{
+	uint8_t payload[B64_DECODE_LEN(B64_ENCODE_LEN(
+				AVR_DOOR_CTRL_MSG_MAX_PAYLOAD_SIZE))];
+	struct blob_attr *tb[ARRAY_SIZE(raw_frame_args)];
+	struct blob_attr *frames = args[RAW_FRAMES];
+	struct request_batch *batch;
+	struct blob_attr *cur;
+	int rem, count, i = 0;
+	uint32_t type;
+	int length;
+
+	count = blobmsg_check_array(frames, BLOBMSG_TYPE_TABLE);
+	if (count < 0 || count > AVR_DOOR_CTRL_MAX_BATCH_SIZE)
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	if (count == 0)
+		return request_batch_reply_empty(uctx, ureq, raw_add_results);
+
+	batch = request_batch_alloc(count);
+	if (!batch)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	/* Check all the frames before queuing anything */
+	blobmsg_for_each_attr(cur, frames, rem) {
+		blobmsg_parse(raw_frame_args, ARRAY_SIZE(raw_frame_args), tb,
+			      blobmsg_data(cur), blobmsg_data_len(cur));
+		if (!tb[RAW_FRAME_TYPE])
+			goto invalid;
+
+		/* Only commands can be sent */
+		type = blobmsg_get_u32(tb[RAW_FRAME_TYPE]);
+		if (type == CTRL_CMD_OK || type >= CTRL_EVENT_BASE)
+			goto invalid;
+
+		length = 0;
+		if (tb[RAW_FRAME_PAYLOAD]) {
+			/* Check the length first to not overflow the buffer */
+			if (strlen(blobmsg_get_string(tb[RAW_FRAME_PAYLOAD])) >
+			    B64_ENCODE_LEN(AVR_DOOR_CTRL_MSG_MAX_PAYLOAD_SIZE))
+				goto invalid;
+			length = b64_decode(
+				blobmsg_get_string(tb[RAW_FRAME_PAYLOAD]),
+				payload, sizeof(payload));
+			if (length < 0 ||
+			    length > AVR_DOOR_CTRL_MSG_MAX_PAYLOAD_SIZE)
+				goto invalid;
+		}
+
+		request_batch_init_entry(batch, ctrl, i, type, length);
+		memcpy(batch->reqs[i++].req.msg.payload, payload, length);
+	}
+
+	batch->complete = raw_complete;
+	batch->add_results = raw_add_results;
+	request_batch_send(batch, count, uctx, ureq);
+
+	return 0;
+
+invalid:
+	free(batch);
+	return UBUS_STATUS_INVALID_ARGUMENT;
+}
+
+#define AVR_DOOR_CTRL_METHOD_CACHED(method, opt_args, cmd_id,		\
+				    wr_query, qr_size, wr_cont_query,	\
+				    rd_resp, resp_size,			\
+				    rd_cache, upd_cache)		\
 	{								\
 		.name = #method,					\
 		.args = method ## _args,				\
@@ -502,6 +1400,24 @@ static int read_get_used_access_response(
 		.read_response = rd_resp,				\
 		.response_size = resp_size,				\
 		.write_continue_query = wr_cont_query,			\
+		.read_cache = rd_cache,					\
+		.update_cache = upd_cache,				\
+	}
+
+#define AVR_DOOR_CTRL_METHOD_FULL(method, opt_args, cmd_id,		\
+				  wr_query, qr_size, wr_cont_query,     \
+				  rd_resp, resp_size)			\
+	AVR_DOOR_CTRL_METHOD_CACHED(method, opt_args, cmd_id,		\
+				    wr_query, qr_size, wr_cont_query,	\
+				    rd_resp, resp_size, NULL, NULL)
+
+#define AVR_DOOR_CTRL_METHOD_LOCAL(method, opt_args, hdl)		\
+	{								\
+		.name = #method,					\
+		.args = method ## _args,				\
+		.num_args = ARRAY_SIZE(method ## _args),		\
+		.optional_args = opt_args,				\
+		.handler = hdl,						\
 	}
 
 #define AVR_DOOR_CTRL_METHOD(method, opt_args, cmd_id,			\
@@ -533,17 +1449,19 @@ const struct avr_door_ctrl_method avr_door_ctrl_methods[] = {
 		sizeof(struct ctrl_cmd_set_door_config),
 		NULL, 0),
 
-	AVR_DOOR_CTRL_METHOD(
+	AVR_DOOR_CTRL_METHOD_CACHED(
 		get_access_record,
 		BIT(GET_ACCESS_RECORD_PIN) |
 		BIT(GET_ACCESS_RECORD_CARD),
 		CTRL_CMD_GET_ACCESS_RECORD,
 		write_get_access_record_query,
 		sizeof(struct ctrl_cmd_get_access_record),
+		NULL,
 		read_get_access_record_response,
-		sizeof(struct access_record)),
+		sizeof(struct access_record),
+		read_get_access_record_cache, NULL),
 
-	AVR_DOOR_CTRL_METHOD(
+	AVR_DOOR_CTRL_METHOD_CACHED(
 		set_access_record,
 		BIT(SET_ACCESS_RECORD_PIN) |
 		BIT(SET_ACCESS_RECORD_CARD) |
@@ -553,9 +1471,10 @@ const struct avr_door_ctrl_method avr_door_ctrl_methods[] = {
 		CTRL_CMD_SET_ACCESS_RECORD,
 		write_set_access_record_query,
 		sizeof(struct ctrl_cmd_set_access_record),
-		NULL, 0),
+		NULL, NULL, 0,
+		NULL, update_set_access_record_cache),
 
-	AVR_DOOR_CTRL_METHOD(
+	AVR_DOOR_CTRL_METHOD_CACHED(
 		set_access,
 		BIT(SET_ACCESS_PIN) |
 		BIT(SET_ACCESS_CARD) |
@@ -563,14 +1482,28 @@ const struct avr_door_ctrl_method avr_door_ctrl_methods[] = {
 		CTRL_CMD_SET_ACCESS,
 		write_set_access_query,
 		sizeof(struct access_record),
-		NULL, 0),
+		NULL, NULL, 0,
+		NULL, update_set_access_cache),
+
+	AVR_DOOR_CTRL_METHOD_CACHED(
+		get_access,
+		BIT(GET_ACCESS_PIN) |
+		BIT(GET_ACCESS_CARD),
+		CTRL_CMD_GET_ACCESS,
+		write_get_access_query,
+		sizeof(struct access_record),
+		NULL,
+		read_get_access_response,
+		sizeof(uint8_t),
+		read_get_access_cache, NULL),
 
-	AVR_DOOR_CTRL_METHOD(
+	AVR_DOOR_CTRL_METHOD_CACHED(
 		remove_all_access, 0,
 		CTRL_CMD_REMOVE_ALL_ACCESS,
-		NULL, 0, NULL, 0),
+		NULL, 0, NULL, NULL, 0,
+		NULL, update_remove_all_access_cache),
 
-	AVR_DOOR_CTRL_METHOD_FULL(
+	AVR_DOOR_CTRL_METHOD_CACHED(
 		get_used_access,
 		BIT(GET_USED_ACCESS_CLEAR),
 		CTRL_CMD_GET_USED_ACCESS,
@@ -578,7 +1511,100 @@ const struct avr_door_ctrl_method avr_door_ctrl_methods[] = {
 		sizeof(struct ctrl_cmd_get_used_access),
 		write_get_used_access_continue_query,
 		read_get_used_access_response,
-		sizeof(struct ctrl_cmd_resp_used_access)),
+		sizeof(struct ctrl_cmd_resp_used_access),
+		NULL, update_get_used_access_cache),
+
+	AVR_DOOR_CTRL_METHOD(
+		get_group, 0,
+		CTRL_CMD_GET_ACCESS_GROUP,
+		write_get_group_query,
+		sizeof(struct ctrl_cmd_get_access_group),
+		read_get_group_response,
+		sizeof(struct access_group)),
+
+	AVR_DOOR_CTRL_METHOD(
+		set_group, 0,
+		CTRL_CMD_SET_ACCESS_GROUP,
+		write_set_group_query,
+		sizeof(struct ctrl_cmd_set_access_group),
+		NULL, 0),
+
+	AVR_DOOR_CTRL_METHOD(
+		get_schedule, 0,
+		CTRL_CMD_GET_ACCESS_SCHEDULE,
+		write_get_schedule_query,
+		sizeof(struct ctrl_cmd_get_access_schedule),
+		read_get_schedule_response,
+		sizeof(struct access_schedule)),
+
+	AVR_DOOR_CTRL_METHOD(
+		set_schedule,
+		BIT(SET_SCHEDULE_SINCE) |
+		BIT(SET_SCHEDULE_UNTIL) |
+		BIT(SET_SCHEDULE_UTC_OFFSET) |
+		BIT(SET_SCHEDULE_WEEKDAYS) |
+		BIT(SET_SCHEDULE_HOURS),
+		CTRL_CMD_SET_ACCESS_SCHEDULE,
+		write_set_schedule_query,
+		sizeof(struct ctrl_cmd_set_access_schedule),
+		NULL, 0),
+
+	AVR_DOOR_CTRL_METHOD_FULL(
+		dump_access_records, 0,
+		CTRL_CMD_GET_ACCESS_RECORDS_V2,
+		write_dump_access_records_query,
+		sizeof(struct ctrl_cmd_get_access_records),
+		write_dump_access_records_continue_query,
+		read_dump_access_records_response,
+		offsetof(struct ctrl_cmd_resp_access_records, record)),
+
+	AVR_DOOR_CTRL_METHOD_LOCAL(
+		apply_acl, 0,
+		apply_acl_handler),
+
+	AVR_DOOR_CTRL_METHOD_LOCAL(
+		set_access_batch, 0,
+		set_access_batch_handler),
+
+	AVR_DOOR_CTRL_METHOD_LOCAL(
+		raw, 0,
+		raw_handler),
+
+	AVR_DOOR_CTRL_METHOD(
+		stats, 0,
+		CTRL_CMD_GET_STATS,
+		NULL, 0,
+		read_stats_response,
+		offsetof(struct ctrl_stats, reject_cache_hits)),
+
+	AVR_DOOR_CTRL_METHOD(
+		memory_info, 0,
+		CTRL_CMD_GET_MEMORY_INFO,
+		NULL, 0,
+		read_memory_info_response,
+		sizeof(struct ctrl_memory_info)),
+
+	AVR_DOOR_CTRL_METHOD(
+		latency, 0,
+		CTRL_CMD_GET_LATENCY_HIST,
+		write_latency_query,
+		sizeof(struct ctrl_cmd_get_latency_hist),
+		read_latency_response,
+		sizeof(struct ctrl_latency_hist)),
+
+	AVR_DOOR_CTRL_METHOD(
+		reset_latency, 0,
+		CTRL_CMD_GET_LATENCY_HIST,
+		write_reset_latency_query,
+		sizeof(struct ctrl_cmd_get_latency_hist),
+		read_latency_response,
+		sizeof(struct ctrl_latency_hist)),
+
+	AVR_DOOR_CTRL_METHOD(
+		reset_stats, 0,
+		CTRL_CMD_RESET_STATS,
+		NULL, 0,
+		NULL, 0),
 };
 
 static const struct avr_door_ctrl_method *
@@ -599,6 +1625,53 @@ avr_door_ctrl_umethods[ARRAY_SIZE(avr_door_ctrl_methods)] = {};
 static struct ubus_object_type avr_door_ctrl_utype =
 	UBUS_OBJECT_TYPE("door_ctrl", avr_door_ctrl_umethods);
 
+int avr_door_ctrl_alloc_request_pool(struct avr_door_ctrl *ctrl)
+{
+	struct avr_door_ctrl_method_request *reqs;
+	unsigned int i;
+
+	/* One more than the queue depth for the request being processed */
+	reqs = calloc(ctrl->max_pending + 1, sizeof(*reqs));
+	if (!reqs)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&ctrl->free_reqs);
+	for (i = 0; i < ctrl->max_pending + 1; i++)
+		list_add_tail(&reqs[i].req.list, &ctrl->free_reqs);
+	ctrl->req_pool = reqs;
+
+	return 0;
+}
+
+void avr_door_ctrl_free_request_pool(struct avr_door_ctrl *ctrl)
+{
+	free(ctrl->req_pool);
+	ctrl->req_pool = NULL;
+	INIT_LIST_HEAD(&ctrl->free_reqs);
+}
+
+static struct avr_door_ctrl_method_request *
+avr_door_ctrl_method_request_alloc(struct avr_door_ctrl *ctrl)
+{
+	struct avr_door_ctrl_method_request *req;
+
+	if (list_empty(&ctrl->free_reqs))
+		return NULL;
+
+	req = list_first_entry(&ctrl->free_reqs,
+			       struct avr_door_ctrl_method_request, req.list);
+	list_del_init(&req->req.list);
+	memset(req, 0, sizeof(*req));
+
+	return req;
+}
+
+static void avr_door_ctrl_method_request_free(
+	struct avr_door_ctrl_method_request *req)
+{
+	list_add(&req->req.list, &req->req.ctrl->free_reqs);
+}
+
 static int avr_door_ctrl_method_continue(
 	struct avr_door_ctrl_method_request *req,
 	const struct avr_door_ctrl_msg *resp) {
@@ -615,7 +1688,7 @@ static int avr_door_ctrl_method_continue(
 		return err;
 
 	/* Send the updated request */
-	avr_door_ctrl_start_sending(req->req.ctrl);
+	avr_door_ctrl_request_continue(&req->req);
 
 	/* Indicate that the request is still in progress */
 	return -EINPROGRESS;
@@ -654,6 +1727,16 @@ static void avr_door_ctrl_method_complete(
 			     struct avr_door_ctrl_method_request, req);
 	int status;
 
+	/* Keep the ACL cache in sync, if a write timed out we
+	 * don't know if it went through or not. */
+	if (req->method->update_cache) {
+		if (err == 0)
+			req->method->update_cache(request->ctrl,
+						  request->msg.payload);
+		else if (err == -ETIMEDOUT)
+			avr_door_ctrl_acl_invalidate(request->ctrl);
+	}
+
 	if (err == 0)
 		status = UBUS_STATUS_OK;
 	else if (err == -ETIMEDOUT)
@@ -671,7 +1754,7 @@ static void avr_door_ctrl_method_destroy(struct avr_door_ctrl_request *request)
 			     struct avr_door_ctrl_method_request, req);
 
 	blob_buf_free(&req->bbuf);
-	free(request);
+	avr_door_ctrl_method_request_free(req);
 }
 
 static const
@@ -691,6 +1774,7 @@ static int avr_door_ctrl_method_handler(
 		avr_door_ctrl_get_method(method_name);
 	struct avr_door_ctrl *ctrl = container_of(
 		uobj, struct avr_door_ctrl, uobject);
+	uint8_t response[AVR_DOOR_CTRL_MSG_MAX_PAYLOAD_SIZE];
 	struct avr_door_ctrl_method_request *req;
 	int i, err;
 
@@ -714,14 +1798,27 @@ static int avr_door_ctrl_method_handler(
 				return UBUS_STATUS_INVALID_ARGUMENT;
 	}
 
-	req = calloc(1, sizeof(*req));
+	/* The custom handlers queue the batched requests one by one, so
+	 * each call only takes one place in the bulk queue. */
+	if (method->handler) {
+		if (!avr_door_ctrl_can_queue(ctrl, AVR_DOOR_CTRL_PRIO_BULK))
+			return UBUS_STATUS_NO_DATA;
+		return method->handler(uctx, ctrl, ureq, args);
+	}
+
+	/* All the requests are in use, the queue is full */
+	req = avr_door_ctrl_method_request_alloc(ctrl);
 	if (!req)
-		return UBUS_STATUS_UNKNOWN_ERROR;
+		return UBUS_STATUS_NO_DATA;
 
 	avr_door_ctrl_request_init(
 		&req->req, ctrl, &avr_door_ctrl_method_handlers,
 		method->cmd, method->query_size);
 
+	/* Multi-part requests must not delay the interactive ones */
+	if (method->write_continue_query)
+		req->req.priority = AVR_DOOR_CTRL_PRIO_BULK;
+
 	/* Setup the request */
 	req->uctx = uctx;
 	req->method = method;
@@ -730,17 +1827,50 @@ static int avr_door_ctrl_method_handler(
 	if (method->write_query) {
 		err = method->write_query(args, req->req.msg.payload,
 					  &req->bbuf, &req->query_ctx);
-		if (err) {
-			free(req);
-			return err;
+		if (err)
+			goto free_request;
+	}
+
+	/* Answer directly if the response is available in the cache */
+	if (method->read_cache &&
+	    !method->read_cache(ctrl, req->req.msg.payload, response)) {
+		err = 0;
+		if (method->read_response)
+			err = method->read_response(
+				response, &req->bbuf, req->query_ctx);
+		if (!err)
+			err = ubus_send_reply(uctx, ureq, req->bbuf.head);
+		if (err)
+			err = UBUS_STATUS_UNKNOWN_ERROR;
+		goto free_request;
+	}
+
+	/* Store the writes in the journal while the controller is offline */
+	if (avr_door_ctrl_journal_active(ctrl)) {
+		err = avr_door_ctrl_journal_write(ctrl, &req->req.msg);
+		if (err != -EOPNOTSUPP) {
+			if (err)
+				err = UBUS_STATUS_UNKNOWN_ERROR;
+			goto free_request;
 		}
 	}
 
+	/* Keep the latency bounded when the controller is overloaded */
+	if (!avr_door_ctrl_can_queue(ctrl, req->req.priority)) {
+		err = UBUS_STATUS_NO_DATA;
+		goto free_request;
+	}
+
 	ubus_defer_request(uctx, ureq, &req->uresp);
 
 	avr_door_ctrl_request_send(&req->req);
 
 	return 0;
+
+free_request:
+	blob_buf_free(&req->bbuf);
+	avr_door_ctrl_method_request_free(req);
+	return err;
 }
 
 void avr_door_ctrld_init_door_uobject(
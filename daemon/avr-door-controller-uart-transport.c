@@ -183,6 +183,11 @@ static int uart_ctrl_transport_recv_byte(
 			return -ENODATA;
 
 		uart->recv_state = AVR_DOOR_CTRL_SYNC;
+		if (msg->length > sizeof(msg->payload)) {
+			ULOG_WARN("Received too long message: %u bytes\n",
+				  msg->length);
+			return -EBADMSG;
+		}
 		if (uart->recv_crc != msg_compute_crc(msg)) {
 			ULOG_WARN("Received message with a bad CRC: %x != %x!\n", uart->recv_crc, msg_compute_crc(msg));
 			return -EBADMSG;
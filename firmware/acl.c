@@ -1,14 +1,57 @@
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
+#include <util/atomic.h>
 #include "acl.h"
 #include "eeprom.h"
+#include "timer.h"
 #include "utils.h"
+#include "stats.h"
+
+/* Number of rejected credentials remembered and for how long, in ms */
+#ifndef ACL_REJECT_CACHE_SIZE
+#define ACL_REJECT_CACHE_SIZE		4
+#endif
+#define ACL_REJECT_CACHE_TTL		10000
+
+#if ACL_REJECT_CACHE_SIZE > 8
+#error "The reject cache can have at most 8 entries"
+#endif
+
+struct acl_reject {
+	uint32_t hash;
+	uint16_t expires;
+};
+
+static struct acl_reject reject_cache[ACL_REJECT_CACHE_SIZE];
+/* Bit mask of the valid entries, cleared from the timer interrupt */
+static volatile uint8_t reject_cache_valid;
+static uint8_t reject_cache_next;
+static uint8_t reject_cache_generation;
+/* Keep the time running until the last entry expired */
+static struct timer reject_cache_timer;
 
 struct access_record_match {
 	uint8_t type;
 	uint8_t doors;
+	/* Bit mask of the groups that can open the door */
+	uint8_t groups;
 };
 
+static int8_t acl_check_card_range(uint32_t range, uint32_t card)
+{
+	uint8_t bits = ACCESS_RECORD_CARD_RANGE_BITS(range);
+
+	if (bits > ACCESS_RECORD_CARD_ID_BITS)
+		return 0;
+
+	if (card & ~ACCESS_RECORD_CARD_ID_MASK)
+		return 0;
+
+	/* Only compare the bits above the range */
+	return ((card ^ range) & ACCESS_RECORD_CARD_ID_MASK) >> bits == 0;
+}
+
 static int8_t acl_check_card(struct access_record_v2 *rec, uint32_t card)
 {
 	switch (ACCESS_RECORD_CARD_TYPE(rec)) {
@@ -16,7 +59,9 @@ static int8_t acl_check_card(struct access_record_v2 *rec, uint32_t card)
 		return card == 0;
 
 	case ACCESS_RECORD_TYPE_CARD_ID:
-		return card == rec->card;
+		if (!ACCESS_RECORD_CARD_IS_RANGE(rec->card))
+			return card == rec->card;
+		return acl_check_card_range(rec->card, card);
 
 	default:
 		return 0;
@@ -47,9 +92,15 @@ static int8_t access_record_filter(
 {
 	const struct access_record_match *match = val;
 
-	/* Match on the door */
-	if ((hdr->doors & match->doors) == 0)
+	/* Match on the door, directly or through the group */
+	if (NUM_ACCESS_GROUPS > 0 && ACCESS_RECORD_DOORS_IS_GROUP(hdr->doors)) {
+		uint8_t id = ACCESS_RECORD_DOORS_GROUP_ID(hdr->doors);
+
+		if ((match->groups & BIT(id)) == 0)
+			return 0;
+	} else if ((hdr->doors & match->doors) == 0) {
 		return 0;
+	}
 
 	/* Then on the type of data in the record */
 	switch(match->type) {
@@ -81,6 +132,53 @@ static uint8_t acl_check_access_record(
 	return acl_check_pin(rec, pin);
 }
 
+#define SECONDS_PER_DAY		86400UL
+
+static int8_t acl_group_is_scheduled(uint8_t id, time_t now)
+{
+	struct access_schedule sch;
+	uint32_t t;
+	uint16_t day;
+	uint8_t hour;
+
+	if (id >= NUM_ACCESS_SCHEDULES || eeprom_get_access_schedule(id, &sch))
+		return 1;
+
+	t = now + UNIX_OFFSET + sch.utc_offset * (15 * 60L);
+	day = t / SECONDS_PER_DAY;
+	if (day < sch.since || day > sch.until)
+		return 0;
+
+	/* 1970-01-01 was a Thursday */
+	if (!(sch.weekdays & BIT((day + 3) % 7)))
+		return 0;
+
+	hour = (t % SECONDS_PER_DAY) / 3600;
+	return (sch.hours[hour / 8] & BIT(hour % 8)) != 0;
+}
+
+/* Resolve the groups and their schedules once instead of for each
+ * record. The groups left out by their schedule are returned in
+ * unscheduled. */
+static uint8_t acl_get_door_groups(uint8_t doors, uint8_t *unscheduled)
+{
+	struct access_group grp;
+	uint8_t id, groups = 0;
+	time_t now = time(NULL);
+
+	*unscheduled = 0;
+	for (id = 0; id < NUM_ACCESS_GROUPS; id++) {
+		if (eeprom_get_access_group(id, &grp) || !(grp.doors & doors))
+			continue;
+		if (acl_group_is_scheduled(id, now))
+			groups |= BIT(id);
+		else
+			*unscheduled |= BIT(id);
+	}
+
+	return groups;
+}
+
 static int8_t acl_used(uint16_t idx, struct access_record_v2 *rec)
 {
 	/* For HOTP pin we need to update the counter value */
@@ -97,28 +195,118 @@ static int8_t acl_used(uint16_t idx, struct access_record_v2 *rec)
 	return 0;
 }
 
+static uint32_t acl_reject_hash_update(uint32_t hash, uint32_t val)
+{
+	uint8_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < 4; i++, val >>= 8) {
+		hash ^= val & 0xFF;
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+static uint32_t acl_reject_hash(uint8_t type, uint8_t door_id,
+				uint32_t card, uint32_t pin)
+{
+	uint32_t hash = 2166136261UL;
+
+	hash = acl_reject_hash_update(hash, ((uint16_t)type << 8) | door_id);
+	hash = acl_reject_hash_update(hash, card);
+	return acl_reject_hash_update(hash, pin);
+}
+
+static int8_t acl_reject_cache_lookup(uint32_t hash)
+{
+	uint16_t now = timer_get_time();
+	uint8_t i, valid;
+
+	/* Forget everything when the ACL changed */
+	if (reject_cache_generation != eeprom_get_acl_generation()) {
+		reject_cache_generation = eeprom_get_acl_generation();
+		reject_cache_valid = 0;
+		return 0;
+	}
+
+	valid = reject_cache_valid;
+	for (i = 0; i < ACL_REJECT_CACHE_SIZE; i++)
+		if ((valid & BIT(i)) && reject_cache[i].hash == hash &&
+		    time_before(now, reject_cache[i].expires))
+			return 1;
+
+	return 0;
+}
+
+static void acl_reject_cache_add(uint32_t hash)
+{
+	uint16_t expires = timer_get_time() + ACL_REJECT_CACHE_TTL;
+	uint8_t i = reject_cache_next;
+
+	reject_cache_next = (i + 1) % ACL_REJECT_CACHE_SIZE;
+	reject_cache[i].hash = hash;
+	reject_cache[i].expires = expires;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		reject_cache_valid |= BIT(i);
+	}
+	timer_schedule(&reject_cache_timer, expires);
+}
+
+static void on_reject_cache_timeout(void *context)
+{
+	/* All the entries have expired */
+	reject_cache_valid = 0;
+}
+
+void acl_on_time_changed(void)
+{
+	/* The schedules might give access now */
+	reject_cache_valid = 0;
+}
+
 int8_t acl_check_access(uint8_t type, uint32_t card, uint32_t pin,
-			uint8_t door_id)
+			uint8_t door_id, uint16_t *index)
 {
 	struct access_record_match match = {
 		.type = type,
 		.doors = BIT(door_id),
 	};
 	struct access_record_v2 rec;
+	uint8_t unscheduled;
+	uint32_t hash;
 	uint16_t idx;
 
+	stats.access_checks++;
+
+	/* Repeated bad credentials don't need another full scan */
+	hash = acl_reject_hash(type, door_id, card, pin);
+	if (acl_reject_cache_lookup(hash)) {
+		stats.reject_cache_hits++;
+		return -EPERM;
+	}
+
+	match.groups = acl_get_door_groups(match.doors, &unscheduled);
+
 	eeprom_for_each_access_record_where(
 		idx, &rec, access_record_filter, &match) {
 		if (acl_check_access_record(&rec, card, pin)) {
 			acl_used(idx, &rec);
+			if (index)
+				*index = idx;
 			return 0;
 		}
 	}
 
+	/* The schedules can give access at any time, don't remember the
+	 * rejections that might come from one. */
+	if (!unscheduled)
+		acl_reject_cache_add(hash);
 	return -EPERM;
 }
 
 int8_t acl_init(void)
 {
+	timer_init(&reject_cache_timer, on_reject_cache_timeout, NULL);
 	return acl_load_otp_root_key();
 }
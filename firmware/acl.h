@@ -27,15 +27,20 @@ struct access_record_v2;
 
 int8_t acl_init(void);
 
-int8_t acl_check_access(
-	uint8_t type, uint32_t card, uint32_t pin, uint8_t door_id);
+/* On success the index of the matching record is returned in index */
+int8_t acl_check_access(uint8_t type, uint32_t card, uint32_t pin,
+			uint8_t door_id, uint16_t *index);
+
+/* Must be called when the clock has been set */
+void acl_on_time_changed(void);
 
 #if WITH_OTP
 int8_t acl_load_otp_root_key(void);
 
 int8_t acl_check_otp_pin(struct access_record_v2 *rec, uint32_t pin);
 
-int8_t acl_get_otp_key(const struct access_record_v2 *rec,
+int8_t acl_get_otp_key(struct sha1_context *ctx,
+		       const struct access_record_v2 *rec,
 		       uint8_t *key, uint8_t key_size);
 
 #else
@@ -46,7 +51,8 @@ static inline int8_t acl_check_otp_pin(struct access_record_v2 *rec, uint32_t pi
 { return 0; }
 
 
-static inline int8_t acl_get_otp_key(const struct access_record_v2 *rec,
+static inline int8_t acl_get_otp_key(struct sha1_context *ctx,
+				     const struct access_record_v2 *rec,
 				     uint8_t *key, uint8_t key_size)
 { return -EINVAL; }
 
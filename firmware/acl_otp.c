@@ -5,15 +5,17 @@
 #include "sha1.h"
 #include "acl.h"
 #include "eeprom.h"
+#include "stats.h"
+#include "scratch.h"
 
 static uint8_t root_key[CONTROLLER_KEY_SIZE];
 
-int8_t acl_get_otp_key(const struct access_record_v2 *rec,
+int8_t acl_get_otp_key(struct sha1_context *ctx,
+		       const struct access_record_v2 *rec,
 		       uint8_t *key, uint8_t key_size)
 {
 	const struct access_record_otp *otp = &rec->pin.otp;
 	uint8_t info[2 + sizeof(rec->card) + 1];
-	struct sha1_context ctx = {};
 	uint8_t info_size = 0;
 
 	if (ACCESS_RECORD_PIN_TYPE(rec) != ACCESS_RECORD_TYPE_PIN_HOTP &&
@@ -32,10 +34,10 @@ int8_t acl_get_otp_key(const struct access_record_v2 *rec,
 	}
 	info[info_size++] = 1;
 
-	sha1_hmac_init(&ctx, root_key, sizeof(root_key));
-	sha1_input(&ctx, info, info_size);
-	sha1_hmac_finish(&ctx, root_key, sizeof(root_key));
-	return sha1_digest(&ctx, key, key_size);
+	sha1_hmac_init(ctx, root_key, sizeof(root_key));
+	sha1_input(ctx, info, info_size);
+	sha1_hmac_finish(ctx, root_key, sizeof(root_key));
+	return sha1_digest(ctx, key, key_size);
 }
 
 static uint32_t int_to_pin(uint32_t v, uint8_t digits)
@@ -51,21 +53,23 @@ static uint32_t int_to_pin(uint32_t v, uint8_t digits)
 	return pin;
 }
 
-static uint32_t acl_get_otp_pin(const uint8_t *key, uint16_t key_len,
-				uint32_t c, uint8_t digits)
+static uint32_t acl_get_otp_pin(union scratch *s, uint32_t c, uint8_t digits)
 {
-	return int_to_pin(hotp_sha1(key, key_len, c, digits), digits);
+	stats.otp_computations++;
+	return int_to_pin(hotp_sha1(&s->otp.sha1, s->otp.key,
+				    sizeof(s->otp.key), c, digits), digits);
 }
 
-int8_t acl_check_otp_pin(struct access_record_v2 *rec, uint32_t pin)
+static int8_t acl_find_otp_pin(union scratch *s, struct access_record_v2 *rec,
+			       uint32_t pin)
 {
 	uint8_t prev, follow, digits;
-	uint8_t key[OTP_KEY_SIZE];
 	uint32_t c, otp_pin;
 	int8_t err;
 	int8_t i;
 
-	err = acl_get_otp_key(rec, key, sizeof(key));
+	err = acl_get_otp_key(&s->otp.sha1, rec,
+			      s->otp.key, sizeof(s->otp.key));
 	if (err < 0)
 		return 0;
 
@@ -98,12 +102,12 @@ int8_t acl_check_otp_pin(struct access_record_v2 *rec, uint32_t pin)
 		return 0;
 	}
 
-	otp_pin = acl_get_otp_pin(key, sizeof(key), c, digits);
+	otp_pin = acl_get_otp_pin(s, c, digits);
 	if (pin == otp_pin)
 		goto pin_found;
 
 	for (i = 1; i < follow + 1; i++) {
-		otp_pin = acl_get_otp_pin(key, sizeof(key), c + i, digits);
+		otp_pin = acl_get_otp_pin(s, c + i, digits);
 		if (pin == otp_pin) {
 			c = c + i;
 			goto pin_found;
@@ -111,7 +115,7 @@ int8_t acl_check_otp_pin(struct access_record_v2 *rec, uint32_t pin)
 	}
 
 	for (i = 1; i < prev + 1; i++) {
-		otp_pin = acl_get_otp_pin(key, sizeof(key), c - i, digits);
+		otp_pin = acl_get_otp_pin(s, c - i, digits);
 		if (pin == otp_pin) {
 			c = c - i;
 			goto pin_found;
@@ -128,6 +132,16 @@ pin_found:
 	return 1;
 }
 
+int8_t acl_check_otp_pin(struct access_record_v2 *rec, uint32_t pin)
+{
+	int8_t found;
+
+	/* The SHA1 context and the key are too large for the stack */
+	found = acl_find_otp_pin(scratch_get(), rec, pin);
+	scratch_put();
+	return found;
+}
+
 int8_t acl_load_otp_root_key(void)
 {
 	struct controller_config cfg;
@@ -0,0 +1,162 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "audit-log.h"
+#include "work-queue.h"
+#include "utils.h"
+
+#if AUDIT_LOG_SIZE & (AUDIT_LOG_SIZE - 1)
+#error "AUDIT_LOG_SIZE must be a power of 2"
+#endif
+
+#if AUDIT_LOG_SIZE > 128
+#error "AUDIT_LOG_SIZE is too large"
+#endif
+
+#define AUDIT_LOG_SLOT(seq)	((seq) & (AUDIT_LOG_SIZE - 1))
+
+/* Number of entries that can wait to be written to the EEPROM */
+#define AUDIT_LOG_PENDING_SIZE	4
+
+struct audit_log {
+	/* Sequence number of the next entry */
+	uint16_t next_seq;
+	/* Number of valid entries in the EEPROM */
+	uint8_t count;
+
+	struct audit_log_entry pending[AUDIT_LOG_PENDING_SIZE];
+	uint8_t pending_count;
+
+	struct worker writer;
+};
+
+static struct audit_log audit_log;
+
+static int8_t audit_log_read(uint16_t seq,
+			     struct audit_log_eeprom_entry *e)
+{
+	int8_t err;
+
+	err = eeprom_read_audit_log_entry(AUDIT_LOG_SLOT(seq), e);
+	if (err)
+		return err;
+
+	/* Ignore erased entries and entries at the wrong place */
+	if (e->entry.event == AUDIT_LOG_EVENT_NONE ||
+	    e->entry.event == AUDIT_LOG_EVENT_EMPTY ||
+	    AUDIT_LOG_SLOT(e->seq) != AUDIT_LOG_SLOT(seq))
+		return -ENOENT;
+
+	return 0;
+}
+
+static void audit_log_write_pending(
+	struct worker *worker, uint8_t cmd, union work_arg arg)
+{
+	struct audit_log_eeprom_entry e;
+	uint8_t i;
+
+	for (i = 0; i < audit_log.pending_count; i++) {
+		e.seq = audit_log.next_seq;
+		e.entry = audit_log.pending[i];
+		if (eeprom_write_audit_log_entry(AUDIT_LOG_SLOT(e.seq), &e))
+			break;
+		audit_log.next_seq++;
+		if (audit_log.count < AUDIT_LOG_SIZE)
+			audit_log.count++;
+	}
+
+	/* Keep the entries that couldn't be written and retry them later,
+	 * they are only lost if the work queue is full, which is counted
+	 * in the work queue overflows. */
+	audit_log.pending_count -= i;
+	if (audit_log.pending_count) {
+		memmove(audit_log.pending, &audit_log.pending[i],
+			audit_log.pending_count * sizeof(audit_log.pending[0]));
+		if (work_queue_schedule(&audit_log.writer, 0, WORK_ARG(NULL)))
+			audit_log.pending_count = 0;
+	}
+}
+
+int8_t audit_log_add(uint8_t event, uint8_t door, uint16_t index)
+{
+	struct audit_log_entry *entry;
+
+	/* The old EEPROM layout has no room for the log */
+	if (eeprom_has_legacy_layout())
+		return -EBUSY;
+
+	if (audit_log.pending_count >= ARRAY_SIZE(audit_log.pending))
+		return -ENOMEM;
+
+	entry = &audit_log.pending[audit_log.pending_count];
+	entry->time = time(NULL) + UNIX_OFFSET;
+	entry->index = index;
+	entry->door = door;
+	entry->event = event;
+
+	/* Schedule the write with the first pending entry */
+	if (audit_log.pending_count == 0 &&
+	    work_queue_schedule(&audit_log.writer, 0, WORK_ARG(NULL)))
+		return -ENOMEM;
+
+	audit_log.pending_count++;
+	return 0;
+}
+
+uint8_t audit_log_get(uint16_t seq, uint16_t *first,
+		      struct audit_log_entry *entries, uint8_t max)
+{
+	struct audit_log_eeprom_entry e;
+	uint16_t start = seq + 1;
+	uint16_t avail = audit_log.next_seq - start;
+	uint8_t n;
+
+	/* Restart from the oldest entry if seq is not in the log */
+	if (avail > audit_log.count) {
+		start = audit_log.next_seq - audit_log.count;
+		avail = audit_log.count;
+	}
+
+	*first = start;
+	for (n = 0; n < max && n < avail; n++) {
+		if (audit_log_read(start + n, &e) || e.seq != start + n)
+			break;
+		entries[n] = e.entry;
+	}
+
+	return n;
+}
+
+int8_t audit_log_init(void)
+{
+	struct audit_log_eeprom_entry e;
+	uint8_t i, found = 0;
+	uint16_t last = 0;
+
+	audit_log.writer.execute = audit_log_write_pending;
+
+	/* Find the newest entry */
+	for (i = 0; i < AUDIT_LOG_SIZE; i++) {
+		if (audit_log_read(i, &e))
+			continue;
+		if (!found || (int16_t)(e.seq - last) > 0)
+			last = e.seq;
+		found = 1;
+	}
+
+	if (!found)
+		return 0;
+
+	/* Count the consecutive entries that lead to it */
+	audit_log.next_seq = last + 1;
+	while (audit_log.count < AUDIT_LOG_SIZE) {
+		uint16_t seq = last - audit_log.count;
+
+		if (audit_log_read(seq, &e) || e.seq != seq)
+			break;
+		audit_log.count++;
+	}
+
+	return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef AUDIT_LOG_H
+#define AUDIT_LOG_H
+
+#include <stdint.h>
+#include <errno.h>
+#include "eeprom.h"
+
+/*
+ * The audit log keep the last AUDIT_LOG_SIZE events in a ring buffer
+ * in the EEPROM. Each entry get a sequence number that allows the host
+ * to only fetch the entries it hasn't seen yet. The sequence number
+ * wraps around after 0xFFFF.
+ *
+ * The EEPROM writes are slow, so the entries are first queued in RAM
+ * and written from the work queue.
+ */
+
+#if AUDIT_LOG_SIZE
+int8_t audit_log_init(void);
+
+/* Add an entry to the log */
+int8_t audit_log_add(uint8_t event, uint8_t door, uint16_t index);
+
+/* Copy up to max entries that follow the sequence number seq.
+ * Return the number of entries and the sequence number of the first
+ * entry in first. If seq is not in the log anymore start with the
+ * oldest entry. */
+uint8_t audit_log_get(uint16_t seq, uint16_t *first,
+		      struct audit_log_entry *entries, uint8_t max);
+
+#else
+static inline int8_t audit_log_init(void)
+{ return 0; }
+
+static inline int8_t audit_log_add(uint8_t event, uint8_t door, uint16_t index)
+{ return 0; }
+
+static inline uint8_t audit_log_get(uint16_t seq, uint16_t *first,
+				    struct audit_log_entry *entries,
+				    uint8_t max)
+{ *first = seq + 1; return 0; }
+
+#endif
+
+#endif /* AUDIT_LOG_H */
@@ -0,0 +1,540 @@
+/*
+ * Cycle accurate benchmark of the firmware running in simavr.
+ *
+ * For each scenario the firmware is started with an EEPROM image holding
+ * the access records, then a credential is presented on the first door by
+ * driving the Wiegand D0/D1 lines. The cycles spent in the functions of
+ * interest are measured with probes, see sim.h.
+ *
+ * The results are written to stdout, one JSON object per line.
+ *
+ * This file is built for the host with the board and MCU headers of the
+ * firmware, so the EEPROM layout is the one of the tested firmware.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "../eeprom.h"
+#include "../acl.h"
+#include "../hotp.h"
+#include "../sha1.h"
+#include "../wiegand-reader.h"
+#include "sim.h"
+
+#define STR_(x)				#x
+#define STR(x)				STR_(x)
+
+/* Time to let the firmware initialize */
+#define BENCH_BOOT_MS			500
+/* Wiegand timings */
+#define WIEGAND_PULSE_US		50
+#define WIEGAND_INTERVAL_US		1000
+/* Wait between two keys, must be longer than the word timeout */
+#define WIEGAND_KEY_GAP_MS		30
+/* How long to wait for the relay after the last bit */
+#define BENCH_RELAY_TIMEOUT_MS		2000
+
+#define BENCH_PIN			0xFFFF4321
+#define BENCH_CARD			0x123456
+#define BENCH_OTP_DIGITS		6
+/* Present the last PIN that the resync allow */
+#define BENCH_HOTP_RESYNC		15
+/* Present the oldest PIN that the window allow */
+#define BENCH_TOTP_PREVIOUS		3
+#define BENCH_TOTP_INTERVAL		1
+
+/* Without RTC the system time stay at its reset value */
+#define BENCH_TIME			0
+/* Offset of the avr-libc time from the Unix epoch */
+#define UNIX_OFFSET			946684800
+
+static const uint8_t root_key[CONTROLLER_KEY_SIZE] = {
+	0x42, 0x65, 0x6e, 0x63, 0x68, 0x6d, 0x61, 0x72, 0x6b, 0x20,
+	0x72, 0x6f, 0x6f, 0x74, 0x20, 0x6b, 0x65, 0x79, 0x21, 0x00,
+};
+
+
+struct bench_stats {
+	unsigned int count;
+	avr_cycle_count_t total;
+	avr_cycle_count_t min;
+	avr_cycle_count_t max;
+};
+
+struct bench {
+	struct sim sim;
+	struct sim_pin d0, d1, relay;
+
+	avr_irq_t *d0_irq;
+	avr_irq_t *d1_irq;
+	avr_cycle_count_t relay_cycle;
+
+	struct sim_probe probes[2];
+	struct bench_stats stats[2];
+};
+
+#define BENCH_PROBE_ACL			0
+#define BENCH_PROBE_SHA1		1
+
+struct bench_scenario {
+	const char *name;
+	/* Credential built from the test record */
+	uint8_t keys;
+	uint8_t card;
+	uint8_t otp;
+	void (*make_record)(struct access_record_v2 *rec);
+	void (*make_filler)(struct access_record_v2 *rec, uint16_t i);
+};
+
+static uint32_t int_to_pin(uint32_t v, uint8_t digits)
+{
+	uint32_t pin = 0xFFFFFFFF << (4 * digits);
+	uint8_t i;
+
+	for (i = 0; i < digits; i++) {
+		pin |= (v % 10) << (4 * i);
+		v /= 10;
+	}
+
+	return pin;
+}
+
+/* Same as acl_get_otp_key() */
+static void bench_get_otp_key(const struct access_record_v2 *rec,
+			      uint8_t *key)
+{
+	uint8_t info[2 + sizeof(rec->card) + 1];
+	struct sha1_context ctx = {};
+	uint8_t info_size = 0;
+
+	info[info_size++] = rec->pin.otp.key_id >> 8;
+	info[info_size++] = rec->pin.otp.key_id;
+	if (ACCESS_RECORD_HAS_CARD(rec)) {
+		info[info_size++] = rec->card >> 24;
+		info[info_size++] = rec->card >> 16;
+		info[info_size++] = rec->card >> 8;
+		info[info_size++] = rec->card;
+	}
+	info[info_size++] = 1;
+
+	sha1_hmac_init(&ctx, root_key, sizeof(root_key));
+	sha1_input(&ctx, info, info_size);
+	sha1_hmac_finish(&ctx, root_key, sizeof(root_key));
+	sha1_digest(&ctx, key, OTP_KEY_SIZE);
+}
+
+static uint32_t bench_get_otp_pin(const struct access_record_v2 *rec)
+{
+	struct sha1_context ctx;
+	uint8_t key[OTP_KEY_SIZE];
+	uint32_t c;
+
+	bench_get_otp_key(rec, key);
+
+	if (ACCESS_RECORD_PIN_TYPE(rec) == ACCESS_RECORD_TYPE_PIN_HOTP)
+		c = rec->pin.hotp.c + BENCH_HOTP_RESYNC;
+	else
+		c = (BENCH_TIME + UNIX_OFFSET) /
+			(rec->pin.totp.interval * 60) - BENCH_TOTP_PREVIOUS;
+
+	return int_to_pin(hotp_sha1(&ctx, key, sizeof(key), c,
+				    BENCH_OTP_DIGITS),
+			  BENCH_OTP_DIGITS);
+}
+
+/* The records are all marked as used, so the lookups don't write
+ * to the EEPROM, except for HOTP which always update the counter. */
+static void bench_pin_record(struct access_record_v2 *rec)
+{
+	rec->hdr.type = ACCESS_RECORD_TYPE(NONE, FIXED);
+	rec->pin.fixed = BENCH_PIN;
+}
+
+static void bench_pin_filler(struct access_record_v2 *rec, uint16_t i)
+{
+	rec->hdr.type = ACCESS_RECORD_TYPE(NONE, FIXED);
+	rec->pin.fixed = 0xFF000000 | i;
+}
+
+static void bench_card_record(struct access_record_v2 *rec)
+{
+	rec->hdr.type = ACCESS_RECORD_TYPE(ID, NONE);
+	rec->card = BENCH_CARD;
+}
+
+static void bench_card_filler(struct access_record_v2 *rec, uint16_t i)
+{
+	rec->hdr.type = ACCESS_RECORD_TYPE(ID, NONE);
+	rec->card = 0x100000 + i;
+}
+
+static void bench_card_pin_record(struct access_record_v2 *rec)
+{
+	rec->hdr.type = ACCESS_RECORD_TYPE(ID, FIXED);
+	rec->card = BENCH_CARD;
+	rec->pin.fixed = BENCH_PIN;
+}
+
+static void bench_card_pin_filler(struct access_record_v2 *rec, uint16_t i)
+{
+	rec->hdr.type = ACCESS_RECORD_TYPE(ID, FIXED);
+	rec->card = 0x200000 + i;
+	rec->pin.fixed = BENCH_PIN;
+}
+
+static void bench_hotp_record(struct access_record_v2 *rec)
+{
+	rec->hdr.type = ACCESS_RECORD_TYPE(NONE, HOTP);
+	rec->pin.hotp.key_id = 1;
+	rec->pin.hotp.digits = BENCH_OTP_DIGITS - 6;
+	rec->pin.hotp.resync_limit = BENCH_HOTP_RESYNC;
+	rec->pin.hotp.c = 100;
+}
+
+static void bench_totp_record(struct access_record_v2 *rec)
+{
+	rec->hdr.type = ACCESS_RECORD_TYPE(NONE, TOTP);
+	rec->pin.totp.key_id = 2;
+	rec->pin.totp.digits = BENCH_OTP_DIGITS - 6;
+	rec->pin.totp.allow_followings = 1;
+	rec->pin.totp.allow_previous = BENCH_TOTP_PREVIOUS;
+	rec->pin.totp.interval = BENCH_TOTP_INTERVAL;
+}
+
+/* The OTP records are checked against fixed PIN fillers, OTP fillers
+ * would only measure the cost of the OTP more times. */
+static const struct bench_scenario scenarios[] = {
+	{
+		.name = "pin",
+		.keys = 1,
+		.make_record = bench_pin_record,
+		.make_filler = bench_pin_filler,
+	},
+	{
+		.name = "card",
+		.card = 1,
+		.make_record = bench_card_record,
+		.make_filler = bench_card_filler,
+	},
+	{
+		.name = "card_pin",
+		.keys = 1,
+		.card = 1,
+		.make_record = bench_card_pin_record,
+		.make_filler = bench_card_pin_filler,
+	},
+#if WITH_OTP
+	{
+		.name = "hotp_resync",
+		.keys = 1,
+		.otp = 1,
+		.make_record = bench_hotp_record,
+		.make_filler = bench_pin_filler,
+	},
+	{
+		.name = "totp_window",
+		.keys = 1,
+		.otp = 1,
+		.make_record = bench_totp_record,
+		.make_filler = bench_pin_filler,
+	},
+#endif
+};
+
+static const uint8_t fill_levels[] = { 0, 50, 100 };
+
+/* Write a record like eeprom_write_access_record() */
+static int bench_add_record(struct eeprom_config *cfg, uint16_t *idx,
+			    const struct access_record_v2 *rec)
+{
+	struct access_record_entry *entry;
+
+	if (*idx + ACCESS_RECORD_ENTRIES(rec) > NUM_ACCESS_RECORDS)
+		return -ENOSPC;
+
+	entry = &cfg->access[*idx];
+	entry->hdr = rec->hdr;
+	if (ACCESS_RECORD_HAS_CARD(rec)) {
+		entry->card = rec->card;
+		entry++;
+		entry->hdr = rec->hdr;
+		entry->hdr.used = 0;
+		entry->hdr.doors = 0;
+		entry->hdr.type &= ~ACCESS_RECORD_TYPE_CARD(-1);
+	}
+	if (ACCESS_RECORD_HAS_PIN(rec))
+		entry->pin = rec->pin;
+
+	*idx += ACCESS_RECORD_ENTRIES(rec);
+	return 0;
+}
+
+/* Fill the table up to the given level, the tested record is placed
+ * after the fillers so the lookup has to go through all of them. */
+static void bench_make_eeprom(struct eeprom_config *cfg,
+			      const struct bench_scenario *sc,
+			      uint8_t fill, struct access_record_v2 *test)
+{
+	struct access_record_v2 rec;
+	uint16_t free_entries, idx = 0, i;
+
+	memset(cfg, 0, sizeof(*cfg));
+	memcpy(cfg->ctrl.root_key, root_key, sizeof(root_key));
+	for (i = 0; i < NUM_DOORS; i++)
+		cfg->door[i].open_time = 1000;
+	for (i = 0; i < AUDIT_LOG_SIZE; i++)
+		cfg->audit_log[i].entry.event = AUDIT_LOG_EVENT_EMPTY;
+	cfg->layout_version = EEPROM_LAYOUT_VERSION;
+
+	memset(test, 0, sizeof(*test));
+	test->hdr.used = 1;
+	test->hdr.doors = BIT(NUM_DOORS) - 1;
+	sc->make_record(test);
+
+	free_entries = NUM_ACCESS_RECORDS - ACCESS_RECORD_ENTRIES(test);
+	free_entries = (uint32_t)free_entries * fill / 100;
+
+	for (i = 0; ; i++) {
+		memset(&rec, 0, sizeof(rec));
+		rec.hdr.used = 1;
+		rec.hdr.doors = BIT(NUM_DOORS) - 1;
+		sc->make_filler(&rec, i);
+		if (idx + ACCESS_RECORD_ENTRIES(&rec) > free_entries)
+			break;
+		bench_add_record(cfg, &idx, &rec);
+	}
+
+	bench_add_record(cfg, &idx, test);
+}
+
+
+static void bench_on_return(struct sim *sim, struct sim_probe *p,
+			    avr_cycle_count_t cycles)
+{
+	struct bench_stats *stats = p->context;
+
+	if (!stats->count || cycles < stats->min)
+		stats->min = cycles;
+	if (cycles > stats->max)
+		stats->max = cycles;
+	stats->total += cycles;
+	stats->count++;
+}
+
+static void bench_on_relay(struct avr_irq_t *irq, uint32_t value,
+			   void *context)
+{
+	struct bench *b = context;
+
+	if (value && !b->relay_cycle)
+		b->relay_cycle = b->sim.avr->cycle;
+}
+
+/* Send the bits, the first bit is sent first */
+static void bench_wiegand_send(struct bench *b, const uint8_t *bits,
+			       uint8_t count)
+{
+	avr_irq_t *irq;
+	uint8_t i;
+
+	for (i = 0; i < count; i++) {
+		irq = bits[i] ? b->d1_irq : b->d0_irq;
+		avr_raise_irq(irq, 0);
+		sim_run_us(&b->sim, WIEGAND_PULSE_US);
+		avr_raise_irq(irq, 1);
+		sim_run_us(&b->sim, WIEGAND_INTERVAL_US - WIEGAND_PULSE_US);
+	}
+}
+
+static void bench_send_key(struct bench *b, uint8_t key)
+{
+	uint8_t bits[4];
+
+	bench_wiegand_send(b, bits, wiegand_encode_key(key, bits));
+	sim_run_us(&b->sim, WIEGAND_KEY_GAP_MS * 1000);
+}
+
+static void bench_send_pin(struct bench *b, uint32_t pin)
+{
+	int8_t i;
+
+	/* The PIN has one key per nibble, the unused ones are all 1 */
+	for (i = 7; i >= 0; i--)
+		if (((pin >> (4 * i)) & 0xF) != 0xF)
+			bench_send_key(b, (pin >> (4 * i)) & 0xF);
+}
+
+static void bench_send_card(struct bench *b, uint32_t card)
+{
+	uint8_t bits[26];
+
+	bench_wiegand_send(b, bits, wiegand_encode_card(card, bits));
+}
+
+static int bench_run_scenario(struct bench *b,
+			      const struct bench_scenario *sc, uint8_t fill)
+{
+	static struct eeprom_config cfg;
+	struct access_record_v2 test;
+	avr_cycle_count_t last_bit;
+	struct bench_stats *stats;
+	uint32_t pin;
+	int err;
+
+	bench_make_eeprom(&cfg, sc, fill, &test);
+
+	err = sim_start(&b->sim, STR(MCU), F_CPU, &cfg, sizeof(cfg));
+	if (err)
+		return err;
+
+	b->d0_irq = sim_get_pin_irq(&b->sim, &b->d0);
+	b->d1_irq = sim_get_pin_irq(&b->sim, &b->d1);
+	avr_irq_register_notify(sim_get_pin_irq(&b->sim, &b->relay),
+				bench_on_relay, b);
+	b->relay_cycle = 0;
+
+	/* Idle Wiegand lines are high */
+	avr_raise_irq(b->d0_irq, 1);
+	avr_raise_irq(b->d1_irq, 1);
+	sim_run_us(&b->sim, BENCH_BOOT_MS * 1000);
+
+	memset(b->stats, 0, sizeof(b->stats));
+
+	if (sc->keys) {
+		pin = sc->otp ? bench_get_otp_pin(&test) : test.pin.fixed;
+		bench_send_pin(b, pin);
+	}
+	if (sc->card)
+		bench_send_card(b, test.card);
+	else
+		bench_send_key(b, WIEGAND_KEY_ENTER);
+	last_bit = b->sim.avr->cycle;
+
+	while (!b->relay_cycle && b->sim.avr->cycle - last_bit <
+	       sim_us_to_cycles(&b->sim, BENCH_RELAY_TIMEOUT_MS * 1000))
+		sim_run_us(&b->sim, 1000);
+
+	stats = &b->stats[BENCH_PROBE_ACL];
+	printf("{\"board\": \"%s\", \"test\": \"%s\", \"fill\": %u, "
+	       "\"records\": %u, \"granted\": %s, "
+	       "\"acl_check_access_cycles\": %llu, ",
+	       STR(BOARD), sc->name, fill, (unsigned int)NUM_ACCESS_RECORDS,
+	       b->relay_cycle ? "true" : "false",
+	       (unsigned long long)stats->max);
+
+	stats = &b->stats[BENCH_PROBE_SHA1];
+	printf("\"sha1_blocks\": %u, \"sha1_block_cycles\": %llu, ",
+	       stats->count, (unsigned long long)
+	       (stats->count ? stats->total / stats->count : 0));
+
+	/* The latency include the word timeout of the reader */
+	if (b->relay_cycle)
+		printf("\"relay_latency_us\": %llu}\n", (unsigned long long)
+		       sim_cycles_to_us(&b->sim, b->relay_cycle - last_bit));
+	else
+		printf("\"relay_latency_us\": null}\n");
+
+	sim_stop(&b->sim);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-0 PIN] [-1 PIN] [-r PIN] FIRMWARE.elf\n"
+		"  -0 PIN  Wiegand D0 of the tested door (default B4)\n"
+		"  -1 PIN  Wiegand D1 of the tested door (default B3)\n"
+		"  -r PIN  Relay of the tested door (default C1)\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.d0 = { 'B', 4 },
+		.d1 = { 'B', 3 },
+		.relay = { 'C', 1 },
+		.probes = {
+			[BENCH_PROBE_ACL] = {
+				.name = "acl_check_access",
+				.on_return = bench_on_return,
+				.context = &b.stats[BENCH_PROBE_ACL],
+			},
+			[BENCH_PROBE_SHA1] = {
+				.name = "sha1_process_block",
+				.on_return = bench_on_return,
+				.context = &b.stats[BENCH_PROBE_SHA1],
+			},
+		},
+	};
+	struct bench_stats *sha1 = &b.stats[BENCH_PROBE_SHA1];
+	avr_cycle_count_t sha1_min = 0;
+	unsigned int i, j;
+	int opt, err;
+
+	while ((opt = getopt(argc, argv, "0:1:r:h")) != -1) {
+		switch (opt) {
+		case '0':
+			err = sim_parse_pin(optarg, &b.d0);
+			break;
+		case '1':
+			err = sim_parse_pin(optarg, &b.d1);
+			break;
+		case 'r':
+			err = sim_parse_pin(optarg, &b.relay);
+			break;
+		default:
+			err = -EINVAL;
+			break;
+		}
+		if (err) {
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	b.sim.firmware = argv[optind];
+	b.sim.probes = b.probes;
+	b.sim.num_probes = ARRAY_SIZE(b.probes);
+
+	/* Without OTP sha1_process_block doesn't exist */
+	if (!WITH_OTP)
+		b.probes[BENCH_PROBE_SHA1].name = NULL;
+
+	err = sim_find_probes(&b.sim);
+	if (err) {
+		fprintf(stderr, "Failed to read the symbols from %s\n",
+			b.sim.firmware);
+		return 1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(scenarios); i++) {
+		for (j = 0; j < ARRAY_SIZE(fill_levels); j++) {
+			err = bench_run_scenario(&b, &scenarios[i],
+						 fill_levels[j]);
+			if (err) {
+				fprintf(stderr, "Failed to run %s: %s\n",
+					b.sim.firmware, strerror(-err));
+				return 1;
+			}
+			if (sha1->count && (!sha1_min || sha1->min < sha1_min))
+				sha1_min = sha1->min;
+		}
+	}
+
+	if (WITH_OTP)
+		printf("{\"board\": \"%s\", \"test\": \"sha1_process_block\", "
+		       "\"cycles\": %llu}\n",
+		       STR(BOARD), (unsigned long long)sha1_min);
+
+	return 0;
+}
@@ -0,0 +1,950 @@
+/*
+ * Wiegand stress test of the firmware running in simavr.
+ *
+ * Both readers are driven at the same time with swipes and keypad
+ * traffic, either generated at a given rate or read from a script.
+ * The reader events and the work queue drops are traced by probing
+ * work_queue_schedule(), the decisions by probing acl_check_access()
+ * and the relays are watched on their GPIO.
+ *
+ * Each presentation end up either decided, or lost because one of its
+ * reader events was dropped, because the reader reported an error or
+ * because the door controller ignored it while busy. The report give
+ * the loss rates and the latency percentiles from the last Wiegand bit
+ * to the end of acl_check_access(), this include the word timeout of
+ * the reader.
+ *
+ * The results are written to stdout, one JSON object per line.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "../eeprom.h"
+#include "../acl.h"
+#include "../wiegand-reader.h"
+#include "sim.h"
+
+#define STR_(x)				#x
+#define STR(x)				STR_(x)
+
+/* Time to let the firmware initialize */
+#define STORM_BOOT_MS			500
+/* Time to let the firmware process the last presentations */
+#define STORM_TAIL_MS			3000
+
+#define STORM_CARD			0x123456
+#define STORM_PIN			"1234"
+#define STORM_CARD_PIN_CARD		0x654321
+#define STORM_CARD_PIN_PIN		"4321"
+
+#define STORM_MAX_KEYS			8
+
+enum storm_type {
+	STORM_CARD_ONLY,
+	STORM_PIN_ONLY,
+	STORM_CARD_AND_PIN,
+	STORM_NUM_TYPES,
+};
+
+static const char * const storm_type_names[] = {
+	[STORM_CARD_ONLY] = "card",
+	[STORM_PIN_ONLY] = "pin",
+	[STORM_CARD_AND_PIN] = "card_pin",
+};
+
+struct storm_presentation {
+	uint8_t door;
+	uint8_t type;
+	uint32_t card;
+	uint8_t keys[STORM_MAX_KEYS];
+	uint8_t num_keys;
+
+	uint64_t start_us;
+	/* Time of the last bit */
+	uint64_t end_us;
+
+	uint8_t expected_events;
+	uint8_t events;
+	uint8_t drops;
+	uint8_t errors;
+	uint8_t decided;
+};
+
+struct storm_edge {
+	uint64_t time_us;
+	unsigned int seq;
+	unsigned int pres;
+	uint8_t line;
+	uint8_t value;
+};
+
+struct storm_stats {
+	unsigned int presentations;
+	unsigned int expected_events;
+	unsigned int reader_events;
+	unsigned int reader_errors;
+	unsigned int reader_drops;
+	unsigned int door_drops;
+	unsigned int decisions;
+	unsigned int granted;
+	unsigned int unmatched;
+	unsigned int lost_dropped;
+	unsigned int lost_error;
+	unsigned int lost_ignored;
+	unsigned int relay_transitions;
+
+	uint64_t *latencies;
+	unsigned int num_latencies;
+};
+
+struct storm_door {
+	struct storm *storm;
+	uint8_t id;
+	struct sim_pin d0, d1, relay;
+	avr_irq_t *irq[2];
+
+	/* Last presentation started on this door */
+	int current;
+	struct storm_stats stats;
+};
+
+struct storm_timing {
+	uint32_t pulse_us;
+	uint32_t interval_us;
+	uint32_t key_gap_us;
+};
+
+#define STORM_PROBE_SCHEDULE		0
+#define STORM_PROBE_ACL			1
+
+struct storm {
+	struct sim sim;
+	struct sim_probe probes[2];
+	struct storm_door doors[NUM_DOORS];
+	struct storm_timing timing;
+	uint16_t open_time;
+	int verbose;
+
+	/* Location of the door controllers in RAM */
+	uint32_t dc_addr;
+	uint32_t dc_size;
+
+	avr_cycle_count_t start_cycle;
+
+	struct storm_presentation *pres;
+	unsigned int num_pres;
+	struct storm_edge *edges;
+	unsigned int num_edges;
+
+	/* Arguments of the running probed calls */
+	struct {
+		uint16_t worker;
+		uint8_t cmd;
+		uint32_t arg;
+	} schedule_calls[SIM_PROBE_MAX_DEPTH];
+	uint8_t acl_calls[SIM_PROBE_MAX_DEPTH];
+
+	unsigned int other_drops;
+};
+
+/* Write a record like eeprom_write_access_record() */
+static int storm_add_record(struct eeprom_config *cfg, uint16_t *idx,
+			    const struct access_record_v2 *rec)
+{
+	struct access_record_entry *entry;
+
+	if (*idx + ACCESS_RECORD_ENTRIES(rec) > NUM_ACCESS_RECORDS)
+		return -ENOSPC;
+
+	entry = &cfg->access[*idx];
+	entry->hdr = rec->hdr;
+	if (ACCESS_RECORD_HAS_CARD(rec)) {
+		entry->card = rec->card;
+		entry++;
+		entry->hdr = rec->hdr;
+		entry->hdr.used = 0;
+		entry->hdr.doors = 0;
+		entry->hdr.type &= ~ACCESS_RECORD_TYPE_CARD(-1);
+	}
+	if (ACCESS_RECORD_HAS_PIN(rec))
+		entry->pin = rec->pin;
+
+	*idx += ACCESS_RECORD_ENTRIES(rec);
+	return 0;
+}
+
+static uint32_t storm_parse_pin(const char *str, uint8_t *keys,
+				uint8_t *num_keys)
+{
+	uint32_t pin = 0xFFFFFFFF;
+	uint8_t n = 0;
+
+	for (; *str && n < STORM_MAX_KEYS; str++) {
+		if (*str < '0' || *str > '9')
+			break;
+		pin = (pin << 4) | (*str - '0');
+		if (keys)
+			keys[n] = *str - '0';
+		n++;
+	}
+
+	if (num_keys)
+		*num_keys = *str ? 0 : n;
+	return pin;
+}
+
+/* Grant the generated credentials on all the doors */
+static void storm_make_eeprom(struct storm *s, struct eeprom_config *cfg)
+{
+	struct access_record_v2 rec;
+	uint16_t idx = 0, i;
+
+	memset(cfg, 0, sizeof(*cfg));
+	for (i = 0; i < NUM_DOORS; i++)
+		cfg->door[i].open_time = s->open_time;
+	for (i = 0; i < AUDIT_LOG_SIZE; i++)
+		cfg->audit_log[i].entry.event = AUDIT_LOG_EVENT_EMPTY;
+	cfg->layout_version = EEPROM_LAYOUT_VERSION;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.hdr.used = 1;
+	rec.hdr.doors = BIT(NUM_DOORS) - 1;
+
+	rec.hdr.type = ACCESS_RECORD_TYPE(ID, NONE);
+	rec.card = STORM_CARD;
+	storm_add_record(cfg, &idx, &rec);
+
+	rec.hdr.type = ACCESS_RECORD_TYPE(NONE, FIXED);
+	rec.card = 0;
+	rec.pin.fixed = storm_parse_pin(STORM_PIN, NULL, NULL);
+	storm_add_record(cfg, &idx, &rec);
+
+	rec.hdr.type = ACCESS_RECORD_TYPE(ID, FIXED);
+	rec.card = STORM_CARD_PIN_CARD;
+	rec.pin.fixed = storm_parse_pin(STORM_CARD_PIN_PIN, NULL, NULL);
+	storm_add_record(cfg, &idx, &rec);
+}
+
+static struct storm_presentation *storm_add_presentation(
+	struct storm *s, uint8_t door, uint8_t type, uint64_t start_us)
+{
+	struct storm_presentation *p;
+
+	p = realloc(s->pres, (s->num_pres + 1) * sizeof(*p));
+	if (!p)
+		return NULL;
+	s->pres = p;
+
+	p = &s->pres[s->num_pres++];
+	memset(p, 0, sizeof(*p));
+	p->door = door;
+	p->type = type;
+	p->start_us = start_us;
+	return p;
+}
+
+static int storm_add_edge(struct storm *s, unsigned int pres,
+			  uint64_t time_us, uint8_t line, uint8_t value)
+{
+	struct storm_edge *e;
+
+	e = realloc(s->edges, (s->num_edges + 1) * sizeof(*e));
+	if (!e)
+		return -ENOMEM;
+	s->edges = e;
+
+	e = &s->edges[s->num_edges];
+	e->time_us = time_us;
+	e->seq = s->num_edges;
+	e->pres = pres;
+	e->line = line;
+	e->value = value;
+	s->num_edges++;
+	return 0;
+}
+
+/* Add the edges of a Wiegand word, return the start of the next word */
+static uint64_t storm_add_word(struct storm *s, unsigned int pres,
+			       uint64_t t, const uint8_t *bits, uint8_t count)
+{
+	struct storm_presentation *p = &s->pres[pres];
+	uint8_t i;
+
+	for (i = 0; i < count; i++) {
+		/* A 0 pull D0 low, a 1 pull D1 low */
+		if (storm_add_edge(s, pres, t, bits[i], 0) ||
+		    storm_add_edge(s, pres, t + s->timing.pulse_us,
+				   bits[i], 1)) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		p->end_us = t + s->timing.pulse_us;
+		t += s->timing.interval_us;
+	}
+
+	return t + s->timing.key_gap_us;
+}
+
+/* Keys first, then the card or ENTER, like the door controller expect */
+static uint64_t storm_add_edges(struct storm *s, unsigned int pres)
+{
+	struct storm_presentation *p = &s->pres[pres];
+	uint64_t t = p->start_us;
+	uint8_t bits[26];
+	uint8_t i;
+
+	for (i = 0; i < p->num_keys; i++)
+		t = storm_add_word(s, pres, t, bits,
+				   wiegand_encode_key(p->keys[i], bits));
+
+	if (p->type == STORM_PIN_ONLY)
+		t = storm_add_word(s, pres, t, bits,
+				   wiegand_encode_key(WIEGAND_KEY_ENTER, bits));
+	else
+		t = storm_add_word(s, pres, t, bits,
+				   wiegand_encode_card(p->card, bits));
+
+	p->expected_events = p->num_keys + 1;
+	return t;
+}
+
+static int storm_generate(struct storm *s, double rate, uint32_t skew_ms,
+			  uint32_t jitter_ms, uint32_t duration_s,
+			  unsigned int mix)
+{
+	struct storm_presentation *p;
+	uint64_t period_us, t, next;
+	uint8_t type = 0;
+	unsigned int door;
+	const char *pin;
+
+	if (rate <= 0 || !mix)
+		return -EINVAL;
+
+	period_us = 1000000 / rate;
+
+	for (door = 0; door < NUM_DOORS; door++) {
+		t = door ? skew_ms * 1000ULL : 0;
+		while (t < duration_s * 1000000ULL) {
+			/* Cycle through the selected types */
+			while (!(mix & BIT(type)))
+				type = (type + 1) % STORM_NUM_TYPES;
+
+			p = storm_add_presentation(s, door, type, t);
+			if (!p)
+				return -ENOMEM;
+
+			pin = NULL;
+			switch (type) {
+			case STORM_CARD_ONLY:
+				p->card = STORM_CARD;
+				break;
+			case STORM_PIN_ONLY:
+				pin = STORM_PIN;
+				break;
+			case STORM_CARD_AND_PIN:
+				p->card = STORM_CARD_PIN_CARD;
+				pin = STORM_CARD_PIN_PIN;
+				break;
+			}
+			if (pin)
+				storm_parse_pin(pin, p->keys, &p->num_keys);
+			type = (type + 1) % STORM_NUM_TYPES;
+
+			/* A reader can't send two presentations at once */
+			next = storm_add_edges(s, s->num_pres - 1);
+			t += period_us;
+			if (jitter_ms)
+				t += rand() % (jitter_ms * 1000);
+			if (t < next)
+				t = next;
+		}
+	}
+
+	return 0;
+}
+
+/* Each line is: TIME_MS DOOR card CARD | pin DIGITS | card_pin CARD DIGITS */
+static int storm_load_script(struct storm *s, const char *path)
+{
+	char line[256], type[16], arg1[32], arg2[32];
+	struct storm_presentation *p;
+	unsigned int lineno = 0;
+	unsigned long time_ms;
+	unsigned int door;
+	int n, t;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if (line[strspn(line, " \t\r\n")] == '#' ||
+		    line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		n = sscanf(line, "%lu %u %15s %31s %31s",
+			   &time_ms, &door, type, arg1, arg2);
+		for (t = 0; t < STORM_NUM_TYPES; t++)
+			if (n >= 4 && !strcmp(type, storm_type_names[t]))
+				break;
+		if (t >= STORM_NUM_TYPES || door >= NUM_DOORS ||
+		    n != (t == STORM_CARD_AND_PIN ? 5 : 4))
+			goto invalid;
+
+		p = storm_add_presentation(s, door, t, time_ms * 1000);
+		if (!p) {
+			fclose(f);
+			return -ENOMEM;
+		}
+
+		if (t != STORM_PIN_ONLY)
+			p->card = strtoul(arg1, NULL, 0);
+		if (t != STORM_CARD_ONLY) {
+			storm_parse_pin(t == STORM_PIN_ONLY ? arg1 : arg2,
+					p->keys, &p->num_keys);
+			if (!p->num_keys)
+				goto invalid;
+		}
+
+		storm_add_edges(s, s->num_pres - 1);
+	}
+
+	fclose(f);
+	return 0;
+
+invalid:
+	fprintf(stderr, "%s:%u: Invalid presentation\n", path, lineno);
+	fclose(f);
+	return -EINVAL;
+}
+
+static int storm_cmp_edges(const void *a, const void *b)
+{
+	const struct storm_edge *ea = a, *eb = b;
+
+	if (ea->time_us != eb->time_us)
+		return ea->time_us < eb->time_us ? -1 : 1;
+	return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+static int storm_cmp_u64(const void *a, const void *b)
+{
+	const uint64_t *va = a, *vb = b;
+
+	return *va < *vb ? -1 : *va > *vb;
+}
+
+static uint64_t storm_now_us(struct storm *s)
+{
+	return sim_cycles_to_us(&s->sim, s->sim.avr->cycle - s->start_cycle);
+}
+
+static int storm_get_door(struct storm *s, uint16_t worker)
+{
+	if (worker < s->dc_addr || worker >= s->dc_addr + s->dc_size)
+		return -1;
+	return (worker - s->dc_addr) / (s->dc_size / NUM_DOORS);
+}
+
+static struct storm_presentation *storm_get_current(struct storm *s,
+						    int door)
+{
+	if (s->doors[door].current < 0)
+		return NULL;
+	return &s->pres[s->doors[door].current];
+}
+
+static void storm_on_schedule(struct sim *sim, struct sim_probe *p)
+{
+	struct storm *s = p->context;
+
+	s->schedule_calls[p->depth - 1].worker = sim_get_reg16(sim, 24);
+	s->schedule_calls[p->depth - 1].cmd = sim_get_reg(sim, 22);
+	s->schedule_calls[p->depth - 1].arg = sim_get_reg32(sim, 18);
+}
+
+static void storm_on_schedule_return(struct sim *sim, struct sim_probe *p,
+				     avr_cycle_count_t cycles)
+{
+	struct storm *s = p->context;
+	struct storm_presentation *pres;
+	struct storm_stats *stats;
+	uint8_t cmd = s->schedule_calls[p->depth].cmd;
+	uint32_t arg = s->schedule_calls[p->depth].arg;
+	int8_t err = sim_get_reg(sim, 24);
+	int door;
+
+	door = storm_get_door(s, s->schedule_calls[p->depth].worker);
+	if (door < 0) {
+		if (err == -ENOMEM)
+			s->other_drops++;
+		return;
+	}
+
+	stats = &s->doors[door].stats;
+	pres = storm_get_current(s, door);
+
+	switch (cmd) {
+	case WIEGAND_READER_EVENT_KEY:
+	case WIEGAND_READER_EVENT_CARD:
+	case WIEGAND_READER_ERROR:
+		break;
+	default:
+		if (err == -ENOMEM)
+			stats->door_drops++;
+		return;
+	}
+
+	if (err == -ENOMEM) {
+		stats->reader_drops++;
+		if (pres)
+			pres->drops++;
+	} else if (cmd == WIEGAND_READER_ERROR) {
+		stats->reader_errors++;
+		if (pres)
+			pres->errors++;
+	} else {
+		stats->reader_events++;
+		if (pres)
+			pres->events++;
+	}
+
+	if (s->verbose)
+		printf("{\"event\": \"%s\", \"time_us\": %llu, \"door\": %d, "
+		       "\"type\": \"%s\", \"value\": %ld}\n",
+		       err == -ENOMEM ? "drop" : "reader",
+		       (unsigned long long)storm_now_us(s), door,
+		       cmd == WIEGAND_READER_EVENT_KEY ? "key" :
+		       cmd == WIEGAND_READER_EVENT_CARD ? "card" : "error",
+		       cmd == WIEGAND_READER_ERROR ?
+		       (long)(int32_t)arg : (long)arg);
+}
+
+static void storm_on_acl(struct sim *sim, struct sim_probe *p)
+{
+	struct storm *s = p->context;
+
+	s->acl_calls[p->depth - 1] = sim_get_reg(sim, 14);
+}
+
+static void storm_on_acl_return(struct sim *sim, struct sim_probe *p,
+				avr_cycle_count_t cycles)
+{
+	struct storm *s = p->context;
+	struct storm_presentation *pres;
+	struct storm_stats *stats;
+	uint8_t door = s->acl_calls[p->depth];
+	int8_t err = sim_get_reg(sim, 24);
+	uint64_t now = storm_now_us(s);
+
+	if (door >= NUM_DOORS)
+		return;
+
+	stats = &s->doors[door].stats;
+	stats->decisions++;
+	if (!err)
+		stats->granted++;
+
+	pres = storm_get_current(s, door);
+	if (!pres || pres->decided || now < pres->end_us) {
+		stats->unmatched++;
+	} else {
+		pres->decided = 1;
+		stats->latencies[stats->num_latencies++] =
+			now - pres->end_us;
+	}
+
+	if (s->verbose)
+		printf("{\"event\": \"decision\", \"time_us\": %llu, "
+		       "\"door\": %u, \"granted\": %s, \"cycles\": %llu}\n",
+		       (unsigned long long)now, door, err ? "false" : "true",
+		       (unsigned long long)cycles);
+}
+
+static void storm_on_relay(struct avr_irq_t *irq, uint32_t value,
+			   void *context)
+{
+	struct storm_door *d = context;
+
+	d->stats.relay_transitions++;
+	if (d->storm->verbose)
+		printf("{\"event\": \"relay\", \"time_us\": %llu, "
+		       "\"door\": %u, \"value\": %u}\n",
+		       (unsigned long long)storm_now_us(d->storm), d->id,
+		       value);
+}
+
+static void storm_print_stats(const char *door, struct storm_stats *stats)
+{
+	unsigned int lost = stats->lost_dropped + stats->lost_error +
+		stats->lost_ignored;
+	uint64_t *l = stats->latencies;
+	unsigned int n = stats->num_latencies;
+
+	qsort(l, n, sizeof(*l), storm_cmp_u64);
+
+	printf("{\"board\": \"%s\", \"door\": %s, \"presentations\": %u, "
+	       "\"decisions\": %u, \"granted\": %u, \"unmatched\": %u, "
+	       "\"lost\": %u, \"lost_dropped\": %u, \"lost_error\": %u, "
+	       "\"lost_ignored\": %u, \"loss_rate\": %.4f, ",
+	       STR(BOARD), door, stats->presentations,
+	       stats->decisions, stats->granted, stats->unmatched,
+	       lost, stats->lost_dropped, stats->lost_error,
+	       stats->lost_ignored,
+	       stats->presentations ?
+	       (double)lost / stats->presentations : 0.0);
+
+	printf("\"expected_reader_events\": %u, \"reader_events\": %u, "
+	       "\"reader_errors\": %u, \"reader_drops\": %u, "
+	       "\"door_event_drops\": %u, \"event_loss_rate\": %.4f, "
+	       "\"relay_transitions\": %u, ",
+	       stats->expected_events, stats->reader_events,
+	       stats->reader_errors, stats->reader_drops, stats->door_drops,
+	       stats->expected_events && stats->reader_events <
+	       stats->expected_events ?
+	       1.0 - (double)stats->reader_events / stats->expected_events :
+	       0.0, stats->relay_transitions);
+
+	if (n)
+		printf("\"latency_us\": {\"p50\": %llu, \"p90\": %llu, "
+		       "\"p99\": %llu, \"max\": %llu}}\n",
+		       (unsigned long long)l[(n - 1) * 50 / 100],
+		       (unsigned long long)l[(n - 1) * 90 / 100],
+		       (unsigned long long)l[(n - 1) * 99 / 100],
+		       (unsigned long long)l[n - 1]);
+	else
+		printf("\"latency_us\": null}\n");
+}
+
+static void storm_add_stats(struct storm_stats *total,
+			    const struct storm_stats *stats)
+{
+	total->presentations += stats->presentations;
+	total->expected_events += stats->expected_events;
+	total->reader_events += stats->reader_events;
+	total->reader_errors += stats->reader_errors;
+	total->reader_drops += stats->reader_drops;
+	total->door_drops += stats->door_drops;
+	total->decisions += stats->decisions;
+	total->granted += stats->granted;
+	total->unmatched += stats->unmatched;
+	total->lost_dropped += stats->lost_dropped;
+	total->lost_error += stats->lost_error;
+	total->lost_ignored += stats->lost_ignored;
+	total->relay_transitions += stats->relay_transitions;
+
+	memcpy(&total->latencies[total->num_latencies], stats->latencies,
+	       stats->num_latencies * sizeof(*stats->latencies));
+	total->num_latencies += stats->num_latencies;
+}
+
+static int storm_run(struct storm *s)
+{
+	static struct eeprom_config cfg;
+	struct storm_stats total = {};
+	struct storm_presentation *p;
+	struct storm_edge *e;
+	struct storm_door *d;
+	char door_name[8];
+	unsigned int i;
+	int err;
+
+	storm_make_eeprom(s, &cfg);
+
+	err = sim_start(&s->sim, STR(MCU), F_CPU, &cfg, sizeof(cfg));
+	if (err)
+		return err;
+
+	for (i = 0; i < NUM_DOORS; i++) {
+		d = &s->doors[i];
+		d->storm = s;
+		d->id = i;
+		d->current = -1;
+		d->irq[0] = sim_get_pin_irq(&s->sim, &d->d0);
+		d->irq[1] = sim_get_pin_irq(&s->sim, &d->d1);
+		avr_irq_register_notify(sim_get_pin_irq(&s->sim, &d->relay),
+					storm_on_relay, d);
+		/* Idle Wiegand lines are high */
+		avr_raise_irq(d->irq[0], 1);
+		avr_raise_irq(d->irq[1], 1);
+
+		d->stats.latencies = calloc(s->num_pres + 1,
+					    sizeof(*d->stats.latencies));
+		if (!d->stats.latencies)
+			return -ENOMEM;
+	}
+
+	sim_run_us(&s->sim, STORM_BOOT_MS * 1000);
+	s->start_cycle = s->sim.avr->cycle;
+
+	qsort(s->edges, s->num_edges, sizeof(*s->edges), storm_cmp_edges);
+	for (i = 0; i < s->num_edges; i++) {
+		e = &s->edges[i];
+		p = &s->pres[e->pres];
+		d = &s->doors[p->door];
+
+		sim_run_until(&s->sim, s->start_cycle +
+			      sim_us_to_cycles(&s->sim, e->time_us));
+		d->current = e->pres;
+		avr_raise_irq(d->irq[e->line], e->value);
+	}
+
+	sim_run_us(&s->sim, STORM_TAIL_MS * 1000);
+
+	for (i = 0; i < s->num_pres; i++) {
+		p = &s->pres[i];
+		d = &s->doors[p->door];
+
+		d->stats.presentations++;
+		d->stats.expected_events += p->expected_events;
+		if (p->decided)
+			continue;
+		if (p->drops)
+			d->stats.lost_dropped++;
+		else if (p->errors)
+			d->stats.lost_error++;
+		else
+			d->stats.lost_ignored++;
+	}
+
+	total.latencies = calloc(s->num_pres + 1, sizeof(*total.latencies));
+	if (!total.latencies)
+		return -ENOMEM;
+
+	for (i = 0; i < NUM_DOORS; i++) {
+		storm_add_stats(&total, &s->doors[i].stats);
+		snprintf(door_name, sizeof(door_name), "%u", i);
+		storm_print_stats(door_name, &s->doors[i].stats);
+	}
+	storm_print_stats("\"all\"", &total);
+	printf("{\"board\": \"%s\", \"door\": null, \"other_drops\": %u}\n",
+	       STR(BOARD), s->other_drops);
+
+	for (i = 0; i < NUM_DOORS; i++)
+		free(s->doors[i].stats.latencies);
+	free(total.latencies);
+
+	sim_stop(&s->sim);
+	return 0;
+}
+
+static int storm_parse_door(struct storm *s, char *str)
+{
+	char *door, *d0, *d1, *relay;
+	struct storm_door *d;
+	unsigned long id;
+
+	door = strtok(str, ",");
+	d0 = strtok(NULL, ",");
+	d1 = strtok(NULL, ",");
+	relay = strtok(NULL, ",");
+	if (!door || !d0 || !d1 || !relay || strtok(NULL, ","))
+		return -EINVAL;
+
+	id = strtoul(door, NULL, 10);
+	if (id >= NUM_DOORS)
+		return -EINVAL;
+	d = &s->doors[id];
+
+	if (sim_parse_pin(d0, &d->d0) || sim_parse_pin(d1, &d->d1) ||
+	    sim_parse_pin(relay, &d->relay))
+		return -EINVAL;
+
+	return 0;
+}
+
+static int storm_parse_mix(char *str, unsigned int *mix)
+{
+	char *type;
+	int t;
+
+	*mix = 0;
+	for (type = strtok(str, ","); type; type = strtok(NULL, ",")) {
+		for (t = 0; t < STORM_NUM_TYPES; t++)
+			if (!strcmp(type, storm_type_names[t]))
+				break;
+		if (t >= STORM_NUM_TYPES)
+			return -EINVAL;
+		*mix |= BIT(t);
+	}
+
+	return *mix ? 0 : -EINVAL;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS] FIRMWARE.elf\n"
+		"  -d DOOR,D0,D1,RELAY  Pins of a door "
+		"(default 0,B4,B3,C1 and 1,D6,D5,C2)\n"
+		"  -f SCRIPT            Read the presentations from SCRIPT\n"
+		"  -n RATE              Presentations per second and door "
+		"(default 1)\n"
+		"  -s SKEW              Delay of the second door in ms "
+		"(default 0)\n"
+		"  -j JITTER            Random delay added between the "
+		"presentations in ms\n"
+		"  -t DURATION          Duration of the traffic in s "
+		"(default 10)\n"
+		"  -m TYPES             Presentation types to cycle through "
+		"(default card,pin,card_pin)\n"
+		"  -S SEED              Seed of the jitter\n"
+		"  -w PULSE             Wiegand pulse width in us "
+		"(default 50)\n"
+		"  -i INTERVAL          Wiegand bit interval in us "
+		"(default 1000)\n"
+		"  -k GAP               Gap between two keys in ms "
+		"(default 30)\n"
+		"  -o TIME              Door open time in ms (default 500)\n"
+		"  -v                   Print every event\n"
+		"\n"
+		"The script lines are: TIME_MS DOOR card CARD | "
+		"pin DIGITS | card_pin CARD DIGITS\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct storm s = {
+		.doors = {
+			{
+				.d0 = { 'B', 4 },
+				.d1 = { 'B', 3 },
+				.relay = { 'C', 1 },
+			},
+#if NUM_DOORS > 1
+			{
+				.d0 = { 'D', 6 },
+				.d1 = { 'D', 5 },
+				.relay = { 'C', 2 },
+			},
+#endif
+		},
+		.probes = {
+			[STORM_PROBE_SCHEDULE] = {
+				.name = "work_queue_schedule",
+				.on_enter = storm_on_schedule,
+				.on_return = storm_on_schedule_return,
+				.context = &s,
+			},
+			[STORM_PROBE_ACL] = {
+				.name = "acl_check_access",
+				.on_enter = storm_on_acl,
+				.on_return = storm_on_acl_return,
+				.context = &s,
+			},
+		},
+		.timing = {
+			.pulse_us = 50,
+			.interval_us = 1000,
+			.key_gap_us = 30000,
+		},
+		.open_time = 500,
+	};
+	unsigned int mix = BIT(STORM_NUM_TYPES) - 1;
+	uint32_t skew = 0, jitter = 0, duration = 10;
+	const char *script = NULL;
+	double rate = 1;
+	int opt, err;
+
+	while ((opt = getopt(argc, argv, "d:f:n:s:j:t:m:S:w:i:k:o:vh")) != -1) {
+		err = 0;
+		switch (opt) {
+		case 'd':
+			err = storm_parse_door(&s, optarg);
+			break;
+		case 'f':
+			script = optarg;
+			break;
+		case 'n':
+			rate = strtod(optarg, NULL);
+			break;
+		case 's':
+			skew = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			jitter = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			err = storm_parse_mix(optarg, &mix);
+			break;
+		case 'S':
+			srand(strtoul(optarg, NULL, 0));
+			break;
+		case 'w':
+			s.timing.pulse_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			s.timing.interval_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			s.timing.key_gap_us = strtoul(optarg, NULL, 0) * 1000;
+			break;
+		case 'o':
+			s.open_time = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			s.verbose = 1;
+			break;
+		default:
+			err = -EINVAL;
+			break;
+		}
+		if (err) {
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind + 1 != argc ||
+	    s.timing.pulse_us >= s.timing.interval_us) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	s.sim.firmware = argv[optind];
+	s.sim.probes = s.probes;
+	s.sim.num_probes = ARRAY_SIZE(s.probes);
+
+	err = sim_find_probes(&s.sim);
+	if (!err)
+		err = sim_get_symbol(&s.sim, "dc", &s.dc_addr, &s.dc_size);
+	if (!err && s.dc_size < NUM_DOORS)
+		err = -EINVAL;
+	if (err) {
+		fprintf(stderr, "Failed to read the symbols from %s\n",
+			s.sim.firmware);
+		return 1;
+	}
+
+	if (script)
+		err = storm_load_script(&s, script);
+	else
+		err = storm_generate(&s, rate, skew, jitter, duration, mix);
+	if (err) {
+		fprintf(stderr, "Failed to create the traffic: %s\n",
+			strerror(-err));
+		return 1;
+	}
+
+	err = storm_run(&s);
+	if (err) {
+		fprintf(stderr, "Failed to run %s: %s\n",
+			s.sim.firmware, strerror(-err));
+		return 1;
+	}
+
+	free(s.edges);
+	free(s.pres);
+	return 0;
+}
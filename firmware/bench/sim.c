@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <gelf.h>
+
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <avr_ioport.h>
+
+#include "sim.h"
+
+/* Offset of the data addresses in the AVR ELF files */
+#define SIM_DATA_OFFSET		0x800000
+
+/* Call cb for each symbol of the firmware until it return non-zero */
+static int sim_for_each_symbol(struct sim *sim,
+			       int (*cb)(const char *name,
+					 const GElf_Sym *sym, void *ctx),
+			       void *ctx)
+{
+	Elf_Scn *scn = NULL;
+	Elf_Data *data;
+	GElf_Shdr shdr;
+	GElf_Sym sym;
+	const char *name;
+	unsigned int n;
+	int fd, ret = 0;
+	Elf *elf;
+
+	elf_version(EV_CURRENT);
+	fd = open(sim->firmware, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	elf = elf_begin(fd, ELF_C_READ, NULL);
+	if (!elf) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	while (!ret && (scn = elf_nextscn(elf, scn))) {
+		gelf_getshdr(scn, &shdr);
+		if (shdr.sh_type != SHT_SYMTAB)
+			continue;
+
+		data = elf_getdata(scn, NULL);
+		for (n = 0; !ret && n < shdr.sh_size / shdr.sh_entsize; n++) {
+			gelf_getsym(data, n, &sym);
+			name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+			if (name)
+				ret = cb(name, &sym, ctx);
+		}
+	}
+
+	elf_end(elf);
+	close(fd);
+	return ret < 0 ? ret : 0;
+}
+
+struct sim_symbol_lookup {
+	const char *name;
+	uint32_t addr;
+	uint32_t size;
+};
+
+static int sim_lookup_symbol(const char *name, const GElf_Sym *sym,
+			     void *ctx)
+{
+	struct sim_symbol_lookup *lookup = ctx;
+
+	if (strcmp(name, lookup->name))
+		return 0;
+
+	lookup->addr = sym->st_value;
+	if (lookup->addr >= SIM_DATA_OFFSET)
+		lookup->addr -= SIM_DATA_OFFSET;
+	lookup->size = sym->st_size;
+	return 1;
+}
+
+int sim_get_symbol(struct sim *sim, const char *name,
+		   uint32_t *addr, uint32_t *size)
+{
+	struct sim_symbol_lookup lookup = {
+		.name = name,
+	};
+	int err;
+
+	err = sim_for_each_symbol(sim, sim_lookup_symbol, &lookup);
+	if (err)
+		return err;
+	if (!lookup.addr && !lookup.size)
+		return -ENOENT;
+
+	if (addr)
+		*addr = lookup.addr;
+	if (size)
+		*size = lookup.size;
+	return 0;
+}
+
+static int sim_lookup_probe(const char *name, const GElf_Sym *sym,
+			    void *ctx)
+{
+	struct sim *sim = ctx;
+	unsigned int i;
+
+	if (GELF_ST_TYPE(sym->st_info) != STT_FUNC)
+		return 0;
+
+	for (i = 0; i < sim->num_probes; i++)
+		if (sim->probes[i].name && !strcmp(name, sim->probes[i].name))
+			sim->probes[i].addr = sym->st_value;
+
+	return 0;
+}
+
+int sim_find_probes(struct sim *sim)
+{
+	unsigned int i;
+	int err;
+
+	err = sim_for_each_symbol(sim, sim_lookup_probe, sim);
+	if (err)
+		return err;
+
+	for (i = 0; i < sim->num_probes; i++)
+		if (sim->probes[i].name && !sim->probes[i].addr) {
+			fprintf(stderr, "Symbol %s not found in %s\n",
+				sim->probes[i].name, sim->firmware);
+			err = -ENOENT;
+		}
+
+	return err;
+}
+
+int sim_start(struct sim *sim, const char *mcu, uint32_t frequency,
+	      const void *eeprom, size_t eeprom_size)
+{
+	elf_firmware_t fw = {};
+	unsigned int i;
+
+	if (elf_read_firmware(sim->firmware, &fw))
+		return -EINVAL;
+
+	fw.frequency = frequency;
+	/* Replace the EEPROM content from the ELF */
+	if (eeprom) {
+		fw.eeprom = (uint8_t *)eeprom;
+		fw.eesize = eeprom_size;
+	}
+
+	sim->avr = avr_make_mcu_by_name(mcu);
+	if (!sim->avr)
+		return -ENODEV;
+
+	avr_init(sim->avr);
+	avr_load_firmware(sim->avr, &fw);
+
+	for (i = 0; i < sim->num_probes; i++)
+		sim->probes[i].depth = 0;
+
+	return 0;
+}
+
+void sim_stop(struct sim *sim)
+{
+	avr_terminate(sim->avr);
+	free(sim->avr);
+	sim->avr = NULL;
+}
+
+static uint16_t sim_get_sp(avr_t *avr)
+{
+	return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+static void sim_check_probes(struct sim *sim)
+{
+	avr_t *avr = sim->avr;
+	struct sim_probe *p;
+	unsigned int i, j;
+	uint32_t ret;
+	uint16_t sp;
+
+	for (i = 0; i < sim->num_probes; i++) {
+		p = &sim->probes[i];
+		if (!p->addr)
+			continue;
+
+		if (avr->pc == p->addr && p->depth < SIM_PROBE_MAX_DEPTH) {
+			sp = sim_get_sp(avr);
+			/* The return address is pushed big endian */
+			for (ret = 0, j = 1; j <= avr->address_size; j++)
+				ret = (ret << 8) | avr->data[sp + j];
+			p->calls[p->depth].ret = ret * 2;
+			p->calls[p->depth].sp = sp + avr->address_size;
+			p->calls[p->depth].start = avr->cycle;
+			p->depth++;
+			if (p->on_enter)
+				p->on_enter(sim, p);
+		} else if (p->depth > 0 &&
+			   avr->pc == p->calls[p->depth - 1].ret &&
+			   sim_get_sp(avr) == p->calls[p->depth - 1].sp) {
+			p->depth--;
+			if (p->on_return)
+				p->on_return(sim, p, avr->cycle -
+					     p->calls[p->depth].start);
+		}
+	}
+}
+
+void sim_run_until(struct sim *sim, avr_cycle_count_t until)
+{
+	int state;
+
+	while (sim->avr->cycle < until) {
+		state = avr_run(sim->avr);
+		if (state == cpu_Done || state == cpu_Crashed) {
+			fprintf(stderr, "The firmware stopped at 0x%x\n",
+				sim->avr->pc);
+			exit(1);
+		}
+		sim_check_probes(sim);
+	}
+}
+
+avr_cycle_count_t sim_us_to_cycles(struct sim *sim, uint64_t us)
+{
+	return us * sim->avr->frequency / 1000000;
+}
+
+uint64_t sim_cycles_to_us(struct sim *sim, avr_cycle_count_t cycles)
+{
+	return cycles * 1000000 / sim->avr->frequency;
+}
+
+void sim_run_us(struct sim *sim, uint32_t us)
+{
+	sim_run_until(sim, sim->avr->cycle + sim_us_to_cycles(sim, us));
+}
+
+int sim_parse_pin(const char *str, struct sim_pin *pin)
+{
+	char *end;
+
+	if (str[0] < 'A' || str[0] > 'L')
+		return -EINVAL;
+
+	pin->port = str[0];
+	pin->pin = strtoul(str + 1, &end, 10);
+	if (end == str + 1 || *end || pin->pin > 7)
+		return -EINVAL;
+
+	return 0;
+}
+
+avr_irq_t *sim_get_pin_irq(struct sim *sim, const struct sim_pin *pin)
+{
+	return avr_io_getirq(sim->avr, AVR_IOCTL_IOPORT_GETIRQ(pin->port),
+			     pin->pin);
+}
+
+uint8_t wiegand_encode_card(uint32_t card, uint8_t *bits)
+{
+	uint8_t i, p;
+
+	for (i = 0; i < 24; i++)
+		bits[1 + i] = (card >> (23 - i)) & 1;
+
+	/* Even parity of the first half */
+	for (p = 0, i = 1; i <= 12; i++)
+		p ^= bits[i];
+	bits[0] = p;
+
+	/* Odd parity of the second half */
+	for (p = 1, i = 13; i <= 24; i++)
+		p ^= bits[i];
+	bits[25] = p;
+
+	return 26;
+}
+
+uint8_t wiegand_encode_key(uint8_t key, uint8_t *bits)
+{
+	uint8_t i;
+
+	for (i = 0; i < 4; i++)
+		bits[i] = (key >> (3 - i)) & 1;
+
+	return 4;
+}
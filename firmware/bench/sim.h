@@ -0,0 +1,100 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sim_avr.h>
+
+/* Helpers to run the firmware in simavr, shared by the benchmark tools */
+
+struct sim;
+
+#define SIM_PROBE_MAX_DEPTH		4
+
+/* A probe watch the calls to a function. The calls start when the PC
+ * reach the function entry and end when it reach the return address
+ * with the stack pointer back to its value before the call. Interrupts
+ * can nest calls, the time spent in interrupts is included. */
+struct sim_probe {
+	const char *name;
+	uint32_t addr;
+
+	/* Called at the function entry, the arguments are in the registers */
+	void (*on_enter)(struct sim *sim, struct sim_probe *p);
+	/* Called on return, the return value is in the registers */
+	void (*on_return)(struct sim *sim, struct sim_probe *p,
+			  avr_cycle_count_t cycles);
+	void *context;
+
+	/* Running calls */
+	struct {
+		uint32_t ret;
+		uint16_t sp;
+		avr_cycle_count_t start;
+	} calls[SIM_PROBE_MAX_DEPTH];
+	uint8_t depth;
+};
+
+struct sim_pin {
+	char port;
+	uint8_t pin;
+};
+
+struct sim {
+	const char *firmware;
+	avr_t *avr;
+
+	struct sim_probe *probes;
+	unsigned int num_probes;
+};
+
+/* Get the address and size of a symbol, the data addresses are
+ * returned without the offset of the data section. */
+int sim_get_symbol(struct sim *sim, const char *name,
+		   uint32_t *addr, uint32_t *size);
+
+/* Resolve the address of all the probes */
+int sim_find_probes(struct sim *sim);
+
+/* Load the firmware with the given EEPROM content */
+int sim_start(struct sim *sim, const char *mcu, uint32_t frequency,
+	      const void *eeprom, size_t eeprom_size);
+
+void sim_stop(struct sim *sim);
+
+void sim_run_until(struct sim *sim, avr_cycle_count_t until);
+
+void sim_run_us(struct sim *sim, uint32_t us);
+
+avr_cycle_count_t sim_us_to_cycles(struct sim *sim, uint64_t us);
+
+uint64_t sim_cycles_to_us(struct sim *sim, avr_cycle_count_t cycles);
+
+/* Read a register, a 16 bits argument start on an even register */
+static inline uint8_t sim_get_reg(struct sim *sim, uint8_t reg)
+{
+	return sim->avr->data[reg];
+}
+
+static inline uint16_t sim_get_reg16(struct sim *sim, uint8_t reg)
+{
+	return sim->avr->data[reg] | (sim->avr->data[reg + 1] << 8);
+}
+
+static inline uint32_t sim_get_reg32(struct sim *sim, uint8_t reg)
+{
+	return sim_get_reg16(sim, reg) |
+		((uint32_t)sim_get_reg16(sim, reg + 2) << 16);
+}
+
+/* Parse a pin name like B4 */
+int sim_parse_pin(const char *str, struct sim_pin *pin);
+
+avr_irq_t *sim_get_pin_irq(struct sim *sim, const struct sim_pin *pin);
+
+/* Wiegand encoding, the first bit is sent first */
+uint8_t wiegand_encode_card(uint32_t card, uint8_t *bits);
+
+uint8_t wiegand_encode_key(uint8_t key, uint8_t *bits);
+
+#endif /* SIM_H */
@@ -15,3 +15,9 @@
 
 /* No OTP support */
 #define WITH_OTP		0
+
+/* No audit log, the EEPROM is too small */
+#define AUDIT_LOG_SIZE		0
+
+/* No access schedules without RTC */
+#define NUM_ACCESS_SCHEDULES	0
@@ -15,3 +15,9 @@
 
 /* Enable TOTP and HOTP support */
 #define WITH_OTP		1
+
+/* Number of entries in the audit log, must be a power of 2 */
+#define AUDIT_LOG_SIZE		16
+
+/* Number of access groups with a schedule */
+#define NUM_ACCESS_SCHEDULES	4
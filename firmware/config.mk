@@ -34,3 +34,5 @@ WITH_RTC := $(call CPP_COND,$(BOARD_H),HAS_RTC)
 WITH_RTC_DS3231 := $(call CPP_COND,$(BOARD_H),HAS_RTC && DS3231_ADDR)
 
 WITH_OTP := $(call CPP_COND,$(BOARD_H),WITH_OTP)
+
+WITH_AUDIT_LOG := $(call CPP_COND,$(BOARD_H),AUDIT_LOG_SIZE)
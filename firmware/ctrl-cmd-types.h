@@ -5,7 +5,7 @@
 #include "eeprom-types.h"
 
 #define CTRL_MSG_HEADER_SIZE		2
-#define CTRL_MSG_MAX_PAYLOAD_SIZE	20
+#define CTRL_MSG_MAX_PAYLOAD_SIZE	32
 
 struct ctrl_msg {
 	uint8_t type;
@@ -108,6 +108,89 @@ struct ctrl_msg {
  */
 #define CTRL_CMD_GET_USED_ACCESS_V2	34
 
+/* Input:  struct ctrl_cmd_get_access_records
+ * Output: struct ctrl_cmd_resp_access_records, with only count records
+ */
+#define CTRL_CMD_GET_ACCESS_RECORDS_V2	35
+
+/* Input:  none
+ * Output: struct ctrl_cmd_resp_acl_digest
+ */
+#define CTRL_CMD_GET_ACL_DIGEST		36
+
+/* Input:  struct ctrl_cmd_get_access_group
+ * Output: struct access_group
+ */
+#define CTRL_CMD_GET_ACCESS_GROUP	37
+
+/* Input:  struct ctrl_cmd_set_access_group
+ * Output: none
+ */
+#define CTRL_CMD_SET_ACCESS_GROUP	38
+
+/* Input:  struct access_record_v2
+ * Output: none
+ *
+ * Like CTRL_CMD_SET_ACCESS_V2 but an existing HOTP record with the
+ * same key keeps its used flag and its counter is never moved back.
+ */
+#define CTRL_CMD_UPDATE_ACCESS_V2	39
+
+/* Input:  struct ctrl_cmd_get_audit_log
+ * Output: struct ctrl_cmd_resp_audit_log, with only count entries
+ */
+#define CTRL_CMD_GET_AUDIT_LOG		40
+
+/* Input:  struct ctrl_cmd_get_access_schedule
+ * Output: struct access_schedule
+ */
+#define CTRL_CMD_GET_ACCESS_SCHEDULE	41
+
+/* Input:  struct ctrl_cmd_set_access_schedule
+ * Output: none
+ */
+#define CTRL_CMD_SET_ACCESS_SCHEDULE	42
+
+/* Input:  none
+ * Output: struct ctrl_stats
+ */
+#define CTRL_CMD_GET_STATS		50
+
+/* Input:  none
+ * Output: none
+ */
+#define CTRL_CMD_RESET_STATS		51
+
+/* Input:  struct ctrl_cmd_get_latency_hist
+ * Output: struct ctrl_latency_hist
+ */
+#define CTRL_CMD_GET_LATENCY_HIST	52
+
+/* Input:  struct ctrl_cmd_get_trace
+ * Output: struct ctrl_cmd_resp_trace, with only count entries
+ * Only available when the firmware is built with TRACE.
+ */
+#define CTRL_CMD_GET_TRACE		53
+
+/* Input:  none
+ * Output: struct ctrl_memory_info
+ */
+#define CTRL_CMD_GET_MEMORY_INFO	54
+
+/* Input:  none
+ * Output: struct ctrl_eeprom_raw_info
+ */
+#define CTRL_CMD_GET_EEPROM_RAW_INFO	60
+
+/* Input:  struct ctrl_cmd_read_eeprom_raw
+ * Output: length bytes of the EEPROM, the root key reads as zeros
+ */
+#define CTRL_CMD_READ_EEPROM_RAW	61
+
+/* Input:  struct ctrl_cmd_write_eeprom_raw
+ * Output: none
+ */
+#define CTRL_CMD_WRITE_EEPROM_RAW	62
 
 /* Payload depend on the query */
 #define CTRL_CMD_OK			0
@@ -117,9 +200,42 @@ struct ctrl_msg {
 /* The base id for all event signaling */
 #define CTRL_EVENT_BASE			127
 
-/* No payload, just indicate that the system started */
+/* Payload: struct device_descriptor, indicate that the system started */
 #define CTRL_EVENT_STARTED		(CTRL_EVENT_BASE + 0)
 
+/* Payload: struct ctrl_event_door */
+#define CTRL_EVENT_ACCESS_GRANTED	(CTRL_EVENT_BASE + 1)
+
+/* Payload: struct ctrl_event_door */
+#define CTRL_EVENT_ACCESS_DENIED	(CTRL_EVENT_BASE + 2)
+
+/* Payload: struct ctrl_event_door, the door was opened while locked */
+#define CTRL_EVENT_DOOR_FORCED		(CTRL_EVENT_BASE + 3)
+
+/* Payload: struct ctrl_event_door, the door has been open for too long */
+#define CTRL_EVENT_DOOR_HELD		(CTRL_EVENT_BASE + 4)
+
+/* Payload: struct ctrl_event_door, with the error code */
+#define CTRL_EVENT_READER_ERROR		(CTRL_EVENT_BASE + 5)
+
+/* Payload: struct ctrl_event_door, with the back-off delay in seconds,
+ * the door rejects everything until it is over */
+#define CTRL_EVENT_DOOR_BACKOFF		(CTRL_EVENT_BASE + 6)
+
+/* Payload: struct ctrl_event_door, with the error code, sent after the
+ * started event if the EEPROM layout could not be upgraded. The old
+ * layout is kept, without audit log, groups and schedules. */
+#define CTRL_EVENT_LAYOUT_ERROR		(CTRL_EVENT_BASE + 8)
+
+/* Largest payload sent with an event */
+#define CTRL_EVENT_MAX_PAYLOAD_SIZE	12
+
+/* Index used in events when no access record is involved */
+#define CTRL_EVENT_NO_RECORD		0xFFFF
+/* Index used in the access denied events when the credentials have not
+ * been checked because the door is in back-off */
+#define CTRL_EVENT_BACKOFF_RECORD	0xFFFE
+
 struct device_descriptor {
 	uint8_t major_version;
 	uint8_t minor_version;
@@ -173,4 +289,175 @@ struct ctrl_cmd_resp_used_access_v2 {
 	struct access_record_v2 record;
 } PACKED;
 
+struct ctrl_cmd_get_access_records {
+	/* 0 to start, otherwise the index of the last record received */
+	uint16_t start;
+} PACKED;
+
+#define CTRL_ACCESS_RECORDS_MAX_RECORDS	2
+
+struct ctrl_cmd_resp_access_records {
+	/* No record is returned once the end has been reached */
+	uint8_t count;
+	/* The index is offset by one like with CTRL_CMD_GET_USED_ACCESS_V2 */
+	struct ctrl_cmd_resp_used_access_v2 record[CTRL_ACCESS_RECORDS_MAX_RECORDS];
+} PACKED;
+
+struct ctrl_cmd_resp_acl_digest {
+	/* CRC16 over the index and content of all the records, excluding
+	 * the data that change when the records are used. */
+	uint16_t digest;
+	/* Number of records */
+	uint16_t count;
+} PACKED;
+
+struct ctrl_cmd_get_access_group {
+	uint8_t id;
+} PACKED;
+
+struct ctrl_cmd_set_access_group {
+	uint8_t id;
+	struct access_group group;
+} PACKED;
+
+struct ctrl_cmd_get_access_schedule {
+	/* Id of the group using the schedule */
+	uint8_t id;
+} PACKED;
+
+struct ctrl_cmd_set_access_schedule {
+	uint8_t id;
+	struct access_schedule schedule;
+} PACKED;
+
+struct ctrl_cmd_get_audit_log {
+	/* Sequence number of the last entry already seen */
+	uint16_t seq;
+} PACKED;
+
+#define CTRL_AUDIT_LOG_MAX_ENTRIES	4
+
+struct ctrl_cmd_resp_audit_log {
+	/* Sequence number of the first entry */
+	uint16_t seq;
+	uint8_t count;
+	struct audit_log_entry entry[CTRL_AUDIT_LOG_MAX_ENTRIES];
+} PACKED;
+
+struct ctrl_stats {
+	/* Works dropped because the work queue was full */
+	uint16_t work_queue_overflows;
+	/* Errors reported by the Wiegand readers */
+	uint16_t reader_errors;
+	/* Messages received with a bad CRC */
+	uint16_t crc_errors;
+	/* EEPROM block writes */
+	uint32_t eeprom_writes;
+	/* Calls to acl_check_access() */
+	uint32_t access_checks;
+	/* OTP values computed */
+	uint32_t otp_computations;
+	/* Longest run of a single work, in milliseconds */
+	uint16_t max_work_time;
+	/* Access checks answered from the cache of rejected credentials */
+	uint16_t reject_cache_hits;
+	/* Back-offs started after repeated rejections */
+	uint16_t door_backoffs;
+	/* Credentials rejected without any check during a back-off */
+	uint16_t backoff_rejects;
+} PACKED;
+
+/* Bucket 0 count the latencies below 2^(SHIFT + 1) us, bucket N those in
+ * [2^(SHIFT + N), 2^(SHIFT + N + 1)) and the last one everything above. */
+#define CTRL_LATENCY_HIST_BUCKETS	16
+#define CTRL_LATENCY_HIST_SHIFT		8
+
+struct ctrl_cmd_get_latency_hist {
+	uint8_t door;
+	/* Clear the histogram after reading it */
+	uint8_t reset;
+} PACKED;
+
+/* Time from the last Wiegand bit to the open or reject decision */
+struct ctrl_latency_hist {
+	uint16_t count[CTRL_LATENCY_HIST_BUCKETS];
+} PACKED;
+
+struct ctrl_trace_entry {
+	/* Trace point, see trace.h */
+	uint8_t id;
+	uint8_t arg;
+	/* Time from timer_get_time_us(), wraps after 65ms */
+	uint16_t time;
+} PACKED;
+
+struct ctrl_cmd_get_trace {
+	/* Sequence number of the last entry already seen */
+	uint16_t seq;
+} PACKED;
+
+#define CTRL_TRACE_MAX_ENTRIES		7
+
+struct ctrl_cmd_resp_trace {
+	/* Sequence number of the first entry */
+	uint16_t seq;
+	uint8_t count;
+	struct ctrl_trace_entry entry[CTRL_TRACE_MAX_ENTRIES];
+} PACKED;
+
+/* All sizes in bytes */
+struct ctrl_memory_info {
+	uint16_t ram_size;
+	/* Data, BSS and no init sections */
+	uint16_t static_size;
+	/* Deepest stack usage since the boot */
+	uint16_t stack_max;
+	/* Smallest free space left between the static data and the stack */
+	uint16_t stack_free;
+} PACKED;
+
+struct ctrl_eeprom_raw_info {
+	/* Size of the EEPROM image */
+	uint16_t size;
+	/* Xmodem CRC of the whole image, with the root key as zeros */
+	uint16_t crc;
+} PACKED;
+
+struct ctrl_cmd_read_eeprom_raw {
+	uint16_t offset;
+	/* At most CTRL_MSG_MAX_PAYLOAD_SIZE */
+	uint8_t length;
+} PACKED;
+
+#define CTRL_EEPROM_RAW_CHUNK_SIZE	28
+
+/* Also write the root key, otherwise it is left untouched */
+#define CTRL_EEPROM_RAW_ROOT_KEY	0x01
+
+struct ctrl_cmd_write_eeprom_raw {
+	uint16_t offset;
+	uint8_t length;
+	uint8_t flags;
+	uint8_t data[CTRL_EEPROM_RAW_CHUNK_SIZE];
+} PACKED;
+
+struct ctrl_event_door {
+	/* Time of the event in seconds since the Unix epoch */
+	uint32_t time;
+	/* Access record that matched, CTRL_EVENT_NO_RECORD if none or
+	 * CTRL_EVENT_BACKOFF_RECORD if the credentials were not checked */
+	uint16_t index;
+	uint8_t door;
+	/* Credentials type (ACCESS_TYPE_*), ACCESS_TYPE_NONE for door events */
+	uint8_t type;
+	union {
+		/* Card that has been presented, 0 if none */
+		uint32_t card;
+		/* Error code for the reader errors */
+		int32_t error;
+		/* Delay in seconds for the back-off */
+		uint32_t delay;
+	};
+} PACKED;
+
 #endif /* CTRL_CMD_TYPES_H */
@@ -6,9 +6,14 @@
 #include "uart.h"
 #include "uart-ctrl-transport.h"
 #include "ctrl-cmd.h"
+#include "acl.h"
 #include "eeprom.h"
+#include "audit-log.h"
 #include "work-queue.h"
 #include "rtc.h"
+#include "stack.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 
 struct ctrl_cmd_desc {
@@ -25,9 +30,9 @@ struct ctrl_cmd_handler {
 void ctrl_cmd_init_device_descriptor(struct device_descriptor *desc)
 {
 	desc->major_version = 0;
-	desc->minor_version = 3;
+	desc->minor_version = 16;
 	desc->num_doors = NUM_DOORS;
-	desc->num_access_records = NUM_ACCESS_RECORDS;
+	desc->num_access_records = eeprom_get_num_access_records();
 	desc->free_access_records = eeprom_get_free_access_record_count();
 }
 
@@ -158,6 +163,19 @@ static int8_t ctrl_cmd_set_access_v2(
 	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, NULL, 0);
 }
 
+static int8_t ctrl_cmd_update_access_v2(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct access_record_v2 *record = payload;
+	int8_t err;
+
+	err = eeprom_update_access_record(record);
+	if (err)
+		return err;
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, NULL, 0);
+}
+
 static int8_t ctrl_cmd_get_access(
 	struct ctrl_transport *ctrl, const void *payload)
 {
@@ -277,6 +295,119 @@ static int8_t ctrl_cmd_get_used_access_v2(
 	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, &resp, sizeof(resp));
 }
 
+static int8_t access_record_is_set(
+	const struct access_record_hdr *hdr, const void *val)
+{
+	return hdr->type != ACCESS_RECORD_TYPE(NONE, NONE);
+}
+
+static int8_t ctrl_cmd_get_access_records_v2(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct ctrl_cmd_get_access_records *get = payload;
+	struct ctrl_cmd_resp_access_records resp;
+	struct ctrl_cmd_resp_used_access_v2 *r;
+	uint16_t idx;
+	int8_t err;
+
+	/* Same index offset as with CTRL_CMD_GET_USED_ACCESS_V2 */
+	if (get->start == 0)
+		idx = ACCESS_RECORD_ITER_START;
+	else
+		idx = get->start - 1;
+
+	for (resp.count = 0; resp.count < ARRAY_SIZE(resp.record);
+	     resp.count++) {
+		r = &resp.record[resp.count];
+		err = eeprom_get_next_access_record(
+			&idx, &r->record, access_record_is_set, NULL);
+		if (err == -ENOENT)
+			break;
+		if (err)
+			return err;
+		r->index = idx + 1;
+	}
+
+	return ctrl_transport_reply(
+		ctrl, CTRL_CMD_OK, &resp,
+		offsetof(struct ctrl_cmd_resp_access_records, record) +
+		resp.count * sizeof(resp.record[0]));
+}
+
+static int8_t ctrl_cmd_get_acl_digest(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	struct ctrl_cmd_resp_acl_digest resp;
+	uint16_t count;
+
+	resp.digest = eeprom_get_access_records_digest(&count);
+	resp.count = count;
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, &resp, sizeof(resp));
+}
+
+static int8_t ctrl_cmd_get_access_group(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct ctrl_cmd_get_access_group *get = payload;
+	struct access_group grp;
+	int8_t err;
+
+	err = eeprom_get_access_group(get->id, &grp);
+	if (err)
+		return err;
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, &grp, sizeof(grp));
+}
+
+static int8_t ctrl_cmd_set_access_group(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct ctrl_cmd_set_access_group *set = payload;
+	int8_t err;
+
+	if (set->group.doors & ~(BIT(NUM_DOORS) - 1))
+		return -EINVAL;
+
+	err = eeprom_set_access_group(set->id, &set->group);
+	if (err)
+		return err;
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, NULL, 0);
+}
+
+static int8_t ctrl_cmd_get_access_schedule(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct ctrl_cmd_get_access_schedule *get = payload;
+	struct access_schedule sch;
+	int8_t err;
+
+	err = eeprom_get_access_schedule(get->id, &sch);
+	if (err)
+		return err;
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, &sch, sizeof(sch));
+}
+
+static int8_t ctrl_cmd_set_access_schedule(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct ctrl_cmd_set_access_schedule *set = payload;
+	int8_t err;
+
+	/* No week day is valid and suspends the group, but an
+	 * erased schedule can't be written as it is unrestricted. */
+	if (set->schedule.weekdays & ~ACCESS_SCHEDULE_ALL_WEEKDAYS)
+		return -EINVAL;
+
+	err = eeprom_set_access_schedule(set->id, &set->schedule);
+	if (err)
+		return err;
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, NULL, 0);
+}
+
 static int8_t ctrl_cmd_get_time(
 	struct ctrl_transport *ctrl, const void *payload)
 {
@@ -302,6 +433,7 @@ static int8_t ctrl_cmd_set_time(
 	}
 
 	set_system_time(t);
+	acl_on_time_changed();
 
 	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, NULL, 0);
 }
@@ -357,6 +489,127 @@ static int8_t ctrl_cmd_set_controller_config(
 	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, NULL, 0);
 }
 
+static int8_t ctrl_cmd_get_audit_log(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct ctrl_cmd_get_audit_log *get = payload;
+	struct ctrl_cmd_resp_audit_log resp;
+
+	resp.count = audit_log_get(get->seq, &resp.seq, resp.entry,
+				   ARRAY_SIZE(resp.entry));
+
+	return ctrl_transport_reply(
+		ctrl, CTRL_CMD_OK, &resp,
+		offsetof(struct ctrl_cmd_resp_audit_log, entry) +
+		resp.count * sizeof(resp.entry[0]));
+}
+
+static int8_t ctrl_cmd_get_stats(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	struct ctrl_stats s;
+
+	stats_get(&s);
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, &s, sizeof(s));
+}
+
+static int8_t ctrl_cmd_reset_stats(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	stats_reset();
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, NULL, 0);
+}
+
+static int8_t ctrl_cmd_get_latency_hist(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct ctrl_cmd_get_latency_hist *get = payload;
+	struct ctrl_latency_hist hist;
+	int8_t err;
+
+	err = stats_get_latency(get->door, &hist, get->reset);
+	if (err)
+		return err;
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, &hist, sizeof(hist));
+}
+
+static int8_t ctrl_cmd_get_memory_info(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	struct ctrl_memory_info info;
+
+	stack_get_info(&info);
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, &info, sizeof(info));
+}
+
+static int8_t ctrl_cmd_get_eeprom_raw_info(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	struct ctrl_eeprom_raw_info info;
+
+	info.size = eeprom_get_raw_size();
+	info.crc = eeprom_get_raw_crc();
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, &info, sizeof(info));
+}
+
+static int8_t ctrl_cmd_read_eeprom_raw(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct ctrl_cmd_read_eeprom_raw *read = payload;
+	uint8_t data[CTRL_MSG_MAX_PAYLOAD_SIZE];
+	int8_t err;
+
+	if (read->length > sizeof(data))
+		return -EINVAL;
+
+	err = eeprom_read_raw(read->offset, data, read->length);
+	if (err)
+		return err;
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, data, read->length);
+}
+
+static int8_t ctrl_cmd_write_eeprom_raw(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct ctrl_cmd_write_eeprom_raw *write = payload;
+	int8_t err;
+
+	if (write->length > sizeof(write->data))
+		return -EINVAL;
+
+	err = eeprom_write_raw(write->offset, write->data, write->length,
+			       write->flags & CTRL_EEPROM_RAW_ROOT_KEY);
+	if (err)
+		return err;
+
+	return ctrl_transport_reply(ctrl, CTRL_CMD_OK, NULL, 0);
+}
+
+#if TRACE
+static int8_t ctrl_cmd_get_trace(
+	struct ctrl_transport *ctrl, const void *payload)
+{
+	const struct ctrl_cmd_get_trace *get = payload;
+	struct ctrl_cmd_resp_trace resp;
+	uint16_t seq;
+
+	resp.count = trace_get(get->seq, &seq, resp.entry,
+			       ARRAY_SIZE(resp.entry));
+	resp.seq = seq;
+
+	return ctrl_transport_reply(
+		ctrl, CTRL_CMD_OK, &resp,
+		offsetof(struct ctrl_cmd_resp_trace, entry) +
+		resp.count * sizeof(resp.entry[0]));
+}
+#endif
+
 static const struct ctrl_cmd_desc ctrl_cmd_desc[] PROGMEM = {
 	{
 		.type    = CTRL_CMD_GET_DEVICE_DESCRIPTOR,
@@ -408,6 +661,11 @@ static const struct ctrl_cmd_desc ctrl_cmd_desc[] PROGMEM = {
 		.length  = sizeof(struct access_record_v2),
 		.handler = ctrl_cmd_set_access_v2,
 	},
+	{
+		.type    = CTRL_CMD_UPDATE_ACCESS_V2,
+		.length  = sizeof(struct access_record_v2),
+		.handler = ctrl_cmd_update_access_v2,
+	},
 	{
 		.type    = CTRL_CMD_GET_ACCESS,
 		.length  = sizeof(struct access_record),
@@ -433,6 +691,83 @@ static const struct ctrl_cmd_desc ctrl_cmd_desc[] PROGMEM = {
 		.length  = sizeof(struct ctrl_cmd_get_used_access),
 		.handler = ctrl_cmd_get_used_access_v2,
 	},
+	{
+		.type    = CTRL_CMD_GET_ACCESS_RECORDS_V2,
+		.length  = sizeof(struct ctrl_cmd_get_access_records),
+		.handler = ctrl_cmd_get_access_records_v2,
+	},
+	{
+		.type    = CTRL_CMD_GET_ACL_DIGEST,
+		.length  = 0,
+		.handler = ctrl_cmd_get_acl_digest,
+	},
+	{
+		.type    = CTRL_CMD_GET_ACCESS_GROUP,
+		.length  = sizeof(struct ctrl_cmd_get_access_group),
+		.handler = ctrl_cmd_get_access_group,
+	},
+	{
+		.type    = CTRL_CMD_SET_ACCESS_GROUP,
+		.length  = sizeof(struct ctrl_cmd_set_access_group),
+		.handler = ctrl_cmd_set_access_group,
+	},
+	{
+		.type    = CTRL_CMD_GET_AUDIT_LOG,
+		.length  = sizeof(struct ctrl_cmd_get_audit_log),
+		.handler = ctrl_cmd_get_audit_log,
+	},
+	{
+		.type    = CTRL_CMD_GET_ACCESS_SCHEDULE,
+		.length  = sizeof(struct ctrl_cmd_get_access_schedule),
+		.handler = ctrl_cmd_get_access_schedule,
+	},
+	{
+		.type    = CTRL_CMD_SET_ACCESS_SCHEDULE,
+		.length  = sizeof(struct ctrl_cmd_set_access_schedule),
+		.handler = ctrl_cmd_set_access_schedule,
+	},
+	{
+		.type    = CTRL_CMD_GET_STATS,
+		.length  = 0,
+		.handler = ctrl_cmd_get_stats,
+	},
+	{
+		.type    = CTRL_CMD_RESET_STATS,
+		.length  = 0,
+		.handler = ctrl_cmd_reset_stats,
+	},
+	{
+		.type    = CTRL_CMD_GET_LATENCY_HIST,
+		.length  = sizeof(struct ctrl_cmd_get_latency_hist),
+		.handler = ctrl_cmd_get_latency_hist,
+	},
+	{
+		.type    = CTRL_CMD_GET_MEMORY_INFO,
+		.length  = 0,
+		.handler = ctrl_cmd_get_memory_info,
+	},
+#if TRACE
+	{
+		.type    = CTRL_CMD_GET_TRACE,
+		.length  = sizeof(struct ctrl_cmd_get_trace),
+		.handler = ctrl_cmd_get_trace,
+	},
+#endif
+	{
+		.type    = CTRL_CMD_GET_EEPROM_RAW_INFO,
+		.length  = 0,
+		.handler = ctrl_cmd_get_eeprom_raw_info,
+	},
+	{
+		.type    = CTRL_CMD_READ_EEPROM_RAW,
+		.length  = sizeof(struct ctrl_cmd_read_eeprom_raw),
+		.handler = ctrl_cmd_read_eeprom_raw,
+	},
+	{
+		.type    = CTRL_CMD_WRITE_EEPROM_RAW,
+		.length  = sizeof(struct ctrl_cmd_write_eeprom_raw),
+		.handler = ctrl_cmd_write_eeprom_raw,
+	},
 	{
 		.type    = CTRL_CMD_GET_TIME,
 		.length  = 0,
@@ -461,6 +796,8 @@ static void on_ctrl_transport_received_msg(
 	struct ctrl_cmd_desc desc;
 	int8_t i, err;
 
+	trace(TRACE_CTRL_CMD, msg->type);
+
 	for (i = 0; i < ARRAY_SIZE(ctrl_cmd_desc); i++) {
 		memcpy_P(&desc, &ctrl_cmd_desc[i], sizeof(desc));
 		if (desc.type == msg->type)
@@ -512,3 +849,9 @@ int8_t ctrl_send_event(uint8_t type, const void *payload, uint8_t length)
 	return ctrl_transport_send_event(
 		&ctrl_cmd_handler.transport, type, payload, length);
 }
+
+int8_t ctrl_send_door_event(uint8_t type, struct ctrl_event_door *event)
+{
+	event->time = time(NULL) + UNIX_OFFSET;
+	return ctrl_send_event(type, event, sizeof(*event));
+}
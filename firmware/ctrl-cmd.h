@@ -8,6 +8,9 @@ int8_t ctrl_cmd_init(void);
 
 int8_t ctrl_send_event(uint8_t type, const void *payload, uint8_t length);
 
+/* Send a door event, its time is filled in here */
+int8_t ctrl_send_door_event(uint8_t type, struct ctrl_event_door *event);
+
 void ctrl_cmd_init_device_descriptor(struct device_descriptor *desc);
 
 #endif /* CTRL_CMD_H */
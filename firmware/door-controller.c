@@ -6,24 +6,35 @@
 #include "timer.h"
 #include "utils.h"
 #include "door-controller.h"
+#include "stats.h"
+#include "trace.h"
 
 #define BUTTON_DEBOUNCE_DELAY		100
 
 #define IDLE_TIMEOUT			10000
 #define BUZZER_ERROR_DURATION		400
+#define DOOR_HELD_TIMEOUT		30000
+
+/* After BACKOFF_THRESHOLD rejections in a row the door rejects everything
+ * for BACKOFF_MIN_DELAY, doubled for each further rejection. The count is
+ * cleared by an access or after BACKOFF_FORGET_TIMEOUT without rejection. */
+#define BACKOFF_THRESHOLD		3
+#define BACKOFF_MIN_DELAY		1000
+#define BACKOFF_MAX_DELAY		30000
+#define BACKOFF_FORGET_TIMEOUT		30000
 
 #define DOOR_OPEN_FROM_READER		0
 #define DOOR_OPEN_FROM_BUTTON		1
 
-static const uint16_t buzzer_rejected_seq[] = {
+static const uint16_t buzzer_rejected_seq[] PROGMEM = {
 	0, 200, 600, 200, 600, 200, 600
 };
 
-static const uint16_t buzzer_timeout_seq[] = {
+static const uint16_t buzzer_timeout_seq[] PROGMEM = {
 	0, 100, 200, 100, 200, 100, 200
 };
 
-static const uint16_t buzzer_accepted_seq[] = {
+static const uint16_t buzzer_accepted_seq[] PROGMEM = {
 	0, 100, 200 /*, 100, 200*/
 };
 
@@ -31,7 +42,7 @@ static const uint16_t buzzer_accepted_seq[] = {
 #include <stdio.h>
 #include "uart.h"
 
-static const char *state_names[] = {
+static const char state_names[][9] PROGMEM = {
 	"IDLE",
 	"READ PIN",
 	"OPENING",
@@ -42,17 +53,18 @@ static const char *state_names[] = {
 
 static char print_buf[32];
 
+/* The name is in PROGMEM */
 static const char *state_name(enum door_state state)
 {
 	if (state < 0 || state >= ARRAY_SIZE(state_names))
-		return "";
+		return PSTR("");
 	else
 		return state_names[state];
 }
 
 static void door_ctrl_show_state(struct door_ctrl *dc, enum door_state state)
 {
-	static const char fmt[] PROGMEM = "[%d]-> %x (%s)\r\n";
+	static const char fmt[] PROGMEM = "[%d]-> %x (%S)\r\n";
 
 	snprintf_P(print_buf, sizeof(print_buf), fmt,
 		   dc->door_id, state, state_name(state));
@@ -77,6 +89,7 @@ static void door_ctrl_set_state(struct door_ctrl *dc, enum door_state state)
 		return;
 
 	dc->state = state;
+	trace(TRACE_DOOR_STATE, (dc->door_id << 4) | state);
 	/* If the new state ends the processing deschdule the idle timer */
 	switch (state) {
 	case DOOR_CTRL_IDLE:
@@ -102,13 +115,98 @@ static void on_idle_timeout(void *context)
 	door_ctrl_event(dc, DOOR_CTRL_EVENT_IDLE_TIMEOUT, WORK_ARG(NULL));
 }
 
+static void on_held_timeout(void *context)
+{
+	struct door_ctrl *dc = context;
+
+	door_ctrl_event(dc, DOOR_CTRL_EVENT_HELD_TIMEOUT, WORK_ARG(NULL));
+}
+
+static void on_backoff_timeout(void *context)
+{
+	struct door_ctrl *dc = context;
+
+	door_ctrl_event(dc, DOOR_CTRL_EVENT_BACKOFF_TIMEOUT, WORK_ARG(NULL));
+}
+
+static void door_ctrl_notify_event(struct door_ctrl *dc,
+				   uint8_t what, int8_t err)
+{
+	if (dc->notify)
+		dc->notify(dc->door_id, what, err, dc->notify_context);
+}
+
+static void door_ctrl_schedule_backoff(struct door_ctrl *dc, uint16_t delay)
+{
+	work_queue_deschedule(&dc->hdlr, DOOR_CTRL_EVENT_BACKOFF_TIMEOUT);
+	timer_schedule_in(&dc->backoff_timer, delay);
+}
+
+static void door_ctrl_add_failure(struct door_ctrl *dc)
+{
+	uint16_t delay;
+	uint8_t n;
+
+	if (dc->failures < UINT8_MAX)
+		dc->failures++;
+
+	if (dc->failures < BACKOFF_THRESHOLD) {
+		door_ctrl_schedule_backoff(dc, BACKOFF_FORGET_TIMEOUT);
+		return;
+	}
+
+	n = dc->failures - BACKOFF_THRESHOLD;
+	delay = n < 5 ? BACKOFF_MIN_DELAY << n : BACKOFF_MAX_DELAY;
+	if (delay > BACKOFF_MAX_DELAY)
+		delay = BACKOFF_MAX_DELAY;
+
+	dc->backoff = 1;
+	stats.door_backoffs++;
+	door_ctrl_schedule_backoff(dc, delay);
+	door_ctrl_notify_event(dc, DOOR_CTRL_NOTIFY_BACKOFF, delay / 1000);
+}
+
+static void door_ctrl_backoff_timeout(struct door_ctrl *dc)
+{
+	if (dc->backoff) {
+		/* Keep the count for a while to escalate on the next one */
+		dc->backoff = 0;
+		door_ctrl_schedule_backoff(dc, BACKOFF_FORGET_TIMEOUT);
+	} else {
+		dc->failures = 0;
+	}
+}
+
 static int8_t door_ctrl_check_key(struct door_ctrl *dc, uint8_t type,
 				  uint32_t card, uint32_t pin)
 {
+	int8_t err;
+
 	if (!dc->check_key)
 		return -ENOENT;
 
-	return dc->check_key(dc->door_id, type, card, pin, dc->check_context);
+	/* Don't even look at the credentials during a back-off */
+	if (dc->backoff) {
+		stats.backoff_rejects++;
+		if (dc->report_key)
+			dc->report_key(dc->door_id, type, card, -EBUSY,
+				       dc->check_context);
+		return -EBUSY;
+	}
+
+	trace(TRACE_DOOR_CHECK, dc->door_id);
+
+	err = dc->check_key(dc->door_id, type, card, pin, dc->check_context);
+	if (err) {
+		door_ctrl_add_failure(dc);
+	} else if (dc->failures) {
+		dc->failures = 0;
+		timer_deschedule(&dc->backoff_timer);
+		work_queue_deschedule(&dc->hdlr,
+				      DOOR_CTRL_EVENT_BACKOFF_TIMEOUT);
+	}
+
+	return err;
 }
 
 static void door_ctrl_set_open(struct door_ctrl *dc, uint8_t source,
@@ -125,6 +223,9 @@ static void door_ctrl_set_open(struct door_ctrl *dc, uint8_t source,
 		return;
 
 	if (dc->open_status) {
+		/* Drop any pending end of a previous opening */
+		work_queue_deschedule(&dc->hdlr, DOOR_CTRL_EVENT_OPEN_FINISHED);
+		dc->unlocked = 1;
 		trigger_set(&dc->open_trigger, 1);
 		trigger_set(&dc->led_trigger, 1);
 	} else {
@@ -135,25 +236,31 @@ static void door_ctrl_set_open(struct door_ctrl *dc, uint8_t source,
 
 static void door_ctrl_open(struct door_ctrl *dc)
 {
+	trace(TRACE_DOOR_OPEN, dc->door_id);
+	stats_add_latency(dc->door_id,
+			  wiegand_reader_time_since_last_bit(&dc->wr));
 	door_ctrl_set_state(dc, DOOR_CTRL_OPENING);
 	door_ctrl_set_open(dc, DOOR_OPEN_FROM_READER, 1);
 	door_ctrl_set_open(dc, DOOR_OPEN_FROM_READER, 0);
-	trigger_start_seq(&dc->buzzer_trigger, buzzer_accepted_seq,
-		      ARRAY_SIZE(buzzer_accepted_seq));
+	trigger_start_seq_P(&dc->buzzer_trigger, buzzer_accepted_seq,
+			    ARRAY_SIZE(buzzer_accepted_seq));
 }
 
 static void door_ctrl_reject(struct door_ctrl *dc)
 {
+	trace(TRACE_DOOR_REJECT, dc->door_id);
+	stats_add_latency(dc->door_id,
+			  wiegand_reader_time_since_last_bit(&dc->wr));
 	door_ctrl_set_state(dc, DOOR_CTRL_REJECTED);
-	trigger_start_seq(&dc->buzzer_trigger, buzzer_rejected_seq,
-			  ARRAY_SIZE(buzzer_rejected_seq));
+	trigger_start_seq_P(&dc->buzzer_trigger, buzzer_rejected_seq,
+			    ARRAY_SIZE(buzzer_rejected_seq));
 }
 
 static void door_ctrl_timeout(struct door_ctrl *dc)
 {
 	door_ctrl_set_state(dc, DOOR_CTRL_TIMEOUT);
-	trigger_start_seq(&dc->buzzer_trigger, buzzer_timeout_seq,
-			  ARRAY_SIZE(buzzer_timeout_seq));
+	trigger_start_seq_P(&dc->buzzer_trigger, buzzer_timeout_seq,
+			    ARRAY_SIZE(buzzer_timeout_seq));
 }
 
 static void door_ctrl_error(struct door_ctrl *dc)
@@ -162,6 +269,23 @@ static void door_ctrl_error(struct door_ctrl *dc)
 	trigger_start(&dc->buzzer_trigger, BUZZER_ERROR_DURATION);
 }
 
+static void door_ctrl_door_status(struct door_ctrl *dc, uint8_t open)
+{
+	/* The first report just give us the initial state */
+	if (dc->door_status_known && open && !dc->unlocked)
+		door_ctrl_notify_event(dc, DOOR_CTRL_NOTIFY_FORCED, 0);
+
+	dc->door_status_known = 1;
+	dc->door_open = open;
+
+	if (open) {
+		timer_schedule_in(&dc->held_timer, DOOR_HELD_TIMEOUT);
+	} else {
+		timer_deschedule(&dc->held_timer);
+		work_queue_deschedule(&dc->hdlr, DOOR_CTRL_EVENT_HELD_TIMEOUT);
+	}
+}
+
 static void on_event(struct worker *worker,
 		     uint8_t event, union work_arg val)
 {
@@ -189,8 +313,23 @@ static void on_event(struct worker *worker,
 	case DOOR_CTRL_EVENT_IDLE_TIMEOUT:
 		door_ctrl_timeout(dc);
 		return;
+	case DOOR_CTRL_EVENT_OPEN_FINISHED:
+		if (!dc->open_status)
+			dc->unlocked = 0;
+		return;
+	case DOOR_CTRL_EVENT_DOOR_STATUS:
+		door_ctrl_door_status(dc, val.u);
+		return;
+	case DOOR_CTRL_EVENT_HELD_TIMEOUT:
+		if (dc->door_open)
+			door_ctrl_notify_event(dc, DOOR_CTRL_NOTIFY_HELD, 0);
+		return;
+	case DOOR_CTRL_EVENT_BACKOFF_TIMEOUT:
+		door_ctrl_backoff_timeout(dc);
+		return;
 	case WIEGAND_READER_ERROR:
-		/* TODO: Handle protocol errors */
+		door_ctrl_notify_event(dc, DOOR_CTRL_NOTIFY_READER_ERROR,
+				       val.i);
 		door_ctrl_error(dc);
 		return;
 	case WIEGAND_READER_EVENT_KEY:
@@ -269,7 +408,10 @@ static void on_event(struct worker *worker,
 
 static void on_door_status_changed(uint8_t state, void *context)
 {
-	// TODO: Send an event
+	struct door_ctrl *dc = context;
+
+	door_ctrl_event(dc, DOOR_CTRL_EVENT_DOOR_STATUS,
+			WORK_ARG_UINT(state ^ dc->status_closed));
 }
 
 static void on_open_button_changed(uint8_t state, void *context)
@@ -292,12 +434,18 @@ int8_t door_ctrl_init(struct door_ctrl *dc,
 
 	dc->door_id = cfg->door_id;
 	dc->open_time = cfg->open_time;
+	dc->status_closed = cfg->status_closed;
 	dc->check_key = cfg->check_key;
+	dc->report_key = cfg->report_key;
 	dc->check_context = cfg->check_context;
+	dc->notify = cfg->notify;
+	dc->notify_context = cfg->notify_context;
 
 	dc->hdlr.execute = on_event;
 
 	timer_init(&dc->idle_timer, on_idle_timeout, dc);
+	timer_init(&dc->held_timer, on_held_timeout, dc);
+	timer_init(&dc->backoff_timer, on_backoff_timeout, dc);
 
 	err = wiegand_reader_init(
 		&dc->wr, cfg->d0_irq, cfg->d1_irq, &dc->hdlr);
@@ -305,7 +453,7 @@ int8_t door_ctrl_init(struct door_ctrl *dc,
 		return err;
 
 	err = trigger_init(&dc->open_trigger, cfg->open_gpio,
-			   NULL, 0);
+			   &dc->hdlr, DOOR_CTRL_EVENT_OPEN_FINISHED);
 	if (err)
 		return err;
 
@@ -18,6 +18,26 @@ typedef int8_t (*door_ctrl_check)(
 	uint32_t card, uint32_t pin,
 	void *context);
 
+/* Called with the credentials rejected without calling check_key,
+ * err gives the reason */
+typedef void (*door_ctrl_report)(
+	uint8_t door_id, uint8_t type,
+	uint32_t card, int8_t err,
+	void *context);
+
+/* The door has been opened while it was locked */
+#define DOOR_CTRL_NOTIFY_FORCED		0
+/* The door stayed open for too long */
+#define DOOR_CTRL_NOTIFY_HELD		1
+/* The reader reported an error */
+#define DOOR_CTRL_NOTIFY_READER_ERROR	2
+/* Too many rejections, err is the back-off delay in seconds */
+#define DOOR_CTRL_NOTIFY_BACKOFF	3
+
+typedef void (*door_ctrl_notify)(
+	uint8_t door_id, uint8_t what, int8_t err,
+	void *context);
+
 struct door_ctrl_config {
 	uint8_t door_id;
 
@@ -30,14 +50,21 @@ struct door_ctrl_config {
 	uint8_t led_gpio;
 	uint8_t buzzer_gpio;
 
+	/* Door contact, by default it is active when the door is open */
 	uint8_t status_gpio;
 	uint8_t open_btn_gpio;
 
 	uint8_t status_pull : 1;
+	/* Set if the door contact is active when the door is closed */
+	uint8_t status_closed : 1;
 	uint8_t open_btn_pull : 1;
 
 	door_ctrl_check check_key;
+	door_ctrl_report report_key;
 	void *check_context;
+
+	door_ctrl_notify notify;
+	void *notify_context;
 };
 
 enum door_state {
@@ -53,6 +80,9 @@ enum door_state {
 #define DOOR_CTRL_EVENT_BUZZER_FINISHED		11
 #define DOOR_CTRL_EVENT_OPEN_FINISHED		12
 #define DOOR_CTRL_EVENT_IDLE_TIMEOUT		13
+#define DOOR_CTRL_EVENT_DOOR_STATUS		14
+#define DOOR_CTRL_EVENT_HELD_TIMEOUT		15
+#define DOOR_CTRL_EVENT_BACKOFF_TIMEOUT		16
 
 struct door_ctrl {
 	uint8_t door_id;
@@ -67,14 +97,29 @@ struct door_ctrl {
 	uint8_t open_status;
 	struct trigger open_trigger;
 
+	uint8_t unlocked : 1;
+	uint8_t door_open : 1;
+	uint8_t door_status_known : 1;
+	uint8_t status_closed : 1;
+	struct timer held_timer;
+
 	struct trigger led_trigger;
 	struct trigger buzzer_trigger;
 
 	struct timer idle_timer;
 
+	/* Rejections in a row and the back-off they triggered */
+	uint8_t failures;
+	uint8_t backoff : 1;
+	struct timer backoff_timer;
+
 	door_ctrl_check check_key;
+	door_ctrl_report report_key;
 	void *check_context;
 
+	door_ctrl_notify notify;
+	void *notify_context;
+
 	struct button status;
 	struct button open_btn;
 };
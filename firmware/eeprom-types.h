@@ -41,6 +41,20 @@ struct controller_config {
 #define ACCESS_RECORD_TYPE_HAS_CARD(type) \
 	(ACCESS_RECORD_TYPE_CARD(type) != ACCESS_RECORD_TYPE_CARD_NONE)
 
+/* The 26 bits Wiegand cards only have 24 bits of card number, so the
+ * upper byte of a card ID is used to make records that match a range of
+ * cards. It gives the number of low bits of the card number that are
+ * ignored, with 16 a single record match all the cards of a facility. */
+#define ACCESS_RECORD_CARD_ID_BITS	24
+#define ACCESS_RECORD_CARD_ID_MASK	((1UL << ACCESS_RECORD_CARD_ID_BITS) - 1)
+#define ACCESS_RECORD_CARD_RANGE_BITS(card) \
+	((uint8_t)((card) >> ACCESS_RECORD_CARD_ID_BITS))
+#define ACCESS_RECORD_CARD_IS_RANGE(card) \
+	(ACCESS_RECORD_CARD_RANGE_BITS(card) != 0)
+#define ACCESS_RECORD_CARD_RANGE(card, bits) \
+	(((uint32_t)(bits) << ACCESS_RECORD_CARD_ID_BITS) | \
+	 ((card) & ACCESS_RECORD_CARD_ID_MASK))
+
 #define ACCESS_RECORD_TYPE_PIN_NONE	(0 << 1)
 #define ACCESS_RECORD_TYPE_PIN_FIXED	(1 << 1)
 #define ACCESS_RECORD_TYPE_PIN_HOTP	(2 << 1)
@@ -71,10 +85,45 @@ struct access_record_hdr {
 	uint8_t type	: 3;
 	/* Mark if this record has ever been used */
 	uint8_t used	: 1;
-	/* Bit mask of the allowed doors */
+	/* Bit mask of the allowed doors, or a group reference */
 	uint8_t doors	: 4;
 } PACKED;
 
+/* On controllers with less than 4 doors the highest bit of the doors
+ * mask can't be a door. It then mark the records that take their doors
+ * from a group, the other bits give the group id. */
+#define ACCESS_RECORD_DOORS_GROUP	BIT(3)
+#define ACCESS_RECORD_DOORS_IS_GROUP(doors) \
+	(((doors) & ACCESS_RECORD_DOORS_GROUP) != 0)
+#define ACCESS_RECORD_DOORS_GROUP_ID(doors) \
+	((doors) & ~ACCESS_RECORD_DOORS_GROUP)
+#define ACCESS_RECORD_DOORS_FROM_GROUP(id) \
+	(ACCESS_RECORD_DOORS_GROUP | (id))
+
+struct access_group {
+	/* Bit mask of the doors the members of the group can open */
+	uint8_t doors;
+} PACKED;
+
+/* When the time is known a group can also have a schedule, giving
+ * when its members have access. The days and hours are in local time,
+ * given by the UTC offset. A schedule without any week day never gives
+ * access, the erased ones, with the upper bit set, don't restrict it. */
+struct access_schedule {
+	/* First and last valid day, in days since 1970-01-01 */
+	uint16_t since;
+	uint16_t until;
+	/* Offset of the local time from UTC in quarters of hour */
+	int8_t utc_offset;
+	/* Bit mask of the valid week days, bit 0 is Monday */
+	uint8_t weekdays;
+	/* Bit mask of the valid hours, bit 0 of the first byte is midnight */
+	uint8_t hours[3];
+} PACKED;
+
+#define ACCESS_SCHEDULE_ALL_WEEKDAYS	0x7F
+#define ACCESS_SCHEDULE_ERASED		0xFF
+
 struct access_record_otp {
 	/* This index identify the key, the real key is derived from the
 	 * device key using one round HKDF (see RFC5869 for details)
@@ -149,4 +198,34 @@ struct access_record_v2 {
 	union access_record_pin pin;
 } PACKED;
 
+/* The audit log events use the same numbering as the control events,
+ * offset from the event base. Erased entries read as empty. */
+#define AUDIT_LOG_EVENT_NONE		0
+#define AUDIT_LOG_EVENT_ACCESS_GRANTED	1
+#define AUDIT_LOG_EVENT_ACCESS_DENIED	2
+#define AUDIT_LOG_EVENT_DOOR_FORCED	3
+#define AUDIT_LOG_EVENT_DOOR_HELD	4
+#define AUDIT_LOG_EVENT_READER_ERROR	5
+#define AUDIT_LOG_EVENT_DOOR_BACKOFF	6
+/* Only in the log, the index gives the number of access records that
+ * had to be moved when the EEPROM layout changed */
+#define AUDIT_LOG_EVENT_RECORDS_MOVED	7
+#define AUDIT_LOG_EVENT_EMPTY		0xF
+
+struct audit_log_entry {
+	/* Time of the event in seconds since the Unix epoch */
+	uint32_t time;
+	/* Access record involved, 0xFFFF if none */
+	uint16_t index;
+	uint8_t door  : 4;
+	uint8_t event : 4;
+} PACKED;
+
+/* In the EEPROM each entry also store its sequence number, the
+ * sequence number modulo the log size give the entry position. */
+struct audit_log_eeprom_entry {
+	uint16_t seq;
+	struct audit_log_entry entry;
+} PACKED;
+
 #endif /* EEPROM_TYPES_H */
@@ -9,7 +9,8 @@ static int8_t access_record_v1_from_v2(
 	rec_v1->type = 0;
 	rec_v1->invalid = 0;
 	rec_v1->used = rec_v2->hdr.used;
-	rec_v1->doors = rec_v2->hdr.doors;
+	/* The old clients don't know the groups */
+	rec_v1->doors = eeprom_get_access_record_doors(&rec_v2->hdr);
 
 	if (ACCESS_RECORD_HAS_PIN(rec_v2)) {
 		/* Return an error if this record can't be represented
@@ -26,7 +27,8 @@ static int8_t access_record_v1_from_v2(
 		/* Return an error if this record can't be represented
 		 * with the old data format */
 		if (ACCESS_RECORD_CARD_TYPE(rec_v2) !=
-		    ACCESS_RECORD_TYPE_CARD_ID)
+		    ACCESS_RECORD_TYPE_CARD_ID ||
+		    ACCESS_RECORD_CARD_IS_RANGE(rec_v2->card))
 			return -EEXIST;
 
 		rec_v1->type |= ACCESS_TYPE_CARD;
@@ -43,6 +45,10 @@ static int8_t access_record_v2_from_v1(
 	if (rec_v1->type == ACCESS_TYPE_CARD_AND_PIN)
 		return -EBADF;
 
+	/* Without groups the other bits are doors that don't exist */
+	if (rec_v1->doors & ~(BIT(NUM_DOORS) - 1))
+		return -EINVAL;
+
 	rec_v2->hdr.type = ACCESS_RECORD_TYPE(NONE, NONE);
 	rec_v2->hdr.used = rec_v1->used;
 	rec_v2->hdr.doors = rec_v1->doors;
@@ -55,6 +61,9 @@ static int8_t access_record_v2_from_v1(
 	}
 
 	if (rec_v1->type == ACCESS_TYPE_CARD) {
+		/* The upper byte would be read as a card range */
+		if (rec_v1->key & ~ACCESS_RECORD_CARD_ID_MASK)
+			return -EINVAL;
 		rec_v2->hdr.type = ACCESS_RECORD_TYPE(ID, NONE);
 		rec_v2->card = rec_v1->key;
 	} else {
@@ -123,7 +132,7 @@ int8_t eeprom_get_access(uint8_t type, uint32_t key, uint8_t *doors)
 		return err;
 
 	if (doors)
-		*doors = rec_v2.hdr.doors;
+		*doors = eeprom_get_access_record_doors(&rec_v2.hdr);
 
 	return 0;
 }
@@ -134,6 +143,7 @@ int8_t eeprom_set_access(uint8_t type, uint32_t key, uint8_t doors)
 	struct access_record rec_v1 = {
 		.type = type,
 		.key = key,
+		.doors = doors,
 	};
 	int8_t err;
 
@@ -155,7 +165,7 @@ static int8_t access_record_filter(
 	const struct access_record_match *match = val;
 
 	/* Match on the door */
-	if ((hdr->doors & match->doors) == 0)
+	if ((eeprom_get_access_record_doors(hdr) & match->doors) == 0)
 		return 0;
 
 	/* Then on the type of data in the record */
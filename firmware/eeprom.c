@@ -2,16 +2,55 @@
 #include <string.h>
 #include <errno.h>
 #include <avr/eeprom.h>
+#include <util/crc16.h>
 #include "eeprom.h"
 #include "utils.h"
+#include "stats.h"
 
 static struct eeprom_config config EEMEM;
 
+static uint8_t acl_generation;
+
+/* Size of the access records table, it stays larger as long as the
+ * EEPROM keeps the original layout. */
+static uint16_t num_access_records = NUM_ACCESS_RECORDS;
+
+static void eeprom_write(const void *src, void *dst, size_t size)
+{
+	stats.eeprom_writes++;
+	eeprom_write_block(src, dst, size);
+}
+
+/* For the writes that can change the result of an access check */
+static void eeprom_write_acl(const void *src, void *dst, size_t size)
+{
+	acl_generation++;
+	eeprom_write(src, dst, size);
+}
+
+uint8_t eeprom_get_acl_generation(void)
+{
+	return acl_generation;
+}
+
+/* Erase a region, only writing the bytes that are not erased yet */
+static void eeprom_erase(uint8_t *dst, uint16_t size)
+{
+	const uint8_t erased = 0xFF;
+	uint8_t val;
+
+	for (; size > 0; size--, dst++) {
+		eeprom_read_block(&val, dst, sizeof(val));
+		if (val != erased)
+			eeprom_write_acl(&erased, dst, sizeof(erased));
+	}
+}
+
 static int8_t eeprom_entry_is_in_bounds(uint16_t idx, uint8_t len)
 {
 	uint16_t end = idx + len;
 	/* Check that we don't overflow */
-	return end > idx && end <= ARRAY_SIZE(config.access);
+	return end > idx && end <= num_access_records;
 }
 
 static struct access_record_entry *eeprom_entry_at(uint16_t idx, uint8_t len)
@@ -28,7 +67,7 @@ static int8_t eeprom_entry_clear(uint16_t idx)
 	if (!eep)
 		return -EINVAL;
 
-	eeprom_write_block(&hdr, eep, sizeof(hdr));
+	eeprom_write_acl(&hdr, eep, sizeof(hdr));
 	return 0;
 }
 
@@ -93,7 +132,8 @@ int8_t eeprom_update_access_record_hdr(
 	struct access_record_entry *eep;
 
 	/* Don't allow editing empty records or turning them in a continuation */
-	if (hdr->type == ACCESS_RECORD_TYPE(NONE, NONE) || hdr->doors == 0)
+	if (hdr->type == ACCESS_RECORD_TYPE(NONE, NONE) || hdr->doors == 0 ||
+	    eeprom_check_access_record_doors(hdr->doors))
 		return -EINVAL;
 
 	/* Validate the index */
@@ -107,7 +147,7 @@ int8_t eeprom_update_access_record_hdr(
 		return -EINVAL;
 
 	if (memcmp(&old_hdr, hdr, sizeof(*hdr)))
-		eeprom_write_block(hdr, eep, sizeof(*hdr));
+		eeprom_write_acl(hdr, eep, sizeof(*hdr));
 
 	return 0;
 }
@@ -124,6 +164,10 @@ int8_t eeprom_write_access_record(
 	if (!eep)
 		return -EINVAL;
 
+	if (!ACCESS_RECORD_IS_EMPTY(rec) &&
+	    eeprom_check_access_record_doors(rec->hdr.doors))
+		return -EINVAL;
+
 	/* Make sure we don't write in the middle of a record */
 	err = eeprom_read_access_record_hdr(idx, &entry.hdr);
 	if (err)
@@ -147,7 +191,7 @@ int8_t eeprom_write_access_record(
 
 		if (ACCESS_RECORD_HAS_CARD(rec)) {
 			entry.card = rec->card;
-			eeprom_write_block(&entry, eep + n, sizeof(entry));
+			eeprom_write_acl(&entry, eep + n, sizeof(entry));
 
 			/* Clear the used flag, doors mask and card type
 			 * for the continuation entries */
@@ -161,7 +205,7 @@ int8_t eeprom_write_access_record(
 
 		if (ACCESS_RECORD_HAS_PIN(rec)) {
 			entry.pin = rec->pin;
-			eeprom_write_block(&entry, eep + n, sizeof(entry));
+			eeprom_write_acl(&entry, eep + n, sizeof(entry));
 
 			/* Advance the write pointer */
 			n++;
@@ -234,6 +278,45 @@ uint16_t eeprom_get_free_access_record_count(void)
 	return count;
 }
 
+static uint16_t crc16_update_block(
+	uint16_t crc, const void *data, uint8_t size)
+{
+	const uint8_t *d = data;
+	uint8_t i;
+
+	for (i = 0; i < size; i++)
+		crc = _crc_xmodem_update(crc, d[i]);
+	return crc;
+}
+
+uint16_t eeprom_get_access_records_digest(uint16_t *count)
+{
+	struct access_record_v2 rec;
+	uint16_t idx, crc = 0, n = 0;
+
+	for (idx = 0; eeprom_entry_is_in_bounds(idx, 1);
+	     idx += ACCESS_RECORD_ENTRIES(&rec)) {
+		eeprom_read_access_record_hdr(idx, &rec.hdr);
+		if (ACCESS_RECORD_IS_EMPTY(&rec))
+			continue;
+		eeprom_read_access_record_data(idx, &rec);
+
+		/* Leave out the data that is updated when the record is used */
+		rec.hdr.used = 0;
+		if (ACCESS_RECORD_PIN_TYPE(&rec) == ACCESS_RECORD_TYPE_PIN_HOTP)
+			rec.pin.hotp.c = 0;
+
+		crc = crc16_update_block(crc, &idx, sizeof(idx));
+		crc = crc16_update_block(crc, &rec, sizeof(rec));
+		n++;
+	}
+
+	if (count)
+		*count = n;
+
+	return crc;
+}
+
 static uint32_t access_record_get_pin(const struct access_record_v2 *rec)
 {
 	switch (ACCESS_RECORD_PIN_TYPE(rec)) {
@@ -299,7 +382,7 @@ static int8_t eeprom_find_free_entry(uint8_t type, uint16_t *pos)
 			continue;
 		}
 		/* Save the start of the range */
-		if (start == -1)
+		if (start == (uint16_t)-1)
 			start = idx;
 		/* Done if we have enough entries */
 		if (idx + 1 - start == ACCESS_RECORD_TYPE_ENTRIES(type)) {
@@ -312,7 +395,8 @@ static int8_t eeprom_find_free_entry(uint8_t type, uint16_t *pos)
 	return -ENOSPC;
 }
 
-int8_t eeprom_save_access_record(const struct access_record_v2 *rec)
+static int8_t eeprom_store_access_record(
+	const struct access_record_v2 *rec, uint8_t keep_state)
 {
 	struct access_record_v2 tmp;
 	uint16_t idx;
@@ -332,6 +416,20 @@ int8_t eeprom_save_access_record(const struct access_record_v2 *rec)
 			return 0;
 		/* Find a free spot */
 		err = eeprom_find_free_entry(rec->hdr.type, &idx);
+	} else if (!err && keep_state && rec->hdr.doors &&
+		   ACCESS_RECORD_PIN_TYPE(&tmp) == ACCESS_RECORD_TYPE_PIN_HOTP &&
+		   tmp.pin.hotp.key_id == rec->pin.hotp.key_id) {
+		/* The used flag and the HOTP counter are maintained here,
+		 * the host copy might be stale. Never move the counter back
+		 * as it would accept the old PINs again. */
+		uint16_t c = tmp.pin.hotp.c;
+		uint8_t used = tmp.hdr.used;
+
+		tmp = *rec;
+		tmp.hdr.used |= used;
+		if (tmp.pin.hotp.c < c)
+			tmp.pin.hotp.c = c;
+		rec = &tmp;
 	}
 	if (err)
 		return err;
@@ -339,12 +437,135 @@ int8_t eeprom_save_access_record(const struct access_record_v2 *rec)
 	return eeprom_write_access_record(idx, rec);
 }
 
+int8_t eeprom_save_access_record(const struct access_record_v2 *rec)
+{
+	return eeprom_store_access_record(rec, 0);
+}
+
+int8_t eeprom_update_access_record(const struct access_record_v2 *rec)
+{
+	return eeprom_store_access_record(rec, 1);
+}
+
+/* Read a record of the original layout, where the access records
+ * table used all the space after the doors config. */
+static void eeprom_read_legacy_access_record(
+	uint16_t idx, struct access_record_v2 *rec)
+{
+	struct access_record_entry *eep = config.access + idx;
+
+	eeprom_read_block(&rec->hdr, eep, sizeof(rec->hdr));
+	rec->card = 0;
+	rec->pin.fixed = 0;
+
+	if (ACCESS_RECORD_HAS_CARD(rec)) {
+		eeprom_read_block(&rec->card, &eep->card, sizeof(rec->card));
+		eep++;
+	}
+	if (ACCESS_RECORD_HAS_PIN(rec))
+		eeprom_read_block(&rec->pin, &eep->pin, sizeof(rec->pin));
+}
+
+/* Move the records that are not fully in the new table to free entries */
+static int8_t eeprom_move_legacy_access_records(uint16_t *moved)
+{
+	const struct access_record_hdr empty = {};
+	struct access_record_v2 rec, tmp;
+	uint16_t idx, pos;
+	uint8_t len, i, erased, doors;
+	int8_t err;
+
+	for (idx = 0; idx < EEPROM_LEGACY_NUM_ACCESS_RECORDS; idx += len) {
+		eeprom_read_legacy_access_record(idx, &rec);
+		len = ACCESS_RECORD_ENTRIES(&rec);
+		erased = *(uint8_t *)&rec.hdr == 0xFF ||
+			ACCESS_RECORD_IS_EMPTY(&rec) ||
+			ACCESS_RECORD_IS_CONTINUATION(&rec);
+
+		/* The original firmware had no groups, drop the doors that
+		 * don't exist to not read them as a group reference. A
+		 * record left without doors is removed. */
+		doors = rec.hdr.doors;
+		if (!erased)
+			rec.hdr.doors &= BIT(NUM_DOORS) - 1;
+
+		if (idx + len <= NUM_ACCESS_RECORDS) {
+			if (rec.hdr.doors != doors)
+				eeprom_write_access_record(idx, &rec);
+			continue;
+		}
+
+		/* Step over the erased and left over entries one by one */
+		if (erased || idx + len > EEPROM_LEGACY_NUM_ACCESS_RECORDS) {
+			len = 1;
+			continue;
+		}
+
+		/* A previous attempt might have been interrupted after
+		 * writing the new copy, only write it if needed. */
+		tmp = rec;
+		if (rec.hdr.doors &&
+		    (eeprom_load_this_access_record(&tmp, &pos) || pos == idx)) {
+			err = eeprom_find_free_entry(rec.hdr.type, &pos);
+			if (!err)
+				err = eeprom_write_access_record(pos, &rec);
+			if (err)
+				return err;
+			(*moved)++;
+		}
+
+		/* Then clear the old copy */
+		for (i = 0; i < len; i++)
+			eeprom_write_acl(&empty, config.access + idx + i,
+					 sizeof(empty));
+	}
+
+	return 0;
+}
+
+int8_t eeprom_init(uint16_t *moved)
+{
+	const uint8_t version = EEPROM_LAYOUT_VERSION;
+	uint8_t *start = (uint8_t *)&config.access[NUM_ACCESS_RECORDS];
+	uint8_t *end = &config.layout_version;
+	uint8_t val;
+	int8_t err;
+
+	*moved = 0;
+	eeprom_read_block(&val, end, sizeof(val));
+	if (val == version)
+		return 0;
+
+	/* With an older layout the region after the table might still
+	 * contain access records. Keep the old layout if they don't fit
+	 * in the free entries, it is retried on each start. */
+	err = eeprom_move_legacy_access_records(moved);
+	if (err) {
+		num_access_records = EEPROM_LEGACY_NUM_ACCESS_RECORDS;
+		return err;
+	}
+
+	eeprom_erase(start, end - start);
+	eeprom_write(&version, end, sizeof(version));
+	return 0;
+}
+
+uint16_t eeprom_get_num_access_records(void)
+{
+	return num_access_records;
+}
+
+int8_t eeprom_has_legacy_layout(void)
+{
+	return num_access_records != NUM_ACCESS_RECORDS;
+}
+
 void eeprom_remove_all_access(void)
 {
 	struct access_record_hdr hdr;
 	uint16_t idx;
 
-	for (idx = 0; idx < ARRAY_SIZE(config.access); idx++) {
+	for (idx = 0; idx < num_access_records; idx++) {
 		eeprom_read_access_record_hdr(idx, &hdr);
 		if (hdr.type != ACCESS_RECORD_TYPE(NONE, NONE))
 			eeprom_entry_clear(idx);
@@ -359,7 +580,7 @@ int8_t eeprom_get_controller_config(struct controller_config *cfg)
 
 int8_t eeprom_set_controller_config(const struct controller_config *cfg)
 {
-	eeprom_write_block(cfg, &config.ctrl, sizeof(*cfg));
+	eeprom_write_acl(cfg, &config.ctrl, sizeof(*cfg));
 	return 0;
 }
 
@@ -377,6 +598,197 @@ int8_t eeprom_set_door_config(uint8_t id, const struct door_config *cfg)
 	if (id >= ARRAY_SIZE(config.door))
 		return -EINVAL;
 
-	eeprom_write_block(cfg, &config.door[id], sizeof(*cfg));
+	eeprom_write(cfg, &config.door[id], sizeof(*cfg));
+	return 0;
+}
+
+int8_t eeprom_get_access_group(uint8_t id, struct access_group *grp)
+{
+	if (id >= ARRAY_SIZE(config.group))
+		return -EINVAL;
+	if (eeprom_has_legacy_layout())
+		return -EBUSY;
+
+	eeprom_read_block(grp, &config.group[id], sizeof(*grp));
+	/* Erased groups have no doors */
+	if (grp->doors == 0xFF)
+		grp->doors = 0;
+	return 0;
+}
+
+int8_t eeprom_set_access_group(uint8_t id, const struct access_group *grp)
+{
+	struct access_group old;
+
+	if (id >= ARRAY_SIZE(config.group))
+		return -EINVAL;
+	if (eeprom_has_legacy_layout())
+		return -EBUSY;
+
+	/* Groups are often re-applied as a whole, skip the unchanged ones */
+	eeprom_read_block(&old, &config.group[id], sizeof(old));
+	if (memcmp(&old, grp, sizeof(old)))
+		eeprom_write_acl(grp, &config.group[id], sizeof(*grp));
+	return 0;
+}
+
+int8_t eeprom_get_access_schedule(uint8_t id, struct access_schedule *sch)
+{
+	if (id >= ARRAY_SIZE(config.schedule))
+		return -EINVAL;
+	if (eeprom_has_legacy_layout())
+		return -EBUSY;
+
+	eeprom_read_block(sch, &config.schedule[id], sizeof(*sch));
+	/* Erased schedules don't restrict the access, but one without
+	 * any week day is kept as is and never gives access. */
+	if (sch->weekdays & ~ACCESS_SCHEDULE_ALL_WEEKDAYS) {
+		memset(sch, 0xFF, sizeof(*sch));
+		sch->since = 0;
+		sch->utc_offset = 0;
+		sch->weekdays = ACCESS_SCHEDULE_ALL_WEEKDAYS;
+	}
+	return 0;
+}
+
+int8_t eeprom_set_access_schedule(
+	uint8_t id, const struct access_schedule *sch)
+{
+	struct access_schedule old;
+
+	if (id >= ARRAY_SIZE(config.schedule))
+		return -EINVAL;
+	if (eeprom_has_legacy_layout())
+		return -EBUSY;
+
+	eeprom_read_block(&old, &config.schedule[id], sizeof(old));
+	if (memcmp(&old, sch, sizeof(old)))
+		eeprom_write_acl(sch, &config.schedule[id], sizeof(*sch));
+	return 0;
+}
+
+int8_t eeprom_check_access_record_doors(uint8_t doors)
+{
+	if (NUM_ACCESS_GROUPS > 0 && ACCESS_RECORD_DOORS_IS_GROUP(doors))
+		return ACCESS_RECORD_DOORS_GROUP_ID(doors) < NUM_ACCESS_GROUPS ?
+			0 : -EINVAL;
+
+	return (doors & ~(BIT(NUM_DOORS) - 1)) ? -EINVAL : 0;
+}
+
+uint8_t eeprom_get_access_record_doors(const struct access_record_hdr *hdr)
+{
+	struct access_group grp;
+
+	if (NUM_ACCESS_GROUPS == 0 || !ACCESS_RECORD_DOORS_IS_GROUP(hdr->doors))
+		return hdr->doors;
+
+	if (eeprom_get_access_group(
+		    ACCESS_RECORD_DOORS_GROUP_ID(hdr->doors), &grp))
+		return 0;
+
+	return grp.doors;
+}
+
+/* The raw access covers the whole config, but the root key can't be read */
+#define ROOT_KEY_START	offsetof(struct eeprom_config, ctrl.root_key)
+#define ROOT_KEY_END	(ROOT_KEY_START + sizeof(config.ctrl.root_key))
+
+static int8_t eeprom_raw_is_in_bounds(uint16_t offset, uint8_t size)
+{
+	uint16_t end = offset + size;
+	/* Check that we don't overflow */
+	return end >= offset && end <= sizeof(config);
+}
+
+uint16_t eeprom_get_raw_size(void)
+{
+	return sizeof(config);
+}
+
+int8_t eeprom_read_raw(uint16_t offset, void *data, uint8_t size)
+{
+	uint8_t *d = data;
+	uint8_t i;
+
+	if (!eeprom_raw_is_in_bounds(offset, size))
+		return -EINVAL;
+
+	eeprom_read_block(data, (const uint8_t *)&config + offset, size);
+	for (i = 0; i < size; i++)
+		if (offset + i >= ROOT_KEY_START && offset + i < ROOT_KEY_END)
+			d[i] = 0;
+	return 0;
+}
+
+static void eeprom_update_raw(uint16_t offset, const uint8_t *data,
+			      uint8_t size)
+{
+	acl_generation++;
+	stats.eeprom_writes++;
+	/* Only the changed bytes are written */
+	eeprom_update_block(data, (uint8_t *)&config + offset, size);
+}
+
+int8_t eeprom_write_raw(uint16_t offset, const void *data, uint8_t size,
+			uint8_t with_root_key)
+{
+	const uint8_t *d = data;
+	uint16_t end = offset + size;
+
+	if (!eeprom_raw_is_in_bounds(offset, size))
+		return -EINVAL;
+
+	if (with_root_key || end <= ROOT_KEY_START || offset >= ROOT_KEY_END) {
+		eeprom_update_raw(offset, d, size);
+		return 0;
+	}
+
+	/* Only write what is around the root key */
+	if (offset < ROOT_KEY_START)
+		eeprom_update_raw(offset, d, ROOT_KEY_START - offset);
+	if (end > ROOT_KEY_END)
+		eeprom_update_raw(ROOT_KEY_END, d + (ROOT_KEY_END - offset),
+				  end - ROOT_KEY_END);
+	return 0;
+}
+
+uint16_t eeprom_get_raw_crc(void)
+{
+	uint8_t buf[16];
+	uint16_t offset, crc = 0;
+	uint8_t size;
+
+	for (offset = 0; offset < sizeof(config); offset += size) {
+		size = sizeof(config) - offset < sizeof(buf) ?
+			sizeof(config) - offset : sizeof(buf);
+		eeprom_read_raw(offset, buf, size);
+		crc = crc16_update_block(crc, buf, size);
+	}
+
+	return crc;
+}
+
+int8_t eeprom_read_audit_log_entry(
+	uint8_t idx, struct audit_log_eeprom_entry *entry)
+{
+	if (idx >= ARRAY_SIZE(config.audit_log))
+		return -EINVAL;
+	if (eeprom_has_legacy_layout())
+		return -EBUSY;
+
+	eeprom_read_block(entry, &config.audit_log[idx], sizeof(*entry));
+	return 0;
+}
+
+int8_t eeprom_write_audit_log_entry(
+	uint8_t idx, const struct audit_log_eeprom_entry *entry)
+{
+	if (idx >= ARRAY_SIZE(config.audit_log))
+		return -EINVAL;
+	if (eeprom_has_legacy_layout())
+		return -EBUSY;
+
+	eeprom_write(entry, &config.audit_log[idx], sizeof(*entry));
 	return 0;
 }
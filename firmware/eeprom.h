@@ -3,20 +3,83 @@
 
 #include "eeprom-types.h"
 
+#ifndef AUDIT_LOG_SIZE
+#define AUDIT_LOG_SIZE 0
+#endif
+
+#define AUDIT_LOG_EEPROM_SIZE \
+	(AUDIT_LOG_SIZE * sizeof(struct audit_log_eeprom_entry))
+
+/* Groups need a free bit in the doors mask, see eeprom-types.h */
+#if NUM_DOORS < 4
+#define NUM_ACCESS_GROUPS 8
+#else
+#define NUM_ACCESS_GROUPS 0
+#endif
+
+#define ACCESS_GROUPS_EEPROM_SIZE \
+	(NUM_ACCESS_GROUPS * sizeof(struct access_group))
+
+/* The schedules are attached to the first groups */
+#ifndef NUM_ACCESS_SCHEDULES
+#define NUM_ACCESS_SCHEDULES 0
+#endif
+
+#if NUM_ACCESS_SCHEDULES > NUM_ACCESS_GROUPS
+#error "There can't be more schedules than groups"
+#endif
+
+#define ACCESS_SCHEDULES_EEPROM_SIZE \
+	(NUM_ACCESS_SCHEDULES * sizeof(struct access_schedule))
+
 #define ACCESS_RECORDS_SIZE \
-	(EEPROM_SIZE - sizeof(struct controller_config) - NUM_DOORS * sizeof(struct door_config))
+	(EEPROM_SIZE - sizeof(struct controller_config) - NUM_DOORS * sizeof(struct door_config) - AUDIT_LOG_EEPROM_SIZE - ACCESS_GROUPS_EEPROM_SIZE - ACCESS_SCHEDULES_EEPROM_SIZE - sizeof(uint8_t))
 
 #define NUM_ACCESS_RECORDS \
 	(ACCESS_RECORDS_SIZE / sizeof(struct access_record_entry))
 
+/* In the original layout the access records used all the space left */
+#define EEPROM_LEGACY_NUM_ACCESS_RECORDS \
+	((EEPROM_SIZE - sizeof(struct controller_config) - NUM_DOORS * sizeof(struct door_config)) / sizeof(struct access_record_entry))
+
+/* Version of the layout below, changed when the regions after the
+ * access records move. Adding it to the controller config would move
+ * all the records, so it is stored in the last byte of the EEPROM that
+ * was left unused by the original layout. */
+#define EEPROM_LAYOUT_VERSION	1
+
+/* The audit log, the groups and the schedules are placed after the
+ * access records to keep the existing records in place. */
 struct eeprom_config {
 	struct controller_config ctrl;
 	struct door_config door[NUM_DOORS];
 	struct access_record_entry access[NUM_ACCESS_RECORDS];
+	struct audit_log_eeprom_entry audit_log[AUDIT_LOG_SIZE];
+	struct access_group group[NUM_ACCESS_GROUPS];
+	struct access_schedule schedule[NUM_ACCESS_SCHEDULES];
+	uint8_t reserved[ACCESS_RECORDS_SIZE %
+			 sizeof(struct access_record_entry)];
+	uint8_t layout_version;
 };
 
+/* Check the layout version and erase the regions placed after the
+ * access records if it doesn't match. The access records found in these
+ * regions are first moved to free entries, their number is returned in
+ * moved. If they don't fit an error is returned and the old layout is
+ * kept, without audit log, groups and schedules. */
+int8_t eeprom_init(uint16_t *moved);
+
+/* Size of the access records table */
+uint16_t eeprom_get_num_access_records(void);
+
+/* Non zero if the old layout has been kept by eeprom_init() */
+int8_t eeprom_has_legacy_layout(void);
+
 uint16_t eeprom_get_free_access_record_count(void);
 
+/* Digest of all the access records, used by the host to check its copy */
+uint16_t eeprom_get_access_records_digest(uint16_t *count);
+
 /* Keep the old API for now */
 int8_t eeprom_get_access_record(uint16_t id, struct access_record *rec);
 
@@ -37,13 +100,17 @@ int8_t eeprom_load_this_access_record(struct access_record_v2 *rec, uint16_t *po
 
 int8_t eeprom_save_access_record(const struct access_record_v2 *rec);
 
+/* Like eeprom_save_access_record() but a stored HOTP record with the
+ * same key keeps its used flag and its counter is never moved back. */
+int8_t eeprom_update_access_record(const struct access_record_v2 *rec);
+
 void eeprom_remove_all_access(void);
 
 /* Generic search API */
 typedef int8_t (*eeprom_check_access_record_t)(
 	const struct access_record_hdr *hdr, const void *check_ctx);
 
-#define ACCESS_RECORD_ITER_START (-1)
+#define ACCESS_RECORD_ITER_START ((uint16_t)-1)
 
 int8_t eeprom_get_next_access_record(
 	uint16_t *idx, struct access_record_v2 *rec,
@@ -66,6 +133,9 @@ int8_t eeprom_write_access_record(
 int8_t eeprom_update_access_record_hdr(
 	uint16_t idx, const struct access_record_hdr *hdr);
 
+/* Changed by every write of the records, groups, schedules or keys */
+uint8_t eeprom_get_acl_generation(void);
+
 int8_t eeprom_get_controller_config(struct controller_config *cfg);
 
 int8_t eeprom_set_controller_config(const struct controller_config *cfg);
@@ -74,4 +144,38 @@ int8_t eeprom_get_door_config(uint8_t id, struct door_config *cfg);
 
 int8_t eeprom_set_door_config(uint8_t id, const struct door_config *cfg);
 
+int8_t eeprom_get_access_group(uint8_t id, struct access_group *grp);
+
+int8_t eeprom_set_access_group(uint8_t id, const struct access_group *grp);
+
+int8_t eeprom_get_access_schedule(uint8_t id, struct access_schedule *sch);
+
+int8_t eeprom_set_access_schedule(
+	uint8_t id, const struct access_schedule *sch);
+
+/* Check that a doors mask only has existing doors or a valid group */
+int8_t eeprom_check_access_record_doors(uint8_t doors);
+
+/* Doors mask of a record header, with the group resolved */
+uint8_t eeprom_get_access_record_doors(const struct access_record_hdr *hdr);
+
+/* Raw access to the whole struct eeprom_config, used for the backups.
+ * The root key reads as zeros and is only written if with_root_key
+ * is set. */
+uint16_t eeprom_get_raw_size(void);
+
+int8_t eeprom_read_raw(uint16_t offset, void *data, uint8_t size);
+
+int8_t eeprom_write_raw(uint16_t offset, const void *data, uint8_t size,
+			uint8_t with_root_key);
+
+/* Xmodem CRC of the whole image as returned by eeprom_read_raw() */
+uint16_t eeprom_get_raw_crc(void);
+
+int8_t eeprom_read_audit_log_entry(
+	uint8_t idx, struct audit_log_eeprom_entry *entry);
+
+int8_t eeprom_write_audit_log_entry(
+	uint8_t idx, const struct audit_log_eeprom_entry *entry);
+
 #endif /* EEPROM_H */
@@ -0,0 +1,26 @@
+/* Virtual controller running on the host */
+
+/* Same EEPROM as the ATmega328P */
+#define EEPROM_SIZE		1024
+
+/* Life LED, not used */
+#define LIFE_LED_GPIO		0
+
+/* Doors */
+#define NUM_DOORS		2
+
+/* RTC */
+#define HAS_RTC			0
+#define DS3231_ADDR		0
+
+/* No I2C */
+#define HAS_I2C			0
+
+/* Enable TOTP and HOTP support */
+#define WITH_OTP		1
+
+/* Number of entries in the audit log, must be a power of 2 */
+#define AUDIT_LOG_SIZE		16
+
+/* Number of access groups with a schedule */
+#define NUM_ACCESS_SCHEDULES	4
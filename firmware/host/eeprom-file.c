@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <avr/eeprom.h>
+#include "host.h"
+
+/* The EEPROM variables are all in the host_eeprom section, the image
+ * file is a copy of this section. Like on the AVR the writes block for
+ * the time needed to program each byte. */
+
+extern uint8_t __start_host_eeprom[];
+extern uint8_t __stop_host_eeprom[];
+
+#define EEPROM_FILE_SIZE (__stop_host_eeprom - __start_host_eeprom)
+
+static int eeprom_fd = -1;
+static uint32_t eeprom_write_delay_us;
+
+int eeprom_file_open(const char *path, uint32_t write_delay_us)
+{
+	struct stat st;
+	ssize_t len;
+
+	eeprom_fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (eeprom_fd < 0)
+		return -errno;
+
+	if (fstat(eeprom_fd, &st))
+		goto error;
+
+	if (st.st_size == 0) {
+		/* New image, start with the default content */
+		len = pwrite(eeprom_fd, __start_host_eeprom,
+			     EEPROM_FILE_SIZE, 0);
+	} else if (st.st_size == EEPROM_FILE_SIZE) {
+		len = pread(eeprom_fd, __start_host_eeprom,
+			    EEPROM_FILE_SIZE, 0);
+	} else {
+		errno = EINVAL;
+		goto error;
+	}
+
+	if (len != EEPROM_FILE_SIZE) {
+		if (len >= 0)
+			errno = EIO;
+		goto error;
+	}
+
+	eeprom_write_delay_us = write_delay_us;
+	return 0;
+
+error:
+	close(eeprom_fd);
+	eeprom_fd = -1;
+	return -errno;
+}
+
+static void eeprom_file_write(const uint8_t *src, uint8_t *dst, size_t n)
+{
+	struct timespec delay;
+	uint64_t us;
+
+	memcpy(dst, src, n);
+	if (eeprom_fd >= 0)
+		pwrite(eeprom_fd, dst, n, dst - __start_host_eeprom);
+
+	us = (uint64_t)eeprom_write_delay_us * n;
+	delay.tv_sec = us / 1000000;
+	delay.tv_nsec = (us % 1000000) * 1000;
+	while (nanosleep(&delay, &delay) && errno == EINTR)
+		/* NOOP */;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	memcpy(dst, src, n);
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t n)
+{
+	eeprom_file_write(src, dst, n);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	size_t i;
+
+	/* Only the bytes that changed cost a write */
+	for (i = 0; i < n; i++)
+		if (s[i] != d[i])
+			eeprom_file_write(&s[i], &d[i], 1);
+}
@@ -0,0 +1,34 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+
+/* Glue between the host drivers and the main loop */
+
+/* Monotonic time in micro seconds */
+uint64_t host_get_time_us(void);
+
+/* Time left until the next timer expire, in micro seconds, or -1 */
+int64_t timers_get_timeout_us(void);
+
+/* Run the expired timers */
+void timers_run(void);
+
+/* Create the pty, optionally with a symlink to its slave side */
+int uart_pty_open(const char *link, uint32_t baud);
+
+void uart_pty_close(void);
+
+/* File descriptor to poll for the incoming data */
+int uart_pty_get_fd(void);
+
+/* Time left until the next byte is sent, or -1 */
+int64_t uart_pty_get_timeout_us(void);
+
+/* Read the incoming data and send the bytes that are due */
+void uart_pty_run(int readable);
+
+/* Load the EEPROM content from an image file, it is created if needed */
+int eeprom_file_open(const char *path, uint32_t write_delay_us);
+
+#endif /* HOST_H */
@@ -0,0 +1,17 @@
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+/* The EEPROM variables are placed in their own section, the host
+ * EEPROM driver load and save this section from/to an image file. */
+
+#include <stddef.h>
+
+#define EEMEM __attribute__((section("host_eeprom")))
+
+void eeprom_read_block(void *dst, const void *src, size_t n);
+
+void eeprom_write_block(const void *src, void *dst, size_t n);
+
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#endif /* HOST_AVR_EEPROM_H */
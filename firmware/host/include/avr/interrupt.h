@@ -0,0 +1,10 @@
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+/* The host build is single threaded, the "interrupts" are only
+ * delivered while sleeping so there is nothing to mask. */
+
+#define cli()	do {} while (0)
+#define sei()	do {} while (0)
+
+#endif /* HOST_AVR_INTERRUPT_H */
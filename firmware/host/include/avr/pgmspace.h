@@ -0,0 +1,23 @@
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+/* On the host the program memory is just normal memory */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#define PROGMEM
+#define PSTR(s)			(s)
+
+#define pgm_read_byte(p)	(*(const uint8_t *)(p))
+#define pgm_read_word(p)	(*(const uint16_t *)(p))
+#define pgm_read_dword(p)	(*(const uint32_t *)(p))
+#define pgm_read_ptr(p)		(*(void * const *)(p))
+
+#define memcpy_P		memcpy
+#define strcmp_P		strcmp
+#define strlen_P		strlen
+#define snprintf_P		snprintf
+
+#endif /* HOST_AVR_PGMSPACE_H */
@@ -0,0 +1,26 @@
+#ifndef HOST_TIME_H
+#define HOST_TIME_H
+
+#include_next <time.h>
+#include <stdint.h>
+
+/* The firmware use the avr-libc time API: time_t is 32 bits and count
+ * the seconds since 2000-01-01. The protocol also send time_t values,
+ * so replace the host API with an implementation of the AVR one. */
+
+typedef uint32_t avr_time_t;
+
+#define UNIX_OFFSET		946684800
+
+avr_time_t avr_time(avr_time_t *t);
+
+struct tm *avr_gmtime_r(const avr_time_t *t, struct tm *tm);
+
+void avr_set_system_time(avr_time_t t);
+
+#define time_t			avr_time_t
+#define time(t)			avr_time(t)
+#define gmtime_r(t, tm)		avr_gmtime_r(t, tm)
+#define set_system_time(t)	avr_set_system_time(t)
+
+#endif /* HOST_TIME_H */
@@ -0,0 +1,14 @@
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#include <stdint.h>
+
+/* Nothing can interrupt the code on the host, just run the block once */
+
+#define ATOMIC_RESTORESTATE	0
+#define ATOMIC_FORCEON		1
+
+#define ATOMIC_BLOCK(type) \
+	for (uint8_t __atomic_once = 1; __atomic_once; __atomic_once = 0)
+
+#endif /* HOST_UTIL_ATOMIC_H */
@@ -0,0 +1,22 @@
+#ifndef HOST_UTIL_CRC16_H
+#define HOST_UTIL_CRC16_H
+
+#include <stdint.h>
+
+/* Same as the avr-libc version, see its documentation */
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+	uint8_t i;
+
+	crc ^= (uint16_t)data << 8;
+	for (i = 0; i < 8; i++) {
+		if (crc & 0x8000)
+			crc = (crc << 1) ^ 0x1021;
+		else
+			crc <<= 1;
+	}
+
+	return crc;
+}
+
+#endif /* HOST_UTIL_CRC16_H */
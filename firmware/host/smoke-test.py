@@ -0,0 +1,411 @@
+#!/usr/bin/env python3
+#
+# Smoke test of the virtual controller: start it with an empty EEPROM
+# image and store, read, list and remove a few access records over the
+# pty, then check that they survive a restart. The access checks are
+# done by presenting credentials on the virtual controller stdin.
+#
+# Only the standard library is used, the frames are encoded here.
+
+import argparse
+import os
+import select
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import tty
+
+CMD_GET_DEVICE_DESCRIPTOR = 0
+CMD_SET_TIME = 3
+CMD_SET_ACCESS = 22
+CMD_SET_ACCESS_V2 = 32
+CMD_GET_ACCESS_V2 = 33
+CMD_GET_ACCESS_RECORDS_V2 = 35
+CMD_SET_ACCESS_GROUP = 38
+CMD_GET_AUDIT_LOG = 40
+CMD_SET_ACCESS_SCHEDULE = 42
+REPLY_OK = 0
+REPLY_ERROR = 255
+EVENT_BASE = 127
+EVENT_ACCESS_GRANTED = EVENT_BASE + 1
+EVENT_ACCESS_DENIED = EVENT_BASE + 2
+AUDIT_LOG_EVENT_RECORDS_MOVED = 7
+
+EBUSY = 16
+EINVAL = 22
+
+TYPE_CARD_ID = 1
+TYPE_PIN_FIXED = 1 << 1
+
+# Credentials types for the access checks
+ACCESS_PIN = 1
+ACCESS_CARD = 2
+ACCESS_CARD_AND_PIN = 3
+
+DOORS_GROUP = 1 << 3
+
+ALL_WEEKDAYS = 0x7F
+ALL_HOURS = (1 << 24) - 1
+SECONDS_PER_DAY = 86400
+
+# EEPROM layout of the virtual controller
+EEPROM_SIZE = 1024
+ACCESS_RECORDS_OFFSET = 28
+ACCESS_ENTRY_SIZE = 5
+NUM_ACCESS_RECORDS = 161
+LEGACY_NUM_ACCESS_RECORDS = 199
+
+START = 0x7E
+ESC = 0x7D
+
+def crc_xmodem(data):
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for i in range(8):
+            crc = ((crc << 1) ^ 0x1021 if crc & 0x8000 else crc << 1) & 0xFFFF
+    return crc
+
+def pack_pin(pin):
+    val = 0xFFFFFFFF
+    for c in pin:
+        val = ((val << 4) & 0xFFFFFFFF) | int(c, 10)
+    return val
+
+def pack_record(rec_type, doors, card = 0, pin = 0):
+    return struct.pack('<BLL', rec_type | (doors << 4), card, pin)
+
+def pack_entries(rec_type, doors, card = 0, pin = 0):
+    # Records with a card and a PIN use a continuation entry
+    if rec_type & TYPE_CARD_ID and rec_type & ~TYPE_CARD_ID:
+        return struct.pack('<BLBL', rec_type | (doors << 4), card,
+                           rec_type & ~TYPE_CARD_ID, pin)
+    return struct.pack('<BL', rec_type | (doors << 4),
+                       card if rec_type & TYPE_CARD_ID else pin)
+
+class VirtualController(object):
+    def __init__(self, binary, workdir):
+        self.link = os.path.join(workdir, 'tty')
+        self.proc = subprocess.Popen(
+            [binary, '-p', self.link, '-w', '0', '-r',
+             '-e', os.path.join(workdir, 'eeprom.bin')],
+            stdin = subprocess.PIPE, stdout = subprocess.DEVNULL,
+            stderr = subprocess.DEVNULL)
+        for i in range(50):
+            if os.path.exists(self.link):
+                break
+            time.sleep(0.1)
+        else:
+            raise RuntimeError('The virtual controller did not start')
+        self.fd = os.open(self.link, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        self.rx = b''
+
+    def close(self):
+        os.close(self.fd)
+        self.proc.stdin.close()
+        self.proc.terminate()
+        self.proc.wait()
+
+    def send(self, cmd, payload = b''):
+        msg = struct.pack('BB', cmd, len(payload)) + payload
+        msg += struct.pack('<H', crc_xmodem(msg))
+        msg = msg.replace(b'\x7d', b'\x7d\x5d').replace(b'\x7e', b'\x7d\x5e')
+        os.write(self.fd, b'\x7e' + msg)
+
+    def read_frame(self, timeout = 2):
+        deadline = time.time() + timeout
+        while True:
+            # A frame is complete once the next start byte is seen or
+            # when it has all its bytes.
+            start = self.rx.find(b'\x7e')
+            if start >= 0:
+                end = self.rx.find(b'\x7e', start + 1)
+                raw = self.rx[start + 1:end if end >= 0 else None]
+                frame = raw.replace(b'\x7d\x5e', b'\x7e') \
+                           .replace(b'\x7d\x5d', b'\x7d')
+                # Don't cut an escape sequence
+                if len(frame) >= 4 and len(frame) >= 4 + frame[1] and \
+                   not raw.endswith(b'\x7d'):
+                    frame = frame[:4 + frame[1]]
+                    self.rx = self.rx[end:] if end >= 0 else b''
+                    if crc_xmodem(frame[:-2]) != \
+                       struct.unpack('<H', frame[-2:])[0]:
+                        raise RuntimeError('Bad CRC in %s' % frame.hex())
+                    return frame[0], frame[2:-2]
+            left = deadline - time.time()
+            if left <= 0 or not select.select([self.fd], [], [], left)[0]:
+                raise TimeoutError
+            self.rx += os.read(self.fd, 256)
+
+    def cmd(self, cmd, payload = b''):
+        self.send(cmd, payload)
+        while True:
+            reply, data = self.read_frame()
+            # Skip the events
+            if reply < EVENT_BASE or reply == REPLY_ERROR:
+                break
+        if reply == REPLY_ERROR:
+            return struct.unpack('b', data)[0], None
+        if reply != REPLY_OK:
+            raise RuntimeError('Unexpected reply %d' % reply)
+        return 0, data
+
+    def wait_event(self, *events):
+        while True:
+            reply, data = self.read_frame()
+            if reply in events:
+                return reply, data
+
+    def present(self, door, access, card = 0, pin = 0):
+        self.proc.stdin.write(b'%d %d %d %d\n' % (door, access, card, pin))
+        self.proc.stdin.flush()
+        event, data = self.wait_event(EVENT_ACCESS_GRANTED,
+                                      EVENT_ACCESS_DENIED)
+        return event == EVENT_ACCESS_GRANTED
+
+def check(what, cond):
+    print('%-44s %s' % (what, 'ok' if cond else 'FAILED'))
+    if not cond:
+        check.failed = True
+check.failed = False
+
+def get_access(vc, rec_type, card = 0, pin = 0):
+    return vc.cmd(CMD_GET_ACCESS_V2, struct.pack('<BLL', rec_type, card, pin))
+
+def list_records(vc):
+    records = []
+    start = 0
+    while True:
+        err, data = vc.cmd(CMD_GET_ACCESS_RECORDS_V2,
+                           struct.pack('<H', start))
+        if err:
+            raise RuntimeError('Listing the records failed: %d' % err)
+        count = data[0]
+        if count == 0:
+            return records
+        for i in range(count):
+            idx, rec = struct.unpack('<H9s', data[1 + i * 11:12 + i * 11])
+            records.append(rec)
+            start = idx
+
+def get_audit_log(vc):
+    entries = []
+    seq = 0xFFFF
+    while True:
+        err, data = vc.cmd(CMD_GET_AUDIT_LOG, struct.pack('<H', seq))
+        if err:
+            raise RuntimeError('Reading the audit log failed: %d' % err)
+        first, count = struct.unpack('<HB', data[0:3])
+        if count == 0:
+            return entries
+        for i in range(count):
+            tm, index, event = struct.unpack(
+                '<LHB', data[3 + i * 7:10 + i * 7])
+            entries.append((event >> 4, event & 0xF, index))
+        seq = (first + count - 1) & 0xFFFF
+
+def set_group(vc, group, doors):
+    return vc.cmd(CMD_SET_ACCESS_GROUP, struct.pack('BB', group, doors))[0]
+
+def test_records(binary, workdir):
+    card = pack_record(TYPE_CARD_ID, 0x3, card = 0x7e1234)
+    pin = pack_record(TYPE_PIN_FIXED, 0x1, pin = pack_pin('1234'))
+
+    vc = VirtualController(binary, workdir)
+    check('set card record', vc.cmd(CMD_SET_ACCESS_V2, card)[0] == 0)
+    check('set PIN record', vc.cmd(CMD_SET_ACCESS_V2, pin)[0] == 0)
+    check('get card record',
+          get_access(vc, TYPE_CARD_ID, card = 0x7e1234) == (0, card))
+    check('get PIN record',
+          get_access(vc, TYPE_PIN_FIXED, pin = pack_pin('1234')) ==
+          (0, pin))
+    check('list records', sorted(list_records(vc)) == sorted([card, pin]))
+    vc.cmd(CMD_SET_ACCESS_V2, pack_record(TYPE_CARD_ID, 0, card = 0x7e1234))
+    check('remove card record',
+          get_access(vc, TYPE_CARD_ID, card = 0x7e1234)[0] != 0)
+    vc.close()
+
+    vc = VirtualController(binary, workdir)
+    check('PIN record kept after restart',
+          get_access(vc, TYPE_PIN_FIXED, pin = pack_pin('1234')) ==
+          (0, pin))
+    check('card record still removed', list_records(vc) == [pin])
+    vc.close()
+
+def test_groups(binary, workdir):
+    rec = pack_record(TYPE_CARD_ID, DOORS_GROUP | 2, card = 0x4321)
+
+    vc = VirtualController(binary, workdir)
+    check('set group', set_group(vc, 2, 0x1) == 0)
+    check('set group record', vc.cmd(CMD_SET_ACCESS_V2, rec)[0] == 0)
+    check('group record opens its door',
+          vc.present(0, ACCESS_CARD, card = 0x4321))
+    check('group record keeps other doors closed',
+          not vc.present(1, ACCESS_CARD, card = 0x4321))
+    set_group(vc, 2, 0x2)
+    check('group record follows the group doors',
+          vc.present(1, ACCESS_CARD, card = 0x4321) and
+          not vc.present(0, ACCESS_CARD, card = 0x4321))
+    check('group id over the limit refused',
+          set_group(vc, 8, 0x1) == -EINVAL)
+    check('group doors over the limit refused',
+          set_group(vc, 3, 0x4) == -EINVAL)
+    check('record doors over the limit refused',
+          vc.cmd(CMD_SET_ACCESS_V2,
+                 pack_record(TYPE_CARD_ID, 0x4, card = 0x1234))[0] ==
+          -EINVAL)
+    vc.close()
+
+def test_card_ranges(binary, workdir):
+    # 4 range bits: the cards 0x123450 to 0x12345F
+    rec = pack_record(TYPE_CARD_ID, 0x1, card = (4 << 24) | 0x123450)
+
+    vc = VirtualController(binary, workdir)
+    check('set card range record', vc.cmd(CMD_SET_ACCESS_V2, rec)[0] == 0)
+    check('cards in the range accepted',
+          vc.present(0, ACCESS_CARD, card = 0x123450) and
+          vc.present(0, ACCESS_CARD, card = 0x12345F))
+    check('first card after the range refused',
+          not vc.present(0, ACCESS_CARD, card = 0x123460))
+    check('last card before the range refused',
+          not vc.present(0, ACCESS_CARD, card = 0x12344F))
+    check('range byte refused on plain card records',
+          vc.cmd(CMD_SET_ACCESS,
+                 struct.pack('<LB', (4 << 24) | 0x123450,
+                             ACCESS_CARD | (0x1 << 4)))[0] == -EINVAL)
+    vc.close()
+
+def set_time(vc, t):
+    return vc.cmd(CMD_SET_TIME, struct.pack('<L', t))[0]
+
+def set_schedule(vc, group, since = 0, until = 0xFFFF, utc_offset = 0,
+                 weekdays = ALL_WEEKDAYS, hours = ALL_HOURS):
+    return vc.cmd(CMD_SET_ACCESS_SCHEDULE,
+                  struct.pack('<BHHbB', group, since, until,
+                              utc_offset, weekdays) +
+                  struct.pack('<L', hours)[0:3])[0]
+
+def test_schedules(binary, workdir):
+    rec = pack_record(TYPE_CARD_ID, DOORS_GROUP | 1, card = 0x5555)
+    # Wednesday 2024-01-03 10:30 UTC
+    day = 19725
+    now = day * SECONDS_PER_DAY + 10 * 3600 + 30 * 60
+    wednesday = 1 << 2
+    hour = 1 << 10
+
+    def opens(**schedule):
+        set_schedule(vc, 1, **schedule)
+        return vc.present(0, ACCESS_CARD, card = 0x5555)
+
+    vc = VirtualController(binary, workdir)
+    check('set time', set_time(vc, now) == 0)
+    set_group(vc, 1, 0x1)
+    vc.cmd(CMD_SET_ACCESS_V2, rec)
+    check('set schedule', set_schedule(vc, 1) == 0)
+    check('schedule day range',
+          opens(since = day, until = day) and
+          not opens(since = day + 1) and
+          not opens(until = day - 1))
+    check('schedule follows the time',
+          set_time(vc, now + SECONDS_PER_DAY) == 0 and
+          not opens(since = day, until = day) and
+          set_time(vc, now) == 0 and
+          vc.present(0, ACCESS_CARD, card = 0x5555))
+    check('schedule week days',
+          opens(weekdays = wednesday) and
+          not opens(weekdays = ALL_WEEKDAYS & ~wednesday))
+    check('schedule hours',
+          opens(hours = hour) and
+          not opens(hours = ALL_HOURS & ~hour))
+    check('schedule UTC offset',
+          opens(hours = hour << 1, utc_offset = 4) and
+          not opens(hours = hour, utc_offset = 4))
+    check('schedule without week days never opens',
+          not opens(weekdays = 0))
+    check('schedule invalid week days refused',
+          set_schedule(vc, 1, weekdays = 0x80) == -EINVAL)
+    vc.close()
+
+def make_legacy_image(binary, workdir, records, full = False):
+    # Start from the default image, then turn it into the old layout
+    # where the access records table used all the EEPROM.
+    path = os.path.join(workdir, 'eeprom.bin')
+    if os.path.exists(path):
+        os.unlink(path)
+    VirtualController(binary, workdir).close()
+    with open(path, 'rb') as f:
+        data = bytearray(f.read())
+    start = ACCESS_RECORDS_OFFSET + NUM_ACCESS_RECORDS * ACCESS_ENTRY_SIZE
+    data[start:EEPROM_SIZE] = bytes(EEPROM_SIZE - start)
+    if full:
+        records = [(i, pack_entries(TYPE_CARD_ID, 0x1, card = 0x10000 + i))
+                   for i in range(NUM_ACCESS_RECORDS)] + records
+    for idx, raw in records:
+        pos = ACCESS_RECORDS_OFFSET + idx * ACCESS_ENTRY_SIZE
+        data[pos:pos + len(raw)] = raw
+    with open(path, 'wb') as f:
+        f.write(data)
+
+def test_migration(binary, workdir):
+    # A card and PIN record straddling the end of the new table, one
+    # in the middle of the new regions and one in the last entry.
+    card_pin = pack_record(TYPE_CARD_ID | TYPE_PIN_FIXED, 0x3,
+                           card = 0xdef, pin = pack_pin('99'))
+    card = pack_record(TYPE_CARD_ID, 0x1, card = 0xabc)
+    pin = pack_record(TYPE_PIN_FIXED, 0x2, pin = pack_pin('4321'))
+    records = [
+        (NUM_ACCESS_RECORDS - 1,
+         pack_entries(TYPE_CARD_ID | TYPE_PIN_FIXED, 0x3,
+                      card = 0xdef, pin = pack_pin('99'))),
+        (170, pack_entries(TYPE_CARD_ID, 0x1, card = 0xabc)),
+        (LEGACY_NUM_ACCESS_RECORDS - 1,
+         pack_entries(TYPE_PIN_FIXED, 0x2, pin = pack_pin('4321'))),
+    ]
+
+    make_legacy_image(binary, workdir, records)
+    vc = VirtualController(binary, workdir)
+    check('migrated records kept',
+          sorted(list_records(vc)) == sorted([card_pin, card, pin]))
+    check('migrated records counted in the audit log',
+          (AUDIT_LOG_EVENT_RECORDS_MOVED, 0, 3) in get_audit_log(vc))
+    check('groups usable after the migration', set_group(vc, 0, 0x1) == 0)
+    vc.close()
+
+    # Without room for the moved records the old layout is kept
+    make_legacy_image(binary, workdir, records[1:], full = True)
+    vc = VirtualController(binary, workdir)
+    err, desc = vc.cmd(CMD_GET_DEVICE_DESCRIPTOR)
+    check('old table size reported',
+          struct.unpack('<H', desc[3:5])[0] == LEGACY_NUM_ACCESS_RECORDS)
+    check('records kept with the old layout',
+          get_access(vc, TYPE_CARD_ID, card = 0xabc) == (0, card) and
+          get_access(vc, TYPE_PIN_FIXED, pin = pack_pin('4321')) ==
+          (0, pin) and
+          len(list_records(vc)) == NUM_ACCESS_RECORDS + 2)
+    check('no groups with the old layout', set_group(vc, 0, 0x1) == -EBUSY)
+    vc.close()
+
+def main():
+    parser = argparse.ArgumentParser(
+        description = 'Smoke test of the virtual controller')
+    parser.add_argument('binary', nargs = '?', default = './virtual-controller',
+                        help = 'Virtual controller to test')
+    args = parser.parse_args()
+
+    # Each test starts with a new EEPROM image
+    for test in (test_records, test_groups, test_card_ranges,
+                 test_schedules, test_migration):
+        workdir = tempfile.mkdtemp()
+        try:
+            test(args.binary, workdir)
+        finally:
+            shutil.rmtree(workdir)
+
+    return 1 if check.failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
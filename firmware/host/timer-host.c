@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <time.h>
+#include "../timer.h"
+#include "host.h"
+
+/* Use the host types and functions in this file */
+#undef time_t
+#undef time
+#undef gmtime_r
+#undef set_system_time
+
+/** Queue of the pending timer, ordered by timeout */
+static struct timer *pending;
+
+/** Offset between the monotonic clock and the AVR system time */
+static int64_t system_time_offset;
+
+uint64_t host_get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Like the firmware without RTC the system time start at 2000-01-01
+ * and must be set with the SET_TIME command. */
+avr_time_t avr_time(avr_time_t *t)
+{
+	avr_time_t now = host_get_time_us() / 1000000 + system_time_offset;
+
+	if (t)
+		*t = now;
+	return now;
+}
+
+void avr_set_system_time(avr_time_t t)
+{
+	system_time_offset = (int64_t)t - host_get_time_us() / 1000000;
+}
+
+struct tm *avr_gmtime_r(const avr_time_t *t, struct tm *tm)
+{
+	time_t unix_time = (time_t)*t + UNIX_OFFSET;
+
+	return gmtime_r(&unix_time, tm);
+}
+
+void timers_init(void)
+{
+}
+
+void timers_sleep(void)
+{
+}
+
+void timers_wakeup(void)
+{
+}
+
+uint16_t timer_get_time(void)
+{
+	return host_get_time_us() / 1000;
+}
+
+uint16_t timer_get_time_us(void)
+{
+	return host_get_time_us();
+}
+
+/** Insert a timer in the pending queue */
+static void timer_queue_pending(struct timer *timer)
+{
+	struct timer *t;
+
+	timer->pending = 1;
+
+	if (pending == NULL || time_before(timer->when, pending->when)) {
+		timer->next = pending;
+		pending = timer;
+		return;
+	}
+
+	for (t = pending;
+	     t->next && time_before_eq(t->next->when, timer->when);
+	     t = t->next)
+		/* NOOP */;
+
+	timer->next = t->next;
+	t->next = timer;
+}
+
+/** Remove a timer from the pending queue */
+static void timer_dequeue_pending(struct timer *old)
+{
+	struct timer *t;
+
+	if (!old->pending)
+		return;
+
+	if (pending == old) {
+		pending = old->next;
+	} else {
+		for (t = pending; t; t = t->next)
+			if (t->next == old) {
+				t->next = old->next;
+				break;
+			}
+	}
+
+	old->next = NULL;
+	old->pending = 0;
+}
+
+void timer_init(struct timer *t, timer_cb_t callback, void *context)
+{
+	if (t == NULL)
+		return;
+
+	t->next = NULL;
+	t->when = 0;
+	t->pending = 0;
+	t->callback = callback;
+	t->context = context;
+}
+
+void timer_schedule(struct timer *t, uint16_t when)
+{
+	if (t == NULL)
+		return;
+
+	timer_dequeue_pending(t);
+	t->when = when;
+	timer_queue_pending(t);
+}
+
+void timer_schedule_in(struct timer *t, uint16_t delay)
+{
+	timer_schedule(t, timer_get_time() + delay);
+}
+
+void timer_deschedule(struct timer *t)
+{
+	if (t == NULL)
+		return;
+
+	timer_dequeue_pending(t);
+}
+
+int64_t timers_get_timeout_us(void)
+{
+	int16_t delay;
+
+	if (!pending)
+		return -1;
+
+	delay = pending->when - timer_get_time();
+	return delay > 0 ? delay * 1000 : 0;
+}
+
+void timers_run(void)
+{
+	struct timer *t;
+
+	while (pending && time_after_eq(timer_get_time(), pending->when)) {
+		t = pending;
+		timer_dequeue_pending(t);
+		if (t->callback)
+			t->callback(t->context);
+	}
+}
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <errno.h>
+#include <stdio.h>
+#include "../uart.h"
+#include "host.h"
+
+/* The UART is emulated with a pseudo terminal. The transmissions take
+ * the time they would need on a real serial line: the bytes are taken
+ * from the ring and written out once all their bits would have been
+ * sent. */
+
+struct uart_pty {
+	int master;
+	/* Keep the slave open to not get hang-ups when the client
+	 * close it. */
+	int slave;
+	char *link;
+	uint32_t baud;
+
+	uart_on_recv_t on_recv;
+	void *recv_context;
+
+	uint8_t tx_ring[UART_TX_RING_SIZE];
+	uint8_t tx_head;
+	uint8_t tx_tail;
+	uint8_t tx_queued;
+	/* Time at which the byte at the head is sent */
+	uint64_t tx_done;
+};
+
+#define UART_TX_RING_MASK	((UART_TX_RING_SIZE) - 1)
+
+/* A start bit, 8 data bits and a stop bit per byte */
+#define uart_pty_byte_time_us()	(10 * 1000000 / uart.baud)
+
+static struct uart_pty uart = {
+	.master = -1,
+	.slave = -1,
+};
+
+int uart_pty_open(const char *link, uint32_t baud)
+{
+	struct termios tio;
+	const char *name;
+
+	uart.master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (uart.master < 0)
+		return -errno;
+
+	if (grantpt(uart.master) || unlockpt(uart.master))
+		goto error;
+
+	name = ptsname(uart.master);
+	if (!name)
+		goto error;
+
+	uart.slave = open(name, O_RDWR | O_NOCTTY);
+	if (uart.slave < 0)
+		goto error;
+
+	/* Start in raw mode, like a real serial port */
+	if (tcgetattr(uart.slave, &tio))
+		goto error;
+	cfmakeraw(&tio);
+	if (tcsetattr(uart.slave, TCSANOW, &tio))
+		goto error;
+
+	if (link) {
+		unlink(link);
+		if (symlink(name, link))
+			goto error;
+		uart.link = strdup(link);
+	}
+
+	fcntl(uart.master, F_SETFL, O_NONBLOCK);
+	uart.baud = baud;
+
+	printf("Serial port: %s\n", link ? link : name);
+	fflush(stdout);
+	return 0;
+
+error:
+	uart_pty_close();
+	return -errno;
+}
+
+void uart_pty_close(void)
+{
+	if (uart.link) {
+		unlink(uart.link);
+		free(uart.link);
+		uart.link = NULL;
+	}
+	if (uart.slave >= 0)
+		close(uart.slave);
+	if (uart.master >= 0)
+		close(uart.master);
+	uart.slave = uart.master = -1;
+}
+
+int uart_pty_get_fd(void)
+{
+	return uart.master;
+}
+
+int64_t uart_pty_get_timeout_us(void)
+{
+	uint64_t now;
+
+	if (uart.tx_head == uart.tx_tail)
+		return -1;
+
+	now = host_get_time_us();
+	return uart.tx_done > now ? uart.tx_done - now : 0;
+}
+
+static void uart_pty_write(const uint8_t *data, uint8_t size)
+{
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(uart.master, data, size);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			/* Nobody is reading, drop the data like
+			 * a real UART would do. */
+			return;
+		}
+		data += len;
+		size -= len;
+	}
+}
+
+void uart_pty_run(int readable)
+{
+	uint8_t buffer[UART_TX_RING_SIZE];
+	ssize_t i, len;
+	uint64_t now;
+
+	while (readable) {
+		len = read(uart.master, buffer, sizeof(buffer));
+		if (len <= 0)
+			break;
+		for (i = 0; i < len; i++)
+			if (uart.on_recv)
+				uart.on_recv(buffer[i], uart.recv_context);
+	}
+
+	/* Send all the bytes that are due */
+	now = host_get_time_us();
+	len = 0;
+	while (uart.tx_head != uart.tx_tail && uart.tx_done <= now) {
+		buffer[len++] = uart.tx_ring[uart.tx_head & UART_TX_RING_MASK];
+		uart.tx_head++;
+		uart.tx_done += uart_pty_byte_time_us();
+	}
+	if (len > 0)
+		uart_pty_write(buffer, len);
+}
+
+int8_t uart_init(uint8_t direction, uint32_t rate,
+		 uint8_t stop_bits, uint8_t parity)
+{
+	/* Use the rate from the firmware if none was given */
+	if (!uart.baud)
+		uart.baud = rate;
+
+	return 0;
+}
+
+int8_t uart_set_recv_handler(uart_on_recv_t on_recv, void *context)
+{
+	uart.on_recv = on_recv;
+	uart.recv_context = context;
+
+	return 0;
+}
+
+uint8_t uart_tx_free(void)
+{
+	return UART_TX_RING_SIZE - (uint8_t)(uart.tx_queued - uart.tx_head);
+}
+
+void uart_tx_queue(uint8_t byte)
+{
+	uart.tx_ring[uart.tx_queued & UART_TX_RING_MASK] = byte;
+	uart.tx_queued++;
+}
+
+void uart_tx_commit(void)
+{
+	/* Start the timing if the line was idle */
+	if (uart.tx_head == uart.tx_tail)
+		uart.tx_done = host_get_time_us() + uart_pty_byte_time_us();
+	uart.tx_tail = uart.tx_queued;
+}
+
+int8_t uart_blocking_send(const void *data, uint8_t size)
+{
+	if (!data)
+		return -EINVAL;
+
+	uart_pty_write(data, size);
+	return 0;
+}
+
+int8_t uart_blocking_write(const char *str)
+{
+	return uart_blocking_send(str, strlen(str));
+}
@@ -0,0 +1,254 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include "../work-queue.h"
+#include "../timer.h"
+#include "../acl.h"
+#include "../audit-log.h"
+#include "../ctrl-cmd.h"
+#include "../gpio.h"
+#include "../sleep.h"
+#include "../rtc.h"
+#include "../stack.h"
+#include "host.h"
+
+/* Run the controller core on the host: the command handling, the ACL
+ * and the EEPROM code are the firmware ones, only the drivers are
+ * replaced. The UART is a pty and the EEPROM is stored in a file. */
+
+/* ATmega328P datasheet: 3.3ms to program an EEPROM byte */
+#define DEFAULT_EEPROM_WRITE_DELAY_US	3300
+
+static volatile sig_atomic_t should_exit;
+
+/* The credentials presented to the readers are read from stdin when
+ * enabled, one "DOOR TYPE CARD PIN" line per access. */
+static int reader_fd = -1;
+static char reader_line[64];
+static size_t reader_len;
+
+/* There is no GPIO on the host */
+int8_t gpio_direction_output(uint8_t gpio, uint8_t val)
+{
+	return 0;
+}
+
+void gpio_set_value(uint8_t gpio, uint8_t state)
+{
+}
+
+int8_t rtc_set(const struct tm *tm)
+{
+	return -ENODEV;
+}
+
+/* The host stack is not painted */
+void stack_get_info(struct ctrl_memory_info *info)
+{
+	memset(info, 0, sizeof(*info));
+}
+
+/* Check the credentials like the door controller does */
+static void reader_check_access(const char *line)
+{
+	struct ctrl_event_door event = {};
+	unsigned long door, type, card, pin;
+	uint16_t index = CTRL_EVENT_NO_RECORD;
+	uint8_t what;
+	int8_t err;
+
+	if (sscanf(line, "%lu %lu %lu %lu", &door, &type, &card, &pin) != 4 ||
+	    door >= NUM_DOORS || type > ACL_TYPE_CARD_AND_PIN) {
+		fprintf(stderr, "Invalid credentials: %s\n", line);
+		return;
+	}
+
+	err = acl_check_access(type, card, pin, door, &index);
+
+	event.index = index;
+	event.door = door;
+	event.type = type;
+	event.card = card;
+	what = err ? CTRL_EVENT_ACCESS_DENIED : CTRL_EVENT_ACCESS_GRANTED;
+	audit_log_add(what - CTRL_EVENT_BASE, door, index);
+	ctrl_send_door_event(what, &event);
+}
+
+static void reader_run(void)
+{
+	ssize_t len;
+	char *eol;
+
+	len = read(reader_fd, reader_line + reader_len,
+		   sizeof(reader_line) - 1 - reader_len);
+	if (len <= 0) {
+		reader_fd = -1;
+		return;
+	}
+
+	reader_len += len;
+	reader_line[reader_len] = 0;
+	while ((eol = strchr(reader_line, '\n'))) {
+		*eol = 0;
+		reader_check_access(reader_line);
+		reader_len -= eol + 1 - reader_line;
+		memmove(reader_line, eol + 1, reader_len + 1);
+	}
+
+	/* Drop the lines that don't fit */
+	if (reader_len == sizeof(reader_line) - 1)
+		reader_len = 0;
+}
+
+/* Wait for the "interrupts": incoming data, end of a transmission,
+ * a timer expiring or some credentials presented. */
+void _sleep(void)
+{
+	struct pollfd pfd[2] = {
+		{
+			.fd = uart_pty_get_fd(),
+			.events = POLLIN,
+		},
+		{
+			.fd = reader_fd,
+			.events = POLLIN,
+		},
+	};
+	int64_t timeout, uart_timeout;
+	int ret;
+
+	_sleep_prepare();
+
+	timeout = timers_get_timeout_us();
+	uart_timeout = uart_pty_get_timeout_us();
+	if (uart_timeout >= 0 && (timeout < 0 || uart_timeout < timeout))
+		timeout = uart_timeout;
+
+	/* Round up to not spin before the deadline */
+	ret = poll(pfd, ARRAY_SIZE(pfd),
+		   timeout < 0 ? -1 : (timeout + 999) / 1000);
+	if (should_exit) {
+		uart_pty_close();
+		exit(0);
+	}
+
+	uart_pty_run(ret > 0 && (pfd[0].revents & POLLIN));
+	if (ret > 0 && (pfd[1].revents & (POLLIN | POLLHUP)))
+		reader_run();
+	timers_run();
+
+	_sleep_finish();
+}
+
+static void on_signal(int sig)
+{
+	should_exit = 1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-p LINK] [-b BAUD] [-e EEPROM] [-w DELAY] [-r]\n"
+		"  -p LINK    Create a symlink to the serial port\n"
+		"  -b BAUD    Baud rate used to time the transmissions\n"
+		"  -e EEPROM  EEPROM image file (default: eeprom.bin)\n"
+		"  -w DELAY   EEPROM write time per byte in us (default: %u)\n"
+		"  -r         Read the credentials presented to the readers on\n"
+		"             stdin, one \"DOOR TYPE CARD PIN\" line per access\n",
+		name, DEFAULT_EEPROM_WRITE_DELAY_US);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t write_delay = DEFAULT_EEPROM_WRITE_DELAY_US;
+	const char *eeprom = "eeprom.bin";
+	struct device_descriptor desc = {};
+	struct sigaction sa = {
+		.sa_handler = on_signal,
+	};
+	const char *link = NULL;
+	struct ctrl_event_door event = {
+		.index = CTRL_EVENT_NO_RECORD,
+		.type = ACL_TYPE_NONE,
+	};
+	uint32_t baud = 0;
+	uint16_t moved;
+	int err, opt;
+
+	while ((opt = getopt(argc, argv, "p:b:e:w:rh")) != -1) {
+		switch (opt) {
+		case 'p':
+			link = optarg;
+			break;
+		case 'b':
+			baud = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			eeprom = optarg;
+			break;
+		case 'w':
+			write_delay = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			reader_fd = STDIN_FILENO;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	err = eeprom_file_open(eeprom, write_delay);
+	if (err) {
+		fprintf(stderr, "Failed to open EEPROM image %s: %s\n",
+			eeprom, strerror(-err));
+		return 1;
+	}
+
+	err = uart_pty_open(link, baud);
+	if (err) {
+		fprintf(stderr, "Failed to create the pty: %s\n",
+			strerror(-err));
+		return 1;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	timers_init();
+
+	event.error = eeprom_init(&moved);
+	if (event.error)
+		fprintf(stderr, "Keeping the old EEPROM layout: %s\n",
+			strerror(-event.error));
+
+	err = acl_init();
+	if (!err)
+		err = audit_log_init();
+	if (!err)
+		err = ctrl_cmd_init();
+	if (err) {
+		fprintf(stderr, "Init failed: %s\n", strerror(-err));
+		uart_pty_close();
+		return 1;
+	}
+
+	if (moved) {
+		fprintf(stderr, "Moved %u access records after a layout change\n",
+			moved);
+		audit_log_add(AUDIT_LOG_EVENT_RECORDS_MOVED, 0, moved);
+	}
+
+	ctrl_cmd_init_device_descriptor(&desc);
+	ctrl_send_event(CTRL_EVENT_STARTED, &desc, sizeof(desc));
+	if (event.error)
+		ctrl_send_door_event(CTRL_EVENT_LAYOUT_ERROR, &event);
+	work_queue_run(LIFE_LED_GPIO);
+
+	return 0;
+}
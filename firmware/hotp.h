@@ -2,8 +2,11 @@
 #define HOTP_H
 
 #include <stdint.h>
+#include "sha1.h"
 
-uint32_t hotp_sha1(const uint8_t *key, uint16_t key_len,
+/* The SHA1 context is passed by the caller to keep it off the stack */
+uint32_t hotp_sha1(struct sha1_context *ctx,
+		   const uint8_t *key, uint16_t key_len,
 		   uint32_t c, uint8_t digits);
 
 #endif /* HOTP_H */
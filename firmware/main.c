@@ -10,6 +10,7 @@
 #include "door-controller.h"
 #include "external-irq.h"
 #include "eeprom.h"
+#include "audit-log.h"
 #include "utils.h"
 #include "uart.h"
 #include "ctrl-cmd.h"
@@ -18,12 +19,27 @@
 #include "i2c.h"
 #include "rtc.h"
 
+static void report_door_event(uint8_t type, struct ctrl_event_door *event)
+{
+	audit_log_add(type - CTRL_EVENT_BASE, event->door, event->index);
+	ctrl_send_door_event(type, event);
+}
+
 static int8_t check_key(uint8_t door_id, uint8_t type,
 			uint32_t card, uint32_t pin, void *context)
 {
+	struct ctrl_event_door event = {
+		.door = door_id,
+		.type = type,
+		.card = card,
+	};
+	uint16_t index = CTRL_EVENT_NO_RECORD;
 	int8_t err = -EPERM;
 
-	err = acl_check_access(type, card, pin, door_id);
+	err = acl_check_access(type, card, pin, door_id, &index);
+	event.index = index;
+	report_door_event(err ? CTRL_EVENT_ACCESS_DENIED :
+			  CTRL_EVENT_ACCESS_GRANTED, &event);
 	if (DEBUG) {
 		static char buffer[40];
 		static const char fmt[] PROGMEM =
@@ -39,6 +55,46 @@ static int8_t check_key(uint8_t door_id, uint8_t type,
 	return err;
 }
 
+static void report_key(uint8_t door_id, uint8_t type,
+		       uint32_t card, int8_t err, void *context)
+{
+	struct ctrl_event_door event = {
+		.index = CTRL_EVENT_BACKOFF_RECORD,
+		.door = door_id,
+		.type = type,
+		.card = card,
+	};
+
+	report_door_event(CTRL_EVENT_ACCESS_DENIED, &event);
+}
+
+static void notify_door_event(uint8_t door_id, uint8_t what, int8_t err,
+			      void *context)
+{
+	struct ctrl_event_door event = {
+		.index = CTRL_EVENT_NO_RECORD,
+		.door = door_id,
+		.type = ACL_TYPE_NONE,
+	};
+
+	switch (what) {
+	case DOOR_CTRL_NOTIFY_FORCED:
+		report_door_event(CTRL_EVENT_DOOR_FORCED, &event);
+		break;
+	case DOOR_CTRL_NOTIFY_HELD:
+		report_door_event(CTRL_EVENT_DOOR_HELD, &event);
+		break;
+	case DOOR_CTRL_NOTIFY_READER_ERROR:
+		event.error = err;
+		report_door_event(CTRL_EVENT_READER_ERROR, &event);
+		break;
+	case DOOR_CTRL_NOTIFY_BACKOFF:
+		event.delay = (uint8_t)err;
+		report_door_event(CTRL_EVENT_DOOR_BACKOFF, &event);
+		break;
+	}
+}
+
 extern const struct door_ctrl_config doors_config[] PROGMEM;
 static struct door_ctrl dc[NUM_DOORS];
 
@@ -53,6 +109,8 @@ static int init_doors(void)
 
 		memcpy_P(&cfg, &doors_config[i], sizeof(cfg));
 		cfg.check_key = check_key;
+		cfg.report_key = report_key;
+		cfg.notify = notify_door_event;
 
 		eeprom_get_door_config(i, &eeprom_cfg);
 		if (eeprom_cfg.open_time > 0 &&
@@ -70,6 +128,11 @@ static int init_doors(void)
 int main(void)
 {
 	struct device_descriptor desc = {};
+	struct ctrl_event_door event = {
+		.index = CTRL_EVENT_NO_RECORD,
+		.type = ACL_TYPE_NONE,
+	};
+	uint16_t moved = 0;
 	int8_t err = 0;
 
 	clock_prescale_set(clock_div_1);
@@ -77,8 +140,17 @@ int main(void)
 
 	if (HAS_I2C)
 		err = i2c_init(I2C_MAX_RATE);
+	/* Keep running with the old layout if it couldn't be upgraded,
+	 * the error is reported once the host link is up. */
+	if (!err)
+		event.error = eeprom_init(&moved);
 	if (!err)
 		err = acl_init();
+	if (!err)
+		err = audit_log_init();
+	/* Report the records moved by a layout change */
+	if (!err && moved)
+		audit_log_add(AUDIT_LOG_EVENT_RECORDS_MOVED, 0, moved);
 	if (!err)
 		err = ctrl_cmd_init();
 	if (!err)
@@ -97,6 +169,8 @@ int main(void)
 
 	ctrl_cmd_init_device_descriptor(&desc);
 	ctrl_send_event(CTRL_EVENT_STARTED, &desc, sizeof(desc));
+	if (event.error)
+		ctrl_send_door_event(CTRL_EVENT_LAYOUT_ERROR, &event);
 	work_queue_run(LIFE_LED_GPIO);
 
 	return 0;
@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+#
+# Report the static RAM used by each module from the linker map and
+# estimate the worst case stack depth from the -fstack-usage files and
+# the call graph found in the disassembly of the firmware.
+#
+# The calls through function pointers (the workers, the IRQ handlers,
+# the command handlers) can't be followed, they are assumed to go to the
+# deepest function that is never called directly.
+
+import argparse
+import glob
+import os
+import re
+import subprocess
+import sys
+
+# Sections of the map that end up in the RAM
+RAM_SECTIONS = ('.data', '.bss', '.noinit')
+
+# Size of the return address pushed by a call
+RETURN_ADDR_SIZE = 2
+
+def parse_map(path):
+    """Return a dict of module -> {section: size} for the RAM sections"""
+    modules = {}
+    output = None
+    pending = None
+    in_map = False
+    with open(path) as fd:
+        for line in fd:
+            line = line.rstrip('\n')
+            if line.startswith('Linker script and memory map'):
+                in_map = True
+                continue
+            if not in_map or not line:
+                continue
+            # Output section
+            if not line.startswith(' '):
+                name = line.split()[0]
+                output = name if name in RAM_SECTIONS else None
+                continue
+            if output is None:
+                continue
+            # Input section whose name was too long, the rest follows
+            m = re.match(r'^ (\S+)$', line)
+            if m:
+                pending = m.group(1)
+                continue
+            if pending:
+                line = ' ' + pending + line
+                pending = None
+            m = re.match(r'^ (\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$',
+                         line)
+            if not m:
+                continue
+            size = int(m.group(3), 16)
+            if size == 0:
+                continue
+            module = os.path.basename(m.group(4))
+            sections = modules.setdefault(module, {})
+            sections[output] = sections.get(output, 0) + size
+    return modules
+
+def parse_stack_usage(paths):
+    """Return a dict of function -> (size, qualifiers)"""
+    usage = {}
+    for path in paths:
+        with open(path) as fd:
+            for line in fd:
+                fields = line.rstrip('\n').split('\t')
+                if len(fields) != 3:
+                    continue
+                func = fields[0].split(':')[-1]
+                size = int(fields[1])
+                # Static functions might share a name, keep the worst
+                if func not in usage or usage[func][0] < size:
+                    usage[func] = (size, fields[2])
+    return usage
+
+def parse_call_graph(objdump, elf):
+    """Return a dict of function -> (set of callees, has indirect calls)"""
+    out = subprocess.run([objdump, '-d', elf], check = True,
+                         stdout = subprocess.PIPE,
+                         universal_newlines = True).stdout
+    graph = {}
+    func = None
+    for line in out.splitlines():
+        m = re.match(r'^[0-9a-f]+ <([^>]+)>:$', line)
+        if m:
+            func = m.group(1)
+            graph[func] = (set(), [False])
+            continue
+        if func is None:
+            continue
+        m = re.search(r'\t(r?call|r?jmp)\t.*<([^>+]+)(\+0x[0-9a-f]+)?>', line)
+        if m:
+            # Jumps inside the function are not calls
+            if m.group(2) != func:
+                graph[func][0].add((m.group(2), m.group(1).endswith('call')))
+            continue
+        if re.search(r'\te?icall\b', line):
+            graph[func][1][0] = True
+    return { f: (calls, indirect[0]) for f, (calls, indirect) in graph.items() }
+
+class StackEstimator(object):
+    def __init__(self, graph, usage):
+        self.graph = graph
+        self.usage = usage
+        self.memo = {}
+        self.unknown = set()
+        self.recursive = set()
+        called = set(c for calls, _ in graph.values() for c, _ in calls)
+        # The functions never called directly are the candidates for
+        # the indirect calls.
+        self.indirect_targets = [
+            f for f in graph
+            if f in usage and f not in called and f != 'main' and
+            not f.startswith('__vector_')]
+        self.indirect = None
+
+    def frame(self, func):
+        if func not in self.usage:
+            self.unknown.add(func)
+            return 0
+        return self.usage[func][0]
+
+    def depth(self, func, stack = ()):
+        """Return the worst depth and the path reaching it"""
+        if func in self.memo:
+            return self.memo[func]
+        if func in stack:
+            self.recursive.add(func)
+            return 0, [func + ' (recursion)']
+
+        stack = stack + (func,)
+        calls, has_indirect = self.graph.get(func, (set(), False))
+        best = (0, [])
+        for callee, is_call in calls:
+            d, path = self.depth(callee, stack)
+            if is_call:
+                d += RETURN_ADDR_SIZE
+            if d > best[0]:
+                best = (d, path)
+        if has_indirect:
+            d, path = self.indirect_depth(stack)
+            d += RETURN_ADDR_SIZE
+            if d > best[0]:
+                best = (d, ['*'] + path)
+
+        result = (self.frame(func) + best[0], [func] + best[1])
+        self.memo[func] = result
+        return result
+
+    def indirect_depth(self, stack):
+        if self.indirect is not None:
+            return self.indirect
+        best = (0, [])
+        for f in self.indirect_targets:
+            if f in stack:
+                continue
+            d = self.depth(f, stack)
+            if d[0] > best[0]:
+                best = d
+        self.indirect = best
+        return best
+
+def main():
+    parser = argparse.ArgumentParser(
+        description = 'Report the RAM usage of the firmware')
+    parser.add_argument('--objdump', default = 'avr-objdump',
+                        help = 'objdump to disassemble the firmware')
+    parser.add_argument('--ram-size', type = int,
+                        help = 'Size of the SRAM to compute what is left')
+    parser.add_argument('elf', help = 'Firmware ELF file')
+    parser.add_argument('su', nargs = '*',
+                        help = 'Stack usage files, default to all the '
+                        '.su files next to the ELF')
+    args = parser.parse_args()
+
+    base = os.path.splitext(args.elf)[0]
+    su_files = args.su or glob.glob(
+        os.path.join(os.path.dirname(args.elf) or '.', '**', '*.su'),
+        recursive = True)
+
+    modules = parse_map(base + '.map')
+    print('Static RAM per module:')
+    print('  %-28s %6s %6s %6s %6s' % ('module', 'data', 'bss', 'noinit',
+                                       'total'))
+    static_total = 0
+    for module, sections in sorted(modules.items(),
+                                   key = lambda m: -sum(m[1].values())):
+        total = sum(sections.values())
+        static_total += total
+        print('  %-28s %6d %6d %6d %6d' % (
+            module, sections.get('.data', 0), sections.get('.bss', 0),
+            sections.get('.noinit', 0), total))
+    print('  %-28s %27d' % ('total', static_total))
+    print()
+
+    usage = parse_stack_usage(su_files)
+    graph = parse_call_graph(args.objdump, args.elf)
+    est = StackEstimator(graph, usage)
+
+    print('Worst case stack depth:')
+    main_depth, main_path = est.depth('main')
+    print('  %-28s %6d  %s' % ('main', main_depth, ' > '.join(main_path)))
+    isr_depth = 0
+    for f in sorted(f for f in graph if f.startswith('__vector_')):
+        d, path = est.depth(f)
+        print('  %-28s %6d  %s' % (f, d, ' > '.join(path)))
+        isr_depth = max(isr_depth, d)
+    # The interrupts are not nested, only one can be on top of main
+    worst = main_depth + isr_depth + RETURN_ADDR_SIZE
+    print('  %-28s %6d' % ('main + deepest interrupt', worst))
+    if args.ram_size:
+        print('  %-28s %6d' % ('left', args.ram_size - static_total - worst))
+    print()
+
+    dynamic = sorted(f for f, (_, q) in usage.items() if q != 'static')
+    if dynamic:
+        print('Functions with a dynamic stack: ' + ', '.join(dynamic))
+    if est.recursive:
+        print('Recursive functions: ' + ', '.join(sorted(est.recursive)))
+    if est.unknown:
+        print('No stack usage for: ' + ', '.join(sorted(est.unknown)))
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,19 @@
+#include "scratch.h"
+#include "sleep.h"
+
+static union scratch scratch;
+static volatile uint8_t scratch_busy;
+
+union scratch *scratch_get(void)
+{
+	/* Nothing else can take it from the main context, so once it
+	 * has been given back it is ours. */
+	sleep_while(scratch_busy);
+	scratch_busy = 1;
+	return &scratch;
+}
+
+void scratch_put(void)
+{
+	scratch_busy = 0;
+}
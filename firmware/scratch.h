@@ -0,0 +1,33 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <stdint.h>
+#include "ctrl-cmd-types.h"
+#include "sha1.h"
+#include "acl.h"
+
+/*
+ * Scratch arena for the short lived users that need a large buffer.
+ * Instead of each of them keeping its own buffer around, or putting it
+ * on the stack, they take the arena in turn so its RAM is only paid
+ * once.
+ *
+ * The arena is taken with scratch_get() which wait for the current
+ * owner to give it back with scratch_put(). Only the main context can
+ * take it, but it can be given back from an interrupt handler.
+ */
+union scratch {
+#if WITH_OTP
+	/* OTP computation, see acl_otp.c */
+	struct {
+		struct sha1_context sha1;
+		uint8_t key[OTP_KEY_SIZE];
+	} otp;
+#endif
+};
+
+union scratch *scratch_get(void);
+
+void scratch_put(void);
+
+#endif /* SCRATCH_H */
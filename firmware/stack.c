@@ -0,0 +1,40 @@
+#include <avr/io.h>
+#include "stack.h"
+
+#define STACK_PAINT		0xC5
+
+/* End of the static data and top of the stack from the linker */
+extern uint8_t _end;
+extern uint8_t __stack;
+
+/* Runs before the stack pointer is setup in .init2, nothing should be
+ * on the stack yet. */
+void stack_paint(void) __attribute__((naked, used, section(".init1")));
+
+void stack_paint(void)
+{
+	__asm__ volatile (
+		"	ldi r30, lo8(_end)\n"
+		"	ldi r31, hi8(_end)\n"
+		"	ldi r24, %0\n"
+		"	ldi r25, hi8(__stack)\n"
+		"	rjmp 2f\n"
+		"1:	st Z+, r24\n"
+		"2:	cpi r30, lo8(__stack)\n"
+		"	cpc r31, r25\n"
+		"	brlo 1b\n"
+		: : "i" (STACK_PAINT));
+}
+
+void stack_get_info(struct ctrl_memory_info *info)
+{
+	const uint8_t *p = &_end;
+
+	while (p < &__stack && *p == STACK_PAINT)
+		p++;
+
+	info->ram_size = RAMEND - RAMSTART + 1;
+	info->static_size = &_end - (uint8_t *)RAMSTART;
+	info->stack_max = &__stack - p + 1;
+	info->stack_free = p - &_end;
+}
@@ -0,0 +1,17 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <stdint.h>
+#include "ctrl-cmd-types.h"
+
+/*
+ * The RAM between the static data and the stack is painted with a
+ * known pattern before main() runs. The deepest point reached by the
+ * stack is then found by looking for the first byte that has been
+ * overwritten.
+ */
+
+/* Fill the memory usage, this scan the whole free RAM */
+void stack_get_info(struct ctrl_memory_info *info);
+
+#endif /* STACK_H */
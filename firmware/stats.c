@@ -0,0 +1,53 @@
+#include <string.h>
+#include <errno.h>
+#include <util/atomic.h>
+#include "stats.h"
+
+struct ctrl_stats stats;
+
+/* Only used from the works, no locking needed */
+static struct ctrl_latency_hist latency_hist[NUM_DOORS];
+
+void stats_get(struct ctrl_stats *s)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		memcpy(s, &stats, sizeof(*s));
+	}
+}
+
+void stats_reset(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		memset(&stats, 0, sizeof(stats));
+	}
+}
+
+void stats_add_latency(uint8_t door, uint32_t us)
+{
+	struct ctrl_latency_hist *hist;
+	uint8_t b;
+
+	if (door >= NUM_DOORS)
+		return;
+
+	for (b = 0; us >= (2UL << CTRL_LATENCY_HIST_SHIFT) &&
+		     b < CTRL_LATENCY_HIST_BUCKETS - 1; b++)
+		us >>= 1;
+
+	hist = &latency_hist[door];
+	if (hist->count[b] < UINT16_MAX)
+		hist->count[b]++;
+}
+
+int8_t stats_get_latency(uint8_t door, struct ctrl_latency_hist *hist,
+			 uint8_t reset)
+{
+	if (door >= NUM_DOORS)
+		return -EINVAL;
+
+	memcpy(hist, &latency_hist[door], sizeof(*hist));
+	if (reset)
+		memset(&latency_hist[door], 0, sizeof(latency_hist[door]));
+
+	return 0;
+}
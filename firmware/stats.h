@@ -0,0 +1,27 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include "ctrl-cmd-types.h"
+
+/*
+ * Statistics counters, reported with CTRL_CMD_GET_STATS.
+ *
+ * Each counter is only updated from a single context, or with the
+ * interrupts disabled, so a plain increment is enough. The counters
+ * wrap around and are cleared on reset.
+ */
+extern struct ctrl_stats stats;
+
+/* Get a coherent copy of the counters */
+void stats_get(struct ctrl_stats *s);
+
+void stats_reset(void);
+
+/* Add a swipe to relay latency, in microseconds, to a door histogram */
+void stats_add_latency(uint8_t door, uint32_t us);
+
+int8_t stats_get_latency(uint8_t door, struct ctrl_latency_hist *hist,
+			 uint8_t reset);
+
+#endif /* STATS_H */
@@ -0,0 +1,39 @@
+#include <util/atomic.h>
+#include "trace.h"
+
+struct trace trace_ring;
+
+uint8_t trace_get(uint16_t seq, uint16_t *first,
+		  struct ctrl_trace_entry *entries, uint8_t max)
+{
+	uint16_t start = seq + 1;
+	uint16_t avail;
+	uint8_t n;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		trace_ring.stopped = 1;
+	}
+
+	/* Restart from the oldest entry if seq is not in the ring */
+	avail = trace_ring.next_seq - start;
+	if (avail > TRACE) {
+		start = trace_ring.next_seq - TRACE;
+		avail = TRACE;
+		/* Skip the entries that have never been written */
+		while (avail > 0 &&
+		       trace_ring.entry[start & (TRACE - 1)].id == 0) {
+			start++;
+			avail--;
+		}
+	}
+
+	*first = start;
+	for (n = 0; n < max && n < avail; n++)
+		entries[n] = trace_ring.entry[(start + n) & (TRACE - 1)];
+
+	/* Everything has been read, restart the recording */
+	if (n == 0)
+		trace_ring.stopped = 0;
+
+	return n;
+}
@@ -0,0 +1,107 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <util/atomic.h>
+#include "ctrl-cmd-types.h"
+#include "timer.h"
+#include "utils.h"
+
+/*
+ * The trace records events with a microsecond time stamp in a ring
+ * buffer of TRACE entries in RAM. It is disabled by default, build with
+ * TRACE set to the ring size (a power of 2) to enable it. TRACE_MASK
+ * select the classes of trace points to build, the class is the high
+ * nibble of the event id.
+ *
+ * A trace point only costs a few instructions, so unlike the DEBUG
+ * output it can be used in the interrupt handlers without changing the
+ * timings too much. The ring is read with CTRL_CMD_GET_TRACE, like the
+ * audit log each entry get a sequence number. The recording is stopped
+ * while the ring is read.
+ */
+
+#ifndef TRACE
+#define TRACE				0
+#endif
+
+#ifndef TRACE_MASK
+#define TRACE_MASK			0xFFFF
+#endif
+
+#if TRACE & (TRACE - 1)
+#error "TRACE must be a power of 2"
+#endif
+
+#define TRACE_CLASS_WIEGAND		1
+#define TRACE_CLASS_WORK_QUEUE		2
+#define TRACE_CLASS_DOOR		3
+#define TRACE_CLASS_CTRL		4
+
+/* Wiegand reader, arg is the bit count */
+#define TRACE_WIEGAND_BIT		0x10
+#define TRACE_WIEGAND_WORD		0x11
+/* Work queue, arg is the work command */
+#define TRACE_WORK_SCHEDULE		0x20
+#define TRACE_WORK_OVERFLOW		0x21
+#define TRACE_WORK_START		0x22
+#define TRACE_WORK_END			0x23
+/* Door controller, arg is door id << 4 | state */
+#define TRACE_DOOR_STATE		0x30
+/* Door controller, arg is the door id */
+#define TRACE_DOOR_CHECK		0x31
+#define TRACE_DOOR_OPEN			0x32
+#define TRACE_DOOR_REJECT		0x33
+/* Control commands, arg is the message type */
+#define TRACE_CTRL_CMD			0x40
+#define TRACE_CTRL_REPLY		0x41
+
+#if TRACE
+struct trace {
+	struct ctrl_trace_entry entry[TRACE];
+	/* Sequence number of the next entry */
+	uint16_t next_seq;
+	uint8_t stopped;
+};
+
+extern struct trace trace_ring;
+
+static inline void trace_add(uint8_t id, uint8_t arg)
+{
+	struct ctrl_trace_entry *e;
+
+	if (trace_ring.stopped)
+		return;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		e = &trace_ring.entry[trace_ring.next_seq++ & (TRACE - 1)];
+		e->id = id;
+		e->arg = arg;
+		e->time = timer_get_time_us();
+	}
+}
+
+/* Copy up to max entries that follow the sequence number seq and stop
+ * the recording. Return the number of entries and the sequence number
+ * of the first entry in first. When there is no more entries restart
+ * the recording. */
+uint8_t trace_get(uint16_t seq, uint16_t *first,
+		  struct ctrl_trace_entry *entries, uint8_t max);
+
+#define trace(id, arg)							\
+	do {								\
+		if (TRACE_MASK & BIT((id) >> 4))			\
+			trace_add(id, arg);				\
+	} while (0)
+
+#else
+#define trace(id, arg) do {} while (0)
+
+static inline uint8_t trace_get(uint16_t seq, uint16_t *first,
+				struct ctrl_trace_entry *entries,
+				uint8_t max)
+{ *first = seq + 1; return 0; }
+
+#endif
+
+#endif /* TRACE_H */
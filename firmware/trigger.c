@@ -1,13 +1,22 @@
 #include <string.h>
 #include <errno.h>
+#include <avr/pgmspace.h>
 #include "trigger.h"
 #include "gpio.h"
 
+static uint16_t trigger_get_step(struct trigger *tr)
+{
+	if (tr->seq_in_flash)
+		return pgm_read_word(&tr->seq[tr->seq_pos]);
+	else
+		return tr->seq[tr->seq_pos];
+}
+
 static void trigger_on_timeout(void *context)
 {
 	struct trigger *tr = context;
 
-	while (tr->seq_pos < tr->seq_len && !tr->seq[tr->seq_pos])
+	while (tr->seq_pos < tr->seq_len && !trigger_get_step(tr))
 		tr->seq_pos++;
 
 	if (tr->seq_pos >= tr->seq_len) {
@@ -20,12 +29,12 @@ static void trigger_on_timeout(void *context)
 	/* Play the next step */
 	if (tr->gpio)
 		gpio_set_value(tr->gpio, !(tr->seq_pos & 1));
-	timer_schedule_in(&tr->timer, tr->seq[tr->seq_pos]);
+	timer_schedule_in(&tr->timer, trigger_get_step(tr));
 	tr->seq_pos++;
 }
 
-int8_t trigger_start_seq(struct trigger *tr, const uint16_t *seq,
-		       uint8_t seq_len)
+static int8_t trigger_start_any_seq(struct trigger *tr, const uint16_t *seq,
+				    uint8_t seq_len, uint8_t in_flash)
 {
 	if (!seq || seq_len < 1 || seq_len == -1)
 		return -EINVAL;
@@ -34,10 +43,23 @@ int8_t trigger_start_seq(struct trigger *tr, const uint16_t *seq,
 	tr->seq = seq;
 	tr->seq_len = seq_len;
 	tr->seq_pos = 0;
+	tr->seq_in_flash = in_flash;
 	trigger_on_timeout(tr);
 	return 0;
 }
 
+int8_t trigger_start_seq(struct trigger *tr, const uint16_t *seq,
+		       uint8_t seq_len)
+{
+	return trigger_start_any_seq(tr, seq, seq_len, 0);
+}
+
+int8_t trigger_start_seq_P(struct trigger *tr, const uint16_t *seq,
+			   uint8_t seq_len)
+{
+	return trigger_start_any_seq(tr, seq, seq_len, 1);
+}
+
 void trigger_start(struct trigger *tr, uint16_t duration)
 {
 	tr->single_seq = duration;
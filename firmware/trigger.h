@@ -14,6 +14,7 @@ struct trigger {
 	const uint16_t *seq;
 	uint8_t seq_len;
 	uint8_t seq_pos;
+	uint8_t seq_in_flash;
 
 	struct worker *on_finished;
 	uint8_t on_finished_cmd;
@@ -29,6 +30,10 @@ void trigger_start(struct trigger *tr, uint16_t duration);
 int8_t trigger_start_seq(struct trigger *tr, const uint16_t *seq,
 			 uint8_t seq_len);
 
+/* Same as trigger_start_seq() but with the sequence in PROGMEM */
+int8_t trigger_start_seq_P(struct trigger *tr, const uint16_t *seq,
+			   uint8_t seq_len);
+
 void trigger_stop(struct trigger *tr);
 
 #endif /* TRIGGER_H */
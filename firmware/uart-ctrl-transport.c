@@ -6,6 +6,9 @@
 #include "uart-ctrl-transport.h"
 #include "ctrl-cmd.h"
 #include "sleep.h"
+#include "utils.h"
+#include "stats.h"
+#include "trace.h"
 
 #define UART_CTRL_TRANSPORT_SYNC		0
 #define UART_CTRL_TRANSPORT_RECV_TYPE		1
@@ -13,18 +16,25 @@
 #define UART_CTRL_TRANSPORT_RECV_PAYLOAD	3
 #define UART_CTRL_TRANSPORT_RECV_CRC		4
 #define UART_CTRL_TRANSPORT_WAIT_FOR_REPLY	5
-#define UART_CTRL_TRANSPORT_SEND_REPLY		6
 
 #define UART_CTRL_TRANSPORT_CRC_INIT		0
 #define uart_ctrl_transport_crc(c, b)		_crc_xmodem_update(c, b)
 
+/* Commands for the TX worker */
+#define UART_CTRL_TRANSPORT_TX_ERROR		0
+
+/* A whole reply must always fit in the transmit ring */
+#if UART_TX_RING_SIZE < UART_CTRL_TRANSPORT_FRAME_SIZE
+#  error "The UART transmit ring is too small for the largest messages"
+#endif
+
 static void uart_ctrl_transport_on_recv(uint8_t byte, void *context)
 {
 	struct ctrl_transport *ctrl = context;
 	struct ctrl_msg *msg = &ctrl->msg;
 	int8_t err;
 
-	/* Ignore any incomming data while responding */
+	/* Ignore any incomming data until the reply has been queued */
 	if (ctrl->state >= UART_CTRL_TRANSPORT_WAIT_FOR_REPLY)
 		return;
 
@@ -89,94 +99,85 @@ static void uart_ctrl_transport_on_recv(uint8_t byte, void *context)
 
 		if (msg->length > sizeof(msg->payload))
 			err = -E2BIG;
-		else if (ctrl->computed_crc != ctrl->msg_crc)
+		else if (ctrl->computed_crc != ctrl->msg_crc) {
+			stats.crc_errors++;
 			err = -EINVAL;
-		else
+		} else
 			err = 0;
 
+		/* Errors are sent from the TX worker as the transmit
+		 * ring is only filled from the main context. */
 		if (err)
-			ctrl_transport_reply(ctrl, CTRL_CMD_ERROR,
-					     &err, sizeof(err));
+			err = work_queue_schedule(&ctrl->tx_worker,
+						  UART_CTRL_TRANSPORT_TX_ERROR,
+						  WORK_ARG_INT(err));
 		else
-			work_queue_schedule(ctrl->on_event,
-					    CTRL_TRANSPORT_RECEIVED_MSG,
-					    WORK_ARG_PTR(msg));
+			err = work_queue_schedule(ctrl->on_event,
+						  CTRL_TRANSPORT_RECEIVED_MSG,
+						  WORK_ARG_PTR(msg));
+		/* If the work queue is full drop the message */
+		if (err)
+			ctrl->state = UART_CTRL_TRANSPORT_SYNC;
 		return;
 	}
 }
 
-static void uart_ctrl_transport_on_sent(void *context)
+static uint8_t uart_ctrl_transport_encoded_size(uint8_t c)
 {
-	struct ctrl_transport *ctrl = context;
-
-	if (ctrl->state == UART_CTRL_TRANSPORT_SEND_REPLY)
-		ctrl->state = UART_CTRL_TRANSPORT_SYNC;
-
-	ctrl->sending = 0;
+	return (c == UART_CTRL_TRANSPORT_START ||
+		c == UART_CTRL_TRANSPORT_ESC) ? 2 : 1;
 }
 
-static int8_t uart_ctrl_transport_write_outbuf(struct ctrl_transport *ctrl,
-				     uint16_t *crc, uint8_t c)
+static void uart_ctrl_transport_queue(uint8_t c)
 {
-	uint8_t esc = (c == UART_CTRL_TRANSPORT_START ||
-		       c == UART_CTRL_TRANSPORT_ESC);
-
-	if (ctrl->pos + esc >= sizeof(ctrl->outbuf))
-		return -E2BIG;
-
-	if (esc) {
-		ctrl->outbuf[ctrl->pos++] = UART_CTRL_TRANSPORT_ESC;
-		ctrl->outbuf[ctrl->pos++] = UART_CTRL_TRANSPORT_ESCAPE(c);
-	} else {
-		ctrl->outbuf[ctrl->pos++] = c;
+	if (c == UART_CTRL_TRANSPORT_START || c == UART_CTRL_TRANSPORT_ESC) {
+		uart_tx_queue(UART_CTRL_TRANSPORT_ESC);
+		c = UART_CTRL_TRANSPORT_ESCAPE(c);
 	}
-
-	if (crc)
-		*crc = uart_ctrl_transport_crc(*crc, c);
-
-	return 0;
+	uart_tx_queue(c);
 }
 
 static int8_t ctrl_transport_write(
 	struct ctrl_transport *ctrl, uint8_t type,
-	const void *payload, uint8_t length)
+	const void *payload, uint8_t length, uint8_t wait)
 {
+	const uint8_t *data = payload;
 	uint16_t crc = UART_CTRL_TRANSPORT_CRC_INIT;
-	int8_t err;
-	uint8_t i;
+	uint8_t size, i;
 
 	if (length > sizeof(ctrl->msg.payload))
 		return -E2BIG;
 
-	/* Initialize the state and write the start byte */
-	ctrl->pos = 0;
-	ctrl->outbuf[ctrl->pos++] = UART_CTRL_TRANSPORT_START;
-	/* Write the packet header */
-	uart_ctrl_transport_write_outbuf(ctrl, &crc, type);
-	uart_ctrl_transport_write_outbuf(ctrl, &crc, length);
-	/* Then the payload */
+	/* Compute the CRC first to get the exact size of the frame */
+	crc = uart_ctrl_transport_crc(crc, type);
+	crc = uart_ctrl_transport_crc(crc, length);
+	size = 1 + uart_ctrl_transport_encoded_size(type) +
+		uart_ctrl_transport_encoded_size(length);
 	for (i = 0; i < length; i++) {
-		err = uart_ctrl_transport_write_outbuf(
-			ctrl, &crc, ((uint8_t *)payload)[i]);
-		if (err)
-			return err;
+		crc = uart_ctrl_transport_crc(crc, data[i]);
+		size += uart_ctrl_transport_encoded_size(data[i]);
 	}
-	/* Finally the CRC */
-	for (i = 0; i < sizeof(crc); i++) {
-		err = uart_ctrl_transport_write_outbuf(
-			ctrl, NULL, ((uint8_t *)&crc)[i]);
-		if (err)
-			return err;
+	size += uart_ctrl_transport_encoded_size(crc & 0xFF) +
+		uart_ctrl_transport_encoded_size(crc >> 8);
+
+	/* Make sure the whole frame fits in the ring */
+	if (uart_tx_free() < size) {
+		if (!wait)
+			return -ENOMEM;
+		sleep_while(uart_tx_free() < size);
 	}
 
-	/* Then send the whole message */
-	ctrl->sending = 1;
-	err = uart_send(ctrl->outbuf, ctrl->pos,
-			uart_ctrl_transport_on_sent, ctrl);
-	if (err)
-		ctrl->sending = 0;
+	/* Then encode it directly in the ring and send it */
+	uart_tx_queue(UART_CTRL_TRANSPORT_START);
+	uart_ctrl_transport_queue(type);
+	uart_ctrl_transport_queue(length);
+	for (i = 0; i < length; i++)
+		uart_ctrl_transport_queue(data[i]);
+	uart_ctrl_transport_queue(crc & 0xFF);
+	uart_ctrl_transport_queue(crc >> 8);
+	uart_tx_commit();
 
-	return err;
+	return 0;
 }
 
 int8_t ctrl_transport_reply(struct ctrl_transport *ctrl, uint8_t type,
@@ -188,19 +189,14 @@ int8_t ctrl_transport_reply(struct ctrl_transport *ctrl, uint8_t type,
 	if (ctrl->state != UART_CTRL_TRANSPORT_WAIT_FOR_REPLY)
 		return -EINVAL;
 
-	/* Wait for any message that is beeing sent to be finished */
-	sleep_while(ctrl->sending);
+	trace(TRACE_CTRL_REPLY, type);
 
-	/* Set the next state */
-	ctrl->state = UART_CTRL_TRANSPORT_SEND_REPLY;
-	/* And write it out */
-	err = ctrl_transport_write(ctrl, type, payload, length);
-	if (err) {
-		if (type == CTRL_CMD_ERROR)
-			ctrl->state = UART_CTRL_TRANSPORT_SYNC;
-		else
-			ctrl->state = UART_CTRL_TRANSPORT_WAIT_FOR_REPLY;
-	}
+	/* Write it out, waiting for the events queued before to make
+	 * room if needed. */
+	err = ctrl_transport_write(ctrl, type, payload, length, 1);
+	/* Once queued the message buffer is free for the next command */
+	if (!err || type == CTRL_CMD_ERROR)
+		ctrl->state = UART_CTRL_TRANSPORT_SYNC;
 
 	return err;
 
@@ -213,9 +209,26 @@ int8_t ctrl_transport_send_event(struct ctrl_transport *ctrl, uint8_t type,
 	if (type < CTRL_EVENT_BASE || type == CTRL_CMD_ERROR)
 		return -EINVAL;
 
-	/* Wait for any currently sent message to be finished */
-	sleep_while(ctrl->sending);
-	return ctrl_transport_write(ctrl, type, payload, length);
+	if (length > CTRL_EVENT_MAX_PAYLOAD_SIZE)
+		return -E2BIG;
+
+	/* Queue it if there is enough room in the ring, never wait */
+	return ctrl_transport_write(ctrl, type, payload, length, 0);
+}
+
+static void uart_ctrl_transport_tx_work(
+	struct worker *worker, uint8_t cmd, union work_arg arg)
+{
+	struct ctrl_transport *ctrl =
+		container_of(worker, struct ctrl_transport, tx_worker);
+	int8_t err;
+
+	switch (cmd) {
+	case UART_CTRL_TRANSPORT_TX_ERROR:
+		err = arg.i;
+		ctrl_transport_reply(ctrl, CTRL_CMD_ERROR, &err, sizeof(err));
+		break;
+	}
 }
 
 int8_t ctrl_transport_init(struct ctrl_transport *ctrl,
@@ -225,6 +238,7 @@ int8_t ctrl_transport_init(struct ctrl_transport *ctrl,
 
 	memset(ctrl, 0, sizeof(*ctrl));
 	ctrl->on_event = on_event;
+	ctrl->tx_worker.execute = uart_ctrl_transport_tx_work;
 
 	err = uart_init(UART_DIRECTION_BOTH, 38400, 1, UART_PARITY_NONE);
 	if (err)
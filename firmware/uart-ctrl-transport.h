@@ -18,19 +18,22 @@
 #define UART_CTRL_TRANSPORT_UNESCAPE(x)		((x) ^ 0x20)
 #define UART_CTRL_TRANSPORT_ESCAPE(x)		UART_CTRL_TRANSPORT_UNESCAPE(x)
 
+/* Size of the largest encoded message, with every byte escaped */
+#define UART_CTRL_TRANSPORT_FRAME_SIZE		\
+	(1 + (2 + CTRL_MSG_MAX_PAYLOAD_SIZE + 2) * 2)
+
 struct ctrl_transport {
 	volatile uint8_t state   : 3;
 	volatile uint8_t escape  : 1;
-	volatile uint8_t sending : 1;
-	volatile uint8_t unused  : 3;
+	volatile uint8_t unused  : 4;
 	uint8_t pos;
 	uint16_t computed_crc;
 	uint16_t msg_crc;
 
 	struct ctrl_msg msg;
-	uint8_t outbuf[1 + sizeof(struct ctrl_msg) * 2];
 
 	struct worker *on_event;
+	struct worker tx_worker;
 };
 
 #endif /* UART_CTRL_TRANSPORT_H */
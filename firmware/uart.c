@@ -5,8 +5,8 @@
 #include <avr/io.h>
 
 #include "uart.h"
-#include "completion.h"
 #include "gpio.h"
+#include "sleep.h"
 
 #ifndef BAUD_TOL
 #  define BAUD_TOL 5
@@ -18,14 +18,17 @@ struct uart {
 	uart_on_recv_t on_recv;
 	void *on_recv_context;
 
-	uart_on_sent_t on_sent;
-	void *on_sent_context;
-
-	const uint8_t *tx_data;
-	uint8_t tx_size;
-	uint8_t tx_pos;
+	/* The positions are free running and masked on access, the
+	 * head is only updated by the IRQ and the others by the main
+	 * context. */
+	uint8_t tx_ring[UART_TX_RING_SIZE];
+	volatile uint8_t tx_head;
+	volatile uint8_t tx_tail;
+	uint8_t tx_queued;
 };
 
+#define UART_TX_RING_MASK	((UART_TX_RING_SIZE) - 1)
+
 static struct uart uart;
 
 static int8_t uart_set_mode(uint32_t baud, uint8_t stop_bits, uint8_t parity)
@@ -112,62 +115,49 @@ int8_t uart_set_recv_handler(uart_on_recv_t on_recv, void *context)
 	return 0;
 }
 
-int8_t uart_send(const void *data, uint8_t size,
-		 uart_on_sent_t on_sent, void *context)
+uint8_t uart_tx_free(void)
 {
-	if (!(uart.direction & UART_DIRECTION_TX))
-		return -EINVAL;
-
-	/* Check if there is a transfer underway */
-	if (uart.tx_size > 0)
-		return -EBUSY;
+	return UART_TX_RING_SIZE - (uint8_t)(uart.tx_queued - uart.tx_head);
+}
 
-	/* Handle 0 length strings */
-	if (size == 0) {
-		if (uart.on_sent)
-			uart.on_sent(uart.on_sent_context);
-		return 0;
-	}
+void uart_tx_queue(uint8_t byte)
+{
+	uart.tx_ring[uart.tx_queued & UART_TX_RING_MASK] = byte;
+	uart.tx_queued++;
+}
 
-	uart.tx_data = data;
-	uart.tx_size = size;
-	uart.on_sent = on_sent;
-	uart.on_sent_context = context;
+void uart_tx_commit(void)
+{
+	if (uart.tx_tail == uart.tx_queued)
+		return;
 
+	uart.tx_tail = uart.tx_queued;
 	/* Enable the load IRQ */
 	UCSR0B |= _BV(UDRIE0);
-	return 0;
 }
 
 int8_t uart_blocking_send(const void *data, uint8_t size)
 {
-	struct completion cmp = {};
-	int8_t err;
+	const uint8_t *buf = data;
 
-	err = uart_send(data, size, completion_done_cb, &cmp);
-	if (err)
-		return err;
+	if (!(uart.direction & UART_DIRECTION_TX))
+		return -EINVAL;
 
-	completion_wait(&cmp);
-	return 0;
-}
+	while (size > 0) {
+		sleep_while(uart_tx_free() == 0);
+		while (size > 0 && uart_tx_free() > 0) {
+			uart_tx_queue(*buf++);
+			size--;
+		}
+		uart_tx_commit();
+	}
 
-int8_t uart_write(const char *str, uart_on_sent_t on_sent, void *context)
-{
-	return uart_send(str, strlen(str), on_sent, context);
+	return 0;
 }
 
 int8_t uart_blocking_write(const char *str)
 {
-	struct completion cmp = {};
-	int8_t err;
-
-	err = uart_write(str, completion_done_cb, &cmp);
-	if (err)
-		return err;
-
-	completion_wait(&cmp);
-	return 0;
+	return uart_blocking_send(str, strlen(str));
 }
 
 ISR(USART_RX_vect)
@@ -182,18 +172,13 @@ ISR(USART_RX_vect)
 
 ISR(USART_UDRE_vect)
 {
-	if (uart.tx_pos < uart.tx_size) {
-		UDR0 = uart.tx_data[uart.tx_pos];
-		uart.tx_pos++;
+	uint8_t head = uart.tx_head;
+
+	if (head != uart.tx_tail) {
+		UDR0 = uart.tx_ring[head & UART_TX_RING_MASK];
+		uart.tx_head = ++head;
 	}
 
-	if (uart.tx_pos >= uart.tx_size) {
+	if (head == uart.tx_tail)
 		UCSR0B &= ~_BV(UDRIE0);
-		uart.tx_data = NULL;
-		uart.tx_size = 0;
-		uart.tx_pos = 0;
-
-		if (uart.on_sent)
-			uart.on_sent(uart.on_sent_context);
-	}
 }
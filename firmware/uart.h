@@ -5,8 +5,15 @@
 
 typedef void (*uart_on_recv_t)(uint8_t byte, void *context);
 
-typedef void (*uart_on_sent_t)(void *context);
+/* Size of the transmit ring, it must be a power of 2 up to 128 */
+#ifndef UART_TX_RING_SIZE
+#  define UART_TX_RING_SIZE	128
+#endif
 
+#if (UART_TX_RING_SIZE) & ((UART_TX_RING_SIZE) - 1) || \
+	(UART_TX_RING_SIZE) > 128
+#  error "UART_TX_RING_SIZE must be a power of 2 up to 128"
+#endif
 
 #define UART_DIRECTION_RX	1
 #define UART_DIRECTION_TX	2
@@ -21,12 +28,22 @@ int8_t uart_init(uint8_t direction, uint32_t rate,
 
 int8_t uart_set_recv_handler(uart_on_recv_t on_recv, void *context);
 
-int8_t uart_send(const void *data, uint8_t size,
-		 uart_on_sent_t on_sent, void *context);
+/*
+ * The data to send is written in a ring which is emptied from the
+ * UDRE interrupt. The bytes added with uart_tx_queue() are only sent
+ * once uart_tx_commit() is called, so a message is never sent partially
+ * and the caller can fill the ring without any copy. The ring must only
+ * be filled from the main context and uart_tx_queue() must not be called
+ * for more bytes than reported by uart_tx_free().
+ */
+uint8_t uart_tx_free(void);
 
-int8_t uart_blocking_send(const void *data, uint8_t size);
+void uart_tx_queue(uint8_t byte);
+
+void uart_tx_commit(void);
 
-int8_t uart_write(const char *str, uart_on_sent_t on_sent, void *context);
+/* Queue the data, waiting for space in the ring if needed */
+int8_t uart_blocking_send(const void *data, uint8_t size);
 
 int8_t uart_blocking_write(const char *str);
 
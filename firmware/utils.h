@@ -23,6 +23,8 @@
 
 #define PACKED			__attribute__((packed))
 
+#define NOINLINE		__attribute__((noinline))
+
 #ifndef container_of
 #define container_of(ptr, type, member) ({			\
 	const typeof( ((type *)0)->member ) *__mptr = (ptr);	\
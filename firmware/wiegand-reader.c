@@ -1,8 +1,11 @@
 #include <string.h>
 #include <errno.h>
+#include <util/atomic.h>
 #include "wiegand-reader.h"
 #include "external-irq.h"
 #include "gpio.h"
+#include "stats.h"
+#include "trace.h"
 
 /* Timeout to trigger reading the bits */
 #define WORD_TIMEOUT 10
@@ -38,6 +41,9 @@ static uint8_t odd_parity(uint8_t *data, uint8_t from, uint8_t to)
 static void wiegand_reader_event(struct wiegand_reader *wr,
 				    uint8_t event, uint32_t val)
 {
+	if (event == WIEGAND_READER_ERROR)
+		stats.reader_errors++;
+
 	work_queue_schedule(wr->on_event, event, WORK_ARG(val));
 }
 
@@ -107,6 +113,8 @@ static void wiegand_reader_on_word_timeout(void *context)
 	struct wiegand_reader *wr = context;
 	int err = -EINVAL;
 
+	trace(TRACE_WIEGAND_WORD, wr->num_bits);
+
 	switch(wr->num_bits) {
 	case 4:
 		err = wiegand_reader_process_4bits_code(wr);
@@ -148,12 +156,34 @@ void wiegand_reader_data_pin_changed(struct wiegand_reader *wr,
 			set_bit(wr->bits, wr->num_bits, 0);
 		return;
 	case 3: /* Inter bit */
+		wr->last_bit_time = timer_get_time();
+		wr->last_bit_time_us = timer_get_time_us();
 		wr->num_bits++;
+		trace(TRACE_WIEGAND_BIT, wr->num_bits);
 		timer_schedule_in(&wr->word_timeout, WORD_TIMEOUT);
 		return;
 	}
 }
 
+uint32_t wiegand_reader_time_since_last_bit(struct wiegand_reader *wr)
+{
+	uint16_t ms, us;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ms = wr->last_bit_time;
+		us = wr->last_bit_time_us;
+	}
+
+	ms = timer_get_time() - ms;
+	us = timer_get_time_us() - us;
+
+	/* The microsecond counter wrap after 65ms */
+	if (ms < 60)
+		return us;
+
+	return ms * 1000UL;
+}
+
 static void wiegand_reader_d0(uint8_t pin_state, void *context)
 {
 	struct wiegand_reader *wr = context;
@@ -11,6 +11,10 @@ struct wiegand_reader {
 
 	uint8_t data_pins;
 
+	/* Time of the last bit */
+	uint16_t last_bit_time;
+	uint16_t last_bit_time_us;
+
 	struct timer word_timeout;
 
 	struct worker *on_event;
@@ -49,4 +53,8 @@ int8_t wiegand_reader_init(struct wiegand_reader *wr,
 			   uint8_t d0_irq, uint8_t d1_irq,
 			   struct worker *on_event);
 
+/** Get the time elapsed since the last bit received, in microseconds.
+ */
+uint32_t wiegand_reader_time_since_last_bit(struct wiegand_reader *wr);
+
 #endif /* WIEGAND_READER_H */
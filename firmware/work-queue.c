@@ -7,6 +7,8 @@
 #include "sleep.h"
 #include "timer.h"
 #include "gpio.h"
+#include "stats.h"
+#include "trace.h"
 
 struct work {
 	struct work * volatile next;
@@ -53,6 +55,10 @@ int8_t work_queue_schedule(struct worker *worker,
 			else
 				runq_head = work;
 			runq_tail = work;
+			trace(TRACE_WORK_SCHEDULE, cmd);
+		} else {
+			stats.work_queue_overflows++;
+			trace(TRACE_WORK_OVERFLOW, cmd);
 		}
 	}
 
@@ -108,12 +114,20 @@ static void work_queue_run_once(void)
 		struct worker *worker = work->worker;
 		uint8_t cmd = work->cmd;
 		union work_arg arg = work->arg;
+		uint16_t start, duration;
 
 		/* Free the work slot */
 		work->worker = NULL;
 
 		/* Run the worker */
+		trace(TRACE_WORK_START, cmd);
+		start = timer_get_time();
 		worker->execute(worker, cmd, arg);
+		duration = timer_get_time() - start;
+		trace(TRACE_WORK_END, cmd);
+
+		if (duration > stats.max_work_time)
+			stats.max_work_time = duration;
 	}
 }
 